@@ -1,14 +1,17 @@
 /* Autoload for YImage plugin. */
 autoload, "image.i", img_get_version, img_get_symbol, img_define_constant,
+  img_set_num_threads, img_get_num_threads, img_get_stats, img_reset_stats,
+  img_print_stats, img_context_new,
   is_image, img_is_complex, img_is_color, img_is_rgb, img_is_rgba,
   img_get_width, img_get_height, img_get_type, img_get_channel, img_get_red,
   img_get_green, img_get_blue, img_get_alpha,
-  img_extract_rectangle, img_rotate, img_detect_spot,
-  img_estimate_noise, img_cost_l2;
+  img_extract_rectangle, img_rotate, img_interpolate, img_detect_spot,
+  img_estimate_noise, img_estimate_noise_map, img_cost_l2, img_cost_l2_map,
+  img_cost_l2_batch;
 autoload, "image.i", img_morph_erosion, img_morph_dilation,
   img_morph_lmin_lmax, img_morph_closing, img_morph_opening,
   img_morph_white_top_hat, img_morph_black_top_hat,
-  img_morph_enhance, img_morph_trilevel;
+  img_morph_enhance, img_morph_trilevel, img_morph_cache_new;
 autoload, "image.i", img_watershed,
   img_segmentation_new, img_segmentation_get_number,
   img_segmentation_get_nrefs, img_segmentation_get_image_width,
@@ -18,7 +21,10 @@ autoload, "image.i", img_watershed,
   img_segmentation_get_ymax, img_segmentation_get_xcen,
   img_segmentation_get_ycen, img_segmentation_get_width,
   img_segmentation_get_height, img_segmentation_get_x,
-  img_segmentation_get_y, img_segmentation_get_link;
+  img_segmentation_get_y, img_segmentation_get_link,
+  img_segmentation_get_flux, img_segmentation_get_xbar,
+  img_segmentation_get_ybar, img_segmentation_get_mxx,
+  img_segmentation_get_mxy, img_segmentation_get_myy;
 autoload, "image.i", img_chainpool_new, img_chainpool_get_number,
   img_chainpool_get_image_width, img_chainpool_get_image_height,
   img_chainpool_get_segmentation, img_chainpool_get_segments,
@@ -48,6 +48,99 @@ extern img_get_version;
    SEE ALSO is_image. */
 _img_init; /* initializes internals */
 
+extern img_set_num_threads;
+extern img_get_num_threads;
+/* DOCUMENT img_set_num_threads, n;
+         or img_get_num_threads();
+     The subroutine img_set_num_threads sets the number of threads used by
+     the "Image" plug-in to process images, and the function
+     img_get_num_threads returns the current number of threads.  The default
+     number of threads is given by the environment variable IMG_NUM_THREADS
+     (1 if not set).  Images are processed by horizontal bands of rows, the
+     results are exactly the same whatever the number of threads.  Only the
+     morpho-math operations, the noise estimation, the comparison of
+     sub-images, the extraction of rectangular regions and the copy of images
+     are currently done by several threads.
+
+   SEE ALSO img_morph_lmin_lmax, img_estimate_noise, img_cost_l2,
+            img_extract_rectangle. */
+
+extern img_get_stats;
+extern img_reset_stats;
+/* DOCUMENT stats = img_get_stats();
+         or names = img_get_stats(1);
+         or img_reset_stats;
+         or img_print_stats;
+     The function img_get_stats returns the statistics collected for the
+     main phases of the morpho-math operations (erosion, dilation, opening,
+     closing and top-hat), of the detection of spots, of the segmentation
+     and of the chaining of segments.  The result is a 4-by-N array of
+     doubles where N is the number of phases: STATS(1,k) is the number of
+     times the k-th phase has been run, STATS(2,k) the cumulated wall time
+     (in seconds), STATS(3,k) the number of items processed (pixels,
+     segments, runs, chain-links or chains, or the number of rejected chains
+     for the fits of the shears) and STATS(4,k) the number of bytes
+     allocated.  With a true argument, img_get_stats returns the names of the
+     phases ("morph", "detect_spot", "segmentation", "build_links",
+     "flood_fill", "runs", "chainpool", "sort_segments", "first_links",
+     "extend_chains", "save_chains", "vertical_shear" and
+     "horizontal_shear").  The statistics are cumulated until
+     img_reset_stats is called.  The subroutine img_print_stats prints the
+     statistics of the phases which have been run.
+
+     The statistics are only collected if the plug-in has been compiled with
+     IMG_STATS_CFLAGS=-DIMG_USE_STATS, otherwise img_get_stats returns nil.
+     The time of the phases run by several threads (img_segmentation_new with
+     a list of images) is summed over the threads.
+
+   SEE ALSO img_set_num_threads, img_segmentation_new, img_chainpool_new. */
+
+func img_print_stats(nil)
+{
+  stats = img_get_stats();
+  if (is_void(stats)) {
+    write, format="%s\n", "statistics not compiled in the \"Image\" plug-in";
+    return;
+  }
+  names = img_get_stats(1);
+  write, format="%-18s %10s %12s %14s %14s\n",
+    "phase", "calls", "time (s)", "items", "bytes";
+  for (k = 1; k <= numberof(names); ++k) {
+    if (stats(1,k) > 0) {
+      write, format="%-18s %10.0f %12.6f %14.0f %14.0f\n",
+        names(k), stats(1,k), stats(2,k), stats(3,k), stats(4,k);
+    }
+  }
+}
+
+extern img_context_new;
+/* DOCUMENT ctx = img_context_new(img);
+         or ctx = img_context_new(img, r);
+
+     The function img_context_new() returns an opaque workspace context
+     for processing many images with the same pixel type and dimensions
+     as IMG (for instance the frames of a video).  Optional argument R is
+     the radius of the structuring element for the morpho-math operations
+     (0 by default).  CTX keeps the tables and the scratch memory of the
+     operations: they are allocated by the first call and reused by the
+     next ones.  The context is given by keyword CTX:
+
+         ctx = img_context_new(img, r);
+         for (k = 1; k <= n; ++k) {
+           img = next_frame();
+           img_morph_erosion, img, r, ctx=ctx, out=lmin;
+           sgm = img_segmentation_new(img, threshold, runs=1, ctx=ctx);
+           msk = img_detect_spot(img, c0,c1,c2, t0,t1,t2, ctx=ctx);
+           ...
+         }
+
+     The results are the same as without a context.  It is an error to use
+     a context with an image of different type or dimensions, or with a
+     different radius for the morpho-math operations.
+
+
+   SEE ALSO img_morph_erosion, img_segmentation_new, img_detect_spot. */
+
 extern is_image;
 /* DOCUMENT is_image(img);
      This function checks whether IMG is a valid image.  The returned value
@@ -245,10 +338,39 @@ extern img_extract_rectangle;
  *   size in ROI is much larger than that in IMG).  If IMG has integer pixel
  *   type, the result is rounded to the same integer type.
  *
+ *   Keyword INTERP can be set with the name of the interpolation method:
+ *   "linear" (the default) for bi-linear interpolation, "cubic" for Keys
+ *   bi-cubic interpolation (4x4 neighbors) or "lanczos3" for Lanczos
+ *   interpolation of order 3 (6x6 neighbors).  The latter two methods
+ *   preserve the sharpness of the image better.  They may yield values
+ *   outside the range of the image values, which are clamped, after
+ *   rounding, for integer pixel types.  Pixels beyond the edges of the image
+ *   take the value of the nearest edge pixel.  If the transform has no
+ *   rotation nor shear, they are computed by separable interpolation along
+ *   the columns and then along the rows which is faster.  If the transform
+ *   is a pure rotation (plus a translation), the rotation is decomposed into
+ *   three shears, each applied by a 1-D interpolation; the result is very
+ *   close (but not identical) to that of the 2-D interpolation and exact
+ *   for rotations by a multiple of 90 degrees about a pixel.
+ *
  *   If keyword INVERSE is true, then the coefficients are those of the
  *   inverse coordinates transform; that is, from the destination to the
  *   source image.
  *
+ *   Keyword ROI can be set with [X0,X1,Y0,Y1] to use the sub-image
+ *   IMG(X0:X1,Y0:Y1) as the source without copying it; the result is the
+ *   same as with IMG(X0:X1,Y0:Y1) as the source.  The bounds follow Yorick
+ *   conventions (1-based, less or equal zero to indicate a bound relative
+ *   to the end).
+ *
+ *   Keyword OUT can be set with an existing array (a variable) of the same
+ *   pixel type as IMG to store the result in place of returning a new
+ *   array.  If OUT has the same dimensions as the result, all of OUT is
+ *   overwritten; otherwise the result is stored into
+ *   OUT(XSPAN(1):XSPAN(2),YSPAN(1):YSPAN(2)) where XSPAN and YSPAN are the
+ *   destination ranges.  OUT must not overlap IMG.  When OUT is set,
+ *   nothing is returned.
+ *
  *
  * EXAMPLE OF A ROTATION
  *
@@ -298,7 +420,7 @@ extern img_extract_rectangle;
  * SEE ALSO interp, img_rotate.
  */
 
-func img_rotate(img, theta, xcen, ycen, pad=)
+func img_rotate(img, theta, xcen, ycen, pad=, interp=)
 /* DOCUMENT img_rotate(img, theta);
          or img_rotate(img, theta, xcen, ycen);
 
@@ -309,7 +431,10 @@ func img_rotate(img, theta, xcen, ycen, pad=)
      Keyword PAD can be used to specify the value of pixels ouside the image
      boundaries.  By default, missing values are extrapolated from the edges.
 
-   SEE ALSO:
+     Keyword INTERP can be used to choose the interpolation method (see
+     img_extract_rectangle).
+
+   SEE ALSO: img_extract_rectangle.
  */
 {
   if (! is_array(img) || ((dims = dimsof(img))(1)) != 2) {
@@ -339,9 +464,31 @@ func img_rotate(img, theta, xcen, ycen, pad=)
   a1 =  dst_x0 - a2*src_x0 - a3*src_y0;
   a4 =  dst_y0 - a5*src_x0 - a6*src_y0;
 
-  return img_extract_rectangle(img, width, height, a1, a2, a3, a4, a5, a6);
+  return img_extract_rectangle(img, width, height, a1, a2, a3, a4, a5, a6,
+                               interp=interp);
 }
 
+extern img_interpolate;
+/* DOCUMENT dst = img_interpolate(img, x, y);
+ *
+ *   This function interpolates image IMG at arbitrary positions and returns
+ *   the result as a 2-D array.  X and Y are the coordinates in IMG of the
+ *   pixels of the result.  If X and Y are WP-by-HP arrays, the result is a
+ *   WP-by-HP image DST such that DST(i,j) is the value of IMG interpolated at
+ *   (X(i,j),Y(i,j)).  If X is a vector of length WP (or a WP-by-1 array) and
+ *   Y is a vector of length HP (or a 1-by-HP array), the coordinates are
+ *   separable and DST(i,j) is IMG interpolated at (X(i),Y(j)), which is
+ *   faster.  Yorick conventions are followed, hence the first pixel of IMG
+ *   is at (1,1).
+ *
+ *   Keyword INTERP can be used to choose the interpolation method (see
+ *   img_extract_rectangle).  Pixels beyond the edges of the image take the
+ *   value of the nearest edge pixel.  If IMG has integer pixel type, the
+ *   result is rounded and clamped to the same integer type.
+ *
+ * SEE ALSO img_extract_rectangle.
+ */
+
 /*---------------------------------------------------------------------------*/
 /* NOISE LEVEL */
 
@@ -352,13 +499,36 @@ extern img_estimate_noise;
          or img_estimate_noise(img, x0, x1, y0, y1, method)
 
       This function estimates the noise level in image IMG or in sub-image
-      IMG(X0:X1,Y0:Y1).
+      IMG(X0:X1,Y0:Y1).  The noise level is estimated from the second
+      differences of adjacent pixels.  METHOD is one of:
+
+        "rms"     (or 0) root mean square of the differences, the default;
+        "mad"     (or 1) median absolute deviation of the differences;
+        "clipped" (or 2) iteratively clipped root mean square of the
+                  differences.
+
+      The two last methods are robust and are much less biased than the
+      root mean square by edges and spots in the image.
 
       Note that the sub-image bounds (X0, X1, Y0, and Y1) follow Yorick
       conventions: they are 1-based, and a value less or equal zero
       indicates a bound relative to the end.
 
-   SEE ALSO:
+   SEE ALSO: img_estimate_noise_map.
+ */
+
+extern img_estimate_noise_map;
+/* DOCUMENT img_estimate_noise_map(img, tw, th)
+         or img_estimate_noise_map(img, tw, th, method)
+
+      This function estimates the noise level in every TW by TH tile of
+      image IMG (the last tiles of a row or of a column may be smaller) and
+      returns the noise levels as a 2-D array.  METHOD is the noise
+      estimation method (see img_estimate_noise).  This is much faster than
+      calling img_estimate_noise for every tile: the image is read once and
+      the tiles are processed in parallel.
+
+   SEE ALSO: img_estimate_noise.
  */
 
 /*---------------------------------------------------------------------------*/
@@ -381,7 +551,98 @@ extern img_cost_l2;
       conventions: 1-based, less or equal zero to indicate a bound
       relative to the end.
 
-   SEE ALSO:
+   SEE ALSO: img_cost_l2_map, img_cost_l2_batch.
+ */
+
+extern img_cost_l2_map;
+/* DOCUMENT img_cost_l2_map(a, ax0, ax1, ay0, ay1,
+                            b, bx0, bx1, by0, by1,
+                            dxmin, dxmax, dymin, dymax, bg, scl);
+
+      This function computes the same costs as img_cost_l2 for all the
+      shifts (DX,DY) such that DXMIN <= DX <= DXMAX and DYMIN <= DY <= DYMAX
+      and returns them as a 2-D array C such that C(i,j) is the cost for
+      DX = DXMIN + i - 1 and DY = DYMIN + j - 1.  This is much faster than
+      calling img_cost_l2 for each shift: only the overlapping regions are
+      scanned and, for large ranges of shifts, the costs are computed by
+      means of FFT's.
+
+   SEE ALSO: img_cost_l2.
+ */
+
+func img_cost_l2_batch(a, ax0, ax1, ay0, ay1, refs, dx, dy, bg, scl)
+/* DOCUMENT img_cost_l2_batch(a, ax0, ax1, ay0, ay1, refs, dx, dy, bg, scl);
+
+      This function computes the same costs as img_cost_l2 between the
+      sub-image A(AX0:AX1,AY0:AY1) and many references at once.  REFS is
+      either a 3-D array, REFS(,,k) being the k-th reference, or an array of
+      pointers to 2-D arrays of the same data type but possibly of different
+      sizes.  DX, DY, BG and SCL are the positions, background levels and
+      scaling factors of the references (see img_cost_l2), they can be
+      scalars (same value for all the references) or have one value per
+      reference.  The result is an array of costs, one per reference, with
+      the dimensions of the array of pointers or the last dimension of
+      REFS.  The references are processed in parallel by the threads (see
+      img_set_num_threads).
+
+   SEE ALSO: img_cost_l2.
+ */
+{
+  if (is_pointer(refs)) {
+    n = numberof(refs);
+    wid = hgt = array(long, n);
+    for (k = 1; k <= n; ++k) {
+      ref = refs(k);
+      if (! is_array(*ref) || (dims = dimsof(*ref))(1) != 2) {
+        error, "references must be 2-D arrays";
+      }
+      if (structof(*ref) != structof(*refs(1))) {
+        error, "references must have the same data type";
+      }
+      wid(k) = dims(2);
+      hgt(k) = dims(3);
+    }
+    off = (wid*hgt)(cum);
+    buf = array(structof(*refs(1)), off(0), 1);
+    for (k = 1; k <= n; ++k) {
+      buf(off(k)+1:off(k+1), 1) = (*refs(k))(*);
+    }
+    off = off(1:-1);
+    res_dims = dimsof(refs);
+  } else {
+    if (! is_array(refs) || (dims = dimsof(refs))(1) < 2 || dims(1) > 3) {
+      error, "references must be a 2-D or a 3-D array";
+    }
+    n = (dims(1) == 3 ? dims(4) : 1);
+    wid = array(dims(2), n);
+    hgt = array(dims(3), n);
+    off = (indgen(n) - 1)*(dims(2)*dims(3));
+    buf = refs(*)(,-);
+    if (dims(1) == 3) res_dims = [1, n];
+  }
+  cost = _img_cost_l2_batch(a, ax0, ax1, ay0, ay1, buf, off, wid, hgt,
+                            (long(dx) + array(long, n))(*),
+                            (long(dy) + array(long, n))(*),
+                            (double(bg) + array(double, n))(*),
+                            (double(scl) + array(double, n))(*));
+  if (is_void(res_dims) || res_dims(1) == 0) {
+    return cost(1);
+  }
+  res = array(double, res_dims);
+  res(*) = cost;
+  return res;
+}
+
+extern _img_cost_l2_batch;
+/* DOCUMENT _img_cost_l2_batch(a, ax0, ax1, ay0, ay1, buf, off, wid, hgt,
+                               dx, dy, bg, scl);
+
+     Private built-in function used by img_cost_l2_batch.  BUF is a N-by-1
+     array with all the references stored contiguously, the k-th reference
+     being the WID(k)-by-HGT(k) array of the elements numbered OFF(k) + 1 to
+     OFF(k) + WID(k)*HGT(k).
+
+   SEE ALSO: img_cost_l2_batch.
  */
 
 /*---------------------------------------------------------------------------*/
@@ -393,6 +654,8 @@ extern img_morph_lmin_lmax;
 /* DOCUMENT lmin = img_morph_erosion(img, r);
          or lmax = img_morph_dilation(img, r);
          or img_morph_lmin_lmax, img, r, lmin, lmax;
+         or img_morph_erosion, img, r, out=lmin;
+         or img_morph_dilation, img, r, out=lmax;
 
       These functions perform basic morpho-math operations on image IMG with
       circular structuring element of radius R.
@@ -412,12 +675,71 @@ extern img_morph_lmin_lmax;
       These functions are faster (by about 20%) but less general than the
       morph_erosion() and morph_dilation() functions provided by Yeti.
 
+      Keyword ROI can be set with [X0,X1,Y0,Y1] to apply the operation to
+      the sub-image IMG(X0:X1,Y0:Y1) without copying it, the result is the
+      same as with IMG(X0:X1,Y0:Y1) as the input image.
+
+      For img_morph_erosion and img_morph_dilation, keyword OUT can be set
+      with an existing array (a variable) of the same pixel type as IMG to
+      store the result in place of returning a new array.  If OUT has the
+      dimensions of the result, all of OUT is overwritten; otherwise OUT
+      must have the dimensions of IMG and the result is stored in the
+      region given by ROI.  OUT may be IMG itself (in which case a
+      temporary image is used).  When OUT is set, nothing is returned.
+      Hence, a large image can be processed by tiles with:
+
+          img_morph_erosion, img, r, roi=[x0,x1,y0,y1], out=dst;
+
+      Keyword CTX can be set with a workspace context (see
+      img_context_new) created for images like IMG (or like the region
+      given by ROI) and for radius R, to avoid allocating workspace for
+      every call.
+
+      If keyword BINARY is true, IMG is considered as a binary image (its
+      non-zero pixels being set) which is packed into a bitmap with 64
+      pixels per word for the operation; the result has the pixel type of
+      IMG with values 0 and 1, it is the same as for IMG != 0 but is
+      computed much faster.  Keyword BINARY cannot be combined with CTX and
+      is not supported by img_morph_lmin_lmax.
+
+      Keyword CACHE can be set with a morphology cache (see
+      img_morph_cache_new) built from IMG with a radius at least R, the
+      result is then computed from the tables of the cache.  Keyword CACHE
+      cannot be combined with ROI, CTX or BINARY.
+
 
    SEE ALSO: morph_erosion, morph_dilation,
              img_morph_closing, img_morph_opening,
-             img_morph_white_top_hat, img_morph_black_top_hat;
+             img_morph_white_top_hat, img_morph_black_top_hat,
+             img_morph_cache_new;
  */
 
+extern img_morph_cache_new;
+/* DOCUMENT cache = img_morph_cache_new(img, rmax);
+
+     The function img_morph_cache_new() returns an opaque morphology cache
+     with the tables of running minima and maxima of all the rows of image
+     IMG.  The tables are built once, then the erosions and dilations of IMG
+     for any radius R <= RMAX are computed from them by keyword CACHE of
+     img_morph_erosion, img_morph_dilation, img_morph_lmin_lmax and
+     img_morph_trilevel.  This is intended for scanning many radii:
+
+         cache = img_morph_cache_new(img, rmax);
+         for (r = 1; r <= rmax; ++r) {
+           img_morph_lmin_lmax, img, r, lmin, lmax, cache=cache;
+           ...
+         }
+
+     The results are the same as without a cache.  IMG is copied into the
+     cache, so the image given with keyword CACHE must be IMG (only its
+     type and dimensions are checked).  Keyword WHAT can be set to 1 to
+     only keep the minima (erosions), to 2 to only keep the maxima
+     (dilations), or to 3 to keep both (the default).  Each kind of extrema
+     takes about N*NUMBEROF(IMG) pixels with N the smallest integer such
+     that 2*RMAX + 1 < 2^N (for instance N = 6 for RMAX = 21).
+
+   SEE ALSO img_morph_erosion, img_morph_trilevel. */
+
 extern img_morph_closing;
 extern img_morph_opening;
 /* DOCUMENT img_morph_closing(img, r);
@@ -426,7 +748,13 @@ extern img_morph_opening;
      Perform an image closing/opening of image IMG by a structuring element of
      radius R.  A closing is a dilation followed by an erosion, whereas an
      opening is an erosion followed by a dilation.  See img_morph_dilation for
-     the meaning of the arguments.
+     the meaning of the arguments.  The rows of the image are streamed through
+     the two operations, the intermediate result is never stored as a whole
+     image.
+
+     Keywords ROI, OUT, CTX and BINARY can be used as for
+     img_morph_erosion.  The operation is performed in-place if OUT is IMG (without ROI or with
+     the same ROI).
 
 
    SEE ALSO: img_morph_erosion, img_morph_dilation,
@@ -449,22 +777,40 @@ local img_morph_black_top_hat;
 
      may be used to detect text or lines in a bimap image.
 
+     All the operations and the final difference are computed in a single
+     pass by a compiled function, without intermediate images.  As with
+     Yorick arithmetic, the result is of type int for a char or short image.
+
 
    SEE ALSO: img_morph_dilation, img_morph_closing, img_morph_enhance. */
 
 func img_morph_white_top_hat(a, r, s)
 {
-  if (! is_void(s)) a = img_morph_closing(a, s);
-  return a - img_morph_opening(a, r);
+  /* Yorick arithmetic promotes char and short to int. */
+  t = structof(a);
+  if (t == short) a = int(a);
+  a = _img_morph_top_hat(a, r, s, 0n);
+  return (t == char ? int(a) : a);
 }
 
 func img_morph_black_top_hat(a, r, s)
 {
-  if (! is_void(s)) a = img_morph_opening(a, s);
-  return img_morph_closing(a, r) - a;
+  t = structof(a);
+  if (t == short) a = int(a);
+  a = _img_morph_top_hat(a, r, s, 1n);
+  return (t == char ? int(a) : a);
 }
 
-func img_morph_enhance(a, r, s)
+extern _img_morph_top_hat;
+/* DOCUMENT _img_morph_top_hat(img, r, s, black);
+     This private function computes the white (BLACK false) or black (BLACK
+     true) top-hat of image IMG with smoothing radius S (can be nil).  All
+     operations are streamed row by row without intermediate images; the
+     result has the same type as IMG.
+
+   SEE ALSO img_morph_white_top_hat, img_morph_black_top_hat. */
+
+func img_morph_enhance(a, r, s, niter=)
 /* DOCUMENT img_morph_enhance(img, r);
          or img_morph_enhance(img, r, s);
 
@@ -484,7 +830,10 @@ func img_morph_enhance(a, r, s)
      [1].
 
      The morph_enhance() may be iterated to achieve deblurring of the input
-     image IMG (hundreds of iterations may be required).
+     image IMG (hundreds of iterations may be required).  Keyword NITER can be
+     used to specify the number of iterations (1 by default).  The iterations
+     are performed by compiled code and stop as soon as the image no longer
+     changes.
 
 
   REFERENCES
@@ -500,74 +849,27 @@ func img_morph_enhance(a, r, s)
     s = -1.0; /* special value */
   } else if (s < 0.0) {
     error, "S must be non-negative";
-  } else {
-    /* Pre-compute the range of the sigmoid function to detect early return
-       with no change and skip the time consuming morpho-math operations. */
-    s = double(s);
-    hi = 1.0/(1.0 + exp(-s));
-    lo = ((hi == 1.0) ? 0.0 : 1.0/(1.0 + exp(s)));
-    if (hi == lo) {
-      return a;
-    }
-  }
-
-  /* Compute the local minima and maxima. */
-  local amin, amax;
-  img_morph_lmin_lmax, a, r, amin, amax;
-
-  /* Staircase remapping of values. */
-  if (s < 0.0) {
-    test = ((a - amin) >= (amax - a));
-    return merge(amax(where(test)), amin(where(! test)), test);
   }
+  if (is_void(niter)) niter = 1;
+  return _img_morph_enhance(a, r, s, niter);
+}
 
-  /* Remapping of values with a sigmoid. */
-  test = ((amin < a)&(a < amax)); // values that need to change
-  w = where(test);
-  if (! is_array(w)) {
-    return a;
-  }
-  type = structof(a);
-  integer = is_integer(a);
-  if (numberof(w) != numberof(a)) {
-    /* Not all values change, select only those for which there is a
-       difference between the local minimum and the local maximum. */
-    unchanged = a(where(! test));
-    a = a(w);
-    amin = amin(w);
-    amax = amax(w);
-  }
+extern _img_morph_enhance;
+/* DOCUMENT _img_morph_enhance(img, r, s, niter);
+     This private function implements img_morph_enhance.  S < 0 selects the
+     step-like rescaling function.
 
-  /* We use the sigmoid function f(t) = 1/(1 + exp(-t)) for the rescaling
-     function g(t) = alpha*f(s*t) + beta with S the shape parameter, and
-     (ALPHA,BETA) chosen to map the range [-1,1] into [0,1]. */
-  alpha = 1.0/(hi - lo);
-  beta = alpha*lo;
-
-  /* Linearly map the values in the range [-1,1] -- we already know that the
-     local minimum and maximum are different. */
-  a = (double(a - amin) - double(amax - a))/double(amax - amin);
-  a = alpha/(1.0 + exp(-s*a)) - beta;
-  a = a*amax + (1.0 - a)*amin;
-  if (! is_void(unchanged)) {
-    a = merge(a, unchanged, test);
-  }
-  if (type != structof(a)) {
-    if (integer) return type(round(a));
-    return type(a);
-  }
-  return a;
-}
+   SEE ALSO img_morph_enhance. */
 
-func img_morph_trilevel(a, r, cmin=, white=, black=)
-/* DOCUMENT img_morph_trilevel(img, r, atol, rtol);
+func img_morph_trilevel(a, r, cmin=, white=, black=, cache=)
+/* DOCUMENT img_morph_trilevel(img, r, cmin=, white=, black=, cache=);
 
      The result is an image of same dimensions as IMG and with pixels set to 0
      where IMG is "black", 1 where IMG is "grey", and 2 where is "white".
 
-     black = fraction of "black" levels in a neighborhood
-     white = fraction of "white" levels in a neighborhood
-     cmin = minimum number of levels
+     black = fraction of "black" levels in a neighborhood (default 0.5)
+     white = fraction of "white" levels in a neighborhood (default 0.5)
+     cmin = minimum number of levels (default 0)
        - a single value to set the absolute minimum number of levels
        - two value to set the absolute minimum and relative number of levels
          CMIN = max(CMIN(1), CMIN(2)*avg(LMAX - LMIN))
@@ -576,41 +878,60 @@ func img_morph_trilevel(a, r, cmin=, white=, black=)
          return 5 + 0.2*(lmax - lmin);
        }
 
-     black if (lmax - lmin) > cmin and pixel <= lmin + black*(lmax - lmin)
-     white if (lmax - lmin) > cmin and pixel >= lmax - white*(lmax - lmin)
+     white if (lmax - lmin) >= cmin and pixel >= lmax - white*(lmax - lmin)
+     black if (lmax - lmin) >= cmin and pixel <= lmin + black*(lmax - lmin)
      grey otherwise
 
      where LMIN and LMAX are the local minimum and maximum of the image (in
-     the neighborhood of the pixel).
+     the neighborhood of the pixel).  With the default settings, all pixels
+     are either black or white, which one is the closest (white in case of a
+     tie).  Except when CMIN is a function, the result is computed in a
+     single pass (two if the relative number of levels is non-zero) by
+     compiled code.
 
-   SEE ALSO: img_morph_lmin_lmax.
+     Keyword CACHE can be set with a morphology cache built from IMG and
+     keeping both extrema (see img_morph_cache_new) to classify the pixels
+     for several radii without recomputing the local extrema from scratch.
+
+   SEE ALSO: img_morph_lmin_lmax, img_morph_cache_new.
  */
 {
-  /* Compute the local minima and maxima of the image. */
-  local amin, amax;
-  img_morph_lmin_lmax, a, r, amin, amax;
-
-  result = 2*((a - amin) >= (amax - a));
-  if (is_void(atol)) atol = 0.0;
-  if (is_void(rtol)) rtol = 0.0;
-  if (atol != 0.0 || rtol != 0.0) {
-    type = structof(a);
-    contrast = amax - amin;
-    write, format="max. local constrast = %g\n", double(max(contrast));
-    write, format="avg. local constrast = %g\n", double(avg(contrast));
-    threshold = atol;
-    if (rtol != 0.0) threshold += rtol*avg(contrast);
-    if (is_integer(a)) {
-      threshold = type(floor(threshold + 0.5));
-    } else {
-      threshold = type(threshold);
+  if (is_void(white)) white = 0.5;
+  if (is_void(black)) black = 0.5;
+  if (is_func(cmin)) {
+    /* Interpreted version for a user defined threshold. */
+    local amin, amax;
+    img_morph_lmin_lmax, a, r, amin, amax, cache=cache;
+    a = double(a);
+    amin = double(amin);
+    amax = double(amax);
+    c = amax - amin;
+    result = array(1, dimsof(a));
+    k = where(c >= cmin(amin, amax));
+    if (is_array(k)) {
+      d0 = a(k) - amin(k);
+      d1 = amax(k) - a(k);
+      result(k) = merge2(2, merge2(0, 1, black*d1 >= (1.0 - black)*d0),
+                         white*d0 >= (1.0 - white)*d1);
     }
-    k = where(contrast < threshold);
-    if (is_array(k)) result(k) = 1;
+    return result;
   }
-  return result;
+  atol = rtol = 0.0;
+  if (! is_void(cmin)) {
+    atol = double(cmin(1));
+    if (numberof(cmin) >= 2) rtol = double(cmin(2));
+  }
+  /* Result is converted to long for backward compatibility. */
+  return long(_img_morph_trilevel(a, r, atol, rtol, black, white, cache));
 }
 
+extern _img_morph_trilevel;
+/* DOCUMENT _img_morph_trilevel(img, r, atol, rtol, black, white, cache);
+     This private function implements img_morph_trilevel, the result is an
+     array of char's.  CACHE is a morphology cache or nil.
+
+   SEE ALSO img_morph_trilevel. */
+
 /*---------------------------------------------------------------------------*/
 /* SEGMENTATION */
 
@@ -640,6 +961,12 @@ extern img_watershed;
      subroutine, the operation is performed in-place (i.e. the contents of
      LAB are updated).
 
+     The points are processed by increasing values of ARR and, for equal
+     values, by increasing index.  The sorting takes a time proportional to
+     the number of points (a single pass for char and short arrays) and the
+     basins are flooded without recursion, so large plateaus are not a
+     problem.
+
    SEE ALSO: img_segmentation_new.
  */
 
@@ -649,7 +976,8 @@ extern img_segmentation_get_nrefs;
 extern img_segmentation_get_image_width;
 extern img_segmentation_get_image_height;
 extern img_segmentation_select;
-/* DOCUMENT sgm = img_segmentation_new(img, threshold);
+/* DOCUMENT sgm = img_segmentation_new(img, threshold, runs=0/1);
+         or sgm = img_segmentation_new(img, threshold, binary=1);
          or   n = img_segmentation_get_number(sgm);
          or   n = img_segmentation_get_nrefs(sgm);
          or len = img_segmentation_get_image_width(sgm);
@@ -659,7 +987,17 @@ extern img_segmentation_select;
      The function img_segmentation_new() segments image IMG and returns an
      opaque image segmentation object SGM.  THRESHOLD is the maximum absolute
      difference between neighbor pixels to be considered as being part of the
-     same region.
+     same region.  If keyword RUNS is true, the segments are built by merging
+     the runs of similar pixels along the rows, this requires much less memory
+     than the default flood fill method and yields the same segments but the
+     pixels of every segment are listed in raster order.  Keyword CTX can
+     be set with a workspace context created for images like IMG (see
+     img_context_new) to reuse the temporary memory of the segmentation.
+     If keyword BINARY is true, THRESHOLD is ignored and the segments are
+     the connected sets of zero and non-zero pixels of IMG: the image is
+     packed into a bitmap whose runs are found 64 pixels at a time, fluxes
+     and moments are those of the image IMG != 0 and the pixels are listed
+     in raster order.  Keywords BINARY and CTX are exclusive.
 
      The expression img_segmentation_get_number(sgm) yields the number of
      segments in SGM.
@@ -687,6 +1025,12 @@ extern img_segmentation_get_xcen;
 extern img_segmentation_get_ycen;
 extern img_segmentation_get_width;
 extern img_segmentation_get_height;
+extern img_segmentation_get_flux;
+extern img_segmentation_get_xbar;
+extern img_segmentation_get_ybar;
+extern img_segmentation_get_mxx;
+extern img_segmentation_get_mxy;
+extern img_segmentation_get_myy;
 /* DOCUMENT img_segmentation_get_count(sgm[, i]);
          or img_segmentation_get_xmin(sgm[, i]);
          or img_segmentation_get_xmax(sgm[, i]);
@@ -696,6 +1040,12 @@ extern img_segmentation_get_height;
          or img_segmentation_get_ycen(sgm[, i]);
          or img_segmentation_get_width(sgm[, i]);
          or img_segmentation_get_height(sgm[, i]);
+         or img_segmentation_get_flux(sgm[, i]);
+         or img_segmentation_get_xbar(sgm[, i]);
+         or img_segmentation_get_ybar(sgm[, i]);
+         or img_segmentation_get_mxx(sgm[, i]);
+         or img_segmentation_get_mxy(sgm[, i]);
+         or img_segmentation_get_myy(sgm[, i]);
 
      The expression img_segmentation_get_count(sgm) yields the numbers of
      pixels in every segments of SGM; while img_segmentation_get_count(sgm, i)
@@ -719,6 +1069,24 @@ extern img_segmentation_get_height;
        width  = xmax - xmin + 1;
        height = ymax - ymin + 1;
 
+     The functions img_segmentation_get_flux(), img_segmentation_get_xbar(),
+     img_segmentation_get_ybar(), img_segmentation_get_mxx(),
+     img_segmentation_get_mxy() and img_segmentation_get_myy() yield the sum
+     of the pixel values, the intensity weighted centroid and the intensity
+     weighted centered second moments of the segment(s), computed when SGM
+     is built.  With V the values of the pixels of the segment and (X,Y)
+     their coordinates:
+
+       flux = sum(V);
+       xbar = sum(V*X)/flux;
+       ybar = sum(V*Y)/flux;
+       mxx  = sum(V*(X - xbar)^2)/flux;
+       mxy  = sum(V*(X - xbar)*(Y - ybar))/flux;
+       myy  = sum(V*(Y - ybar)^2)/flux;
+
+     If the flux is zero, (xbar,ybar) = (xcen,ycen) and the second moments
+     are zero.
+
 
    SEE ALSO: img_watershed, img_segmentation_new, img_segmentation_get_x. */
 
@@ -774,6 +1142,16 @@ extern img_chainpool_new;
                        (default: lmin = 3).
        lmax=NUMBER     maximum number of characters per chain
                        (default: lmax = 10).
+       lazy=FLAG       if true, the shears and the bounding boxes of the
+                       chains are only fitted when first queried (see
+                       below).
+
+     The shears and the bounding boxes of the chains are fitted in parallel
+     by the threads (see img_set_num_threads) and the chains whose fit fails
+     are discarded.  With LAZY true, the chains are fitted on demand by the
+     img_chainpool_get_* functions which return them (a single chain or all
+     the chains at once); none of the chains is then discarded, those whose
+     fit fails have zero shears and the bounding box of their segments.
 
    SEE ALSO img_segmentation_new.
  */
@@ -840,4 +1218,10 @@ extern img_chainpool_get_length;
 
 extern img_detect_spot;
 /* DOCUMENT msk = img_detect_spot(img, c0,c1,c2, t0,t1,t2);
+
+     Keyword CTX can be set with a workspace context created for images
+     like IMG (see img_context_new) to avoid allocating workspace for every
+     call.
+
+   SEE ALSO: img_context_new.
 */
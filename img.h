@@ -26,6 +26,7 @@
 #ifndef _IMG_H
 #define _IMG_H 1
 
+#include <stddef.h>
 #include "c_pseudo_template.h"
 
 /*---------------------------------------------------------------------------*/
@@ -90,6 +91,10 @@
 #define IMG_TYPE_MIN IMG_TYPE_NONE
 #define IMG_TYPE_MAX IMG_TYPE_RGBA
 
+/* Pseudo-type of packed binary images (see BINARY IMAGES below), only for
+   img_copy(). */
+#define IMG_TYPE_BIT       15
+
 /* Use constants in c_pseudo_template.h to setup macro definitions for basic
    integer types. */
 
@@ -158,6 +163,48 @@
 extern "C" {
 #endif
 
+/*---------------------------------------------------------------------------*/
+/* MULTI-THREADING */
+
+extern int img_set_num_threads(long n);
+
+extern long img_get_num_threads(void);
+
+/*---------------------------------------------------------------------------*/
+/* STATISTICS */
+
+/* Instrumented phases (see img_get_stats()).  For each phase, the number of
+   items is the number of pixels, segments, runs, chain-links or chains
+   processed as indicated. */
+#define IMG_STATS_MORPH             0 /* morpho-math (pixels x stages) */
+#define IMG_STATS_DETECT_SPOT       1 /* spot detection (pixels) */
+#define IMG_STATS_SEGMENTATION      2 /* whole segmentation (segments) */
+#define IMG_STATS_BUILD_LINKS       3 /* links between pixels (pixels) */
+#define IMG_STATS_FLOOD_FILL        4 /* flood fill (pixels) */
+#define IMG_STATS_RUNS              5 /* union-find of runs (runs) */
+#define IMG_STATS_CHAINPOOL         6 /* whole chaining (chains kept) */
+#define IMG_STATS_SORT_SEGMENTS     7 /* sort by abscissa (segments) */
+#define IMG_STATS_FIRST_LINKS       8 /* 1st level links (links created) */
+#define IMG_STATS_EXTEND_CHAINS     9 /* longer chains (links created) */
+#define IMG_STATS_SAVE_CHAINS      10 /* selection (candidate chains) */
+#define IMG_STATS_VERTICAL_SHEAR   11 /* shear fit (chains rejected) */
+#define IMG_STATS_HORIZONTAL_SHEAR 12 /* shear fit (chains rejected) */
+#define IMG_STATS_PHASES           13 /* number of phases */
+
+typedef struct _img_stats img_stats_t;
+struct _img_stats {
+  long   calls; /* number of times the phase has been run */
+  double time;  /* cumulated wall time (in seconds) */
+  long   items; /* number of items processed */
+  long   bytes; /* number of bytes allocated */
+};
+
+extern int img_get_stats(img_stats_t stats[]);
+
+extern void img_reset_stats(void);
+
+extern const char *img_get_stats_name(int phase);
+
 /*---------------------------------------------------------------------------*/
 /* COPY AND CONVERSION */
 
@@ -167,6 +214,10 @@ int img_copy(const long  width, const long  height,
              void *dst_addr, const int dst_type,
              const long dst_offset, const long dst_pitch);
 
+extern void img_copy_init(void);
+
+extern size_t img_get_pixel_size(int type);
+
 /*---------------------------------------------------------------------------*/
 /* MORPHO-MATH OPERATIONS */
 
@@ -186,6 +237,30 @@ extern int img_morph_dilation(int type, long width, long height,
                               long r, long ws[],
                               void *lmax, long lmax_pitch);
 
+extern int img_morph_opening(int type, long width, long height,
+                             const void *img, long img_pitch, long r,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_closing(int type, long width, long height,
+                             const void *img, long img_pitch, long r,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_top_hat(int type, long width, long height,
+                             const void *img, long img_pitch,
+                             long r, long s, int black,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_enhance(int type, long width, long height,
+                             const void *img, long img_pitch,
+                             long r, double s, long niter,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_trilevel(int type, long width, long height,
+                              const void *img, long img_pitch, long r,
+                              double atol, double rtol,
+                              double black, double white,
+                              unsigned char dst[], long dst_pitch);
+
 /*---------------------------------------------------------------------------*/
 /* LINEAR TRANSFORM */
 
@@ -204,17 +279,83 @@ extern int img_extract_rectangle(const void *src,
                                  const double a[6],
                                  int inverse);
 
+/* Interpolation methods for img_extract_rectangle_with_interp() and
+   img_remap(). */
+#define IMG_INTERP_LINEAR    0 /* bi-linear interpolation */
+#define IMG_INTERP_CUBIC     1 /* Keys bi-cubic interpolation */
+#define IMG_INTERP_LANCZOS3  2 /* Lanczos interpolation of order 3 */
+
+extern int img_extract_rectangle_with_interp(const void *src,
+                                             const int src_type,
+                                             const long src_offset,
+                                             const long src_width,
+                                             const long src_height,
+                                             const long src_pitch,
+                                             void *dst,
+                                             const int dst_type,
+                                             const long dst_offset,
+                                             const long dst_width,
+                                             const long dst_height,
+                                             const long dst_pitch,
+                                             const double a[6],
+                                             int inverse,
+                                             int interp);
+
 extern int img_inverse_linear_transform(const double a[], long ncoefs,
                                         double b[]);
 
+/* Remapping of an image by arbitrary coordinate maps.  A remap plan stores
+   the taps and the weights of the interpolation for a given geometry, it can
+   be applied to any number of images with the same dimensions. */
+typedef struct _img_remap_plan img_remap_plan_t;
+
+extern img_remap_plan_t *img_remap_plan_new(long src_width, long src_height,
+                                            long dst_width, long dst_height,
+                                            const double x[],
+                                            const double y[],
+                                            int separable, int interp);
+extern img_remap_plan_t *img_remap_plan_new_polynomial(long src_width,
+                                                       long src_height,
+                                                       long dst_width,
+                                                       long dst_height,
+                                                       int degree,
+                                                       const double cx[],
+                                                       const double cy[],
+                                                       int interp);
+extern void img_remap_plan_destroy(img_remap_plan_t *plan);
+extern int img_remap_plan_apply(const img_remap_plan_t *plan,
+                                const void *src, int src_type,
+                                long src_offset, long src_pitch,
+                                void *dst, int dst_type,
+                                long dst_offset, long dst_pitch);
+extern int img_remap(const void *src, const int src_type,
+                     const long src_offset, const long src_width,
+                     const long src_height, const long src_pitch,
+                     void *dst, const int dst_type, const long dst_offset,
+                     const long dst_width, const long dst_height,
+                     const long dst_pitch, const double x[], const double y[],
+                     int separable, int interp);
+
 /*---------------------------------------------------------------------------*/
 /* IMAGE NOISE */
 
+/* Methods for img_estimate_noise() and img_estimate_noise_map(). */
+#define IMG_NOISE_RMS          0 /* root mean square */
+#define IMG_NOISE_MAD          1 /* median absolute deviation */
+#define IMG_NOISE_CLIPPED_RMS  2 /* iteratively clipped root mean square */
+
 extern double img_estimate_noise(const int type, const void *img,
                                  const long offset, const long width,
                                  const long height, const long stride,
                                  const int method);
 
+extern int img_estimate_noise_map(const int type, const void *img,
+                                  const long offset, const long width,
+                                  const long height, const long stride,
+                                  const long tile_width,
+                                  const long tile_height,
+                                  const int method, double map[]);
+
 /*---------------------------------------------------------------------------*/
 /* IMAGE COMPARISON */
 
@@ -234,6 +375,43 @@ extern double img_cost_l2(const int type,
                           const double bg,
                           double scale);
 
+extern int img_cost_l2_map(const int type,
+                           const void *raw_image,
+                           const long raw_offset,
+                           const long raw_width,
+                           const long raw_height,
+                           const long raw_stride,
+                           const void *ref_image,
+                           const long ref_offset,
+                           const long ref_width,
+                           const long ref_height,
+                           const long ref_stride,
+                           const long dx_min,
+                           const long dx_max,
+                           const long dy_min,
+                           const long dy_max,
+                           const double bg,
+                           const double scale,
+                           double cost[]);
+
+extern int img_cost_l2_batch(const int type,
+                             const void *raw_image,
+                             const long raw_offset,
+                             const long raw_width,
+                             const long raw_height,
+                             const long raw_stride,
+                             const long nrefs,
+                             const void *ref_image,
+                             const long ref_offset[],
+                             const long ref_width[],
+                             const long ref_height[],
+                             const long ref_stride[],
+                             const long dx[],
+                             const long dy[],
+                             const double bg[],
+                             const double scale[],
+                             double cost[]);
+
 /* Image segmentation functions. */
 
 typedef unsigned char img_link_t;
@@ -255,6 +433,10 @@ extern int img_build_links(const void *img, const int type,
 /* Opaque structure used to collect segments extracted from an image. */
 typedef struct _img_segmentation img_segmentation_t;
 
+/* Methods to build an image segmentation. */
+#define IMG_SEGMENTATION_FLOOD_FILL  0  /* flood fill of linked pixels */
+#define IMG_SEGMENTATION_RUNS        1  /* union-find of runs of pixels */
+
 extern img_segmentation_t *img_segmentation_new(const void *img,
 						const int type,
 						const long offset,
@@ -262,6 +444,20 @@ extern img_segmentation_t *img_segmentation_new(const void *img,
 						const long height,
 						const long stride,
 						const double threshold);
+extern img_segmentation_t *img_segmentation_new_with_method(
+                            const void *img, const int type,
+                            const long offset, const long width,
+                            const long height, const long stride,
+                            const double threshold, const int method);
+extern int img_segmentation_new_batch(const long number,
+                                      const void *const img[],
+                                      const int type,
+                                      const long offset,
+                                      const long width,
+                                      const long height,
+                                      const long stride,
+                                      const double threshold,
+                                      img_segmentation_t *sgm[]);
 extern void img_segmentation_unlink(img_segmentation_t *ws);
 extern img_segmentation_t *img_segmentation_link(img_segmentation_t *ws);
 extern img_segmentation_t *img_segmentation_select(const img_segmentation_t *src,
@@ -275,6 +471,18 @@ extern int img_segmentation_get_xcens(img_segmentation_t *ws,
 				      double x[], long number);
 extern int img_segmentation_get_ycens(img_segmentation_t *ws,
 				      double y[], long number);
+extern int img_segmentation_get_fluxes(img_segmentation_t *ws,
+                                       double flux[], long number);
+extern int img_segmentation_get_xbars(img_segmentation_t *ws,
+                                      double xbar[], long number);
+extern int img_segmentation_get_ybars(img_segmentation_t *ws,
+                                      double ybar[], long number);
+extern int img_segmentation_get_mxxs(img_segmentation_t *ws,
+                                     double mxx[], long number);
+extern int img_segmentation_get_mxys(img_segmentation_t *ws,
+                                     double mxy[], long number);
+extern int img_segmentation_get_myys(img_segmentation_t *ws,
+                                     double myy[], long number);
 extern int img_segmentation_get_counts(img_segmentation_t *ws,
 				       long count[], long number);
 extern int img_segmentation_get_xmins(img_segmentation_t *ws,
@@ -292,6 +500,12 @@ extern int img_segmentation_get_heights(img_segmentation_t *ws,
 
 extern double img_segmentation_get_xcen(img_segmentation_t *ws, long j);
 extern double img_segmentation_get_ycen(img_segmentation_t *ws, long j);
+extern double img_segmentation_get_flux(img_segmentation_t *ws, long j);
+extern double img_segmentation_get_xbar(img_segmentation_t *ws, long j);
+extern double img_segmentation_get_ybar(img_segmentation_t *ws, long j);
+extern double img_segmentation_get_mxx(img_segmentation_t *ws, long j);
+extern double img_segmentation_get_mxy(img_segmentation_t *ws, long j);
+extern double img_segmentation_get_myy(img_segmentation_t *ws, long j);
 extern long img_segmentation_get_count(img_segmentation_t *ws, long j);
 extern long img_segmentation_get_xmin(img_segmentation_t *ws, long j);
 extern long img_segmentation_get_xmax(img_segmentation_t *ws, long j);
@@ -322,6 +536,17 @@ extern img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
                                           double prec,
                                           long lmin,
                                           long lmax);
+extern img_chainpool_t *img_chainpool_new_lazy(img_segmentation_t *sgm,
+                                               double satol,
+                                               double srtol,
+                                               double drmin,
+                                               double drmax,
+                                               double slope,
+                                               double aatol,
+                                               double artol,
+                                               double prec,
+                                               long lmin,
+                                               long lmax);
 extern void img_chainpool_destroy(img_chainpool_t *self);
 extern long img_chainpool_get_number(img_chainpool_t *self);
 extern img_segmentation_t *img_chainpool_get_segmentation(img_chainpool_t *self);
@@ -389,6 +614,199 @@ extern int img_detect_spot(const void* src, const int type,
                            const double t0, const double t1, const double t2,
                            int dst[], long* count_ptr, double* ws);
 
+/* Streaming spot detector. */
+typedef struct _img_spot_detector img_spot_detector_t;
+typedef struct _img_spot img_spot_t;
+struct _img_spot {
+  long x, y;     /* coordinates of the spot */
+  double value;  /* filtered value at the spot */
+};
+
+extern img_spot_detector_t *img_spot_detector_new(const int type,
+                                                  const long width,
+                                                  const double c0,
+                                                  const double c1,
+                                                  const double c2,
+                                                  const double t0,
+                                                  const double t1,
+                                                  const double t2);
+extern void img_spot_detector_destroy(img_spot_detector_t *det);
+extern long img_spot_detector_push(img_spot_detector_t *det, const void *src,
+                                   const long stride, const long nrows);
+extern long img_spot_detector_finish(img_spot_detector_t *det);
+extern const img_spot_t *img_spot_detector_get_spots(
+                            const img_spot_detector_t *det, long *number);
+
+/*---------------------------------------------------------------------------*/
+/* TILED PROCESSING */
+
+/* Sources and sinks of pixels for images which do not fit in memory.  The
+   callbacks read (resp. write) the WIDTH by HEIGHT pixels of the rectangle
+   starting at (X,Y) from (resp. into) BUF which has PITCH pixels per row,
+   they return IMG_SUCCESS or IMG_FAILURE with errno set. */
+typedef struct _img_tile_source img_tile_source_t;
+typedef struct _img_tile_sink   img_tile_sink_t;
+typedef int img_tile_reader_t(void *data, long x, long y,
+                              long width, long height,
+                              void *buf, long pitch);
+typedef int img_tile_writer_t(void *data, long x, long y,
+                              long width, long height,
+                              const void *buf, long pitch);
+
+extern img_tile_source_t *img_tile_source_new(int type,
+                                              long width, long height,
+                                              img_tile_reader_t *read,
+                                              void *data);
+extern img_tile_source_t *img_tile_source_wrap(int type,
+                                               long width, long height,
+                                               const void *img, long offset,
+                                               long pitch);
+extern img_tile_source_t *img_tile_source_open(const char *path,
+                                               long header, int type,
+                                               long width, long height);
+extern void img_tile_source_destroy(img_tile_source_t *src);
+extern int  img_tile_source_get_type(const img_tile_source_t *src);
+extern long img_tile_source_get_width(const img_tile_source_t *src);
+extern long img_tile_source_get_height(const img_tile_source_t *src);
+extern int img_tile_read(img_tile_source_t *src, long x, long y,
+                         long width, long height, void *buf, long pitch);
+
+extern img_tile_sink_t *img_tile_sink_new(int type, long width, long height,
+                                          img_tile_writer_t *write,
+                                          void *data);
+extern img_tile_sink_t *img_tile_sink_wrap(int type, long width, long height,
+                                           void *img, long offset,
+                                           long pitch);
+extern img_tile_sink_t *img_tile_sink_create(const char *path, long header,
+                                             int type, long width,
+                                             long height);
+extern void img_tile_sink_destroy(img_tile_sink_t *dst);
+extern int img_tile_write(img_tile_sink_t *dst, long x, long y,
+                          long width, long height,
+                          const void *buf, long pitch);
+
+/* Morpho-math operations for img_tile_morph(). */
+#define IMG_MORPH_EROSION    0
+#define IMG_MORPH_DILATION   1
+#define IMG_MORPH_OPENING    2
+#define IMG_MORPH_CLOSING    3
+
+extern int img_tile_morph(int op, img_tile_source_t *src, long r,
+                          long tile_width, long tile_height,
+                          img_tile_sink_t *dst);
+extern int img_tile_extract_rectangle(img_tile_source_t *src,
+                                      img_tile_sink_t *dst,
+                                      const double a[6], int inverse,
+                                      int interp, long tile_width,
+                                      long tile_height);
+extern int img_tile_estimate_noise_map(img_tile_source_t *src,
+                                       long tile_width, long tile_height,
+                                       int method, double map[]);
+extern img_spot_detector_t *img_tile_detect_spots(img_tile_source_t *src,
+                                                  const double c0,
+                                                  const double c1,
+                                                  const double c2,
+                                                  const double t0,
+                                                  const double t1,
+                                                  const double t2,
+                                                  long band_height);
+extern img_segmentation_t *img_tile_segmentation_new(img_tile_source_t *src,
+                                                     double threshold,
+                                                     long band_height);
+
+/*---------------------------------------------------------------------------*/
+/* WORKSPACE CONTEXTS */
+
+/* A context keeps the scratch memory of operations repeatedly applied to
+   images of the same type and dimensions (see img_context_new). */
+typedef struct _img_context img_context_t;
+
+extern img_context_t *img_context_new(int type, long width, long height,
+                                      long r);
+extern void img_context_destroy(img_context_t *ctx);
+extern int  img_context_get_type(const img_context_t *ctx);
+extern long img_context_get_width(const img_context_t *ctx);
+extern long img_context_get_height(const img_context_t *ctx);
+extern long img_context_get_radius(const img_context_t *ctx);
+
+extern int img_context_morph(img_context_t *ctx, int op,
+                             const void *img, long img_pitch,
+                             void *dst, long dst_pitch);
+extern int img_context_morph_lmin_lmax(img_context_t *ctx,
+                                       const void *img, long img_pitch,
+                                       void *lmin, long lmin_pitch,
+                                       void *lmax, long lmax_pitch);
+extern int img_context_detect_spot(img_context_t *ctx, const void *src,
+                                   const double c0, const double c1,
+                                   const double c2, const double t0,
+                                   const double t1, const double t2,
+                                   int dst[], long *count);
+extern img_segmentation_t *img_context_segmentation_new(img_context_t *ctx,
+                                                        const void *img,
+                                                        const long offset,
+                                                        const long stride,
+                                                        const double threshold,
+                                                        const int method);
+
+/*---------------------------------------------------------------------------*/
+/* MORPHOLOGY CACHES */
+
+/* A morphology cache keeps the tables of running minima and/or maxima of
+   all the rows of an image, so that erosions and dilations of this image
+   for any radius up to the radius of the cache are computed without
+   rebuilding them (see img_morph_cache_new). */
+typedef struct _img_morph_cache img_morph_cache_t;
+
+#define IMG_MORPH_CACHE_MIN  1  /* cache running minima (erosion) */
+#define IMG_MORPH_CACHE_MAX  2  /* cache running maxima (dilation) */
+#define IMG_MORPH_CACHE_BOTH 3
+
+extern img_morph_cache_t *img_morph_cache_new(int type,
+                                              long width, long height,
+                                              const void *img,
+                                              long img_pitch,
+                                              long rmax, int what);
+extern void img_morph_cache_destroy(img_morph_cache_t *cache);
+extern int  img_morph_cache_get_type(const img_morph_cache_t *cache);
+extern long img_morph_cache_get_width(const img_morph_cache_t *cache);
+extern long img_morph_cache_get_height(const img_morph_cache_t *cache);
+extern long img_morph_cache_get_radius(const img_morph_cache_t *cache);
+extern int  img_morph_cache_get_what(const img_morph_cache_t *cache);
+
+extern int img_morph_cache_lmin_lmax(const img_morph_cache_t *cache, long r,
+                                     void *lmin, long lmin_pitch,
+                                     void *lmax, long lmax_pitch);
+extern int img_morph_cache_trilevel(const img_morph_cache_t *cache, long r,
+                                    double atol, double rtol,
+                                    double black, double white,
+                                    unsigned char dst[], long dst_pitch);
+
+/*---------------------------------------------------------------------------*/
+/* BINARY IMAGES */
+
+/* Packed binary images (bitmaps) store 64 pixels per 64-bit word: pixel
+   number K (counting from the base address) is the bit K%64 of the word
+   K/64, the least significant bit first.  As for other images, the offsets
+   and the pitches of the bitmaps are given in pixels (that is in bits).
+   img_copy() with IMG_TYPE_BIT converts images into bitmaps (non-zero pixels
+   are set) and bitmaps into images (set pixels are 1, others 0).  The
+   morpho-math operations and the segmentation of bitmaps require that the
+   rows start on a word boundary (the pitch must be a multiple of 64). */
+typedef uint64_t img_bitmap_word_t;
+
+#define IMG_BITMAP_WORD_BITS    64
+
+/* Minimum pitch (in pixels) of a bitmap with WIDTH pixels per row. */
+#define IMG_BITMAP_PITCH(width) ((((width) + 63)/64)*64)
+
+extern int img_bitmap_morph(int op, long width, long height,
+                            const img_bitmap_word_t *src, long src_pitch,
+                            long r, img_bitmap_word_t *dst, long dst_pitch);
+
+extern img_segmentation_t *
+img_bitmap_segmentation_new(const img_bitmap_word_t *bits,
+                            long width, long height, long pitch);
+
 /*---------------------------------------------------------------------------*/
 
 #ifdef  __cplusplus
@@ -0,0 +1,612 @@
+/*
+ * img_bench.c --
+ *
+ * Benchmarks of the C library of YImage (built without Yorick by
+ * "make bench").
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every benchmark case is run in a child process, so that the memory
+ * high-water mark (the maximum resident set size reported by wait4) is the
+ * one of the case alone.  A case is a single operation repeatedly applied
+ * to synthetic data until the minimum duration is reached, the best and the
+ * mean times per call are reported with the number of pixels processed per
+ * second.  The results are printed in CSV (the default) or JSON.
+ *
+ * Usage: img_bench [-t NTHREADS] [-s SECONDS] [-j] [-q] [PATTERN ...]
+ *
+ *   -t NTHREADS  number of threads (default given by IMG_NUM_THREADS);
+ *   -s SECONDS   minimum duration of every case (default 0.5);
+ *   -j           print the results in JSON instead of CSV;
+ *   -q           quick run with smaller images;
+ *   PATTERN      only run the cases whose name contains one of the
+ *                patterns.
+ */
+
+/* Needed for clock_gettime() and wait4() in strict ISO C modes. */
+#ifndef _DEFAULT_SOURCE
+# define _DEFAULT_SOURCE 1
+#endif
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "img.h"
+#include "img_bench.h"
+
+/*---------------------------------------------------------------------------*/
+/* CASES */
+
+typedef enum {
+  BENCH_MORPH,         /* img_morph_lmin_lmax, PARAM = radius */
+  BENCH_EXTRACT,       /* img_extract_rectangle(_with_interp), PARAM = interp,
+                          PARAM2 = 0 for a shift, 1 for a rotation */
+  BENCH_DETECT,        /* img_detect_spot */
+  BENCH_SEGMENT,       /* img_segmentation_new_with_method, PARAM = method */
+  BENCH_CHAINPOOL,     /* img_chainpool_new on a prebuilt segmentation */
+  BENCH_TEXT_PAGE,     /* img_segmentation_new + img_chainpool_new */
+  BENCH_COST,          /* img_cost_l2, PARAM = width of the reference */
+  BENCH_COST_MAP,      /* img_cost_l2_map, PARAM = width of the reference,
+                          PARAM2 = maximum shift */
+  BENCH_COPY,          /* img_copy, PARAM = destination type */
+  BENCH_BITMAP_MORPH,  /* img_bitmap_morph (erosion), PARAM = radius */
+  BENCH_BITMAP_SEGMENT /* img_bitmap_segmentation_new */
+} bench_kind_t;
+
+typedef struct _bench_case bench_case_t;
+struct _bench_case {
+  const char *name;
+  bench_kind_t kind;
+  int type;            /* pixel type of the source */
+  long width, height;  /* dimensions of the source */
+  long param, param2;
+};
+
+/* Result sent by the child process to its parent. */
+typedef struct _bench_result bench_result_t;
+struct _bench_result {
+  double best, mean;   /* best and mean times per call (seconds) */
+  double pixels;       /* number of pixels processed per call */
+  long calls;          /* number of timed calls */
+  long number;         /* number of objects found (segments, spots, ...) */
+  int status;          /* IMG_SUCCESS or IMG_FAILURE */
+  int code;            /* errno in case of failure */
+};
+
+#define MAX_CASES 128
+
+static bench_case_t cases[MAX_CASES];
+static long ncases = 0;
+
+static void add_case(const char *name, bench_kind_t kind, int type,
+                     long width, long height, long param, long param2)
+{
+  if (ncases >= MAX_CASES) {
+    fprintf(stderr, "img_bench: too many cases\n");
+    exit(1);
+  }
+  cases[ncases].name = name;
+  cases[ncases].kind = kind;
+  cases[ncases].type = type;
+  cases[ncases].width = width;
+  cases[ncases].height = height;
+  cases[ncases].param = param;
+  cases[ncases].param2 = param2;
+  ++ncases;
+}
+
+static void build_cases(int quick)
+{
+  static const long radii[] = {1, 2, 3, 5, 8, 13, 21};
+  static const int morph_types[] = {IMG_TYPE_UINT8, IMG_TYPE_INT16,
+                                    IMG_TYPE_FLOAT, IMG_TYPE_DOUBLE};
+  const long n = (quick ? 256 : 1024);
+  const long pw = (quick ? 800 : 2400), ph = (quick ? 600 : 1800);
+  size_t i, j;
+
+  for (i = 0; i < sizeof(morph_types)/sizeof(morph_types[0]); ++i) {
+    for (j = 0; j < sizeof(radii)/sizeof(radii[0]); ++j) {
+      add_case("morph_lmin_lmax", BENCH_MORPH, morph_types[i], n, n,
+               radii[j], 0);
+    }
+  }
+  add_case("extract_shift", BENCH_EXTRACT, IMG_TYPE_FLOAT, n, n,
+           IMG_INTERP_LINEAR, 0);
+  add_case("extract_rotate", BENCH_EXTRACT, IMG_TYPE_FLOAT, n, n,
+           IMG_INTERP_LINEAR, 1);
+  add_case("extract_rotate", BENCH_EXTRACT, IMG_TYPE_FLOAT, n, n,
+           IMG_INTERP_CUBIC, 1);
+  add_case("extract_rotate", BENCH_EXTRACT, IMG_TYPE_FLOAT, n, n,
+           IMG_INTERP_LANCZOS3, 1);
+  add_case("detect_spot", BENCH_DETECT, IMG_TYPE_UINT16, n, n, 0, 0);
+  add_case("detect_spot", BENCH_DETECT, IMG_TYPE_FLOAT, n, n, 0, 0);
+  add_case("segmentation", BENCH_SEGMENT, IMG_TYPE_UINT8, pw, ph,
+           IMG_SEGMENTATION_FLOOD_FILL, 0);
+  add_case("segmentation", BENCH_SEGMENT, IMG_TYPE_UINT8, pw, ph,
+           IMG_SEGMENTATION_RUNS, 0);
+  add_case("chainpool", BENCH_CHAINPOOL, IMG_TYPE_UINT8, pw, ph, 0, 0);
+  add_case("text_page", BENCH_TEXT_PAGE, IMG_TYPE_UINT8, pw, ph, 0, 0);
+  add_case("cost_l2", BENCH_COST, IMG_TYPE_FLOAT, n, n, 32, 0);
+  add_case("cost_l2_map", BENCH_COST_MAP, IMG_TYPE_FLOAT, n, n, 32, 8);
+  add_case("copy", BENCH_COPY, IMG_TYPE_UINT8, 2*n, 2*n, IMG_TYPE_UINT8, 0);
+  add_case("copy", BENCH_COPY, IMG_TYPE_UINT8, 2*n, 2*n, IMG_TYPE_FLOAT, 0);
+  add_case("copy", BENCH_COPY, IMG_TYPE_UINT16, 2*n, 2*n, IMG_TYPE_FLOAT, 0);
+  add_case("copy", BENCH_COPY, IMG_TYPE_FLOAT, 2*n, 2*n, IMG_TYPE_UINT8, 0);
+  add_case("copy", BENCH_COPY, IMG_TYPE_DOUBLE, 2*n, 2*n, IMG_TYPE_FLOAT, 0);
+  add_case("copy", BENCH_COPY, IMG_TYPE_RGB, 2*n, 2*n, IMG_TYPE_UINT8, 0);
+  for (j = 0; j < sizeof(radii)/sizeof(radii[0]); j += 2) {
+    add_case("bitmap_morph", BENCH_BITMAP_MORPH, IMG_TYPE_UINT8, pw, ph,
+             radii[j], 0);
+  }
+  add_case("bitmap_segmentation", BENCH_BITMAP_SEGMENT, IMG_TYPE_UINT8,
+           pw, ph, 0, 0);
+}
+
+/* Short description of the parameters of a case. */
+static void format_param(char *buf, size_t size, const bench_case_t *c)
+{
+  static const char *interp[] = {"linear", "cubic", "lanczos3"};
+
+  switch (c->kind) {
+  case BENCH_MORPH:
+  case BENCH_BITMAP_MORPH:
+    snprintf(buf, size, "r=%ld", c->param);
+    break;
+  case BENCH_EXTRACT:
+    snprintf(buf, size, "%s", interp[c->param]);
+    break;
+  case BENCH_SEGMENT:
+    snprintf(buf, size, "%s", (c->param == IMG_SEGMENTATION_RUNS ?
+                               "runs" : "flood_fill"));
+    break;
+  case BENCH_COST:
+    snprintf(buf, size, "ref=%ldx%ld", c->param, c->param);
+    break;
+  case BENCH_COST_MAP:
+    snprintf(buf, size, "ref=%ldx%ld;shift=%ld", c->param, c->param,
+             c->param2);
+    break;
+  case BENCH_COPY:
+    snprintf(buf, size, "to=%s", type_name((int)c->param));
+    break;
+  default:
+    buf[0] = '\0';
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* TIMING */
+
+static double elapsed(const struct timespec *t0)
+{
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) + 1e-9*(t1.tv_nsec - t0->tv_nsec);
+}
+
+/* State of a running case. */
+typedef struct _bench_state bench_state_t;
+struct _bench_state {
+  const bench_case_t *c;
+  void *src, *dst, *ref;
+  long *ws;
+  int *msk;
+  double *map;
+  img_segmentation_t *sgm;
+  double a[6];
+  long number;
+};
+
+static void destroy_segmentation(bench_state_t *s)
+{
+  if (s->sgm != NULL) {
+    img_segmentation_unlink(s->sgm);
+    s->sgm = NULL;
+  }
+}
+
+static int new_chainpool(bench_state_t *s)
+{
+  img_chainpool_t *chn = img_chainpool_new(s->sgm, 2.0, 0.05, 0.4, 2.5, 0.3,
+                                           2.0, 0.05, 0.05, 3, 10);
+  if (chn == NULL) {
+    return IMG_FAILURE;
+  }
+  s->number = img_chainpool_get_number(chn);
+  img_chainpool_destroy(chn);
+  return IMG_SUCCESS;
+}
+
+/* Apply the operation of the case once. */
+static int run_once(bench_state_t *s)
+{
+  const bench_case_t *c = s->c;
+  const long w = c->width, h = c->height;
+  int status = IMG_SUCCESS;
+
+  switch (c->kind) {
+  case BENCH_MORPH:
+    return img_morph_lmin_lmax(c->type, w, h, s->src, w, c->param, s->ws,
+                               s->dst, w, s->ref, w);
+  case BENCH_EXTRACT:
+    return img_extract_rectangle_with_interp(s->src, c->type, 0, w, h, w,
+                                             s->dst, c->type, 0, w, h, w,
+                                             s->a, 1, (int)c->param);
+  case BENCH_DETECT:
+    return img_detect_spot(s->src, c->type, w, h, 1.0, 0.5, 0.25,
+                           (c->type == IMG_TYPE_FLOAT ? 100.0 : 6000.0),
+                           0.0, 0.0, s->msk, &s->number, s->map);
+  case BENCH_SEGMENT:
+  case BENCH_TEXT_PAGE:
+    destroy_segmentation(s);
+    /* A new segmentation has no references, the chain-pool would destroy
+       it unless it is linked. */
+    s->sgm = img_segmentation_link(
+        img_segmentation_new_with_method(s->src, c->type, 0, w, h, w, 20.0,
+                                         (c->kind == BENCH_SEGMENT ?
+                                          (int)c->param :
+                                          IMG_SEGMENTATION_RUNS)));
+    if (s->sgm == NULL) {
+      return IMG_FAILURE;
+    }
+    s->number = img_segmentation_get_number(s->sgm);
+    if (c->kind == BENCH_TEXT_PAGE) {
+      status = new_chainpool(s);
+    }
+    return status;
+  case BENCH_CHAINPOOL:
+    return new_chainpool(s);
+  case BENCH_COST:
+    return (img_cost_l2(c->type, s->src, 0, w, h, w,
+                        s->ref, 0, c->param, c->param, c->param,
+                        w/2, h/2, 0.0, 1.0) >= 0.0 ?
+            IMG_SUCCESS : IMG_FAILURE);
+  case BENCH_COST_MAP:
+    return img_cost_l2_map(c->type, s->src, 0, w, h, w,
+                           s->ref, 0, c->param, c->param, c->param,
+                           w/2 - c->param2, w/2 + c->param2,
+                           h/2 - c->param2, h/2 + c->param2,
+                           0.0, 1.0, s->map);
+  case BENCH_COPY:
+    return img_copy(w, h, s->src, c->type, 0, w,
+                    s->dst, (int)c->param, 0, w);
+  case BENCH_BITMAP_MORPH:
+    return img_bitmap_morph(IMG_MORPH_EROSION, w, h, s->ref,
+                            IMG_BITMAP_PITCH(w), c->param,
+                            s->dst, IMG_BITMAP_PITCH(w));
+  case BENCH_BITMAP_SEGMENT:
+    destroy_segmentation(s);
+    s->sgm = img_segmentation_link(
+        img_bitmap_segmentation_new(s->ref, w, h, IMG_BITMAP_PITCH(w)));
+    if (s->sgm == NULL) {
+      return IMG_FAILURE;
+    }
+    s->number = img_segmentation_get_number(s->sgm);
+    return IMG_SUCCESS;
+  }
+  errno = EINVAL;
+  return IMG_FAILURE;
+}
+
+/* Number of pixels processed by a call. */
+static double count_pixels(const bench_case_t *c)
+{
+  if (c->kind == BENCH_COST) {
+    return (double)c->param*(double)c->param;
+  }
+  if (c->kind == BENCH_COST_MAP) {
+    double n = 2*c->param2 + 1;
+    return (double)c->param*(double)c->param*n*n;
+  }
+  return (double)c->width*(double)c->height;
+}
+
+/* Prepare the data, run the case and store the result in RES. */
+static void run_case(const bench_case_t *c, double min_time,
+                     bench_result_t *res)
+{
+  bench_state_t s;
+  struct timespec t0;
+  double *val, t, total;
+  size_t size = img_get_pixel_size(c->type);
+  long i, npix = c->width*c->height;
+  long dst_type = (c->kind == BENCH_COPY ? c->param : c->type);
+
+  memset(res, 0, sizeof(*res));
+  memset(&s, 0, sizeof(s));
+  res->status = IMG_FAILURE;
+  res->code = ENOMEM;
+  s.c = c;
+  if (c->kind == BENCH_SEGMENT || c->kind == BENCH_CHAINPOOL ||
+      c->kind == BENCH_TEXT_PAGE) {
+    val = make_page(c->width, c->height);
+  } else if (c->kind == BENCH_BITMAP_MORPH ||
+             c->kind == BENCH_BITMAP_SEGMENT) {
+    /* Binary text page (the glyphs are set). */
+    val = make_page(c->width, c->height);
+    for (i = 0; val != NULL && i < npix; ++i) {
+      val[i] = (val[i] < 128.0 ? 1.0 : 0.0);
+    }
+  } else {
+    val = make_field((c->type == IMG_TYPE_RGB ? 3 : 1)*c->width, c->height,
+                     npix/1000, (c->type == IMG_TYPE_FLOAT ||
+                                 c->type == IMG_TYPE_DOUBLE ? 1000.0 :
+                                 c->type == IMG_TYPE_UINT16 ? 60000.0 :
+                                 c->type == IMG_TYPE_INT16 ? 30000.0 :
+                                 255.0));
+  }
+  if (val == NULL) {
+    return;
+  }
+  if (c->type == IMG_TYPE_RGB) {
+    /* The samples of the RGB pixels are stored as bytes. */
+    s.src = new_image(IMG_TYPE_UINT8, 3*c->width, c->height, val);
+  } else {
+    s.src = new_image(c->type, c->width, c->height, val);
+  }
+  free(val);
+  s.dst = malloc(npix*img_get_pixel_size((int)dst_type));
+  if (s.src == NULL || s.dst == NULL) {
+    return;
+  }
+  switch (c->kind) {
+  case BENCH_MORPH:
+    s.ws = (long *)malloc((2*c->param + 1)*sizeof(long));
+    s.ref = malloc(npix*size);
+    if (s.ws == NULL || s.ref == NULL) {
+      return;
+    }
+    break;
+  case BENCH_EXTRACT:
+    if (c->param2) {
+      /* Rotation by 15 degrees about the center of the image. */
+      double q = 15.0*M_PI/180.0, cs = cos(q), sn = sin(q);
+      double xc = 0.5*(c->width - 1), yc = 0.5*(c->height - 1);
+      s.a[1] =  cs; s.a[2] = -sn; s.a[0] = xc - cs*xc + sn*yc;
+      s.a[4] =  sn; s.a[5] =  cs; s.a[3] = yc - sn*xc - cs*yc;
+    } else {
+      s.a[0] = 0.37; s.a[1] = 1.0; s.a[2] = 0.0;
+      s.a[3] = 0.61; s.a[4] = 0.0; s.a[5] = 1.0;
+    }
+    break;
+  case BENCH_DETECT:
+    s.msk = (int *)malloc(npix*sizeof(int));
+    s.map = (double *)malloc(3*c->width*sizeof(double));
+    if (s.msk == NULL || s.map == NULL) {
+      return;
+    }
+    break;
+  case BENCH_BITMAP_MORPH:
+  case BENCH_BITMAP_SEGMENT:
+    s.ref = malloc((IMG_BITMAP_PITCH(c->width)/8)*c->height);
+    if (s.ref == NULL ||
+        img_copy(c->width, c->height, s.src, c->type, 0, c->width,
+                 s.ref, IMG_TYPE_BIT, 0,
+                 IMG_BITMAP_PITCH(c->width)) != IMG_SUCCESS) {
+      return;
+    }
+    break;
+  case BENCH_CHAINPOOL:
+    s.sgm = img_segmentation_link(
+        img_segmentation_new_with_method(s.src, c->type, 0, c->width,
+                                         c->height, c->width, 20.0,
+                                         IMG_SEGMENTATION_RUNS));
+    if (s.sgm == NULL) {
+      res->code = errno;
+      return;
+    }
+    break;
+  case BENCH_COST:
+  case BENCH_COST_MAP:
+    /* The reference is a patch of the image itself, slightly offset. */
+    s.ref = malloc(c->param*c->param*size);
+    s.map = (double *)malloc((2*c->param2 + 1)*(2*c->param2 + 1)*
+                             sizeof(double));
+    if (s.ref == NULL || s.map == NULL ||
+        img_copy(c->param, c->param, s.src, c->type,
+                 (c->height/2 + 1)*c->width + c->width/2 + 1, c->width,
+                 s.ref, c->type, 0, c->param) != IMG_SUCCESS) {
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+
+  /* Warm up then repeat the operation until the minimum duration is
+     reached. */
+  if (run_once(&s) != IMG_SUCCESS) {
+    res->code = errno;
+    return;
+  }
+  res->best = HUGE_VAL;
+  total = 0.0;
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (run_once(&s) != IMG_SUCCESS) {
+      res->code = errno;
+      return;
+    }
+    t = elapsed(&t0);
+    if (t < res->best) {
+      res->best = t;
+    }
+    total += t;
+    ++res->calls;
+  } while (total < min_time || res->calls < 3);
+  res->mean = total/res->calls;
+  res->pixels = count_pixels(c);
+  res->number = s.number;
+  res->status = IMG_SUCCESS;
+  res->code = 0;
+  destroy_segmentation(&s);
+}
+
+/*---------------------------------------------------------------------------*/
+/* MAIN PROGRAM */
+
+static int selected(const char *name, int npatterns, char *pattern[])
+{
+  int k;
+
+  if (npatterns < 1) {
+    return 1;
+  }
+  for (k = 0; k < npatterns; ++k) {
+    if (strstr(name, pattern[k]) != NULL) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Run case C in a child process, store its result in RES and its memory
+   high-water mark (in kilobytes) in MAXRSS. */
+static int spawn_case(const bench_case_t *c, double min_time,
+                      bench_result_t *res, long *maxrss)
+{
+  struct rusage usage;
+  pid_t pid;
+  ssize_t n;
+  int fd[2], wstatus;
+
+  if (pipe(fd) != 0) {
+    return IMG_FAILURE;
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    close(fd[0]);
+    close(fd[1]);
+    return IMG_FAILURE;
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    run_case(c, min_time, res);
+    n = write(fd[1], res, sizeof(*res));
+    close(fd[1]);
+    _exit(n == (ssize_t)sizeof(*res) ? 0 : 1);
+  }
+  close(fd[1]);
+  n = read(fd[0], res, sizeof(*res));
+  close(fd[0]);
+  if (wait4(pid, &wstatus, 0, &usage) != pid || n != (ssize_t)sizeof(*res)
+      || ! WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+    return IMG_FAILURE;
+  }
+  *maxrss = usage.ru_maxrss;
+  return IMG_SUCCESS;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: img_bench [-t NTHREADS] [-s SECONDS] [-j] [-q] "
+          "[PATTERN ...]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_result_t res;
+  char param[64];
+  double min_time = 0.5;
+  long k, nthreads = 0, maxrss, count = 0;
+  int i, json = 0, quick = 0, failures = 0;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      nthreads = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      min_time = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0) {
+      json = 1;
+    } else if (strcmp(argv[i], "-q") == 0) {
+      quick = 1;
+    } else {
+      usage();
+    }
+  }
+  /* The worker threads are only started by the first parallel job, hence
+     in the child processes. */
+  if (nthreads > 0 && img_set_num_threads(nthreads) != IMG_SUCCESS) {
+    fprintf(stderr, "img_bench: cannot use %ld threads\n", nthreads);
+    return 1;
+  }
+  nthreads = img_get_num_threads();
+  img_copy_init(); /* select the fast converters before forking the cases */
+  build_cases(quick);
+
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("bench,type,width,height,param,threads,calls,best_s,mean_s,"
+           "mpixels_per_s,number,maxrss_kb\n");
+  }
+  for (k = 0; k < ncases; ++k) {
+    const bench_case_t *c = &cases[k];
+    if (! selected(c->name, argc - i, argv + i)) {
+      continue;
+    }
+    format_param(param, sizeof(param), c);
+    if (spawn_case(c, min_time, &res, &maxrss) != IMG_SUCCESS ||
+        res.status != IMG_SUCCESS) {
+      fprintf(stderr, "img_bench: case %s (%s, %s) failed: %s\n",
+              c->name, type_name(c->type), param,
+              strerror(res.code != 0 ? res.code : EIO));
+      ++failures;
+      continue;
+    }
+    if (json) {
+      printf("%s  {\"bench\": \"%s\", \"type\": \"%s\", \"width\": %ld, "
+             "\"height\": %ld, \"param\": \"%s\", \"threads\": %ld, "
+             "\"calls\": %ld, \"best_s\": %.6e, \"mean_s\": %.6e, "
+             "\"mpixels_per_s\": %.3f, \"number\": %ld, "
+             "\"maxrss_kb\": %ld}", (count > 0 ? ",\n" : ""),
+             c->name, type_name(c->type), c->width, c->height, param,
+             nthreads, res.calls, res.best, res.mean,
+             1e-6*res.pixels/res.best, res.number, maxrss);
+    } else {
+      printf("%s,%s,%ld,%ld,%s,%ld,%ld,%.6e,%.6e,%.3f,%ld,%ld\n",
+             c->name, type_name(c->type), c->width, c->height, param,
+             nthreads, res.calls, res.best, res.mean,
+             1e-6*res.pixels/res.best, res.number, maxrss);
+    }
+    fflush(stdout);
+    ++count;
+  }
+  if (json) {
+    printf("%s]\n", (count > 0 ? "\n" : ""));
+  }
+  return (failures > 0 ? 1 : 0);
+}
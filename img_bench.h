@@ -0,0 +1,176 @@
+/*
+ * img_bench.h --
+ *
+ * Synthetic data shared by the benchmarks (img_bench.c) and the consistency
+ * checks (img_check.c) of the C library of YImage.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IMG_BENCH_H
+#define _IMG_BENCH_H 1
+
+#include <stdlib.h>
+#include <math.h>
+#include "img.h"
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* Name of a pixel type. */
+static const char *type_name(int type)
+{
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+  case IMG_TYPE_INT8: return "int8";
+#endif
+#ifdef IMG_TYPE_UINT8
+  case IMG_TYPE_UINT8: return "uint8";
+#endif
+#ifdef IMG_TYPE_INT16
+  case IMG_TYPE_INT16: return "int16";
+#endif
+#ifdef IMG_TYPE_UINT16
+  case IMG_TYPE_UINT16: return "uint16";
+#endif
+#ifdef IMG_TYPE_INT32
+  case IMG_TYPE_INT32: return "int32";
+#endif
+#ifdef IMG_TYPE_UINT32
+  case IMG_TYPE_UINT32: return "uint32";
+#endif
+#ifdef IMG_TYPE_INT64
+  case IMG_TYPE_INT64: return "int64";
+#endif
+#ifdef IMG_TYPE_UINT64
+  case IMG_TYPE_UINT64: return "uint64";
+#endif
+#ifdef IMG_TYPE_FLOAT
+  case IMG_TYPE_FLOAT: return "float";
+#endif
+#ifdef IMG_TYPE_DOUBLE
+  case IMG_TYPE_DOUBLE: return "double";
+#endif
+#ifdef IMG_TYPE_RGB
+  case IMG_TYPE_RGB: return "rgb";
+#endif
+#ifdef IMG_TYPE_RGBA
+  case IMG_TYPE_RGBA: return "rgba";
+#endif
+  default: return "unknown";
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* SYNTHETIC DATA */
+
+/* A simple linear congruential generator, so that the data do not depend on
+   the C library (set SEED to restart a sequence). */
+static unsigned long seed = 12345UL;
+
+static double uniform(void)
+{
+  seed = (1103515245UL*seed + 12345UL) & 0x7fffffffUL;
+  return seed/2147483648.0;
+}
+
+/* Allocate an image and fill it with the values of VAL converted into the
+   pixel type. */
+static void *new_image(int type, long width, long height, const double val[])
+{
+  size_t size = img_get_pixel_size(type);
+  void *img = malloc(width*height*size);
+  if (img == NULL) {
+    return NULL;
+  }
+  if (img_copy(width, height, val, IMG_TYPE_DOUBLE, 0, width,
+               img, type, 0, width) != IMG_SUCCESS) {
+    free(img);
+    return NULL;
+  }
+  return img;
+}
+
+/* Smooth random background with NSPOTS Gaussian spots, values in [0,AMAX]. */
+static double *make_field(long width, long height, long nspots, double amax)
+{
+  double *val = (double *)malloc(width*height*sizeof(double));
+  long i, k, x, y;
+
+  if (val == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < width*height; ++i) {
+    val[i] = 0.1*amax + 0.05*amax*uniform();
+  }
+  for (k = 0; k < nspots; ++k) {
+    double xc = width*uniform(), yc = height*uniform();
+    double a = 0.3*amax + 0.5*amax*uniform();
+    for (y = (long)yc - 4; y <= (long)yc + 4; ++y) {
+      for (x = (long)xc - 4; x <= (long)xc + 4; ++x) {
+        if (x >= 0 && x < width && y >= 0 && y < height) {
+          double dx = x - xc, dy = y - yc;
+          val[y*width + x] += a*exp(-(dx*dx + dy*dy)/3.0);
+        }
+      }
+    }
+  }
+  for (i = 0; i < width*height; ++i) {
+    if (val[i] > amax) val[i] = amax;
+  }
+  return val;
+}
+
+/* Synthetic text page: dark glyphs (blocks of random widths) on a light
+   uniform background, arranged in slightly slanted lines of words. */
+static double *make_page(long width, long height)
+{
+  const long line_height = 40, glyph_height = 18;
+  double *val = (double *)malloc(width*height*sizeof(double));
+  long i, x, y, x0, y0, w, line;
+
+  if (val == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < width*height; ++i) {
+    val[i] = 230.0;
+  }
+  for (line = 0; (line + 1)*line_height < height; ++line) {
+    x0 = 30;
+    while (x0 + 40 < width) {
+      long nglyphs = 2 + (long)(8*uniform());
+      for (i = 0; i < nglyphs && x0 + 20 < width; ++i) {
+        w = 7 + (long)(6*uniform());
+        y0 = line*line_height + 10 + (x0*3)/width;
+        for (y = y0; y < y0 + glyph_height && y < height; ++y) {
+          for (x = x0; x < x0 + w && x < width; ++x) {
+            val[y*width + x] = 30.0;
+          }
+        }
+        x0 += w + 4;
+      }
+      x0 += 14;
+    }
+  }
+  return val;
+}
+
+#endif /* _IMG_BENCH_H */
@@ -0,0 +1,349 @@
+/*
+ * img_bitmap.c --
+ *
+ * Morpho-math operations on packed binary images (bitmaps).
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "img.h"
+#include "img_context.h"
+#include "img_stats.h"
+#include "img_thread.h"
+
+typedef img_bitmap_word_t word_t;
+
+#define ONES (~(word_t)0)
+
+/* Minimum number of rows per band for parallel processing. */
+#define BITMAP_MIN_ROWS 64
+
+/*
+ * The erosion by the disk of radius R is the AND of the source rows Y + DY
+ * (for DY in [-R,R]) eroded horizontally by a segment of half-length
+ * OFF[DY] (the chords of the disk, see img_morph_disk).  The horizontal
+ * erosion by half-length K of a row is built by doubling: H[J + M] = H[J]
+ * & (H[J] shifted by M) & (H[J] shifted by -M) for M <= 2*J + 1, starting
+ * with H[0] = the row.  Each source row is eroded once for all the distinct
+ * half-lengths of the chords and stored in a rolling buffer of 2*R + 1
+ * rows.  Pixels outside the image do not change the result, the rows are
+ * padded by replicating their first and last pixels.  The dilation is the
+ * complement of the erosion of the complemented image.
+ */
+typedef struct _bitmap_job bitmap_job_t;
+struct _bitmap_job {
+  const word_t *src;
+  word_t *dst;
+  long src_pitch, dst_pitch; /* in words */
+  long width, height;
+  long nwords;               /* number of words per row */
+  long r;                    /* radius of the disk */
+  long nk;                   /* number of distinct half-lengths */
+  const long *len;           /* distinct half-lengths in ascending order */
+  const long *idx;           /* index in LEN of the chord DY (IDX[-R..R]) */
+  word_t pad;                /* bits after the last pixel in a row */
+  int invert;                /* complement source and result (dilation) */
+};
+
+/* Set the PAD bits after the last pixel of a row of NWORDS words to the
+   value of this pixel. */
+static void pad_row(word_t row[], long nwords, word_t pad)
+{
+  const word_t last = (pad != 0 ? (pad >> 1) & ~pad : ONES ^ (ONES >> 1));
+  if ((row[nwords - 1] & last) != 0) {
+    row[nwords - 1] |= pad;
+  } else {
+    row[nwords - 1] &= ~pad;
+  }
+}
+
+/* Store in DST the erosion of SRC by a segment of half-length J + M where
+   SRC is the erosion by half-length J (M <= 2*J + 1).  The erosion by J of
+   a pixel outside the row is not neutral (it depends on the pixels of the
+   row within J of it) but it can be replaced by the erosion of the nearest
+   pixel of the row, whose segment is then still covered by the segment of
+   half-length J + M: the first and last pixels of SRC are replicated, and
+   the PAD bits of SRC must already be. */
+static void erode_step(word_t dst[], const word_t src[], long nwords,
+                       long m, word_t pad)
+{
+  const word_t left = ((src[0] & 1) != 0 ? ONES : 0);
+  const word_t right = ((src[nwords - 1] >> 63) != 0 ? ONES : 0);
+  long q = m >> 6, s = m & 63, i;
+
+  for (i = 0; i < nwords; ++i) {
+    word_t a0, a1, b0, b1, hi, lo;
+    a0 = (i + q < nwords ? src[i + q] : right);
+    b0 = (i - q >= 0 ? src[i - q] : left);
+    if (s == 0) {
+      hi = a0;
+      lo = b0;
+    } else {
+      a1 = (i + q + 1 < nwords ? src[i + q + 1] : right);
+      b1 = (i - q - 1 >= 0 ? src[i - q - 1] : left);
+      hi = (a0 >> s) | (a1 << (64 - s)); /* pixels X + M */
+      lo = (b0 << s) | (b1 >> (64 - s)); /* pixels X - M */
+    }
+    dst[i] = src[i] & hi & lo;
+  }
+  pad_row(dst, nwords, pad);
+}
+
+/* Load source row Y into the slots of the rolling buffer BUF (NK rows of
+   NWORDS words per slot) using the two rows of scratch memory in TMP. */
+static void load_row(const bitmap_job_t *job, long y, word_t buf[],
+                     word_t tmp[])
+{
+  const long nwords = job->nwords;
+  const word_t *src = job->src + y*job->src_pitch;
+  word_t *cur = tmp, *next;
+  long i, j, k;
+
+  for (i = 0; i < nwords; ++i) {
+    cur[i] = (job->invert ? ~src[i] : src[i]);
+  }
+  pad_row(cur, nwords, job->pad);
+  j = 0;
+  for (k = 0; k < job->nk; ++k) {
+    long len = job->len[k];
+    word_t *slot = buf + k*nwords;
+    if (len == j) {
+      memcpy(slot, cur, nwords*sizeof(word_t));
+      cur = slot;
+      continue;
+    }
+    while (j < len) {
+      long m = (len - j < 2*j + 1 ? len - j : 2*j + 1);
+      next = (j + m == len ? slot : (cur == tmp ? tmp + nwords : tmp));
+      erode_step(next, cur, nwords, m, job->pad);
+      cur = next;
+      j += m;
+    }
+  }
+}
+
+static int bitmap_task(void *data, long band, long nbands)
+{
+  const bitmap_job_t *job = (const bitmap_job_t *)data;
+  const long nwords = job->nwords, r = job->r, height = job->height;
+  const long y0 = IMG_BAND_START(band, nbands, height);
+  const long y1 = IMG_BAND_START(band + 1, nbands, height);
+  const long nslots = (2*r + 1 < height ? 2*r + 1 : height);
+  const long slot_size = job->nk*nwords;
+  const word_t mask = (job->pad != 0 ? ~job->pad : ONES);
+  word_t *buf, *tmp, *acc;
+  long y, next, i, dy;
+
+  buf = (word_t *)malloc((nslots*slot_size + 3*nwords)*sizeof(word_t));
+  if (buf == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  IMG_STATS_ALLOC(IMG_STATS_MORPH,
+                  (nslots*slot_size + 3*nwords)*sizeof(word_t));
+  tmp = buf + nslots*slot_size;
+  acc = tmp + 2*nwords;
+  next = (y0 > r ? y0 - r : 0);
+  for (y = y0; y < y1; ++y) {
+    long ylo = (y > r ? y - r : 0);
+    long yhi = (y + r < height ? y + r : height - 1);
+    word_t *dst = job->dst + y*job->dst_pitch;
+    for (; next <= yhi; ++next) {
+      load_row(job, next, buf + (next%nslots)*slot_size, tmp);
+    }
+    memset(acc, 0xff, nwords*sizeof(word_t));
+    for (dy = ylo - y; dy <= yhi - y; ++dy) {
+      const word_t *row = (buf + ((y + dy)%nslots)*slot_size
+                           + job->idx[dy]*nwords);
+      for (i = 0; i < nwords; ++i) {
+        acc[i] &= row[i];
+      }
+    }
+    if (job->invert) {
+      for (i = 0; i < nwords; ++i) {
+        acc[i] = ~acc[i];
+      }
+    }
+    for (i = 0; i < nwords - 1; ++i) {
+      dst[i] = acc[i];
+    }
+    dst[i] = (dst[i] & ~mask) | (acc[i] & mask);
+  }
+  free(buf);
+  return IMG_SUCCESS;
+}
+
+/* Erosion (INVERT = 0) or dilation (INVERT = 1) of a bitmap, pitches are in
+   words.  The source and the destination must be identical or not
+   overlap. */
+static int bitmap_erode(long width, long height,
+                        const word_t *src, long src_pitch,
+                        long r, const long off[], int invert,
+                        word_t *dst, long dst_pitch)
+{
+  bitmap_job_t job;
+  const word_t *src_end, *dst_end;
+  long *len, *idx, dy, nk, nbands;
+  int status;
+
+  len = (long *)malloc((3*r + 2)*sizeof(long));
+  if (len == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  idx = len + r + 1; /* IDX[-R..R] */
+  idx += r;
+
+  /* The chords are the longest at DY = 0 and shorter as |DY| increases. */
+  nk = 0;
+  for (dy = r; dy >= 0; --dy) {
+    if (nk == 0 || len[nk - 1] != off[dy]) {
+      len[nk++] = off[dy];
+    }
+    idx[dy] = idx[-dy] = nk - 1;
+  }
+
+  job.src = src;
+  job.dst = dst;
+  job.src_pitch = src_pitch;
+  job.dst_pitch = dst_pitch;
+  job.width = width;
+  job.height = height;
+  job.nwords = (width + 63)/64;
+  job.r = r;
+  job.nk = nk;
+  job.len = len;
+  job.idx = idx;
+  job.pad = ((width & 63) == 0 ? 0 : ONES << (width & 63));
+  job.invert = invert;
+  src_end = src + (height - 1)*src_pitch + job.nwords;
+  dst_end = dst + (height - 1)*dst_pitch + job.nwords;
+  if (dst < src_end && src < dst_end) {
+    /* In-place operation: a single band reads every source row before the
+       rows it overwrites. */
+    nbands = 1;
+  } else {
+    nbands = img_get_num_bands(height, (2*r + 1 > BITMAP_MIN_ROWS ?
+                                        2*r + 1 : BITMAP_MIN_ROWS));
+  }
+  status = img_parallel(nbands, bitmap_task, &job);
+  free(len);
+  return status;
+}
+
+/**
+ * @brief Morpho-math operation on a bitmap.
+ *
+ * This function applies an erosion, a dilation, an opening or a closing by
+ * the disk of radius \a r (the same structuring element as
+ * img_morph_erosion()) to a packed binary image.  Up to 64 pixels are
+ * processed at a time by bitwise operations.  The result is the same as
+ * the corresponding operation on the image converted to 0 and 1 values by
+ * img_copy().  The operation may be done in-place (\a dst = \a src with the
+ * same pitch), otherwise the bitmaps must not overlap.  The bits of the
+ * destination words after the last pixel of a row are left unchanged.
+ *
+ * @param op          The operation: \c IMG_MORPH_EROSION,
+ *                    \c IMG_MORPH_DILATION, \c IMG_MORPH_OPENING or
+ *                    \c IMG_MORPH_CLOSING.
+ * @param width       The width of the image.
+ * @param height      The height of the image.
+ * @param src         The source bitmap.
+ * @param src_pitch   The number of pixels between successive rows of
+ *                    \a src, a multiple of 64 at least equal to \a width.
+ * @param r           The radius of the structuring element.
+ * @param dst         The destination bitmap.
+ * @param dst_pitch   The number of pixels between successive rows of
+ *                    \a dst, a multiple of 64 at least equal to \a width.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ *
+ * @see img_copy(), img_morph_erosion(), img_bitmap_segmentation_new().
+ */
+int img_bitmap_morph(int op, long width, long height,
+                     const img_bitmap_word_t *src, long src_pitch,
+                     long r, img_bitmap_word_t *dst, long dst_pitch)
+{
+  word_t *tmp;
+  long *off, tmp_pitch;
+  int status, first;
+  IMG_STATS_TIMER(tic)
+
+  if (src == NULL || dst == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (width < 1 || height < 1 || r < 0 ||
+      src_pitch < width || (src_pitch & 63) != 0 ||
+      dst_pitch < width || (dst_pitch & 63) != 0 ||
+      (op != IMG_MORPH_EROSION && op != IMG_MORPH_DILATION &&
+       op != IMG_MORPH_OPENING && op != IMG_MORPH_CLOSING)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  src_pitch /= 64;
+  dst_pitch /= 64;
+  if (r == 0) {
+    if (dst != src || dst_pitch != src_pitch) {
+      return img_copy(width, height, src, IMG_TYPE_BIT, 0, 64*src_pitch,
+                      dst, IMG_TYPE_BIT, 0, 64*dst_pitch);
+    }
+    return IMG_SUCCESS;
+  }
+  IMG_STATS_START(tic);
+  off = (long *)malloc((2*r + 1)*sizeof(long));
+  if (off == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  img_morph_disk(r, off + r);
+  if (op == IMG_MORPH_EROSION || op == IMG_MORPH_DILATION) {
+    status = bitmap_erode(width, height, src, src_pitch, r, off + r,
+                          (op == IMG_MORPH_DILATION), dst, dst_pitch);
+    free(off);
+    IMG_STATS_STOP(IMG_STATS_MORPH, tic, width*height);
+    return status;
+  }
+
+  /* Opening and closing via a temporary bitmap. */
+  first = (op == IMG_MORPH_CLOSING);
+  tmp_pitch = (width + 63)/64;
+  tmp = (word_t *)malloc(tmp_pitch*height*sizeof(word_t));
+  if (tmp == NULL) {
+    free(off);
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  IMG_STATS_ALLOC(IMG_STATS_MORPH, tmp_pitch*height*sizeof(word_t));
+  status = bitmap_erode(width, height, src, src_pitch, r, off + r,
+                        first, tmp, tmp_pitch);
+  if (status == IMG_SUCCESS) {
+    status = bitmap_erode(width, height, tmp, tmp_pitch, r, off + r,
+                          ! first, dst, dst_pitch);
+  }
+  free(tmp);
+  free(off);
+  IMG_STATS_STOP(IMG_STATS_MORPH, tic, 2*width*height);
+  return status;
+}
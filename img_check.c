@@ -0,0 +1,1083 @@
+/*
+ * img_check.c --
+ *
+ * Consistency checks of the C library of YImage (built without Yorick by
+ * "make check").
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The fast code paths of the library are checked against the reference ones
+ * on the synthetic data of the benchmarks (see img_bench.h):
+ *
+ *   - the chord-based morphology, the morphology caches and the workspace
+ *     contexts against a brute force computation of the local extrema (with
+ *     NaN pixels for the floating-point types), the morphology of bitmaps
+ *     against the one of images of bytes;
+ *   - the integer filter of the spot detection against the floating-point
+ *     one;
+ *   - the tiled and streaming operations against the same operations on the
+ *     whole image;
+ *   - the flood fill, runs, tiled and bitmap segmentations against each
+ *     other;
+ *   - every result computed with one thread against the same result
+ *     computed with several threads.
+ *
+ * A digest of every result is printed on the standard output, "make check"
+ * compares the digests printed by the programs built with and without
+ * IMG_NO_SIMD.  Failures are reported on the standard error and the exit
+ * status is non-zero if any check failed.
+ *
+ * Usage: img_check [-t NTHREADS] [-v]
+ *
+ *   -t NTHREADS  number of threads of the second pass (default 4);
+ *   -v           report every check, not only the failures.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "img.h"
+#include "img_bench.h"
+
+/*---------------------------------------------------------------------------*/
+/* REPORTS AND DIGESTS */
+
+static int verbose = 0;
+static long failures = 0;
+
+/* Report the result of a check, the name of the check is formatted as by
+   printf. */
+static void report(int ok, const char *format, ...)
+{
+  va_list ap;
+
+  if (! ok) {
+    ++failures;
+  }
+  if (! ok || verbose) {
+    fprintf(stderr, "img_check: %s: ", (ok ? "ok" : "FAILED"));
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+  }
+}
+
+/* Abort on a failure of the library where a result is expected. */
+static void fatal(const char *what)
+{
+  fprintf(stderr, "img_check: %s failed: %s\n", what, strerror(errno));
+  exit(2);
+}
+
+static void *xmalloc(size_t size)
+{
+  void *ptr = malloc(size > 0 ? size : 1);
+  if (ptr == NULL) {
+    fatal("malloc");
+  }
+  return ptr;
+}
+
+/* The results of the first pass (with one thread) are printed and their
+   digests are kept to be compared with those of the second pass (with
+   several threads) which are computed in the same order. */
+#define MAX_DIGESTS 1024
+
+static uint64_t digests[MAX_DIGESTS];
+static long ndigests = 0, idigest = 0;
+static long nthreads = 1;
+static int pass = 0;
+
+/* FNV-1a hash of SIZE bytes at DATA. */
+static uint64_t hash(const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = UINT64_C(14695981039346656037);
+  size_t i;
+
+  for (i = 0; i < size; ++i) {
+    h = (h ^ p[i])*UINT64_C(1099511628211);
+  }
+  return h;
+}
+
+/* Record the digest of a result named NAME. */
+static void record(const char *name, const void *data, size_t size)
+{
+  uint64_t h = hash(data, size);
+
+  if (pass == 0) {
+    if (ndigests >= MAX_DIGESTS) {
+      fprintf(stderr, "img_check: too many results\n");
+      exit(2);
+    }
+    digests[ndigests++] = h;
+    printf("%-40s %016lx\n", name, (unsigned long)h);
+  } else {
+    report(idigest < ndigests && digests[idigest] == h,
+           "%s, 1 thread vs %ld threads", name, nthreads);
+    ++idigest;
+  }
+}
+
+/* Growable array of doubles to serialize results. */
+typedef struct _vector vector_t;
+struct _vector {
+  double *data;
+  size_t len, cap;
+};
+
+static void push(vector_t *v, double val)
+{
+  if (v->len >= v->cap) {
+    size_t cap = (v->cap > 0 ? 2*v->cap : 1024);
+    double *data = (double *)realloc(v->data, cap*sizeof(double));
+    if (data == NULL) {
+      fatal("realloc");
+    }
+    v->data = data;
+    v->cap = cap;
+  }
+  v->data[v->len++] = val;
+}
+
+static int same_vectors(const vector_t *a, const vector_t *b)
+{
+  return (a->len == b->len &&
+          memcmp(a->data, b->data, a->len*sizeof(double)) == 0);
+}
+
+static void record_vector(const char *name, const vector_t *v)
+{
+  record(name, v->data, v->len*sizeof(double));
+}
+
+/*---------------------------------------------------------------------------*/
+/* DATA */
+
+/* Default maximum value of the synthetic images of type TYPE. */
+static double type_amax(int type)
+{
+  return (type == IMG_TYPE_FLOAT || type == IMG_TYPE_DOUBLE ? 1000.0 :
+          type == IMG_TYPE_UINT16 ? 60000.0 :
+          type == IMG_TYPE_INT16 ? 30000.0 : 255.0);
+}
+
+/* Smooth random field with spots (see make_field); if NAN_PIXELS is true,
+   some isolated pixels and a small block are set to NaN. */
+static void *field_image(int type, long width, long height, double amax,
+                         int nan_pixels)
+{
+  double *val = make_field(width, height, width*height/200, amax);
+  void *img;
+  long i, x, y;
+
+  if (val == NULL) {
+    fatal("make_field");
+  }
+  if (nan_pixels) {
+    for (i = 7; i < width*height; i += 53) {
+      val[i] = NAN;
+    }
+    for (y = height/3; y < height/3 + 4 && y < height; ++y) {
+      for (x = width/2; x < width/2 + 5 && x < width; ++x) {
+        val[y*width + x] = NAN;
+      }
+    }
+  }
+  img = new_image(type, width, height, val);
+  free(val);
+  if (img == NULL) {
+    fatal("new_image");
+  }
+  return img;
+}
+
+/* Synthetic text page (see make_page); if BINARY is true, the glyphs are 1
+   and the background 0. */
+static void *page_image(long width, long height, int binary)
+{
+  double *val = make_page(width, height);
+  void *img;
+  long i;
+
+  if (val == NULL) {
+    fatal("make_page");
+  }
+  if (binary) {
+    for (i = 0; i < width*height; ++i) {
+      val[i] = (val[i] < 128.0 ? 1.0 : 0.0);
+    }
+  }
+  img = new_image(IMG_TYPE_UINT8, width, height, val);
+  free(val);
+  if (img == NULL) {
+    fatal("new_image");
+  }
+  return img;
+}
+
+/* Convert an image into doubles. */
+static double *to_double(int type, long width, long height, const void *img)
+{
+  double *val = (double *)xmalloc(width*height*sizeof(double));
+  if (img_copy(width, height, img, type, 0, width,
+               val, IMG_TYPE_DOUBLE, 0, width) != IMG_SUCCESS) {
+    fatal("img_copy");
+  }
+  return val;
+}
+
+/*---------------------------------------------------------------------------*/
+/* MORPHOLOGY */
+
+/* Brute force local minima and maxima over the disk of radius R: NaN
+   neighbors are ignored and a NaN central pixel yields NaN. */
+static void brute_lmin_lmax(const double img[], long width, long height,
+                            long r, double lmin[], double lmax[])
+{
+  long x, y, dx, dy;
+
+  for (y = 0; y < height; ++y) {
+    for (x = 0; x < width; ++x) {
+      double c = img[y*width + x], vmin = c, vmax = c;
+      if (c == c) {
+        for (dy = -r; dy <= r; ++dy) {
+          if (y + dy < 0 || y + dy >= height) {
+            continue;
+          }
+          for (dx = -r; dx <= r; ++dx) {
+            double v;
+            if (x + dx < 0 || x + dx >= width ||
+                dx*dx + dy*dy > r*(r + 1)) {
+              continue;
+            }
+            v = img[(y + dy)*width + x + dx];
+            if (v < vmin) vmin = v;
+            if (v > vmax) vmax = v;
+          }
+        }
+      }
+      lmin[y*width + x] = vmin;
+      lmax[y*width + x] = vmax;
+    }
+  }
+}
+
+/* Number of different values (NaN's are equal). */
+static long count_differences(const double a[], const double b[], long n)
+{
+  long i, count = 0;
+
+  for (i = 0; i < n; ++i) {
+    if (a[i] != b[i] && (a[i] == a[i] || b[i] == b[i])) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+static void check_morph(int type, int nan_pixels)
+{
+  static const long radii[] = {1, 2, 3, 5, 8, 13};
+  static const int ops[] = {IMG_MORPH_EROSION, IMG_MORPH_DILATION,
+                            IMG_MORPH_OPENING, IMG_MORPH_CLOSING};
+  const long width = 67, height = 53, npix = width*height;
+  const size_t size = img_get_pixel_size(type) * npix;
+  const char *tname = type_name(type);
+  const char *suffix = (nan_pixels ? "+nan" : "");
+  char name[80];
+  void *img, *lmin, *lmax, *tmp, *res;
+  double *val, *ref_min, *ref_max, *out;
+  long ws[2*13 + 1];
+  img_morph_cache_t *cache;
+  img_tile_source_t *src;
+  img_tile_sink_t *dst;
+  size_t i, k;
+
+  img = field_image(type, width, height, type_amax(type), nan_pixels);
+  val = to_double(type, width, height, img);
+  ref_min = (double *)xmalloc(npix*sizeof(double));
+  ref_max = (double *)xmalloc(npix*sizeof(double));
+  lmin = xmalloc(size);
+  lmax = xmalloc(size);
+  tmp = xmalloc(size);
+  res = xmalloc(size);
+  cache = img_morph_cache_new(type, width, height, img, width, 13,
+                              IMG_MORPH_CACHE_BOTH);
+  if (cache == NULL) {
+    fatal("img_morph_cache_new");
+  }
+  src = img_tile_source_wrap(type, width, height, img, 0, width);
+  dst = img_tile_sink_wrap(type, width, height, res, 0, width);
+  if (src == NULL || dst == NULL) {
+    fatal("img_tile_source_wrap");
+  }
+  for (i = 0; i < sizeof(radii)/sizeof(radii[0]); ++i) {
+    const long r = radii[i];
+    img_context_t *ctx;
+
+    /* Fast (or brute force for small radii) method against the brute
+       force reference. */
+    if (img_morph_lmin_lmax(type, width, height, img, width, r, ws,
+                            lmin, width, lmax, width) != IMG_SUCCESS) {
+      fatal("img_morph_lmin_lmax");
+    }
+    brute_lmin_lmax(val, width, height, r, ref_min, ref_max);
+    out = to_double(type, width, height, lmin);
+    report(count_differences(out, ref_min, npix) == 0,
+           "morph %s%s r=%ld, erosion vs brute force", tname, suffix, r);
+    free(out);
+    out = to_double(type, width, height, lmax);
+    report(count_differences(out, ref_max, npix) == 0,
+           "morph %s%s r=%ld, dilation vs brute force", tname, suffix, r);
+    free(out);
+    snprintf(name, sizeof(name), "morph_lmin %s%s r=%ld", tname, suffix, r);
+    record(name, lmin, size);
+    snprintf(name, sizeof(name), "morph_lmax %s%s r=%ld", tname, suffix, r);
+    record(name, lmax, size);
+
+    /* Cache and context. */
+    if (img_morph_cache_lmin_lmax(cache, r, tmp, width,
+                                  NULL, width) != IMG_SUCCESS) {
+      fatal("img_morph_cache_lmin_lmax");
+    }
+    report(memcmp(tmp, lmin, size) == 0,
+           "morph %s%s r=%ld, cached erosion", tname, suffix, r);
+    if (img_morph_cache_lmin_lmax(cache, r, NULL, width,
+                                  tmp, width) != IMG_SUCCESS) {
+      fatal("img_morph_cache_lmin_lmax");
+    }
+    report(memcmp(tmp, lmax, size) == 0,
+           "morph %s%s r=%ld, cached dilation", tname, suffix, r);
+    ctx = img_context_new(type, width, height, r);
+    if (ctx == NULL ||
+        img_context_morph_lmin_lmax(ctx, img, width, tmp, width,
+                                    NULL, width) != IMG_SUCCESS) {
+      fatal("img_context_morph_lmin_lmax");
+    }
+    img_context_destroy(ctx);
+    report(memcmp(tmp, lmin, size) == 0,
+           "morph %s%s r=%ld, erosion with a context", tname, suffix, r);
+
+    /* Tiled operations against the whole image. */
+    for (k = 0; k < sizeof(ops)/sizeof(ops[0]); ++k) {
+      int status;
+      switch (ops[k]) {
+      case IMG_MORPH_EROSION:
+        memcpy(tmp, lmin, size);
+        status = IMG_SUCCESS;
+        break;
+      case IMG_MORPH_DILATION:
+        memcpy(tmp, lmax, size);
+        status = IMG_SUCCESS;
+        break;
+      case IMG_MORPH_OPENING:
+        status = img_morph_opening(type, width, height, img, width, r,
+                                   tmp, width);
+        break;
+      default:
+        status = img_morph_closing(type, width, height, img, width, r,
+                                   tmp, width);
+      }
+      if (status != IMG_SUCCESS ||
+          img_tile_morph(ops[k], src, r, 23, 17, dst) != IMG_SUCCESS) {
+        fatal("img_tile_morph");
+      }
+      report(memcmp(tmp, res, size) == 0,
+             "morph %s%s r=%ld op=%d, tiles vs whole image",
+             tname, suffix, r, ops[k]);
+      if (ops[k] >= IMG_MORPH_OPENING) {
+        snprintf(name, sizeof(name), "morph_op%d %s%s r=%ld",
+                 ops[k], tname, suffix, r);
+        record(name, tmp, size);
+      }
+    }
+  }
+  img_tile_source_destroy(src);
+  img_tile_sink_destroy(dst);
+  img_morph_cache_destroy(cache);
+  free(img);
+  free(val);
+  free(ref_min);
+  free(ref_max);
+  free(lmin);
+  free(lmax);
+  free(tmp);
+  free(res);
+}
+
+/* Morphology of bitmaps against the one of images of bytes. */
+static void check_bitmap_morph(void)
+{
+  static const long radii[] = {1, 3, 8, 21};
+  static const int ops[] = {IMG_MORPH_EROSION, IMG_MORPH_DILATION,
+                            IMG_MORPH_OPENING, IMG_MORPH_CLOSING};
+  const long width = 203, height = 151, npix = width*height;
+  const long pitch = IMG_BITMAP_PITCH(width);
+  const size_t nbytes = (pitch/8)*height;
+  unsigned char *img, *ref, *out;
+  img_bitmap_word_t *bits, *res;
+  char name[80];
+  long ws[2*21 + 1];
+  size_t i, k;
+
+  img = (unsigned char *)page_image(width, height, 1);
+  ref = (unsigned char *)xmalloc(npix);
+  out = (unsigned char *)xmalloc(npix);
+  bits = (img_bitmap_word_t *)xmalloc(nbytes);
+  res = (img_bitmap_word_t *)xmalloc(nbytes);
+  if (img_copy(width, height, img, IMG_TYPE_UINT8, 0, width,
+               bits, IMG_TYPE_BIT, 0, pitch) != IMG_SUCCESS) {
+    fatal("img_copy");
+  }
+  for (i = 0; i < sizeof(radii)/sizeof(radii[0]); ++i) {
+    const long r = radii[i];
+    for (k = 0; k < sizeof(ops)/sizeof(ops[0]); ++k) {
+      int status;
+      switch (ops[k]) {
+      case IMG_MORPH_EROSION:
+        status = img_morph_erosion(IMG_TYPE_UINT8, width, height, img,
+                                   width, r, ws, ref, width);
+        break;
+      case IMG_MORPH_DILATION:
+        status = img_morph_dilation(IMG_TYPE_UINT8, width, height, img,
+                                    width, r, ws, ref, width);
+        break;
+      case IMG_MORPH_OPENING:
+        status = img_morph_opening(IMG_TYPE_UINT8, width, height, img,
+                                   width, r, ref, width);
+        break;
+      default:
+        status = img_morph_closing(IMG_TYPE_UINT8, width, height, img,
+                                   width, r, ref, width);
+      }
+      if (status != IMG_SUCCESS ||
+          img_bitmap_morph(ops[k], width, height, bits, pitch, r,
+                           res, pitch) != IMG_SUCCESS ||
+          img_copy(width, height, res, IMG_TYPE_BIT, 0, pitch,
+                   out, IMG_TYPE_UINT8, 0, width) != IMG_SUCCESS) {
+        fatal("img_bitmap_morph");
+      }
+      report(memcmp(out, ref, npix) == 0,
+             "bitmap morph r=%ld op=%d, bitmap vs bytes", r, ops[k]);
+      snprintf(name, sizeof(name), "bitmap_morph r=%ld op=%d", r, ops[k]);
+      record(name, out, npix);
+    }
+  }
+  free(img);
+  free(ref);
+  free(out);
+  free(bits);
+  free(res);
+}
+
+/*---------------------------------------------------------------------------*/
+/* SPOT DETECTION */
+
+/* Detect the spots of an image as a whole (the result is in MASK) and by
+   bands with the streaming detector, check that they are the same and
+   return the number of spots. */
+static long detect(const char *what, int type, long width, long height,
+                   const void *img, const double c[3], const double t[3],
+                   int mask[])
+{
+  static const long bands[] = {1, 2, 5, 1000};
+  double *ws = (double *)xmalloc(3*width*sizeof(double));
+  img_tile_source_t *src;
+  long count, i, j, n;
+  int ok;
+
+  if (img_detect_spot(img, type, width, height, c[0], c[1], c[2],
+                      t[0], t[1], t[2], mask, &count, ws) != IMG_SUCCESS) {
+    fatal("img_detect_spot");
+  }
+  free(ws);
+  src = img_tile_source_wrap(type, width, height, img, 0, width);
+  if (src == NULL) {
+    fatal("img_tile_source_wrap");
+  }
+  for (j = 0; j < (long)(sizeof(bands)/sizeof(bands[0])); ++j) {
+    img_spot_detector_t *det;
+    const img_spot_t *spot;
+    det = img_tile_detect_spots(src, c[0], c[1], c[2], t[0], t[1], t[2],
+                                bands[j]);
+    if (det == NULL) {
+      fatal("img_tile_detect_spots");
+    }
+    spot = img_spot_detector_get_spots(det, &n);
+    ok = (n == count);
+    for (i = 0; ok && i < n; ++i) {
+      ok = (spot[i].x >= 0 && spot[i].x < width &&
+            spot[i].y >= 0 && spot[i].y < height &&
+            mask[spot[i].y*width + spot[i].x] != 0);
+    }
+    report(ok, "detect %s, bands of %ld rows vs whole image (%ld spots)",
+           what, bands[j], count);
+    img_spot_detector_destroy(det);
+  }
+  img_tile_source_destroy(src);
+  return count;
+}
+
+static void check_detect(void)
+{
+  const long width = 211, height = 97, npix = width*height;
+  static const double c_float[3] = {1.0, 0.5, 0.25};
+  static const double c_int[3] = {4.0, 2.0, 1.0};
+  static const double t_uint8[3] = {60.0, 3.0, 1.0};
+  static const double t_uint16[3] = {6000.0, 300.0, 100.0};
+  static const double t_float[3] = {100.0, 5.0, 2.0};
+  static const double t_int8[3] = {700.5, 10.0, 5.25};
+  static const double t_int16[3] = {150000.5, 1000.0, 300.25};
+  static const double c_large[3] = {1001.0, 3.0, 1.0};
+  static const double t_large[3] = {0.0, 0.5, 0.25};
+  int *mask = (int *)xmalloc(npix*sizeof(int));
+  int *ref = (int *)xmalloc(npix*sizeof(int));
+  void *img, *flt;
+  long i, n;
+
+  /* Floating-point filter for all types. */
+  img = field_image(IMG_TYPE_UINT8, width, height, 255.0, 0);
+  detect("uint8", IMG_TYPE_UINT8, width, height, img, c_float, t_uint8, mask);
+  record("detect_spot uint8", mask, npix*sizeof(int));
+
+  /* Integer filter against the floating-point one (the values of the
+     filter are exact in single precision). */
+  flt = xmalloc(npix*sizeof(float));
+  if (img_copy(width, height, img, IMG_TYPE_UINT8, 0, width,
+               flt, IMG_TYPE_FLOAT, 0, width) != IMG_SUCCESS) {
+    fatal("img_copy");
+  }
+  n = detect("uint8 (integer filter)", IMG_TYPE_UINT8, width, height, img,
+             c_int, t_int8, mask);
+  detect("uint8 as float", IMG_TYPE_FLOAT, width, height, flt, c_int,
+         t_int8, ref);
+  report(n > 0 && memcmp(mask, ref, npix*sizeof(int)) == 0,
+         "detect uint8, integer vs floating-point filter");
+  record("detect_spot uint8 (integer filter)", mask, npix*sizeof(int));
+  free(img);
+
+  img = field_image(IMG_TYPE_UINT16, width, height, 60000.0, 0);
+  detect("uint16", IMG_TYPE_UINT16, width, height, img, c_float, t_uint16,
+         mask);
+  record("detect_spot uint16", mask, npix*sizeof(int));
+  if (img_copy(width, height, img, IMG_TYPE_UINT16, 0, width,
+               flt, IMG_TYPE_FLOAT, 0, width) != IMG_SUCCESS) {
+    fatal("img_copy");
+  }
+  n = detect("uint16 (integer filter)", IMG_TYPE_UINT16, width, height, img,
+             c_int, t_int16, mask);
+  detect("uint16 as float", IMG_TYPE_FLOAT, width, height, flt, c_int,
+         t_int16, ref);
+  report(n > 0 && memcmp(mask, ref, npix*sizeof(int)) == 0,
+         "detect uint16, integer vs floating-point filter");
+  record("detect_spot uint16 (integer filter)", mask, npix*sizeof(int));
+
+  /* Filtered values beyond 2^24 which differ by less than the precision of
+     a float, only the integer filter is exact (the streaming detector must
+     use it too). */
+  for (i = 0; i < npix; ++i) {
+    ((uint16_t *)img)[i] = (uint16_t)(uniform() < 0.5 ? 65000 : 65001);
+  }
+  n = detect("uint16 (large integer filter)", IMG_TYPE_UINT16, width, height,
+             img, c_large, t_large, mask);
+  report(n > 0, "detect uint16, spots with a large integer filter");
+  record("detect_spot uint16 (large integer filter)", mask,
+         npix*sizeof(int));
+  free(img);
+  free(flt);
+
+  img = field_image(IMG_TYPE_FLOAT, width, height, 1000.0, 0);
+  detect("float", IMG_TYPE_FLOAT, width, height, img, c_float, t_float,
+         mask);
+  record("detect_spot float", mask, npix*sizeof(int));
+  free(img);
+
+  /* NaN pixels (the vectorized code must yield the same spots as the scalar
+     one). */
+  img = field_image(IMG_TYPE_FLOAT, width, height, 1000.0, 1);
+  detect("float with NaN", IMG_TYPE_FLOAT, width, height, img, c_float,
+         t_float, mask);
+  record("detect_spot float with NaN", mask, npix*sizeof(int));
+  free(img);
+  free(mask);
+  free(ref);
+}
+
+/*---------------------------------------------------------------------------*/
+/* SEGMENTATION */
+
+typedef struct _point point_t;
+struct _point {
+  long x, y, link;
+};
+
+static int compare_points(const void *a, const void *b)
+{
+  const point_t *p = (const point_t *)a, *q = (const point_t *)b;
+  if (p->y != q->y) {
+    return (p->y < q->y ? -1 : 1);
+  }
+  return (p->x < q->x ? -1 : (p->x > q->x ? 1 : 0));
+}
+
+/* Serialize a segmentation (which is unlinked), the pixels of every segment
+   are sorted in raster order if SORT is true. */
+static void serialize_segmentation(vector_t *v, img_segmentation_t *sgm,
+                                   int sort)
+{
+  long i, j, n, count, *x, *y, *link;
+  point_t *p;
+
+  if (sgm == NULL) {
+    fatal("segmentation");
+  }
+  v->len = 0;
+  n = img_segmentation_get_number(sgm);
+  push(v, n);
+  for (j = 0; j < n; ++j) {
+    count = img_segmentation_get_count(sgm, j);
+    push(v, count);
+    push(v, img_segmentation_get_xmin(sgm, j));
+    push(v, img_segmentation_get_xmax(sgm, j));
+    push(v, img_segmentation_get_ymin(sgm, j));
+    push(v, img_segmentation_get_ymax(sgm, j));
+    push(v, img_segmentation_get_flux(sgm, j));
+    push(v, img_segmentation_get_xbar(sgm, j));
+    push(v, img_segmentation_get_ybar(sgm, j));
+    push(v, img_segmentation_get_mxx(sgm, j));
+    push(v, img_segmentation_get_mxy(sgm, j));
+    push(v, img_segmentation_get_myy(sgm, j));
+    push(v, img_segmentation_get_xcen(sgm, j));
+    push(v, img_segmentation_get_ycen(sgm, j));
+    x = (long *)xmalloc(3*count*sizeof(long));
+    y = x + count;
+    link = y + count;
+    p = (point_t *)xmalloc(count*sizeof(point_t));
+    if (img_segmentation_get_x(sgm, j, x, count) != IMG_SUCCESS ||
+        img_segmentation_get_y(sgm, j, y, count) != IMG_SUCCESS ||
+        img_segmentation_get_link(sgm, j, link, count) != IMG_SUCCESS) {
+      fatal("img_segmentation_get_x");
+    }
+    for (i = 0; i < count; ++i) {
+      p[i].x = x[i];
+      p[i].y = y[i];
+      p[i].link = link[i];
+    }
+    if (sort) {
+      qsort(p, count, sizeof(point_t), compare_points);
+    }
+    for (i = 0; i < count; ++i) {
+      push(v, p[i].x);
+      push(v, p[i].y);
+      push(v, p[i].link);
+    }
+    free(x);
+    free(p);
+  }
+}
+
+/* Serialize the chains of segments of a segmentation. */
+static void serialize_chains(vector_t *v, img_segmentation_t *sgm)
+{
+  img_chainpool_t *chn;
+  long i, j, n, len, *list;
+
+  errno = 0;
+  chn = img_chainpool_new(sgm, 2.0, 0.05, 0.4, 2.5, 0.3, 2.0, 0.05, 0.05,
+                          3, 10);
+  v->len = 0;
+  if (chn == NULL) {
+    /* No chains at all is not an error (errno is left unchanged). */
+    if (errno != 0) {
+      fatal("img_chainpool_new");
+    }
+    push(v, 0);
+    return;
+  }
+  n = img_chainpool_get_number(chn);
+  push(v, n);
+  for (j = 0; j < n; ++j) {
+    len = img_chainpool_get_length(chn, j);
+    push(v, len);
+    push(v, img_chainpool_get_xmin(chn, j));
+    push(v, img_chainpool_get_xmax(chn, j));
+    push(v, img_chainpool_get_ymin(chn, j));
+    push(v, img_chainpool_get_ymax(chn, j));
+    push(v, img_chainpool_get_vertical_shear(chn, j));
+    push(v, img_chainpool_get_horizontal_shear(chn, j));
+    list = (long *)xmalloc(len*sizeof(long));
+    if (img_chainpool_get_segments(chn, j, list, len) != IMG_SUCCESS) {
+      fatal("img_chainpool_get_segments");
+    }
+    for (i = 0; i < len; ++i) {
+      push(v, list[i]);
+    }
+    free(list);
+  }
+  img_chainpool_destroy(chn);
+}
+
+/* New segmentation with a reference (see img_segmentation_link). */
+static img_segmentation_t *segment(const void *img, long width, long height,
+                                   double threshold, int method)
+{
+  return img_segmentation_link(
+      img_segmentation_new_with_method(img, IMG_TYPE_UINT8, 0, width, height,
+                                       width, threshold, method));
+}
+
+static void check_segment_image(const char *what, const unsigned char img[],
+                                long width, long height, double threshold,
+                                int binary)
+{
+  static const long bands[] = {1, 4, 1000};
+  vector_t runs = {NULL, 0, 0}, other = {NULL, 0, 0}, sorted = {NULL, 0, 0};
+  img_segmentation_t *sgm;
+  img_tile_source_t *src;
+  char name[80];
+  size_t k;
+
+  sgm = segment(img, width, height, threshold, IMG_SEGMENTATION_RUNS);
+  serialize_segmentation(&runs, sgm, 0);
+  serialize_segmentation(&sorted, sgm, 1);
+  snprintf(name, sizeof(name), "segmentation %s", what);
+  record_vector(name, &runs);
+  serialize_chains(&other, sgm);
+  snprintf(name, sizeof(name), "chainpool %s", what);
+  record_vector(name, &other);
+  img_segmentation_unlink(sgm);
+
+  /* The flood fill yields the same segments with the pixels in another
+     order. */
+  sgm = segment(img, width, height, threshold, IMG_SEGMENTATION_FLOOD_FILL);
+  serialize_segmentation(&other, sgm, 1);
+  img_segmentation_unlink(sgm);
+  report(same_vectors(&other, &sorted),
+         "segmentation %s, flood fill vs runs", what);
+
+  /* The tiled segmentation yields the same result as the runs. */
+  src = img_tile_source_wrap(IMG_TYPE_UINT8, width, height, img, 0, width);
+  if (src == NULL) {
+    fatal("img_tile_source_wrap");
+  }
+  for (k = 0; k < sizeof(bands)/sizeof(bands[0]); ++k) {
+    sgm = img_segmentation_link(img_tile_segmentation_new(src, threshold,
+                                                          bands[k]));
+    serialize_segmentation(&other, sgm, 0);
+    img_segmentation_unlink(sgm);
+    report(same_vectors(&other, &runs),
+           "segmentation %s, bands of %ld rows vs runs", what, bands[k]);
+  }
+  img_tile_source_destroy(src);
+
+  /* So does the segmentation of the bitmap of a binary image. */
+  if (binary) {
+    const long pitch = IMG_BITMAP_PITCH(width);
+    img_bitmap_word_t *bits = (img_bitmap_word_t *)xmalloc((pitch/8)*height);
+    if (img_copy(width, height, img, IMG_TYPE_UINT8, 0, width,
+                 bits, IMG_TYPE_BIT, 0, pitch) != IMG_SUCCESS) {
+      fatal("img_copy");
+    }
+    sgm = img_segmentation_link(img_bitmap_segmentation_new(bits, width,
+                                                            height, pitch));
+    serialize_segmentation(&other, sgm, 0);
+    img_segmentation_unlink(sgm);
+    free(bits);
+    report(same_vectors(&other, &runs),
+           "segmentation %s, bitmap vs runs", what);
+  }
+  free(runs.data);
+  free(other.data);
+  free(sorted.data);
+}
+
+static void check_segmentation(void)
+{
+  const long width = 400, height = 300;
+  unsigned char *img;
+  long i;
+
+  img = (unsigned char *)page_image(width, height, 0);
+  check_segment_image("page", img, width, height, 20.0, 0);
+  free(img);
+  img = (unsigned char *)page_image(width, height, 1);
+  check_segment_image("binary page", img, width, height, 0.5, 1);
+  free(img);
+
+  /* Random pixels with few levels give many small segments of any shape
+     (including in the first and last columns). */
+  img = (unsigned char *)xmalloc(61*47);
+  for (i = 0; i < 61*47; ++i) {
+    img[i] = (unsigned char)(4*uniform());
+  }
+  check_segment_image("random", img, 61, 47, 1.0, 0);
+  for (i = 0; i < 61*47; ++i) {
+    img[i] = (uniform() < 0.5);
+  }
+  check_segment_image("random binary", img, 61, 47, 0.5, 1);
+  free(img);
+}
+
+/*---------------------------------------------------------------------------*/
+/* OTHER OPERATIONS */
+
+static void check_extract(void)
+{
+  static const int interps[] = {IMG_INTERP_LINEAR, IMG_INTERP_CUBIC,
+                                IMG_INTERP_LANCZOS3};
+  const long width = 131, height = 97, npix = width*height;
+  const double q = 15.0*M_PI/180.0, cs = cos(q), sn = sin(q);
+  const double xc = 0.5*(width - 1), yc = 0.5*(height - 1);
+  const double shift[6] = {0.375, 1.0, 0.0, 0.625, 0.0, 1.0};
+  double rotate[6];
+  float *img, *out, *res;
+  img_tile_source_t *src;
+  img_tile_sink_t *dst;
+  char name[80];
+  size_t k;
+
+  rotate[1] =  cs; rotate[2] = -sn; rotate[0] = xc - cs*xc + sn*yc;
+  rotate[4] =  sn; rotate[5] =  cs; rotate[3] = yc - sn*xc - cs*yc;
+  img = (float *)field_image(IMG_TYPE_FLOAT, width, height, 1000.0, 0);
+  out = (float *)xmalloc(npix*sizeof(float));
+  res = (float *)xmalloc(npix*sizeof(float));
+  src = img_tile_source_wrap(IMG_TYPE_FLOAT, width, height, img, 0, width);
+  dst = img_tile_sink_wrap(IMG_TYPE_FLOAT, width, height, res, 0, width);
+  if (src == NULL || dst == NULL) {
+    fatal("img_tile_source_wrap");
+  }
+  for (k = 0; k < sizeof(interps)/sizeof(interps[0]); ++k) {
+    /* The coordinates of a shift by a fraction of a power of two are exact
+       for the tiles as for the whole image. */
+    if (img_extract_rectangle_with_interp(img, IMG_TYPE_FLOAT, 0, width,
+                                          height, width, out,
+                                          IMG_TYPE_FLOAT, 0, width, height,
+                                          width, shift, 1,
+                                          interps[k]) != IMG_SUCCESS ||
+        img_tile_extract_rectangle(src, dst, shift, 1, interps[k],
+                                   32, 24) != IMG_SUCCESS) {
+      fatal("img_extract_rectangle_with_interp");
+    }
+    report(memcmp(out, res, npix*sizeof(float)) == 0,
+           "extract shift interp=%d, tiles vs whole image", interps[k]);
+    snprintf(name, sizeof(name), "extract_shift interp=%d", interps[k]);
+    record(name, out, npix*sizeof(float));
+    if (img_extract_rectangle_with_interp(img, IMG_TYPE_FLOAT, 0, width,
+                                          height, width, out,
+                                          IMG_TYPE_FLOAT, 0, width, height,
+                                          width, rotate, 1,
+                                          interps[k]) != IMG_SUCCESS) {
+      fatal("img_extract_rectangle_with_interp");
+    }
+    snprintf(name, sizeof(name), "extract_rotate interp=%d", interps[k]);
+    record(name, out, npix*sizeof(float));
+  }
+  img_tile_source_destroy(src);
+  img_tile_sink_destroy(dst);
+  free(img);
+  free(out);
+  free(res);
+}
+
+static void check_noise(void)
+{
+  static const int methods[] = {IMG_NOISE_RMS, IMG_NOISE_MAD,
+                                IMG_NOISE_CLIPPED_RMS};
+  const long width = 150, height = 110, tw = 32, th = 16;
+  const long nmap = ((width + tw - 1)/tw)*((height + th - 1)/th);
+  double *map = (double *)xmalloc(nmap*sizeof(double));
+  double *res = (double *)xmalloc(nmap*sizeof(double));
+  img_tile_source_t *src;
+  char name[80];
+  void *img;
+  size_t k;
+
+  img = field_image(IMG_TYPE_UINT16, width, height, 60000.0, 0);
+  src = img_tile_source_wrap(IMG_TYPE_UINT16, width, height, img, 0, width);
+  if (src == NULL) {
+    fatal("img_tile_source_wrap");
+  }
+  for (k = 0; k < sizeof(methods)/sizeof(methods[0]); ++k) {
+    if (img_estimate_noise_map(IMG_TYPE_UINT16, img, 0, width, height, width,
+                               tw, th, methods[k], map) != IMG_SUCCESS ||
+        img_tile_estimate_noise_map(src, tw, th, methods[k],
+                                    res) != IMG_SUCCESS) {
+      fatal("img_estimate_noise_map");
+    }
+    report(memcmp(map, res, nmap*sizeof(double)) == 0,
+           "noise map method=%d, bands vs whole image", methods[k]);
+    snprintf(name, sizeof(name), "noise_map method=%d", methods[k]);
+    record(name, map, nmap*sizeof(double));
+  }
+  img_tile_source_destroy(src);
+  free(img);
+  free(map);
+  free(res);
+}
+
+static void check_cost(void)
+{
+  const long width = 120, height = 90, rw = 24, shift = 6;
+  const long nmap = (2*shift + 1)*(2*shift + 1);
+  double *map = (double *)xmalloc(nmap*sizeof(double));
+  double cost;
+  float *img, *ref;
+
+  img = (float *)field_image(IMG_TYPE_FLOAT, width, height, 1000.0, 0);
+  ref = (float *)xmalloc(rw*rw*sizeof(float));
+  if (img_copy(rw, rw, img, IMG_TYPE_FLOAT, (height/2 + 1)*width + width/2 + 1,
+               width, ref, IMG_TYPE_FLOAT, 0, rw) != IMG_SUCCESS ||
+      img_cost_l2_map(IMG_TYPE_FLOAT, img, 0, width, height, width,
+                      ref, 0, rw, rw, rw, width/2 - shift, width/2 + shift,
+                      height/2 - shift, height/2 + shift, 0.0, 1.0,
+                      map) != IMG_SUCCESS) {
+    fatal("img_cost_l2_map");
+  }
+  record("cost_l2_map", map, nmap*sizeof(double));
+  cost = img_cost_l2(IMG_TYPE_FLOAT, img, 0, width, height, width,
+                     ref, 0, rw, rw, rw, width/2, height/2, 0.0, 1.0);
+  if (cost < 0.0) {
+    fatal("img_cost_l2");
+  }
+  record("cost_l2", &cost, sizeof(cost));
+  free(img);
+  free(ref);
+  free(map);
+}
+
+static void check_copy(void)
+{
+  static const int conv[][2] = {
+    {IMG_TYPE_UINT8,  IMG_TYPE_FLOAT},
+    {IMG_TYPE_UINT16, IMG_TYPE_FLOAT},
+    {IMG_TYPE_FLOAT,  IMG_TYPE_UINT8},
+    {IMG_TYPE_DOUBLE, IMG_TYPE_FLOAT},
+    {IMG_TYPE_FLOAT,  IMG_TYPE_DOUBLE},
+    {IMG_TYPE_RGB,    IMG_TYPE_UINT8},
+    {IMG_TYPE_RGB,    IMG_TYPE_FLOAT},
+    {IMG_TYPE_RGB,    IMG_TYPE_DOUBLE},
+    {IMG_TYPE_RGBA,   IMG_TYPE_UINT8},
+    {IMG_TYPE_RGBA,   IMG_TYPE_FLOAT},
+    {IMG_TYPE_RGBA,   IMG_TYPE_DOUBLE}
+  };
+  const long width = 173, height = 61;
+  char name[80];
+  size_t k;
+
+  for (k = 0; k < sizeof(conv)/sizeof(conv[0]); ++k) {
+    const int stype = conv[k][0], dtype = conv[k][1];
+    const size_t size = img_get_pixel_size(dtype)*width*height;
+    void *src, *dst = xmalloc(size);
+    if (stype == IMG_TYPE_RGB || stype == IMG_TYPE_RGBA) {
+      /* The samples of the colored pixels are stored as bytes. */
+      src = field_image(IMG_TYPE_UINT8, (stype == IMG_TYPE_RGB ? 3 : 4)*width,
+                        height, 255.0, 0);
+    } else {
+      src = field_image(stype, width, height, (stype == IMG_TYPE_FLOAT ?
+                                               300.0 : type_amax(stype)), 0);
+    }
+    if (img_copy(width, height, src, stype, 0, width,
+                 dst, dtype, 0, width) != IMG_SUCCESS) {
+      fatal("img_copy");
+    }
+    snprintf(name, sizeof(name), "copy %s to %s", type_name(stype),
+             type_name(dtype));
+    record(name, dst, size);
+    free(src);
+    free(dst);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* MAIN PROGRAM */
+
+/* The data of each group of checks does not depend on the other groups. */
+static void run_checks(void)
+{
+  seed = 12345UL;
+  check_morph(IMG_TYPE_UINT8, 0);
+  check_morph(IMG_TYPE_INT16, 0);
+  check_morph(IMG_TYPE_FLOAT, 0);
+  check_morph(IMG_TYPE_FLOAT, 1);
+  check_morph(IMG_TYPE_DOUBLE, 1);
+  check_bitmap_morph();
+  seed = 23456UL;
+  check_detect();
+  seed = 34567UL;
+  check_segmentation();
+  seed = 45678UL;
+  check_extract();
+  check_noise();
+  check_cost();
+  check_copy();
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: img_check [-t NTHREADS] [-v]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  nthreads = 4;
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      nthreads = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = 1;
+    } else {
+      usage();
+    }
+  }
+  if (img_set_num_threads(1) != IMG_SUCCESS) {
+    fatal("img_set_num_threads");
+  }
+  pass = 0;
+  run_checks();
+  if (nthreads > 1) {
+    if (img_set_num_threads(nthreads) == IMG_SUCCESS) {
+      pass = 1;
+      idigest = 0;
+      run_checks();
+      report(idigest == ndigests, "number of results with %ld threads",
+             nthreads);
+    } else {
+      fprintf(stderr, "img_check: cannot use %ld threads (%s), "
+              "multi-threading not checked\n", nthreads, strerror(errno));
+    }
+  }
+  if (failures > 0) {
+    fprintf(stderr, "img_check: %ld check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
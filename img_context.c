@@ -0,0 +1,187 @@
+/*
+ * img_context.c --
+ *
+ * Reusable workspace contexts for repeated operations on images of the same
+ * size.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "img.h"
+#include "img_context.h"
+#include "img_stats.h"
+
+/**
+ * @brief Create a workspace context.
+ *
+ * A context keeps the scratch memory of the operations applied to a
+ * sequence of images of the same type and dimensions (for instance the
+ * frames of a video) and the tables which only depend on the geometry (the
+ * chords of the structuring element of radius \a r).  The scratch buffers
+ * are allocated by the first call of an operation and reused by the next
+ * ones, so that processing a new image with the same operations does not
+ * allocate memory (except for the result of the segmentation).
+ *
+ * A context must not be used by several threads at the same time; the
+ * operations may however be split between the threads of the library (see
+ * img_set_num_threads()).
+ *
+ * @param type    The pixel type of the images.
+ * @param width   The width of the images.
+ * @param height  The height of the images.
+ * @param r       The radius of the structuring element for morpho-math
+ *                operations, must be non-negative.
+ *
+ * @return A new context or \c NULL on error with \c errno set.
+ *
+ * @see img_context_destroy(), img_context_morph(),
+ *      img_context_morph_lmin_lmax(), img_context_detect_spot(),
+ *      img_context_segmentation_new().
+ */
+img_context_t *img_context_new(int type, long width, long height, long r)
+{
+  img_context_t *ctx;
+  long *off;
+
+  if (img_get_pixel_size(type) == 0 || width < 1 || height < 1 || r < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  ctx = (img_context_t *)malloc(sizeof(img_context_t));
+  if (ctx == NULL) {
+    return NULL;
+  }
+  off = (long *)malloc((2*r + 1)*sizeof(long));
+  if (off == NULL) {
+    free(ctx);
+    return NULL;
+  }
+  ctx->off = off + r;
+  img_morph_disk(r, ctx->off);
+  ctx->buf = NULL;
+  ctx->len = NULL;
+  ctx->nbufs = 0;
+  ctx->width = width;
+  ctx->height = height;
+  ctx->r = r;
+  ctx->type = type;
+  IMG_CONTEXT_SET_PHASE(ctx, IMG_STATS_MORPH);
+  return ctx;
+}
+
+/**
+ * @brief Destroy a workspace context.
+ *
+ * @param ctx  The context to destroy (may be \c NULL).
+ */
+void img_context_destroy(img_context_t *ctx)
+{
+  long k;
+
+  if (ctx != NULL) {
+    for (k = 0; k < ctx->nbufs; ++k) {
+      if (ctx->buf[k] != NULL) {
+        free(ctx->buf[k]);
+      }
+    }
+    if (ctx->buf != NULL) {
+      free(ctx->buf);
+    }
+    if (ctx->len != NULL) {
+      free(ctx->len);
+    }
+    free(ctx->off - ctx->r);
+    free(ctx);
+  }
+}
+
+int img_context_get_type(const img_context_t *ctx)
+{
+  return (ctx != NULL ? ctx->type : -1);
+}
+
+long img_context_get_width(const img_context_t *ctx)
+{
+  return (ctx != NULL ? ctx->width : -1L);
+}
+
+long img_context_get_height(const img_context_t *ctx)
+{
+  return (ctx != NULL ? ctx->height : -1L);
+}
+
+long img_context_get_radius(const img_context_t *ctx)
+{
+  return (ctx != NULL ? ctx->r : -1L);
+}
+
+/*
+ * Get the address of the K-th scratch buffer of context CTX with at least
+ * SIZE bytes.  The buffer is allocated or enlarged if needed, its contents
+ * is not preserved.  This function may change CTX->BUF and must therefore be
+ * called by the calling thread before splitting the work between threads.
+ * Returns NULL with errno set on error.
+ */
+void *img_context_buffer(img_context_t *ctx, long k, size_t size)
+{
+  if (k >= ctx->nbufs) {
+    long j, n = (k >= 2*ctx->nbufs ? k + 1 : 2*ctx->nbufs);
+    void **buf = (void **)realloc(ctx->buf, n*sizeof(void *));
+    size_t *len;
+    if (buf == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    ctx->buf = buf;
+    len = (size_t *)realloc(ctx->len, n*sizeof(size_t));
+    if (len == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    ctx->len = len;
+    for (j = ctx->nbufs; j < n; ++j) {
+      ctx->buf[j] = NULL;
+      ctx->len[j] = 0;
+    }
+    ctx->nbufs = n;
+  }
+  if (size < 1) {
+    size = 1;
+  }
+  if (ctx->len[k] < size) {
+    /* The contents need not be preserved, so avoid realloc which would copy
+       it. */
+    if (ctx->buf[k] != NULL) {
+      free(ctx->buf[k]);
+    }
+    ctx->len[k] = 0;
+    ctx->buf[k] = malloc(size);
+    if (ctx->buf[k] == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    ctx->len[k] = size;
+    IMG_STATS_ALLOC(ctx->phase, size);
+  }
+  return ctx->buf[k];
+}
@@ -0,0 +1,72 @@
+/*
+ * img_context.h --
+ *
+ * Private definitions for the reusable workspace contexts.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IMG_CONTEXT_H
+#define _IMG_CONTEXT_H 1
+
+#include <stddef.h>
+#include "img.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * A context stores the geometry of the images it is used with, the
+ * half-lengths of the chords of the disk of radius R (OFF[-R] to OFF[R]) and
+ * a list of scratch buffers which only grow.  The buffers are used by the
+ * operations as they see fit: the same buffer may be used by different
+ * operations, they must not expect to find their contents again.
+ */
+struct _img_context {
+  long *off;          /* half-lengths of chords, OFF[-R] to OFF[R] */
+  void **buf;         /* scratch buffers */
+  size_t *len;        /* sizes (in bytes) of the scratch buffers */
+  long nbufs;         /* number of scratch buffers */
+  long width, height; /* dimensions of the images */
+  long r;             /* radius of the structuring element */
+  int type;           /* pixel type of the images */
+#ifdef IMG_USE_STATS
+  int phase;          /* phase charged for the allocation of buffers */
+#endif
+};
+
+/* Set the phase charged for the buffers allocated by the next operation with
+   context CTX (see img_stats.h). */
+#ifdef IMG_USE_STATS
+# define IMG_CONTEXT_SET_PHASE(ctx, p)  ((ctx)->phase = (p))
+#else
+# define IMG_CONTEXT_SET_PHASE(ctx, p)  ((void)0)
+#endif
+
+/* Private functions. */
+extern void *img_context_buffer(img_context_t *ctx, long k, size_t size);
+extern void img_morph_disk(long r, long off[]);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _IMG_CONTEXT_H */
@@ -26,20 +26,598 @@
 #ifndef _IMG_COPY_C
 #define _IMG_COPY_C 1
 
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <math.h>
 
 #include "img.h"
+#include "img_thread.h"
+
+#ifdef IMG_USE_PTHREADS
+# include <pthread.h>
+#endif
 
 /* Definitions of macros. */
 #ifndef NULL
 # define NULL ((void *)0)
 #endif
 #define COPY(src,dst) CPT_JOIN5(copy, _, CPT_ABBREV(src), _, CPT_ABBREV(dst))
+#define PACK(src)     CPT_JOIN3(pack, _, CPT_ABBREV(src))
+#define UNPACK(dst)   CPT_JOIN3(unpack, _, CPT_ABBREV(dst))
 
 /* Brightness giben RGB components (see, e.g., color FAQ at
    http://www.poynton.com/notes/colour_and_gamma/ColorFAQ.html). */
-#define LUMA(R,G,B)   (0.2126*(R) + 0.7152*(G) + 0.0722*(B))
+#define LUMA_R        0.2126
+#define LUMA_G        0.7152
+#define LUMA_B        0.0722
+#define LUMA(R,G,B)   (LUMA_R*(R) + LUMA_G*(G) + LUMA_B*(B))
+
+/* Minimum number of rows per band for parallel processing. */
+#define COPY_MIN_ROWS 32
+
+/*---------------------------------------------------------------------------*/
+/* FAST ROW CONVERTERS */
+
+/* Signature of a function which converts a row of N contiguous pixels. */
+typedef void copy_row_t(long n, const void *src, void *dst);
+
+/* Table of fast row converters indexed by the source and destination types.
+   A NULL entry means that the generic code is used.  The table is filled
+   once, by the first call to img_copy() or img_copy_init(), according to the
+   features of the processor. */
+static copy_row_t *copy_row_table[IMG_TYPE_MAX + 1][IMG_TYPE_MAX + 1];
+
+/* Row converters for identical types, N is the number of bytes.  The second
+   one is used when source and destination overlap. */
+static void copy_row_memcpy(long n, const void *src, void *dst)
+{
+  memcpy(dst, src, n);
+}
+
+static void copy_row_memmove(long n, const void *src, void *dst)
+{
+  memmove(dst, src, n);
+}
+
+/* The vectorized converters are only provided for x86-64 processors where
+   SSE2 is always available and where floating-point arithmetic is carried
+   out in SSE registers (not in the x87 unit) so that the vectorized code
+   yields exactly the same results as the generic code.  All the kernels
+   below apply the same conversion rules as the generic code: truncation
+   toward zero, keeping the least significant bits, for floating-point to
+   integer conversion and LUMA computed in double precision with the same
+   order of operations.  Each kernel terminates with a scalar loop for the
+   remaining pixels.  Define IMG_NO_SIMD to disable them. */
+#if !defined(IMG_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+# define COPY_SIMD 1
+# include <immintrin.h>
+# define TARGET_SSE2  __attribute__((__target__("sse2")))
+# define TARGET_SSSE3 __attribute__((__target__("ssse3")))
+# define TARGET_AVX2  __attribute__((__target__("avx2")))
+
+static TARGET_SSE2 void
+copy_row_u8_f32_sse2(long n, const void *src_addr, void *dst_addr)
+{
+  const uint8_t *src = src_addr;
+  float *dst = dst_addr;
+  const __m128i zero = _mm_setzero_si128();
+  long x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_ps(dst + x,
+                  _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_ps(dst + x + 4,
+                  _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_ps(dst + x + 8,
+                  _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_ps(dst + x + 12,
+                  _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+  }
+  for (; x < n; ++x) {
+    dst[x] = src[x];
+  }
+}
+
+static TARGET_SSE2 void
+copy_row_u16_f32_sse2(long n, const void *src_addr, void *dst_addr)
+{
+  const uint16_t *src = src_addr;
+  float *dst = dst_addr;
+  const __m128i zero = _mm_setzero_si128();
+  long x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm_storeu_ps(dst + x,
+                  _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+    _mm_storeu_ps(dst + x + 4,
+                  _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+  }
+  for (; x < n; ++x) {
+    dst[x] = src[x];
+  }
+}
+
+static TARGET_SSE2 void
+copy_row_f32_u8_sse2(long n, const void *src_addr, void *dst_addr)
+{
+  const float *src = src_addr;
+  uint8_t *dst = dst_addr;
+  const __m128i mask = _mm_set1_epi32(0xff);
+  long x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i a = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(src + x)), mask);
+    __m128i b = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(src + x + 4)),
+                              mask);
+    __m128i c = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(src + x + 8)),
+                              mask);
+    __m128i d = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(src + x + 12)),
+                              mask);
+    _mm_storeu_si128((__m128i *)(dst + x),
+                     _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                      _mm_packs_epi32(c, d)));
+  }
+  for (; x < n; ++x) {
+    dst[x] = src[x];
+  }
+}
+
+static TARGET_SSE2 void
+copy_row_f32_u16_sse2(long n, const void *src_addr, void *dst_addr)
+{
+  const float *src = src_addr;
+  uint16_t *dst = dst_addr;
+  long x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    /* Sign-extend the 16 least significant bits so that the saturation
+       performed by the packing is a no-op. */
+    __m128i a = _mm_cvttps_epi32(_mm_loadu_ps(src + x));
+    __m128i b = _mm_cvttps_epi32(_mm_loadu_ps(src + x + 4));
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_packs_epi32(a, b));
+  }
+  for (; x < n; ++x) {
+    dst[x] = src[x];
+  }
+}
+
+/* Compute the luma of 4 pixels stored as (R,G,B,X) 32-bit words. */
+static inline TARGET_SSE2 void
+luma4_sse2(__m128i v, __m128d *lo, __m128d *hi)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128d wr = _mm_set1_pd(LUMA_R);
+  const __m128d wg = _mm_set1_pd(LUMA_G);
+  const __m128d wb = _mm_set1_pd(LUMA_B);
+  __m128i r = _mm_and_si128(v, mask);
+  __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+  __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+  *lo = _mm_add_pd(_mm_add_pd(_mm_mul_pd(wr, _mm_cvtepi32_pd(r)),
+                              _mm_mul_pd(wg, _mm_cvtepi32_pd(g))),
+                   _mm_mul_pd(wb, _mm_cvtepi32_pd(b)));
+  r = _mm_shuffle_epi32(r, _MM_SHUFFLE(1,0,3,2));
+  g = _mm_shuffle_epi32(g, _MM_SHUFFLE(1,0,3,2));
+  b = _mm_shuffle_epi32(b, _MM_SHUFFLE(1,0,3,2));
+  *hi = _mm_add_pd(_mm_add_pd(_mm_mul_pd(wr, _mm_cvtepi32_pd(r)),
+                              _mm_mul_pd(wg, _mm_cvtepi32_pd(g))),
+                   _mm_mul_pd(wb, _mm_cvtepi32_pd(b)));
+}
+
+static inline TARGET_SSE2 __m128i load4_rgba_sse2(const uint8_t *src)
+{
+  return _mm_loadu_si128((const __m128i *)src);
+}
+
+/* Load exactly 12 bytes (4 RGB pixels) and expand them as (R,G,B,X). */
+static inline TARGET_SSSE3 __m128i load4_rgb_ssse3(const uint8_t *src)
+{
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                        6, 7, 8, -1, 9, 10, 11, -1);
+  int32_t last;
+  memcpy(&last, src + 8, 4);
+  return _mm_shuffle_epi8(_mm_unpacklo_epi64(
+                              _mm_loadl_epi64((const __m128i *)src),
+                              _mm_cvtsi32_si128(last)), shuffle);
+}
+
+static inline TARGET_SSE2 void store4_u8_sse2(void *dst,
+                                              __m128d lo, __m128d hi)
+{
+  __m128i v = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+  int32_t word;
+  v = _mm_packs_epi32(v, v);
+  word = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+  memcpy(dst, &word, 4);
+}
+
+static inline TARGET_SSE2 void store4_f32_sse2(float *dst,
+                                               __m128d lo, __m128d hi)
+{
+  _mm_storeu_ps(dst, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+}
+
+static inline TARGET_SSE2 void store4_f64_sse2(double *dst,
+                                               __m128d lo, __m128d hi)
+{
+  _mm_storeu_pd(dst, lo);
+  _mm_storeu_pd(dst + 2, hi);
+}
+
+/* Compute the luma of 8 pixels stored as (R,G,B,X) 32-bit words. */
+static inline TARGET_AVX2 void
+luma8_avx2(__m256i v, __m256d *lo, __m256d *hi)
+{
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256d wr = _mm256_set1_pd(LUMA_R);
+  const __m256d wg = _mm256_set1_pd(LUMA_G);
+  const __m256d wb = _mm256_set1_pd(LUMA_B);
+  __m256i r = _mm256_and_si256(v, mask);
+  __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), mask);
+  __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+#define LUMA4(part)                                                     \
+  _mm256_add_pd(_mm256_add_pd(                                          \
+      _mm256_mul_pd(wr, _mm256_cvtepi32_pd(part(r))),                   \
+      _mm256_mul_pd(wg, _mm256_cvtepi32_pd(part(g)))),                  \
+    _mm256_mul_pd(wb, _mm256_cvtepi32_pd(part(b))))
+#define LOW(v)  _mm256_castsi256_si128(v)
+#define HIGH(v) _mm256_extracti128_si256(v, 1)
+  *lo = LUMA4(LOW);
+  *hi = LUMA4(HIGH);
+#undef LUMA4
+#undef LOW
+#undef HIGH
+}
+
+static inline TARGET_AVX2 __m256i load8_rgba_avx2(const uint8_t *src)
+{
+  return _mm256_loadu_si256((const __m256i *)src);
+}
+
+static inline TARGET_AVX2 __m256i load8_rgb_avx2(const uint8_t *src)
+{
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(
+                                     load4_rgb_ssse3(src)),
+                                 load4_rgb_ssse3(src + 12), 1);
+}
+
+static inline TARGET_AVX2 void store8_u8_avx2(void *dst,
+                                              __m256d lo, __m256d hi)
+{
+  __m128i v = _mm_packs_epi32(_mm256_cvttpd_epi32(lo),
+                              _mm256_cvttpd_epi32(hi));
+  _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(v, v));
+}
+
+static inline TARGET_AVX2 void store8_f32_avx2(float *dst,
+                                               __m256d lo, __m256d hi)
+{
+  _mm_storeu_ps(dst, _mm256_cvtpd_ps(lo));
+  _mm_storeu_ps(dst + 4, _mm256_cvtpd_ps(hi));
+}
+
+static inline TARGET_AVX2 void store8_f64_avx2(double *dst,
+                                               __m256d lo, __m256d hi)
+{
+  _mm256_storeu_pd(dst, lo);
+  _mm256_storeu_pd(dst + 4, hi);
+}
+
+/* Define a function NAME to convert a row of RGB or RGBA pixels into gray
+   levels.  TARGET is the instruction set attribute, WIDTH is the number of
+   pixels processed at each step (4 or 8), SRC_STRIDE is the number of bytes
+   per source pixel (3 or 4), LOAD, STORE and LUMA are the helpers to load
+   WIDTH pixels, to store their gray levels and to compute their luma, DST_T
+   is the destination type and VEC_T the vector type of the luma values. */
+#define LUMA_ROW(name, target, width, src_stride, load, store, luma,    \
+                 dst_t, vec_t)                                          \
+  static target void name(long n, const void *src_addr, void *dst_addr) \
+  {                                                                     \
+    const uint8_t *src = src_addr;                                      \
+    dst_t *dst = dst_addr;                                              \
+    vec_t lo, hi;                                                       \
+    long x;                                                             \
+    for (x = 0; x + width <= n; x += width) {                           \
+      luma(load(src + src_stride*x), &lo, &hi);                         \
+      store(dst + x, lo, hi);                                           \
+    }                                                                   \
+    for (; x < n; ++x) {                                                \
+      dst[x] = LUMA(src[src_stride*x], src[src_stride*x+1],             \
+                    src[src_stride*x+2]);                               \
+    }                                                                   \
+  }
+
+LUMA_ROW(copy_row_rgba_u8_sse2, TARGET_SSE2, 4, 4, load4_rgba_sse2,
+         store4_u8_sse2, luma4_sse2, uint8_t, __m128d)
+LUMA_ROW(copy_row_rgba_f32_sse2, TARGET_SSE2, 4, 4, load4_rgba_sse2,
+         store4_f32_sse2, luma4_sse2, float, __m128d)
+LUMA_ROW(copy_row_rgba_f64_sse2, TARGET_SSE2, 4, 4, load4_rgba_sse2,
+         store4_f64_sse2, luma4_sse2, double, __m128d)
+LUMA_ROW(copy_row_rgb_u8_ssse3, TARGET_SSSE3, 4, 3, load4_rgb_ssse3,
+         store4_u8_sse2, luma4_sse2, uint8_t, __m128d)
+LUMA_ROW(copy_row_rgb_f32_ssse3, TARGET_SSSE3, 4, 3, load4_rgb_ssse3,
+         store4_f32_sse2, luma4_sse2, float, __m128d)
+LUMA_ROW(copy_row_rgb_f64_ssse3, TARGET_SSSE3, 4, 3, load4_rgb_ssse3,
+         store4_f64_sse2, luma4_sse2, double, __m128d)
+LUMA_ROW(copy_row_rgba_u8_avx2, TARGET_AVX2, 8, 4, load8_rgba_avx2,
+         store8_u8_avx2, luma8_avx2, uint8_t, __m256d)
+LUMA_ROW(copy_row_rgba_f32_avx2, TARGET_AVX2, 8, 4, load8_rgba_avx2,
+         store8_f32_avx2, luma8_avx2, float, __m256d)
+LUMA_ROW(copy_row_rgba_f64_avx2, TARGET_AVX2, 8, 4, load8_rgba_avx2,
+         store8_f64_avx2, luma8_avx2, double, __m256d)
+LUMA_ROW(copy_row_rgb_u8_avx2, TARGET_AVX2, 8, 3, load8_rgb_avx2,
+         store8_u8_avx2, luma8_avx2, uint8_t, __m256d)
+LUMA_ROW(copy_row_rgb_f32_avx2, TARGET_AVX2, 8, 3, load8_rgb_avx2,
+         store8_f32_avx2, luma8_avx2, float, __m256d)
+LUMA_ROW(copy_row_rgb_f64_avx2, TARGET_AVX2, 8, 3, load8_rgb_avx2,
+         store8_f64_avx2, luma8_avx2, double, __m256d)
+
+#undef LUMA_ROW
+
+static TARGET_AVX2 void
+copy_row_u8_f32_avx2(long n, const void *src_addr, void *dst_addr)
+{
+  const uint8_t *src = src_addr;
+  float *dst = dst_addr;
+  long x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm256_storeu_ps(dst + x,
+                     _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+    _mm256_storeu_ps(dst + x + 8,
+                     _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                                            _mm_srli_si128(v, 8))));
+  }
+  for (; x < n; ++x) {
+    dst[x] = src[x];
+  }
+}
+
+static TARGET_AVX2 void
+copy_row_u16_f32_avx2(long n, const void *src_addr, void *dst_addr)
+{
+  const uint16_t *src = src_addr;
+  float *dst = dst_addr;
+  long x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm256_storeu_ps(dst + x,
+                     _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)));
+  }
+  for (; x < n; ++x) {
+    dst[x] = src[x];
+  }
+}
+
+static TARGET_SSSE3 void
+copy_row_rgb_rgba_ssse3(long n, const void *src_addr, void *dst_addr)
+{
+  const uint8_t *src = src_addr;
+  uint8_t *dst = dst_addr;
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  long x;
+  for (x = 0; x + 4 <= n; x += 4) {
+    _mm_storeu_si128((__m128i *)(dst + 4*x),
+                     _mm_or_si128(load4_rgb_ssse3(src + 3*x), alpha));
+  }
+  for (; x < n; ++x) {
+    dst[4*x] = src[3*x];
+    dst[4*x+1] = src[3*x+1];
+    dst[4*x+2] = src[3*x+2];
+    dst[4*x+3] = 255;
+  }
+}
+
+static TARGET_SSSE3 void
+copy_row_rgba_rgb_ssse3(long n, const void *src_addr, void *dst_addr)
+{
+  const uint8_t *src = src_addr;
+  uint8_t *dst = dst_addr;
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+                                        10, 12, 13, 14, -1, -1, -1, -1);
+  long x;
+  for (x = 0; x + 4 <= n; x += 4) {
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+                                                 (src + 4*x)), shuffle);
+    int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    _mm_storel_epi64((__m128i *)(dst + 3*x), v);
+    memcpy(dst + 3*x + 8, &last, 4);
+  }
+  for (; x < n; ++x) {
+    dst[3*x] = src[4*x];
+    dst[3*x+1] = src[4*x+1];
+    dst[3*x+2] = src[4*x+2];
+  }
+}
+
+#endif /* COPY_SIMD */
+
+/* Fill the table of the fast converters, this is done once (see
+   COPY_INIT). */
+static void copy_init(void)
+{
+#ifdef COPY_SIMD
+# define SET(SRC,DST,func) \
+  copy_row_table[IMG_TYPE_##SRC][IMG_TYPE_##DST] = func
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    SET(UINT8,  FLOAT,  copy_row_u8_f32_sse2);
+    SET(UINT16, FLOAT,  copy_row_u16_f32_sse2);
+    SET(FLOAT,  UINT8,  copy_row_f32_u8_sse2);
+    SET(FLOAT,  UINT16, copy_row_f32_u16_sse2);
+    SET(RGBA,   UINT8,  copy_row_rgba_u8_sse2);
+    SET(RGBA,   FLOAT,  copy_row_rgba_f32_sse2);
+    SET(RGBA,   DOUBLE, copy_row_rgba_f64_sse2);
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    SET(RGB,    UINT8,  copy_row_rgb_u8_ssse3);
+    SET(RGB,    FLOAT,  copy_row_rgb_f32_ssse3);
+    SET(RGB,    DOUBLE, copy_row_rgb_f64_ssse3);
+    SET(RGB,    RGBA,   copy_row_rgb_rgba_ssse3);
+    SET(RGBA,   RGB,    copy_row_rgba_rgb_ssse3);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    SET(UINT8,  FLOAT,  copy_row_u8_f32_avx2);
+    SET(UINT16, FLOAT,  copy_row_u16_f32_avx2);
+    SET(RGBA,   UINT8,  copy_row_rgba_u8_avx2);
+    SET(RGBA,   FLOAT,  copy_row_rgba_f32_avx2);
+    SET(RGBA,   DOUBLE, copy_row_rgba_f64_avx2);
+    SET(RGB,    UINT8,  copy_row_rgb_u8_avx2);
+    SET(RGB,    FLOAT,  copy_row_rgb_f32_avx2);
+    SET(RGB,    DOUBLE, copy_row_rgb_f64_avx2);
+  }
+# undef SET
+#endif /* COPY_SIMD */
+}
+
+#ifdef IMG_USE_PTHREADS
+static pthread_once_t copy_once = PTHREAD_ONCE_INIT;
+# define COPY_INIT() pthread_once(&copy_once, copy_init)
+#else
+static int copy_initialized = 0;
+# define COPY_INIT()                            \
+  do {                                          \
+    if (! copy_initialized) {                   \
+      copy_init();                              \
+      copy_initialized = 1;                     \
+    }                                           \
+  } while (0)
+#endif
+
+/**
+ * @brief Select the fast pixel converters.
+ *
+ * This function fills the table of the fast converters used by img_copy()
+ * according to the features of the processor.  The table is filled only
+ * once, by the first call to this function or to img_copy(), so calling it
+ * is optional; it is called by `_img_init` in the Yorick plug-in to avoid
+ * the cost of the detection in the first copy.  The first call is thread
+ * safe when the library is compiled with \c IMG_USE_PTHREADS; otherwise,
+ * callers using img_copy() from several threads must call this function
+ * before starting them.
+ */
+void img_copy_init(void)
+{
+  COPY_INIT();
+}
+
+/* Job to copy the pixels of a rectangular region by bands of rows.  If
+   member ROW is not NULL, it is used to convert the pixels row by row (or
+   all the pixels of a band at once if the rows are contiguous), otherwise
+   the generic function COPY is used. */
+typedef struct _copy_job copy_job_t;
+struct _copy_job {
+  void (*copy)(const long  width, const long  height,
+               const void *src_addr, const long src_offset,
+               long src_pitch, void *dst_addr,
+               const long dst_offset, long dst_pitch);
+  copy_row_t *row;
+  const void *src_addr;
+  void *dst_addr;
+  long width, height;
+  long src_offset, src_pitch;
+  long dst_offset, dst_pitch;
+  size_t src_size, dst_size;
+};
+
+static int copy_task(void *data, long band, long nbands)
+{
+  copy_job_t *job = (copy_job_t *)data;
+  long y0 = IMG_BAND_START(band, nbands, job->height);
+  long y1 = IMG_BAND_START(band + 1, nbands, job->height);
+  if (job->row != NULL) {
+    const char *src = (const char *)job->src_addr +
+      (job->src_offset + y0*job->src_pitch)*job->src_size;
+    char *dst = (char *)job->dst_addr +
+      (job->dst_offset + y0*job->dst_pitch)*job->dst_size;
+    if (job->src_pitch == job->width && job->dst_pitch == job->width) {
+      job->row((y1 - y0)*job->width, src, dst);
+    } else {
+      size_t src_step = job->src_pitch*job->src_size;
+      size_t dst_step = job->dst_pitch*job->dst_size;
+      long y;
+      for (y = y0; y < y1; ++y, src += src_step, dst += dst_step) {
+        job->row(job->width, src, dst);
+      }
+    }
+  } else {
+    job->copy(job->width, y1 - y0,
+              job->src_addr, job->src_offset + y0*job->src_pitch,
+              job->src_pitch,
+              job->dst_addr, job->dst_offset + y0*job->dst_pitch,
+              job->dst_pitch);
+  }
+  return IMG_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+/* PACKED BINARY IMAGES */
+
+typedef img_bitmap_word_t word_t;
+
+/* Mask of the N bits starting at bit J of a word (0 < N <= 64 - J). */
+#define BITS_MASK(j, n) ((n) >= 64 ? ~(word_t)0 : \
+                         ((((word_t)1 << (n)) - 1) << (j)))
+
+/* Get N bits (0 < N <= 64) of bitmap BITS starting at pixel K. */
+static word_t get_bits(const word_t bits[], long k, long n)
+{
+  long j = (k & 63);
+  word_t w = bits[k >> 6] >> j;
+  if (j + n > 64) {
+    w |= bits[(k >> 6) + 1] << (64 - j);
+  }
+  return (n >= 64 ? w : w & (((word_t)1 << n) - 1));
+}
+
+/* Copy a bitmap into another one.  The rows are split in chunks which do
+   not cross a word of the destination.  If the bitmaps overlap and the
+   destination comes after the source, the rows and the chunks are copied in
+   reverse order. */
+static void copy_bits(const long width, const long height,
+                      const void *src_addr, const long src_offset,
+                      long src_pitch, void *dst_addr,
+                      const long dst_offset, long dst_pitch)
+{
+  const word_t *src = src_addr;
+  word_t *dst = dst_addr;
+  long x, y, n, k, dx, dy, ystep;
+  int backward = ((const word_t *)dst_addr + (dst_offset >> 6) >
+                  (const word_t *)src_addr + (src_offset >> 6) ||
+                  ((const word_t *)dst_addr + (dst_offset >> 6) ==
+                   (const word_t *)src_addr + (src_offset >> 6) &&
+                   (dst_offset & 63) > (src_offset & 63)));
+
+  ystep = (backward ? -1 : 1);
+  for (dy = 0, y = (backward ? height - 1 : 0); dy < height;
+       ++dy, y += ystep) {
+    long s0 = src_offset + y*src_pitch;
+    long d0 = dst_offset + y*dst_pitch;
+    if (! backward) {
+      for (x = 0; x < width; x += n) {
+        long j = ((d0 + x) & 63);
+        n = 64 - j;
+        if (n > width - x) n = width - x;
+        k = (d0 + x) >> 6;
+        dst[k] = ((dst[k] & ~BITS_MASK(j, n)) |
+                  (get_bits(src, s0 + x, n) << j));
+      }
+    } else {
+      for (x = width; x > 0; x -= n) {
+        /* Chunk ending at pixel X - 1. */
+        long j;
+        dx = ((d0 + x - 1) & 63) + 1; /* bits of the chunk in its word */
+        n = (dx < x ? dx : x);
+        j = ((d0 + x - n) & 63);
+        k = (d0 + x - n) >> 6;
+        dst[k] = ((dst[k] & ~BITS_MASK(j, n)) |
+                  (get_bits(src, s0 + x - n, n) << j));
+      }
+    }
+  }
+}
 
 /* Manage to include this file with a different source data type each time.
    This is the first level of "self" inclusion, a second level is needed to
@@ -101,6 +679,162 @@
 # include __FILE__
 #endif
 
+/**
+ * @brief Get the size of the pixels of a given type.
+ *
+ * @param type   The pixel type.
+ *
+ * @return The number of bytes per pixel, 0 if \a type is invalid.
+ */
+size_t img_get_pixel_size(int type)
+{
+#define CASE(TYPE) case IMG_TYPE_##TYPE: return sizeof(CPT_CTYPE(TYPE))
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+#ifdef IMG_TYPE_SCOMPLEX
+    CASE(SCOMPLEX);
+#endif
+#ifdef IMG_TYPE_DCOMPLEX
+    CASE(DCOMPLEX);
+#endif
+#ifdef IMG_TYPE_RGB
+    CASE(RGB);
+#endif
+#ifdef IMG_TYPE_RGBA
+    CASE(RGBA);
+#endif
+  default:
+    return 0;
+  }
+#undef CASE
+}
+
+/* Copy with conversion to or from a bitmap.  The rows of a bitmap
+   destination are only split between threads if they start on a word
+   boundary as otherwise two rows may share a word. */
+static int copy_bitmap(const long width, const long height,
+                       const void *src_addr, const int src_type,
+                       const long src_offset, const long src_pitch,
+                       void *dst_addr, const int dst_type,
+                       const long dst_offset, const long dst_pitch)
+{
+  copy_job_t job;
+  long nbands;
+  int unpack = (src_type == IMG_TYPE_BIT);
+
+  if (src_type == IMG_TYPE_BIT && dst_type == IMG_TYPE_BIT) {
+    if (src_addr == dst_addr && src_offset == dst_offset &&
+        src_pitch == dst_pitch) {
+      return IMG_SUCCESS;
+    }
+    job.copy = copy_bits;
+  } else {
+
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                        \
+    job.copy = (unpack ? UNPACK(TYPE) : PACK(TYPE));            \
+    break
+
+    switch (unpack ? dst_type : src_type) {
+#ifdef IMG_TYPE_INT8
+      CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+      CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+      CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+      CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+      CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+      CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+      CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+      CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+      CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+      CASE(DOUBLE);
+#endif
+#ifdef IMG_TYPE_SCOMPLEX
+      CASE(SCOMPLEX);
+#endif
+#ifdef IMG_TYPE_DCOMPLEX
+      CASE(DCOMPLEX);
+#endif
+#ifdef IMG_TYPE_RGB
+      CASE(RGB);
+#endif
+#ifdef IMG_TYPE_RGBA
+      CASE(RGBA);
+#endif
+    default:
+      errno = EINVAL;
+      return IMG_FAILURE;
+    }
+
+#undef CASE
+
+  }
+  if (dst_type != IMG_TYPE_BIT ||
+      ((dst_offset & 63) == 0 && (dst_pitch & 63) == 0 &&
+       src_type != IMG_TYPE_BIT)) {
+    nbands = img_get_num_bands(height, COPY_MIN_ROWS);
+  } else {
+    nbands = 1;
+  }
+  job.row = NULL;
+  job.src_addr = src_addr;
+  job.dst_addr = dst_addr;
+  job.width = width;
+  job.height = height;
+  job.src_offset = src_offset;
+  job.src_pitch = src_pitch;
+  job.dst_offset = dst_offset;
+  job.dst_pitch = dst_pitch;
+  job.src_size = 0;
+  job.dst_size = 0;
+  return img_parallel(nbands, copy_task, &job);
+}
+
 /**
  * @brief Convert and copy the pixels of a rectangular region.
  *
@@ -122,6 +856,12 @@
  * @param dst_pitch   The number of pixels between two successive rows of the
  *                    destination image.
  *
+ * The source or the destination may be a packed binary image (type
+ * \c IMG_TYPE_BIT) whose offset and pitch are in bits: non-zero pixels of
+ * the source are set in the bitmap, the pixels of a bitmap are converted
+ * into 0 or 1.  Overlapping bitmaps are correctly copied, an image must
+ * not overlap a bitmap.
+ *
  * @return Normally \c IMG_SUCCESS; \c IMG_FAILURE in case of error and
  *         \c errno set to \c EFAULT if one of the addresses is invalid,
  *         to \c EINVAL if one of the other arguments is invalid.
@@ -137,6 +877,12 @@ int img_copy(const long width,
              const long  dst_offset,
              const long  dst_pitch)
 {
+  copy_job_t job;
+  const char *src_beg, *src_end, *dst_beg, *dst_end;
+  size_t src_size, dst_size;
+  long nbands;
+  int overlap;
+
   if ((src_addr == NULL) || (dst_addr == NULL)) {
     errno = EFAULT;
     return IMG_FAILURE;
@@ -146,9 +892,14 @@ int img_copy(const long width,
     errno = EINVAL;
     return IMG_FAILURE;
   }
+  if (src_type == IMG_TYPE_BIT || dst_type == IMG_TYPE_BIT) {
+    return copy_bitmap(width, height, src_addr, src_type, src_offset,
+                       src_pitch, dst_addr, dst_type, dst_offset, dst_pitch);
+  }
 
-#define CALL(SRC,DST) COPY(SRC,DST)(width,height,src_addr,src_offset,\
-                                    src_pitch,dst_addr,dst_offset,dst_pitch)
+#define CALL(SRC,DST) job.copy = COPY(SRC,DST);             \
+                      src_size = sizeof(CPT_CTYPE(SRC));    \
+                      dst_size = sizeof(CPT_CTYPE(DST))
 
 #define CASE2(SRC,DST) case IMG_TYPE_##DST: CALL(SRC,DST); break
 
@@ -312,7 +1063,43 @@ int img_copy(const long width,
 #undef CASEm
 #undef CASEn
 
-  return IMG_SUCCESS;
+  /* Copy by bands of rows unless source and destination overlap (in which
+     case the result depends on the order of the operations). */
+  src_beg = (const char *)src_addr + src_offset*src_size;
+  src_end = src_beg + ((height - 1)*src_pitch + width)*src_size;
+  dst_beg = (const char *)dst_addr + dst_offset*dst_size;
+  dst_end = dst_beg + ((height - 1)*dst_pitch + width)*dst_size;
+  overlap = (dst_beg < src_end && src_beg < dst_end);
+  nbands = (overlap ? 1 : img_get_num_bands(height, COPY_MIN_ROWS));
+  job.src_addr = src_addr;
+  job.dst_addr = dst_addr;
+  job.width = width;
+  job.height = height;
+  job.src_offset = src_offset;
+  job.src_pitch = src_pitch;
+  job.dst_offset = dst_offset;
+  job.dst_pitch = dst_pitch;
+  if (src_type == dst_type) {
+    /* Plain copy of bytes. */
+    if (src_beg == dst_beg && src_pitch == dst_pitch) {
+      return IMG_SUCCESS;
+    }
+    job.row = (overlap ? copy_row_memmove : copy_row_memcpy);
+    job.width *= src_size;
+    job.src_offset *= src_size;
+    job.src_pitch *= src_size;
+    job.dst_offset *= dst_size;
+    job.dst_pitch *= dst_size;
+    job.src_size = 1;
+    job.dst_size = 1;
+  } else {
+    /* The fast converters assume no overlapping. */
+    COPY_INIT();
+    job.row = (overlap ? NULL : copy_row_table[src_type][dst_type]);
+    job.src_size = src_size;
+    job.dst_size = dst_size;
+  }
+  return img_parallel(nbands, copy_task, &job);
 }
 
 #elif (_IMG_COPY_C == 1) /****************************************************/
@@ -377,6 +1164,97 @@ int img_copy(const long width,
 # include __FILE__
 #endif
 
+/* Conversions between type SRC and bitmaps (SRC is also the destination
+   type for UNPACK).  Pixels are non-zero if any of their components (the
+   color ones for RGBA) is non-zero. */
+#if CPT_IS_COMPLEX(SRC)
+# define PIX_STRIDE 2
+# if CPT_IS_SCOMPLEX(SRC)
+#  define pix_t float
+# else
+#  define pix_t double
+# endif
+# define NONZERO(p) ((p)[0] != 0 || (p)[1] != 0)
+#elif CPT_IS_COLOR(SRC)
+# define pix_t uint8_t
+# if CPT_IS_RGB(SRC)
+#  define PIX_STRIDE 3
+# else
+#  define PIX_STRIDE 4
+# endif
+# define NONZERO(p) (((p)[0] | (p)[1] | (p)[2]) != 0)
+#else
+# define pix_t CPT_CTYPE(SRC)
+# define PIX_STRIDE 1
+# define NONZERO(p) ((p)[0] != 0)
+#endif
+
+static void PACK(SRC)(const long  width, const long  height,
+                      const void *src_addr, const long src_offset,
+                      long src_pitch, void *dst_addr,
+                      const long dst_offset, long dst_pitch)
+{
+  const pix_t *src = (const pix_t *)src_addr + PIX_STRIDE*src_offset;
+  word_t *dst = dst_addr;
+  long x, y, i, n;
+
+  for (y = 0; y < height; ++y, src += PIX_STRIDE*src_pitch) {
+    long d0 = dst_offset + y*dst_pitch;
+    for (x = 0; x < width; x += n) {
+      long j = ((d0 + x) & 63), k = ((d0 + x) >> 6);
+      const pix_t *p = src + PIX_STRIDE*x;
+      word_t w = 0;
+      n = 64 - j;
+      if (n > width - x) n = width - x;
+      for (i = 0; i < n; ++i, p += PIX_STRIDE) {
+        w |= (word_t)(NONZERO(p) ? 1 : 0) << i;
+      }
+      dst[k] = ((dst[k] & ~BITS_MASK(j, n)) | (w << j));
+    }
+  }
+}
+
+static void UNPACK(SRC)(const long  width, const long  height,
+                        const void *src_addr, const long src_offset,
+                        long src_pitch, void *dst_addr,
+                        const long dst_offset, long dst_pitch)
+{
+  const word_t *src = src_addr;
+  pix_t *dst = (pix_t *)dst_addr + PIX_STRIDE*dst_offset;
+  long x, y, i, n;
+
+  for (y = 0; y < height; ++y, dst += PIX_STRIDE*dst_pitch) {
+    long s0 = src_offset + y*src_pitch;
+    for (x = 0; x < width; x += n) {
+      pix_t *p = dst + PIX_STRIDE*x;
+      word_t w;
+      n = 64 - ((s0 + x) & 63);
+      if (n > width - x) n = width - x;
+      w = get_bits(src, s0 + x, n);
+      for (i = 0; i < n; ++i, w >>= 1, p += PIX_STRIDE) {
+        const pix_t v = (pix_t)(w & 1);
+#if PIX_STRIDE == 1
+        p[0] = v;
+#elif CPT_IS_COMPLEX(SRC)
+        p[0] = v;
+        p[1] = 0;
+#else
+        p[0] = v;
+        p[1] = v;
+        p[2] = v;
+# if PIX_STRIDE == 4
+        p[3] = 255;
+# endif
+#endif
+      }
+    }
+  }
+}
+
+#undef NONZERO
+#undef PIX_STRIDE
+#undef pix_t
+
 /* Restore the state. */
 #undef SRC
 #undef _IMG_COPY_C
@@ -28,8 +28,10 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <math.h>
 
 #include "img.h"
+#include "img_thread.h"
 
 #ifndef NULL
 # define NULL ((void*)0L)
@@ -38,7 +40,44 @@
 
 /* Definitions that will be expanded by the template code. */
 
-#define COST_L2(TYPE)  CPT_JOIN(img_cost_l2_,CPT_ABBREV(TYPE))
+#define COST_L2(TYPE)   CPT_JOIN(img_cost_l2_,CPT_ABBREV(TYPE))
+#define COST_COPY(TYPE) CPT_JOIN(cost_copy_,CPT_ABBREV(TYPE))
+
+/* Minimum number of rows per band for parallel processing. */
+#define COST_MIN_ROWS 16
+
+/* Relative cost of the FFT method (per pixel and per log2 of the number of
+   pixels of the zero-padded arrays) with respect to the direct method (per
+   pixel of the overlapping regions) to compute a cost map. */
+#define COST_FFT_FACTOR 8.0
+
+/* Job to integrate the cost over the rows of the raw and reference
+   sub-images.  Rows are numbered from 0 to RAW_HEIGHT - 1 for the raw
+   sub-image and then from RAW_HEIGHT to RAW_HEIGHT + REF_HEIGHT - 1 for the
+   reference sub-image.  The overlapping region is integrated with the rows
+   of the raw sub-image.  To have a result which does not depend on the
+   number of threads, there is one partial sum per row and the partial sums
+   are added in order. */
+typedef struct _cost_job cost_job_t;
+struct _cost_job {
+  void (*rows)(const cost_job_t *job, long y0, long y1);
+  const void *raw_image, *ref_image;
+  double *sum;
+  double bg;
+  long raw_width, raw_height, raw_stride;
+  long ref_width, ref_height, ref_stride;
+  long raw_x0, raw_x1, raw_y0, raw_y1;
+  long ref_x0, ref_x1, ref_y0, ref_y1;
+};
+
+static int cost_task(void *data, long band, long nbands)
+{
+  cost_job_t *job = (cost_job_t *)data;
+  long n = job->raw_height + job->ref_height;
+  job->rows(job, IMG_BAND_START(band, nbands, n),
+            IMG_BAND_START(band + 1, nbands, n));
+  return IMG_SUCCESS;
+}
 
 #define pixel_t        CPT_CTYPE(TYPE)
 
@@ -117,6 +156,188 @@
 #endif
 */
 
+/* Prepare job to compute the cost between two sub-images, return
+   IMG_SUCCESS or IMG_FAILURE with errno set. */
+static int cost_setup(cost_job_t *job, const int type,
+                      const void *raw_image, const long raw_offset,
+                      const long raw_width, const long raw_height,
+                      const long raw_stride,
+                      const void *ref_image, const long ref_offset,
+                      const long ref_width, const long ref_height,
+                      const long ref_stride, const double bg)
+{
+  if ((raw_image == NULL) || (ref_image == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((raw_width < 1) || (raw_height < 1) || (raw_stride < raw_width) ||
+      (ref_width < 1) || (ref_height < 1) || (ref_stride < ref_width)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                              \
+    job->rows = COST_L2(TYPE);                                        \
+    job->raw_image = (const CPT_CTYPE(TYPE) *)raw_image + raw_offset; \
+    job->ref_image = (const CPT_CTYPE(TYPE) *)ref_image + ref_offset; \
+  break
+
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+    /*
+#ifdef IMG_TYPE_SCOMPLEX
+    CASE(SCOMPLEX);
+#endif
+#ifdef IMG_TYPE_DCOMPLEX
+    CASE(DCOMPLEX);
+#endif
+#ifdef IMG_TYPE_RGB
+    CASE(RGB);
+#endif
+#ifdef IMG_TYPE_RGBA
+    CASE(RGBA);
+#endif
+    */
+  default:
+    /* Bad pixel type. */
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#undef CASE
+
+  job->bg = bg;
+  job->raw_width = raw_width;
+  job->raw_height = raw_height;
+  job->raw_stride = raw_stride;
+  job->ref_width = ref_width;
+  job->ref_height = ref_height;
+  job->ref_stride = ref_stride;
+  return IMG_SUCCESS;
+}
+
+/* Integrate the cost for a reference sub-image at position (DX,DY), the
+   rows are processed in parallel if NBANDS > 1.  Return the cost or -1 in
+   case of error. */
+static double cost_integrate(cost_job_t *job, const long dx, const long dy,
+                             double scale, long nbands)
+{
+  const long raw_width = job->raw_width;
+  const long raw_height = job->raw_height;
+  const long ref_width = job->ref_width;
+  const long ref_height = job->ref_height;
+  double s;
+  long y, temp;
+
+  /* Compute the bounding box coordinates of the overlapping region in the
+     reference and raw images.  The limits are X0 <= X < X1 and Y0 <= Y < Y1
+     that is (X0,Y0 inclusive and (X1,Y1) exclusive.  If the two sub-images
+     are not overlapping, the overlapping region is made empty. */
+  if (dx >= 0) {
+    if ((job->raw_x0 = dx) >= raw_width) {
+      goto no_overlap;
+    }
+    job->ref_x0 = 0;
+  } else {
+    if ((job->ref_x0 = -dx) >= ref_width) {
+      goto no_overlap;
+    }
+    job->raw_x0 = 0;
+  }
+  if (dy >= 0) {
+    if ((job->raw_y0 = dy) >= raw_height) {
+      goto no_overlap;
+    }
+    job->ref_y0 = 0;
+  } else {
+    if ((job->ref_y0 = -dy) >= ref_height) {
+      goto no_overlap;
+    }
+    job->raw_y0 = 0;
+  }
+  if ((temp = ref_width + dx) <= raw_width) {
+    job->raw_x1 = temp;
+    job->ref_x1 = ref_width;
+  } else {
+    job->raw_x1 = raw_width;
+    job->ref_x1 = raw_width - dx;
+  }
+  if ((temp = ref_height + dy) <= raw_height) {
+    job->raw_y1 = temp;
+    job->ref_y1 = ref_height;
+  } else {
+    job->raw_y1 = raw_height;
+    job->ref_y1 = raw_height - dy;
+  }
+  goto integrate;
+
+  /* The two sub-images are not overlapping. */
+ no_overlap:
+  job->raw_x0 = job->raw_x1 = job->raw_y0 = job->raw_y1 = 0;
+  job->ref_x0 = job->ref_x1 = job->ref_y0 = job->ref_y1 = 0;
+
+  /* Integrate the cost. */
+ integrate:
+  temp = raw_height + ref_height;
+  job->sum = (double *)malloc(temp*sizeof(double));
+  if (job->sum == NULL) {
+    errno = ENOMEM;
+    return -1.0;
+  }
+  if (nbands > 1) {
+    if (img_parallel(nbands, cost_task, job) != IMG_SUCCESS) {
+      free((void *)job->sum);
+      job->sum = NULL;
+      return -1.0;
+    }
+  } else {
+    job->rows(job, 0, temp);
+  }
+  s = 0.0;
+  for (y = 0; y < temp; ++y) {
+    s += job->sum[y];
+  }
+  free((void *)job->sum);
+  job->sum = NULL;
+
+  if (scale == 0.0) {
+    scale = 1.0/(double)(raw_width*raw_height
+                         + ref_width*(ref_height - job->ref_y1 + job->ref_y0)
+                         + (ref_width - job->ref_x1 + job->ref_x0)*
+                         (job->ref_y1 - job->ref_y0));
+  }
+  return scale*s;
+}
+
 /**
  * @brief Compute quadratic difference between two sub-images.
  *
@@ -166,25 +387,532 @@ double img_cost_l2(const int type,
                    const double bg,
                    double scale)
 {
-  double result;
-  if ((raw_image == NULL) || (ref_image == NULL)) {
-    errno = EFAULT;
+  cost_job_t job;
+
+  if (cost_setup(&job, type, raw_image, raw_offset, raw_width, raw_height,
+                 raw_stride, ref_image, ref_offset, ref_width, ref_height,
+                 ref_stride, bg) != IMG_SUCCESS) {
     return -1.0;
   }
+  return cost_integrate(&job, dx, dy, scale,
+                        img_get_num_bands(raw_height + ref_height,
+                                          COST_MIN_ROWS));
+}
+
+/*---------------------------------------------------------------------------*/
+/* BATCH OF REFERENCES */
+
+/* Job to compute the costs of a batch of references, the references are
+   distributed among the bands and the cost of each reference is computed
+   by a single thread. */
+typedef struct _cost_batch_job cost_batch_job_t;
+struct _cost_batch_job {
+  int type;
+  const void *raw_image, *ref_image;
+  long raw_offset, raw_width, raw_height, raw_stride;
+  long nrefs;
+  const long *ref_offset, *ref_width, *ref_height, *ref_stride;
+  const long *dx, *dy;
+  const double *bg, *scale;
+  double *cost;
+};
+
+static int cost_batch_task(void *data, long band, long nbands)
+{
+  const cost_batch_job_t *batch = (const cost_batch_job_t *)data;
+  long k0 = IMG_BAND_START(band, nbands, batch->nrefs);
+  long k1 = IMG_BAND_START(band + 1, nbands, batch->nrefs);
+  cost_job_t job;
+  double c;
+  long k;
+
+  for (k = k0; k < k1; ++k) {
+    if (cost_setup(&job, batch->type, batch->raw_image, batch->raw_offset,
+                   batch->raw_width, batch->raw_height, batch->raw_stride,
+                   batch->ref_image, batch->ref_offset[k],
+                   batch->ref_width[k], batch->ref_height[k],
+                   batch->ref_stride[k], batch->bg[k]) != IMG_SUCCESS) {
+      return IMG_FAILURE;
+    }
+    c = cost_integrate(&job, batch->dx[k], batch->dy[k], batch->scale[k], 1);
+    if (c < 0.0) {
+      return IMG_FAILURE;
+    }
+    batch->cost[k] = c;
+  }
+  return IMG_SUCCESS;
+}
+
+/**
+ * @brief Compute quadratic differences between a sub-image and many
+ *        references.
+ *
+ * This function computes the same costs as img_cost_l2() for a batch of
+ * \a nrefs reference sub-images compared to a single raw sub-image.  The
+ * references are all parts of the same image (or array) at base address
+ * \a ref_image and are distributed among the threads.  The result does not
+ * depend on the number of threads.
+ *
+ * @param type        The type identifier of the images \a raw and \a ref.
+ * @param raw_image   Base address of the raw image.
+ * @param raw_offset  Offset (in number of pixels with respect to \a raw_image)
+ *                    of the first pixel of the raw sub-image.
+ * @param raw_width   Width of raw sub-image.
+ * @param raw_height  Height of raw sub-image.
+ * @param raw_stride  Elements per row of \a raw_image.
+ * @param nrefs       Number of references.
+ * @param ref_image   Base address of the reference images.
+ * @param ref_offset  Offsets (in number of pixels with respect to
+ *                    \a ref_image) of the first pixel of the reference
+ *                    sub-images.
+ * @param ref_width   Widths of reference sub-images.
+ * @param ref_height  Heights of reference sub-images.
+ * @param ref_stride  Elements per row of the reference sub-images.
+ * @param dx          X-positions of reference sub-images with respect
+ *                    to raw sub-image.
+ * @param dy          Y-positions of reference sub-images with respect
+ *                    to raw sub-image.
+ * @param bg          Background levels.
+ * @param scale       Scale factors (see img_cost_l2()).
+ * @param cost        Output array of \a nrefs costs.
+ *
+ * All arrays but \a cost are read-only and have \a nrefs elements.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ */
+
+int img_cost_l2_batch(const int type,
+                      const void *raw_image,
+                      const long raw_offset,
+                      const long raw_width,
+                      const long raw_height,
+                      const long raw_stride,
+                      const long nrefs,
+                      const void *ref_image,
+                      const long ref_offset[],
+                      const long ref_width[],
+                      const long ref_height[],
+                      const long ref_stride[],
+                      const long dx[],
+                      const long dy[],
+                      const double bg[],
+                      const double scale[],
+                      double cost[])
+{
+  cost_batch_job_t batch;
+
+  if (nrefs < 0) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  if (nrefs == 0) {
+    return IMG_SUCCESS;
+  }
+  if ((ref_offset == NULL) || (ref_width == NULL) || (ref_height == NULL) ||
+      (ref_stride == NULL) || (dx == NULL) || (dy == NULL) ||
+      (bg == NULL) || (scale == NULL) || (cost == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  batch.type = type;
+  batch.raw_image = raw_image;
+  batch.raw_offset = raw_offset;
+  batch.raw_width = raw_width;
+  batch.raw_height = raw_height;
+  batch.raw_stride = raw_stride;
+  batch.nrefs = nrefs;
+  batch.ref_image = ref_image;
+  batch.ref_offset = ref_offset;
+  batch.ref_width = ref_width;
+  batch.ref_height = ref_height;
+  batch.ref_stride = ref_stride;
+  batch.dx = dx;
+  batch.dy = dy;
+  batch.bg = bg;
+  batch.scale = scale;
+  batch.cost = cost;
+  return img_parallel(img_get_num_bands(nrefs, 1), cost_batch_task, &batch);
+}
+
+/*---------------------------------------------------------------------------*/
+/* COST MAP */
+
+/* The cost for a given shift (DX,DY) writes:
+
+       COST = SUM_OV (B - A)^2 + SUM_NA A^2 + SUM_NB B^2
+
+   with A = RAW - BG, B = REF - BG, OV the overlapping region, NA (resp. NB)
+   the non-overlapping region of the raw (resp. reference) sub-image.  The
+   non-overlapping terms are obtained from the integral images of A^2 and B^2
+   as the totals minus the sums over the overlapping region.  For a large
+   window of shifts, the cost is better computed as:
+
+       COST = SUM A^2 + SUM B^2 - 2*SUM_OV A*B
+
+   where the cross-correlation SUM_OV A*B is computed for all shifts at once
+   by FFT. */
+
+/* Job to compute the rows of a cost map by the direct method. */
+typedef struct _cost_map_job cost_map_job_t;
+struct _cost_map_job {
+  const double *a, *b;   /* raw and reference sub-images minus background */
+  const double *sa, *sb; /* integral images of A^2 and B^2 */
+  double *cost;
+  double scale;
+  long raw_width, raw_height, ref_width, ref_height;
+  long dx0, dx1, dy0, dy1;
+};
+
+/* Compute the overlapping part [*I0,*I1) of intervals [0,RAW_LEN) and
+   [D,D+REF_LEN), return its length. */
+static long overlap(long d, long raw_len, long ref_len, long *i0, long *i1)
+{
+  long lo = (d > 0 ? d : 0);
+  long hi = (d + ref_len < raw_len ? d + ref_len : raw_len);
+  if (hi < lo) {
+    hi = lo;
+  }
+  *i0 = lo;
+  *i1 = hi;
+  return hi - lo;
+}
+
+/* Compute in S, an array of (WIDTH + 1)*(HEIGHT + 1) values, the integral
+   image of V^2: S[X + Y*(WIDTH + 1)] is the sum of V^2 for all pixels
+   before column X and before row Y. */
+static void integral_of_squares(const double v[], long width, long height,
+                                double s[])
+{
+  const long pitch = width + 1;
+  long x, y;
+  double t;
+
+  for (x = 0; x <= width; ++x) {
+    s[x] = 0.0;
+  }
+  for (y = 0; y < height; ++y) {
+    const double *row = v + y*width;
+    double *prev = s + y*pitch;
+    double *next = prev + pitch;
+    t = 0.0;
+    next[0] = 0.0;
+    for (x = 0; x < width; ++x) {
+      t += row[x]*row[x];
+      next[x + 1] = prev[x + 1] + t;
+    }
+  }
+}
+
+/* Sum of the squares in the rectangle [X0,X1)x[Y0,Y1) given the integral
+   image S of an image of width WIDTH. */
+static double sum_of_squares(const double s[], long width,
+                             long x0, long x1, long y0, long y1)
+{
+  const long pitch = width + 1;
+  return ((s[x1 + y1*pitch] - s[x0 + y1*pitch]) -
+          (s[x1 + y0*pitch] - s[x0 + y0*pitch]));
+}
+
+static int cost_map_task(void *data, long band, long nbands)
+{
+  const cost_map_job_t *job = (const cost_map_job_t *)data;
+  const long raw_width = job->raw_width, raw_height = job->raw_height;
+  const long ref_width = job->ref_width, ref_height = job->ref_height;
+  const long nx = job->dx1 - job->dx0 + 1;
+  const long ny = job->dy1 - job->dy0 + 1;
+  const double sa2 = job->sa[(raw_width + 1)*(raw_height + 1) - 1];
+  const double sb2 = job->sb[(ref_width + 1)*(ref_height + 1) - 1];
+  long j0 = IMG_BAND_START(band, nbands, ny);
+  long j1 = IMG_BAND_START(band + 1, nbands, ny);
+  long i, j, dx, dy, x, y, x0, x1, y0, y1, ow, oh;
+  double s, t, r, scale;
+
+  for (j = j0; j < j1; ++j) {
+    dy = job->dy0 + j;
+    oh = overlap(dy, raw_height, ref_height, &y0, &y1);
+    for (i = 0; i < nx; ++i) {
+      dx = job->dx0 + i;
+      ow = overlap(dx, raw_width, ref_width, &x0, &x1);
+      s = sa2 + sb2;
+      if (ow > 0 && oh > 0) {
+        for (y = y0; y < y1; ++y) {
+          const double *a = job->a + y*raw_width;
+          const double *b = job->b + (y - dy)*ref_width - dx;
+          r = 0.0;
+          for (x = x0; x < x1; ++x) {
+            t = b[x] - a[x];
+            r += t*t;
+          }
+          s += r;
+        }
+        s -= sum_of_squares(job->sa, raw_width, x0, x1, y0, y1);
+        s -= sum_of_squares(job->sb, ref_width, x0 - dx, x1 - dx,
+                            y0 - dy, y1 - dy);
+      }
+      scale = job->scale;
+      if (scale == 0.0) {
+        scale = 1.0/(double)(raw_width*raw_height + ref_width*ref_height
+                             - ow*oh);
+      }
+      job->cost[i + j*nx] = (s > 0.0 ? scale*s : 0.0);
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+/* In-place complex FFT of length N (a power of 2) of the N complex values
+   stored (real and imaginary parts interleaved) in Z.  The sign of the
+   exponent is that of SIGN, the result is not normalized. */
+static void fft(double z[], long n, int sign)
+{
+  const double pi = 3.14159265358979323846;
+  long i, j, k, m, step;
+  double ar, ai, br, bi, wr, wi, tr, ti, theta, s, c;
+
+  /* Bit reversal permutation. */
+  for (i = 1, j = 0; i < n; ++i) {
+    for (k = n >> 1; j & k; k >>= 1) {
+      j ^= k;
+    }
+    j |= k;
+    if (i < j) {
+      tr = z[2*i];     z[2*i] = z[2*j];         z[2*j] = tr;
+      ti = z[2*i + 1]; z[2*i + 1] = z[2*j + 1]; z[2*j + 1] = ti;
+    }
+  }
+
+  /* Butterflies. */
+  for (step = 1; step < n; step <<= 1) {
+    theta = sign*pi/(double)step;
+    s = sin(0.5*theta);
+    c = -2.0*s*s;       /* cos(theta) - 1 */
+    s = sin(theta);
+    wr = 1.0;
+    wi = 0.0;
+    for (m = 0; m < step; ++m) {
+      for (i = m; i < n; i += 2*step) {
+        j = i + step;
+        br = wr*z[2*j] - wi*z[2*j + 1];
+        bi = wr*z[2*j + 1] + wi*z[2*j];
+        ar = z[2*i];
+        ai = z[2*i + 1];
+        z[2*i] = ar + br;
+        z[2*i + 1] = ai + bi;
+        z[2*j] = ar - br;
+        z[2*j + 1] = ai - bi;
+      }
+      tr = wr;
+      wr += c*wr - s*wi;
+      wi += c*wi + s*tr;
+    }
+  }
+}
+
+/* 2-D complex FFT of a NX-by-NY array.  WS is a workspace of 2*NY values. */
+static void fft2d(double z[], long nx, long ny, int sign, double ws[])
+{
+  long x, y;
+
+  for (y = 0; y < ny; ++y) {
+    fft(z + 2*nx*y, nx, sign);
+  }
+  for (x = 0; x < nx; ++x) {
+    for (y = 0; y < ny; ++y) {
+      ws[2*y] = z[2*(x + nx*y)];
+      ws[2*y + 1] = z[2*(x + nx*y) + 1];
+    }
+    fft(ws, ny, sign);
+    for (y = 0; y < ny; ++y) {
+      z[2*(x + nx*y)] = ws[2*y];
+      z[2*(x + nx*y) + 1] = ws[2*y + 1];
+    }
+  }
+}
+
+static long next_power_of_two(long n)
+{
+  long p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+/* Compute the cost map by FFT.  Returns IMG_FAILURE if memory cannot be
+   allocated. */
+static int cost_map_fft(const cost_map_job_t *job, long px, long py)
+{
+  const long raw_width = job->raw_width, raw_height = job->raw_height;
+  const long ref_width = job->ref_width, ref_height = job->ref_height;
+  const long nx = job->dx1 - job->dx0 + 1;
+  const long ny = job->dy1 - job->dy0 + 1;
+  const double sa2 = job->sa[(raw_width + 1)*(raw_height + 1) - 1];
+  const double sb2 = job->sb[(ref_width + 1)*(ref_height + 1) - 1];
+  const double q = 0.25/((double)px*(double)py);
+  double *z, *ws, zr, zi, cr, ci, ar, ai, br, bi, s, scale;
+  long i, j, k, l, dx, dy, x, y, ow, oh, x0, x1, y0, y1;
+
+  z = (double *)malloc(2*(px*py + py)*sizeof(double));
+  if (z == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  ws = z + 2*px*py;
+
+  /* FFT of Z = A + i*B. */
+  for (k = 0; k < 2*px*py; ++k) {
+    z[k] = 0.0;
+  }
+  for (y = 0; y < raw_height; ++y) {
+    for (x = 0; x < raw_width; ++x) {
+      z[2*(x + px*y)] = job->a[x + raw_width*y];
+    }
+  }
+  for (y = 0; y < ref_height; ++y) {
+    for (x = 0; x < ref_width; ++x) {
+      z[2*(x + px*y) + 1] = job->b[x + ref_width*y];
+    }
+  }
+  fft2d(z, px, py, -1, ws);
+
+  /* Replace Z(k) by conj(B(k))*A(k) with A(k) = (Z(k) + conj(Z(-k)))/2 and
+     B(k) = (Z(k) - conj(Z(-k)))/(2*i), the two frequencies k and -k are
+     processed together. */
+  for (y = 0; y < py; ++y) {
+    for (x = 0; x < px; ++x) {
+      k = x + px*y;
+      l = ((px - x) & (px - 1)) + px*((py - y) & (py - 1));
+      if (l < k) {
+        continue;
+      }
+      zr = z[2*k];
+      zi = z[2*k + 1];
+      cr = z[2*l];
+      ci = -z[2*l + 1];
+      /* 2*A(k), 2*B(k) */
+      ar = zr + cr;
+      ai = zi + ci;
+      br = zi - ci;
+      bi = cr - zr;
+      /* 4*conj(B(k))*A(k), then the same for -k (A(-k) = conj(A(k)) and
+         B(-k) = conj(B(k))) */
+      z[2*k] = q*(br*ar + bi*ai);
+      z[2*k + 1] = q*(br*ai - bi*ar);
+      z[2*l] = z[2*k];
+      z[2*l + 1] = -z[2*k + 1];
+    }
+  }
+  fft2d(z, px, py, +1, ws);
+
+  /* Extract the cost map. */
+  for (j = 0; j < ny; ++j) {
+    dy = job->dy0 + j;
+    oh = overlap(dy, raw_height, ref_height, &y0, &y1);
+    for (i = 0; i < nx; ++i) {
+      dx = job->dx0 + i;
+      ow = overlap(dx, raw_width, ref_width, &x0, &x1);
+      s = sa2 + sb2;
+      if (ow > 0 && oh > 0) {
+        s -= 2.0*z[2*((dx & (px - 1)) + px*(dy & (py - 1)))];
+      }
+      scale = job->scale;
+      if (scale == 0.0) {
+        scale = 1.0/(double)(raw_width*raw_height + ref_width*ref_height
+                             - ow*oh);
+      }
+      job->cost[i + j*nx] = (s > 0.0 ? scale*s : 0.0);
+    }
+  }
+  free(z);
+  return IMG_SUCCESS;
+}
+
+/**
+ * @brief Compute quadratic differences between two sub-images for a window
+ *        of shifts.
+ *
+ * This function computes the same cost as img_cost_l2() for all shifts
+ * (dx,dy) such that \a dx_min <= dx <= \a dx_max and \a dy_min <= dy <= \a
+ * dy_max.  The costs are stored in \a cost, an array of nx*ny values with
+ * nx = \a dx_max - \a dx_min + 1 and ny = \a dy_max - \a dy_min + 1, the cost
+ * for the shift (dx,dy) being cost[(dx - dx_min) + (dy - dy_min)*nx].
+ *
+ * The non-overlapping regions are taken into account by means of the
+ * integral images of the squared differences to the background level, so
+ * that only the overlapping region has to be scanned for each shift.  For
+ * large windows, the costs are computed from the cross-correlation of the two
+ * sub-images by FFT, the computational time then barely depends on the
+ * number of shifts (the result is the same up to rounding errors).
+ *
+ * @param type        The type identifier of the images \a raw and \a ref.
+ * @param raw_image   Base address of the raw image.
+ * @param raw_offset  Offset (in number of pixels with respect to \a raw_image)
+ *                    of the first pixel of the raw sub-image.
+ * @param raw_width   Width of raw sub-image.
+ * @param raw_height  Height of raw sub-image.
+ * @param raw_stride  Elements per row of \a raw_image.
+ * @param ref_image   Base address of the reference image.
+ * @param ref_offset  Offset (in number of pixels with respect to \a ref_image)
+ *                    of the first pixel of the reference sub-image.
+ * @param ref_width   Width of reference sub-image.
+ * @param ref_height  Height of reference sub-image.
+ * @param ref_stride  Elements per row of \a ref_image.
+ * @param dx_min      Minimum X-position of reference sub-image with respect
+ *                    to raw sub-image.
+ * @param dx_max      Maximum X-position.
+ * @param dy_min      Minimum Y-position of reference sub-image with respect
+ *                    to raw sub-image.
+ * @param dy_max      Maximum Y-position.
+ * @param bg          Background level for pixels outside the overlapping
+ *                    region.
+ * @param scale       Scale factor, if \a scale = 0, the error is normalized
+ *                    by the total number of pixels in the overlapping region
+ *                    *and* non-overlapping regions.
+ * @param cost        The output cost map.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE (with \c errno set).
+ */
+int img_cost_l2_map(const int type,
+                    const void *raw_image,
+                    const long raw_offset,
+                    const long raw_width,
+                    const long raw_height,
+                    const long raw_stride,
+                    const void *ref_image,
+                    const long ref_offset,
+                    const long ref_width,
+                    const long ref_height,
+                    const long ref_stride,
+                    const long dx_min,
+                    const long dx_max,
+                    const long dy_min,
+                    const long dy_max,
+                    const double bg,
+                    const double scale,
+                    double cost[])
+{
+  void (*copy)(const void *src, long width, long height, long stride,
+               double bg, double dst[]);
+  cost_map_job_t job;
+  double *ws, direct, fast;
+  long i, j, x0, x1, px, py, wx, wy;
+  int status;
+
+  if ((raw_image == NULL) || (ref_image == NULL) || (cost == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
   if ((raw_width < 1) || (raw_height < 1) || (raw_stride < raw_width) ||
-      (ref_width < 1) || (ref_height < 1) || (ref_stride < ref_width)) {
+      (ref_width < 1) || (ref_height < 1) || (ref_stride < ref_width) ||
+      (dx_min > dx_max) || (dy_min > dy_max) || (scale < 0.0)) {
     errno = EINVAL;
-    return -1.0;
+    return IMG_FAILURE;
   }
 
-#define CASE(TYPE) case IMG_TYPE_##TYPE:                                \
-    result = COST_L2(TYPE)((const CPT_CTYPE(TYPE) *)raw_image,          \
-                           raw_offset, raw_width,                       \
-                           raw_height, raw_stride,                      \
-                           (const CPT_CTYPE(TYPE) *)ref_image,          \
-                           ref_offset, ref_width,                       \
-                           ref_height, ref_stride,                      \
-                           dx, dy, bg, scale);                          \
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                             \
+    copy = COST_COPY(TYPE);                                          \
+    raw_image = (const CPT_CTYPE(TYPE) *)raw_image + raw_offset;     \
+    ref_image = (const CPT_CTYPE(TYPE) *)ref_image + ref_offset;     \
   break
 
   switch (type) {
@@ -218,197 +946,159 @@ double img_cost_l2(const int type,
 #ifdef IMG_TYPE_DOUBLE
     CASE(DOUBLE);
 #endif
-    /*
-#ifdef IMG_TYPE_SCOMPLEX
-    CASE(SCOMPLEX);
-#endif
-#ifdef IMG_TYPE_DCOMPLEX
-    CASE(DCOMPLEX);
-#endif
-#ifdef IMG_TYPE_RGB
-    CASE(RGB);
-#endif
-#ifdef IMG_TYPE_RGBA
-    CASE(RGBA);
-#endif
-    */
   default:
     /* Bad pixel type. */
     errno = EINVAL;
-    result = -1.0;
+    return IMG_FAILURE;
   }
 
 #undef CASE
 
-  return result;
+  /* Sub-images minus the background and their integral images of squares
+     (in a single block). */
+  ws = (double *)malloc((raw_width*raw_height + ref_width*ref_height +
+                         (raw_width + 1)*(raw_height + 1) +
+                         (ref_width + 1)*(ref_height + 1))*sizeof(double));
+  if (ws == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  job.a = ws;
+  job.b = job.a + raw_width*raw_height;
+  job.sa = job.b + ref_width*ref_height;
+  job.sb = job.sa + (raw_width + 1)*(raw_height + 1);
+  copy(raw_image, raw_width, raw_height, raw_stride, bg, (double *)job.a);
+  copy(ref_image, ref_width, ref_height, ref_stride, bg, (double *)job.b);
+  integral_of_squares(job.a, raw_width, raw_height, (double *)job.sa);
+  integral_of_squares(job.b, ref_width, ref_height, (double *)job.sb);
+  job.cost = cost;
+  job.scale = scale;
+  job.raw_width = raw_width;
+  job.raw_height = raw_height;
+  job.ref_width = ref_width;
+  job.ref_height = ref_height;
+  job.dx0 = dx_min;
+  job.dx1 = dx_max;
+  job.dy0 = dy_min;
+  job.dy1 = dy_max;
+
+  /* Choose the fastest method: the number of operations of the direct
+   * method is proportional to the sum of the overlapping areas, that of
+   * the FFT method to N*log2(N) with N the number of pixels of the
+   * zero-padded arrays. */
+  wx = 0;
+  for (i = dx_min; i <= dx_max; ++i) {
+    wx += overlap(i, raw_width, ref_width, &x0, &x1);
+  }
+  wy = 0;
+  for (j = dy_min; j <= dy_max; ++j) {
+    wy += overlap(j, raw_height, ref_height, &x0, &x1);
+  }
+  direct = (double)wx*(double)wy;
+  px = next_power_of_two(raw_width + ref_width - 1);
+  py = next_power_of_two(raw_height + ref_height - 1);
+  fast = COST_FFT_FACTOR*(double)px*(double)py*log2((double)px*(double)py);
+  if (direct > fast) {
+    status = cost_map_fft(&job, px, py);
+  } else {
+    status = img_parallel(img_get_num_bands(dy_max - dy_min + 1, 1),
+                          cost_map_task, &job);
+  }
+  free(ws);
+  return status;
 }
 
 /*---------------------------------------------------------------------------*/
 
 #else /* _IMG_COST_C defined */
 
-double COST_L2(TYPE)(const pixel_t *raw_image,
-                     const long raw_offset,
-                     const long raw_width,
-                     const long raw_height,
-                     const long raw_stride,
-                     const pixel_t *ref_image,
-                     const long ref_offset,
-                     const long ref_width,
-                     const long ref_height,
-                     const long ref_stride,
-                     const long dx,
-                     const long dy,
-                     const double bg,
-                     double scale)
+/* Store in JOB->SUM[Y] the cost of row Y for all Y in [Y0,Y1), see the
+   definition of cost_job_t for the numbering of rows. */
+static void COST_L2(TYPE)(const cost_job_t *job, long y0, long y1)
 {
+  const pixel_t *raw_image = (const pixel_t *)job->raw_image;
+  const pixel_t *ref_image = (const pixel_t *)job->ref_image;
+  const double bg = job->bg;
+  const long raw_width = job->raw_width;
+  const long raw_height = job->raw_height;
+  const long raw_stride = job->raw_stride;
+  const long ref_width = job->ref_width;
+  const long ref_stride = job->ref_stride;
+  const long raw_x0 = job->raw_x0, raw_x1 = job->raw_x1;
+  const long raw_y0 = job->raw_y0, raw_y1 = job->raw_y1;
+  const long ref_x0 = job->ref_x0, ref_x1 = job->ref_x1;
+  const long ref_y0 = job->ref_y0, ref_y1 = job->ref_y1;
   double s;
-  long raw_x0, raw_x1, raw_y0, raw_y1;
-  long ref_x0, ref_x1, ref_y0, ref_y1;
-  long x, y, offset, temp;
-
-  raw_image += raw_offset;
-  ref_image += ref_offset;
-  s = 0;
-
-  /* Compute the bounding box coordinates of the overlapping region in the
-     reference and raw images.  The limits are X0 <= X < X1 and Y0 <= Y < Y1
-     that is (X0,Y0 inclusive and (X1,Y1) exclusive. */
-  if (dx >= 0) {
-    if ((raw_x0 = dx) >= raw_width) {
-      goto no_overlap;
-    }
-    ref_x0 = 0;
-  } else {
-    if ((ref_x0 = -dx) >= ref_width) {
-      goto no_overlap;
-    }
-    raw_x0 = 0;
-  }
-  if (dy >= 0) {
-    if ((raw_y0 = dy) >= raw_height) {
-      goto no_overlap;
-    }
-    ref_y0 = 0;
-  } else {
-    if ((ref_y0 = -dy) >= ref_height) {
-      goto no_overlap;
-    }
-    raw_y0 = 0;
-  }
-  if ((temp = ref_width + dx) <= raw_width) {
-    raw_x1 = temp;
-    ref_x1 = ref_width;
-  } else {
-    raw_x1 = raw_width;
-    ref_x1 = raw_width - dx;
-  }
-  if ((temp = ref_height + dy) <= raw_height) {
-    raw_y1 = temp;
-    ref_y1 = ref_height;
-  } else {
-    raw_y1 = raw_height;
-    ref_y1 = raw_height - dy;
-  }
+  long x, y, offset;
 
-  /* Integrate the cost in the overlapping region. */
   offset = (ref_x0 - raw_x0) + (ref_y0 - raw_y0)*ref_stride;
-  for (y = raw_y0; y < raw_y1; ++y) {
+  for (y = y0; y < y1 && y < raw_height; ++y) {
     const pixel_t *raw = raw_image + y*raw_stride;
-    const pixel_t *ref = ref_image + offset + y*ref_stride;
-    for (x = raw_x0; x < raw_x1; ++x) {
-      double a = (double)ref[x] - (double)raw[x];
-      s += a*a;
-    }
-  }
-
-  /* Integrate the cost in the non-overlapping regions of the raw
-     sub-image. */
-  for (y = 0; y < raw_y0; ++y) {
-    const pixel_t *raw = raw_image + y*raw_stride;
-    for (x = 0; x < raw_width; ++x) {
-      double a = raw[x] - bg;
-      s += a*a;
-    }
-  }
-  if (raw_x0 > 0 || raw_x1 < raw_width) {
-    for (y = raw_y0; y < raw_y1; ++y) {
-      const pixel_t *raw = raw_image + y*raw_stride;
+    s = 0.0;
+    if (raw_y0 <= y && y < raw_y1) {
+      /* Integrate the cost in the overlapping region and in the
+         non-overlapping regions of the row. */
+      const pixel_t *ref = ref_image + offset + y*ref_stride;
+      for (x = raw_x0; x < raw_x1; ++x) {
+        double a = (double)ref[x] - (double)raw[x];
+        s += a*a;
+      }
       for (x = 0; x < raw_x0; ++x) {
-	double a = raw[x] - bg;
-	s += a*a;
+        double a = raw[x] - bg;
+        s += a*a;
       }
       for (x = raw_x1; x < raw_width; ++x) {
-	double a = raw[x] - bg;
-	s += a*a;
+        double a = raw[x] - bg;
+        s += a*a;
+      }
+    } else {
+      /* Integrate the cost in a non-overlapping row. */
+      for (x = 0; x < raw_width; ++x) {
+        double a = raw[x] - bg;
+        s += a*a;
       }
     }
+    job->sum[y] = s;
   }
-  for (y = raw_y1; y < raw_height; ++y) {
-    const pixel_t *raw = raw_image + y*raw_stride;
-    for (x = 0; x < raw_width; ++x) {
-      double a = raw[x] - bg;
-      s += a*a;
-    }
-  }
-
-  /* Integrate the cost in the non-overlapping regions of the reference
-     sub-image. */
-  for (y = 0; y < ref_y0; ++y) {
-    const pixel_t *ref = ref_image + y*ref_stride;
-    for (x = 0; x < ref_width; ++x) {
-      double a = ref[x] - bg;
-      s += a*a;
-    }
-  }
-  if (ref_x0 > 0 || ref_x1 < ref_width) {
-    for (y = ref_y0; y < ref_y1; ++y) {
-      const pixel_t *ref = ref_image + y*ref_stride;
+  for (; y < y1; ++y) {
+    long ref_y = y - raw_height;
+    const pixel_t *ref = ref_image + ref_y*ref_stride;
+    s = 0.0;
+    if (ref_y0 <= ref_y && ref_y < ref_y1) {
+      /* Only integrate the cost in the non-overlapping regions of the
+         row. */
       for (x = 0; x < ref_x0; ++x) {
-	double a = ref[x] - bg;
-	s += a*a;
+        double a = ref[x] - bg;
+        s += a*a;
       }
       for (x = ref_x1; x < ref_width; ++x) {
-	double a = ref[x] - bg;
-	s += a*a;
+        double a = ref[x] - bg;
+        s += a*a;
+      }
+    } else {
+      for (x = 0; x < ref_width; ++x) {
+        double a = ref[x] - bg;
+        s += a*a;
       }
     }
+    job->sum[y] = s;
   }
-  for (y = ref_y1; y < ref_height; ++y) {
-    const pixel_t *ref = ref_image + y*ref_stride;
-    for (x = 0; x < ref_width; ++x) {
-      double a = ref[x] - bg;
-      s += a*a;
-    }
-  }
+}
 
-  if (scale == 0.0) {
-    scale = 1.0/(double)(raw_width*raw_height
-			 + ref_width*(ref_height - ref_y1 + ref_y0)
-			 + (ref_width - ref_x1 + ref_x0)*(ref_y1 - ref_y0));
-  }
-  return scale*s;
+/* Copy a sub-image into DST (a WIDTH-by-HEIGHT array of doubles) with BG
+   subtracted. */
+static void COST_COPY(TYPE)(const void *src, long width, long height,
+                            long stride, double bg, double dst[])
+{
+  long x, y;
 
-  /* The two sub-images are not overlapping. */
- no_overlap:
-  for (y = 0; y < raw_height; ++y) {
-    const pixel_t *pixel = raw_image + y*raw_stride;
-    for (x = 0; x < raw_width; ++x) {
-      double a = pixel[x] - bg;
-      s += a*a;
-    }
-  }
-  for (y = 0; y < ref_height; ++y) {
-    const pixel_t *pixel = ref_image + y*ref_stride;
-    for (x = 0; x < ref_width; ++x) {
-      double a = pixel[x] - bg;
-      s += a*a;
+  for (y = 0; y < height; ++y) {
+    const pixel_t *row = (const pixel_t *)src + y*stride;
+    for (x = 0; x < width; ++x) {
+      dst[x] = (double)row[x] - bg;
     }
+    dst += width;
   }
-  if (scale == 0.0) {
-    scale = 1.0/(double)(raw_width*raw_height + ref_width*ref_height);
-  }
-  return scale*s;
 }
 
 /* Undefine macro(s) that may be re-defined to avoid warnings. */
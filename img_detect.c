@@ -31,8 +31,11 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <math.h>
 #include "c_pseudo_template.h"
 #include "img.h"
+#include "img_context.h"
+#include "img_stats.h"
 
 #ifndef NULL
 # define NULL ((void *)0)
@@ -47,7 +50,50 @@
 #define index_t           int
 #define pixel_t           CPT_CTYPE(TYPE)
 #define real_t            CPT_CTYPE(REAL)
-#define DETECT_SPOT(TYPE) CPT_JOIN2(detect_spot_, CPT_ABBREV(TYPE))
+#define DETECT_SPOT(TYPE,REAL)                                          \
+  CPT_JOIN4(detect_spot_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define PUSH_ROWS(TYPE,REAL)                                            \
+  CPT_JOIN4(push_rows_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define FINISH(TYPE,REAL)                                               \
+  CPT_JOIN4(finish_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define FILTER(TYPE,REAL)                                               \
+  CPT_JOIN4(filter_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define DETECT_ROW(TYPE,REAL)                                           \
+  CPT_JOIN4(detect_row_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define DETECT_SPOT_FAST(TYPE,REAL)                                     \
+  CPT_JOIN4(detect_spot_fast_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define FILTER_ROW_VEC(TYPE,REAL)                                       \
+  CPT_JOIN4(filter_row_vec_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+#define DETECT_ROW_VEC(TYPE,REAL)                                       \
+  CPT_JOIN4(detect_row_vec_, CPT_ABBREV(TYPE), _, CPT_ABBREV(REAL))
+
+/* Streaming spot detector.  The image rows are converted into REAL_T values
+   and stored, with the rows of the filtered image, in cyclically permuted
+   rows of a workspace owned by the detector (see "Workspace" below).  After
+   R rows of the current frame have been received, IMG[2] is the row R-1 of
+   the clean image, IMG[1] and IMG[0] the two previous ones; FLT[2] is the
+   row R-2 of the filtered image, FLT[1] and FLT[0] the two previous ones.
+   ZERO is a row of zeros used beyond the edges of the frame.  The rows are
+   large enough for any REAL_T.  As in img_detect_spot(), REAL_T is a 32-bit
+   integer when EXACT is true, the coefficients and thresholds are then those
+   given by integer_filter(). */
+struct _img_spot_detector {
+  void *ws;       /* workspace for the rows */
+  void *img[3];
+  void *flt[3];
+  void *zero;
+  img_spot_t *spot; /* detected spots in current frame */
+  long nspots, maxspots; /* number of spots and size of SPOT */
+  long width;     /* width of the frames */
+  long nrows;     /* number of rows received in current frame */
+  int finished;   /* current frame has been finished */
+  int type;       /* pixel type */
+  int exact;      /* filter with 32-bit integers */
+  double c0, c1, c2, t0, t1, t2; /* filter and thresholds */
+};
+
+static int append_spot(img_spot_detector_t *det, long x, long y,
+                       double value);
 
 
 /*
@@ -112,6 +158,18 @@
  * Using 16-bit signed integers for pixels left enough dynamics to also
  * compute the convolution with the same data type.
  *
+ * In img_detect_spot(), the filter is computed with single precision floats
+ * for integer pixels of at most 32 bits and for float pixels, and with
+ * double precision floats otherwise.  For 8- and 16-bit integer pixels,
+ * when c0, c1 and c2 are integers and the filtered values cannot exceed
+ * INTEGER_FILTER_BOUND in magnitude, the filter is computed exactly with
+ * 32-bit integers and the thresholds are replaced by their integer part
+ * (which does not change the result of the comparisons (2)).  The detected
+ * spots are then those that would be obtained with exact arithmetic.  The
+ * single precision floating-point filter gives the same result if the
+ * filtered values cannot exceed 2^24 in magnitude and the thresholds are
+ * integers, because then all its computations are exact.
+ *
  *
  * In-line processing:
  * -------------------
@@ -362,36 +420,252 @@
     }                                           \
   } while (0)
 
+/*---------------------------------------------------------------------------*/
+/* VECTORIZED DETECTION */
+
+/*
+ * When the compiler targets SSE2, AVX2 or NEON, spots are detected by
+ * processing VLEN consecutive pixels of a row at once.  This is done for the
+ * pixel types whose filtered values are single precision floats or, with the
+ * integer filter (see img_detect_spot()), 32-bit integers.  Each row of the
+ * filtered image is computed first, then the rows of the filtered image are
+ * scanned for local maxima.  The first and last columns and rows, and the
+ * remaining pixels of a row which do not fill a vector, are processed by
+ * scalar code.  The operations are performed in the same order as in
+ * DETECT_SPOT (which is kept as a reference and used for other pixel types)
+ * so that the same spots are detected.  Define IMG_NO_SIMD at compile time to
+ * only use the scalar code.
+ *
+ * The macros below are the only part of the code which depends on the
+ * instruction set.  Macros VF* operate on vectors of floats (vfloat_t), VI*
+ * on vectors of 32-bit integers (vint_t):
+ *
+ *   VxSET1(a)      - vector with all elements set to A;
+ *   VxLOADU(p)     - load elements from P (unaligned);
+ *   VxSTOREU(p,a)  - store elements at P (unaligned);
+ *   VxADD(a,b)     - A + B;
+ *   VxMUL(a,b)     - A*B;
+ *   VxMAX(a,b)     - (A > B ? A : B);
+ *   VxGT(a,b)      - A > B, the result is a mask (vfmask_t or vimask_t);
+ *   VxAND(m1,m2)   - M1 and M2;
+ *   VxFLAGS(m)     - integers set to 1 (true) or 0 (false) from M;
+ *   VxCOUNT(n,m)   - add 1 to the integers of N where M is true;
+ *   VILOAD_<TYPE>(p), VFLOAD_<TYPE>(p) - load and convert pixels of type
+ *                    TYPE at P (only defined for supported types);
+ *   VISUM(n)       - sum of the elements of N (as a long integer).
+ */
+
+#if !defined(IMG_NO_SIMD) && defined(__AVX2__)
+# include <immintrin.h>
+# define VLEN 8
+# define vfloat_t  __m256
+# define vfmask_t  __m256
+# define vint_t    __m256i
+# define vimask_t  __m256i
+# define VFSET1(a)      _mm256_set1_ps(a)
+# define VFLOADU(p)     _mm256_loadu_ps(p)
+# define VFSTOREU(p,a)  _mm256_storeu_ps(p, a)
+# define VFADD(a,b)     _mm256_add_ps(a, b)
+# define VFMUL(a,b)     _mm256_mul_ps(a, b)
+# define VFMAX(a,b)     _mm256_max_ps(a, b)
+# define VFGT(a,b)      _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+# define VFAND(m1,m2)   _mm256_and_ps(m1, m2)
+# define VFFLAGS(m)     _mm256_srli_epi32(_mm256_castps_si256(m), 31)
+# define VFCOUNT(n,m)   _mm256_sub_epi32(n, _mm256_castps_si256(m))
+# define VISET1(a)      _mm256_set1_epi32(a)
+# define VILOADU(p)     _mm256_loadu_si256((const __m256i *)(p))
+# define VISTOREU(p,a)  _mm256_storeu_si256((__m256i *)(p), a)
+# define VIADD(a,b)     _mm256_add_epi32(a, b)
+# define VIMUL(a,b)     _mm256_mullo_epi32(a, b)
+# define VIMAX(a,b)     _mm256_max_epi32(a, b)
+# define VIGT(a,b)      _mm256_cmpgt_epi32(a, b)
+# define VIAND(m1,m2)   _mm256_and_si256(m1, m2)
+# define VIFLAGS(m)     _mm256_srli_epi32(m, 31)
+# define VICOUNT(n,m)   _mm256_sub_epi32(n, m)
+# define VILOAD_INT8(p)                                                 \
+  _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+# define VILOAD_UINT8(p)                                                \
+  _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+# define VILOAD_INT16(p)                                                \
+  _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(p)))
+# define VILOAD_UINT16(p)                                               \
+  _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p)))
+# define VFLOAD_INT8(p)   _mm256_cvtepi32_ps(VILOAD_INT8(p))
+# define VFLOAD_UINT8(p)  _mm256_cvtepi32_ps(VILOAD_UINT8(p))
+# define VFLOAD_INT16(p)  _mm256_cvtepi32_ps(VILOAD_INT16(p))
+# define VFLOAD_UINT16(p) _mm256_cvtepi32_ps(VILOAD_UINT16(p))
+# define VFLOAD_INT32(p)  _mm256_cvtepi32_ps(VILOADU(p))
+# define VFLOAD_FLOAT(p)  _mm256_loadu_ps(p)
+#elif !defined(IMG_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+# include <emmintrin.h>
+# ifdef __SSE4_1__
+#  include <smmintrin.h>
+# endif
+# define VLEN 4
+# define vfloat_t  __m128
+# define vfmask_t  __m128
+# define vint_t    __m128i
+# define vimask_t  __m128i
+# define VFSET1(a)      _mm_set1_ps(a)
+# define VFLOADU(p)     _mm_loadu_ps(p)
+# define VFSTOREU(p,a)  _mm_storeu_ps(p, a)
+# define VFADD(a,b)     _mm_add_ps(a, b)
+# define VFMUL(a,b)     _mm_mul_ps(a, b)
+# define VFMAX(a,b)     _mm_max_ps(a, b)
+# define VFGT(a,b)      _mm_cmpgt_ps(a, b)
+# define VFAND(m1,m2)   _mm_and_ps(m1, m2)
+# define VFFLAGS(m)     _mm_srli_epi32(_mm_castps_si128(m), 31)
+# define VFCOUNT(n,m)   _mm_sub_epi32(n, _mm_castps_si128(m))
+# define VISET1(a)      _mm_set1_epi32(a)
+# define VILOADU(p)     _mm_loadu_si128((const __m128i *)(p))
+# define VISTOREU(p,a)  _mm_storeu_si128((__m128i *)(p), a)
+# define VIADD(a,b)     _mm_add_epi32(a, b)
+# define VIGT(a,b)      _mm_cmpgt_epi32(a, b)
+# define VIAND(m1,m2)   _mm_and_si128(m1, m2)
+# define VIFLAGS(m)     _mm_srli_epi32(m, 31)
+# define VICOUNT(n,m)   _mm_sub_epi32(n, m)
+# ifdef __SSE4_1__
+#  define VIMUL(a,b)    _mm_mullo_epi32(a, b)
+#  define VIMAX(a,b)    _mm_max_epi32(a, b)
+# else
+/* SSE2 has neither 32-bit multiplication nor maximum of signed integers. */
+static __m128i vimul(__m128i a, __m128i b)
+{
+  __m128i p02 = _mm_mul_epu32(a, b);
+  __m128i p13 = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(p02, _MM_SHUFFLE(0,0,2,0)),
+                            _mm_shuffle_epi32(p13, _MM_SHUFFLE(0,0,2,0)));
+}
+static __m128i vimax(__m128i a, __m128i b)
+{
+  __m128i m = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+#  define VIMUL(a,b)    vimul(a, b)
+#  define VIMAX(a,b)    vimax(a, b)
+# endif
+static __m128i vload4u8(const void *p)
+{
+  int32_t val;
+  memcpy(&val, p, 4);
+  return _mm_cvtsi32_si128(val);
+}
+# define VILOAD_INT8(p)                                                 \
+  _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(),                \
+    _mm_unpacklo_epi8(_mm_setzero_si128(), vload4u8(p))), 24)
+# define VILOAD_UINT8(p)                                                \
+  _mm_unpacklo_epi16(_mm_unpacklo_epi8(vload4u8(p), _mm_setzero_si128()), \
+                     _mm_setzero_si128())
+# define VILOAD_INT16(p)                                                \
+  _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(),                \
+    _mm_loadl_epi64((const __m128i *)(p))), 16)
+# define VILOAD_UINT16(p)                                               \
+  _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(p)),             \
+                     _mm_setzero_si128())
+# define VFLOAD_INT8(p)   _mm_cvtepi32_ps(VILOAD_INT8(p))
+# define VFLOAD_UINT8(p)  _mm_cvtepi32_ps(VILOAD_UINT8(p))
+# define VFLOAD_INT16(p)  _mm_cvtepi32_ps(VILOAD_INT16(p))
+# define VFLOAD_UINT16(p) _mm_cvtepi32_ps(VILOAD_UINT16(p))
+# define VFLOAD_INT32(p)  _mm_cvtepi32_ps(VILOADU(p))
+# define VFLOAD_FLOAT(p)  _mm_loadu_ps(p)
+#elif !defined(IMG_NO_SIMD) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define VLEN 4
+# define vfloat_t  float32x4_t
+# define vfmask_t  uint32x4_t
+# define vint_t    int32x4_t
+# define vimask_t  uint32x4_t
+# define VFSET1(a)      vdupq_n_f32(a)
+# define VFLOADU(p)     vld1q_f32(p)
+# define VFSTOREU(p,a)  vst1q_f32(p, a)
+# define VFADD(a,b)     vaddq_f32(a, b)
+# define VFMUL(a,b)     vmulq_f32(a, b)
+# define VFMAX(a,b)     vbslq_f32(vcgtq_f32(a, b), a, b)
+# define VFGT(a,b)      vcgtq_f32(a, b)
+# define VFAND(m1,m2)   vandq_u32(m1, m2)
+# define VFFLAGS(m)     vreinterpretq_s32_u32(vshrq_n_u32(m, 31))
+# define VFCOUNT(n,m)   vsubq_s32(n, vreinterpretq_s32_u32(m))
+# define VISET1(a)      vdupq_n_s32(a)
+# define VILOADU(p)     vld1q_s32((const int32_t *)(p))
+# define VISTOREU(p,a)  vst1q_s32((int32_t *)(p), a)
+# define VIADD(a,b)     vaddq_s32(a, b)
+# define VIMUL(a,b)     vmulq_s32(a, b)
+# define VIMAX(a,b)     vmaxq_s32(a, b)
+# define VIGT(a,b)      vcgtq_s32(a, b)
+# define VIAND(m1,m2)   vandq_u32(m1, m2)
+# define VIFLAGS(m)     VFFLAGS(m)
+# define VICOUNT(n,m)   VFCOUNT(n, m)
+# define VILOAD_INT16(p)  vmovl_s16(vld1_s16((const int16_t *)(p)))
+# define VILOAD_UINT16(p)                                               \
+  vreinterpretq_s32_u32(vmovl_u16(vld1_u16((const uint16_t *)(p))))
+# define VFLOAD_INT16(p)  vcvtq_f32_s32(VILOAD_INT16(p))
+# define VFLOAD_UINT16(p) vcvtq_f32_s32(VILOAD_UINT16(p))
+# define VFLOAD_INT32(p)  vcvtq_f32_s32(VILOADU(p))
+# define VFLOAD_FLOAT(p)  vld1q_f32(p)
+#endif
+
+#ifdef VLEN
+static long visum(vint_t n)
+{
+  int32_t buf[VLEN];
+  int k;
+  long sum = 0;
+  VISTOREU(buf, n);
+  for (k = 0; k < VLEN; ++k) sum += buf[k];
+  return sum;
+}
+# define VISUM(n) visum(n)
+#endif
+
+/* Largest magnitude of the values of the filter with integer coefficients
+   (see img_detect_spot()). */
+#define INTEGER_FILTER_BOUND 536870912.0 /* 2^29 */
+
 /*---------------------------------------------------------------------------*/
 /* Manage to include this file with a different data type each time. */
 
 #if defined(IMG_TYPE_INT8)
 # define TYPE INT8
 # define REAL FLOAT
+# ifdef VFLOAD_INT8
+#  define VLOAD_PIXELS VFLOAD_INT8
+# endif
 # include __FILE__
 #endif
 
 #if defined(IMG_TYPE_UINT8)
 # define TYPE UINT8
 # define REAL FLOAT
+# ifdef VFLOAD_UINT8
+#  define VLOAD_PIXELS VFLOAD_UINT8
+# endif
 # include __FILE__
 #endif
 
 #if defined(IMG_TYPE_INT16)
 # define TYPE INT16
 # define REAL FLOAT
+# ifdef VFLOAD_INT16
+#  define VLOAD_PIXELS VFLOAD_INT16
+# endif
 # include __FILE__
 #endif
 
 #if defined(IMG_TYPE_UINT16)
 # define TYPE UINT16
 # define REAL FLOAT
+# ifdef VFLOAD_UINT16
+#  define VLOAD_PIXELS VFLOAD_UINT16
+# endif
 # include __FILE__
 #endif
 
 #if defined(IMG_TYPE_INT32)
 # define TYPE INT32
 # define REAL FLOAT
+# ifdef VFLOAD_INT32
+#  define VLOAD_PIXELS VFLOAD_INT32
+# endif
 # include __FILE__
 #endif
 
@@ -416,6 +690,9 @@
 #if defined(IMG_TYPE_FLOAT)
 # define TYPE FLOAT
 # define REAL FLOAT
+# ifdef VFLOAD_FLOAT
+#  define VLOAD_PIXELS VFLOAD_FLOAT
+# endif
 # include __FILE__
 #endif
 
@@ -425,6 +702,49 @@
 # include __FILE__
 #endif
 
+/* Detection with integer filter coefficients and 32-bit integer
+   arithmetic. */
+
+#if defined(IMG_TYPE_INT8)
+# define TYPE INT8
+# define REAL INT32
+# define INTEGER_FILTER
+# ifdef VILOAD_INT8
+#  define VLOAD_PIXELS VILOAD_INT8
+# endif
+# include __FILE__
+#endif
+
+#if defined(IMG_TYPE_UINT8)
+# define TYPE UINT8
+# define REAL INT32
+# define INTEGER_FILTER
+# ifdef VILOAD_UINT8
+#  define VLOAD_PIXELS VILOAD_UINT8
+# endif
+# include __FILE__
+#endif
+
+#if defined(IMG_TYPE_INT16)
+# define TYPE INT16
+# define REAL INT32
+# define INTEGER_FILTER
+# ifdef VILOAD_INT16
+#  define VLOAD_PIXELS VILOAD_INT16
+# endif
+# include __FILE__
+#endif
+
+#if defined(IMG_TYPE_UINT16)
+# define TYPE UINT16
+# define REAL INT32
+# define INTEGER_FILTER
+# ifdef VILOAD_UINT16
+#  define VLOAD_PIXELS VILOAD_UINT16
+# endif
+# include __FILE__
+#endif
+
 #if defined(IMG_TYPE_SCOMPLEX) && 0
 # define TYPE SCOMPLEX
 # include __FILE__
@@ -445,13 +765,80 @@
 # include __FILE__
 #endif
 
+/* Check whether the filter can be computed with 32-bit integers for pixels
+   of type TYPE and store the integer coefficients and thresholds in Q. */
+static int integer_filter(const int type,
+                          const double c0, const double c1, const double c2,
+                          const double t0, const double t1, const double t2,
+                          int32_t q[6])
+{
+  double amax, bound, c[3], t[3];
+  int k;
+
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+  case IMG_TYPE_INT8:
+    amax = 128.0;
+    break;
+#endif
+#ifdef IMG_TYPE_UINT8
+  case IMG_TYPE_UINT8:
+    amax = 255.0;
+    break;
+#endif
+#ifdef IMG_TYPE_INT16
+  case IMG_TYPE_INT16:
+    amax = 32768.0;
+    break;
+#endif
+#ifdef IMG_TYPE_UINT16
+  case IMG_TYPE_UINT16:
+    amax = 65535.0;
+    break;
+#endif
+  default:
+    return 0;
+  }
+  c[0] = c0;
+  c[1] = c1;
+  c[2] = c2;
+  t[0] = t0;
+  t[1] = t1;
+  t[2] = t2;
+  for (k = 0; k < 3; ++k) {
+    if (! (fabs(c[k]) <= INTEGER_FILTER_BOUND) || floor(c[k]) != c[k] ||
+        t[k] != t[k]) {
+      return 0;
+    }
+  }
+  bound = amax*(fabs(c0) + 4.0*fabs(c1) + 4.0*fabs(c2));
+  if (bound > INTEGER_FILTER_BOUND) {
+    return 0;
+  }
+  for (k = 0; k < 3; ++k) {
+    q[k] = (int32_t)c[k];
+    /* Filtered values and their differences are in [-2*BOUND,2*BOUND]. */
+    if (t[k] >= 2.0*bound) {
+      q[k+3] = (int32_t)(2.0*bound);
+    } else if (t[k] < -2.0*bound) {
+      q[k+3] = -(int32_t)(2.0*bound) - 1;
+    } else {
+      q[k+3] = (int32_t)floor(t[k]);
+    }
+  }
+  return 1;
+}
+
 int img_detect_spot(const void* src, const int type,
                     const int width, const long height,
                     const double c0, const double c1, const double c2,
                     const double t0, const double t1, const double t2,
                     int dst[], long* count_ptr, double* ws)
 {
+  int32_t q[6];
   long count;
+  int exact;
+  IMG_STATS_TIMER(tic)
 
   /* Check arguments and initialization. */
   if (dst == NULL || src == NULL || ws == NULL) {
@@ -462,47 +849,60 @@ int img_detect_spot(const void* src, const int type,
     errno = EINVAL;
     goto failure;
   }
+  IMG_STATS_START(tic);
 #ifdef CLEAR_RESULT_FIRST
   memset(dst, 0, width*height*sizeof(dst[0]));
 #endif
 
-#define CASE(TYPE)                                                      \
-  case IMG_TYPE_##TYPE:                                                 \
-    count = DETECT_SPOT(TYPE)((const CPT_CTYPE(TYPE)*)src,              \
+  exact = integer_filter(type, c0, c1, c2, t0, t1, t2, q);
+
+#define CALL(TYPE,REAL,c0,c1,c2,t0,t1,t2)                               \
+  DETECT_SPOT_FAST(TYPE,REAL)((const CPT_CTYPE(TYPE)*)src,              \
                               width, height, c0, c1, c2, t0, t1, t2,    \
-                              dst, (void*)ws);                          \
+                              dst, (void*)ws)
+#define CASE(TYPE,REAL)                                                 \
+  case IMG_TYPE_##TYPE:                                                 \
+    count = CALL(TYPE, REAL, c0, c1, c2, t0, t1, t2);                   \
+    break
+#define CASE_INTEGER(TYPE)                                              \
+  case IMG_TYPE_##TYPE:                                                 \
+    if (exact) {                                                        \
+      count = CALL(TYPE, INT32, q[0], q[1], q[2], q[3], q[4], q[5]);    \
+    } else {                                                            \
+      count = CALL(TYPE, FLOAT, c0, c1, c2, t0, t1, t2);                \
+    }                                                                   \
     break
 
   switch (type) {
 #ifdef IMG_TYPE_INT8
-    CASE(INT8);
+    CASE_INTEGER(INT8);
 #endif
 #ifdef IMG_TYPE_UINT8
-    CASE(UINT8);
+    CASE_INTEGER(UINT8);
 #endif
 #ifdef IMG_TYPE_INT16
-    CASE(INT16);
+    CASE_INTEGER(INT16);
 #endif
 #ifdef IMG_TYPE_UINT16
-    CASE(UINT16);
+    CASE_INTEGER(UINT16);
 #endif
 #ifdef IMG_TYPE_INT32
-    CASE(INT32);
+    CASE(INT32, FLOAT);
 #endif
 #ifdef IMG_TYPE_UINT32
-    CASE(UINT32);
+    CASE(UINT32, FLOAT);
 #endif
 #ifdef IMG_TYPE_INT64
-    CASE(INT64);
+    CASE(INT64, DOUBLE);
 #endif
 #ifdef IMG_TYPE_UINT64
-    CASE(UINT64);
+    CASE(UINT64, DOUBLE);
 #endif
 #ifdef IMG_TYPE_FLOAT
-    CASE(FLOAT);
+    CASE(FLOAT, FLOAT);
 #endif
 #ifdef IMG_TYPE_DOUBLE
-    CASE(DOUBLE);
+    CASE(DOUBLE, DOUBLE);
 #endif
     /*
 #ifdef IMG_TYPE_SCOMPLEX
@@ -524,7 +924,10 @@ int img_detect_spot(const void* src, const int type,
   }
 
 #undef CASE
+#undef CASE_INTEGER
+#undef CALL
 
+  IMG_STATS_STOP(IMG_STATS_DETECT_SPOT, tic, width*height);
   if (count_ptr != NULL) {
     *count_ptr = count;
   }
@@ -537,10 +940,438 @@ failure:
   return IMG_FAILURE;
 }
 
+/**
+ * @brief Detect spots with a workspace context.
+ *
+ * This function is the same as img_detect_spot() for an image of the type
+ * and dimensions of the context \a ctx, the workspace of 3 rows being taken
+ * from the context.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ *
+ * @see img_context_new(), img_detect_spot().
+ */
+int img_context_detect_spot(img_context_t *ctx, const void *src,
+                            const double c0, const double c1,
+                            const double c2, const double t0,
+                            const double t1, const double t2,
+                            int dst[], long *count)
+{
+  double *ws;
+
+  if (ctx == NULL) {
+    errno = EFAULT;
+    if (count != NULL) {
+      *count = -1L;
+    }
+    return IMG_FAILURE;
+  }
+  IMG_CONTEXT_SET_PHASE(ctx, IMG_STATS_DETECT_SPOT);
+  ws = (double *)img_context_buffer(ctx, 0, 3*ctx->width*sizeof(double));
+  if (ws == NULL) {
+    if (count != NULL) {
+      *count = -1L;
+    }
+    return IMG_FAILURE;
+  }
+  return img_detect_spot(src, ctx->type, ctx->width, ctx->height,
+                         c0, c1, c2, t0, t1, t2, dst, count, ws);
+}
+
+/**
+ * @brief Create a new streaming spot detector.
+ *
+ * The streaming spot detector applies the same filtering and detection as
+ * img_detect_spot() (with the same integer filter for 8- and 16-bit pixels
+ * and integer coefficients) but the rows of the frames are provided by
+ * chunks as they are acquired (see img_spot_detector_push()) and the
+ * detected spots are stored in a list (see img_spot_detector_get_spots()).
+ * The detector owns its workspace (7 rows of pixels) and its list of
+ * spots, which are re-used for every frame.
+ *
+ * @param type        The pixel type of the frames.
+ * @param width       The width of the frames.
+ * @param c0          The weight of the central pixel in the filter.
+ * @param c1          The weight of the edge pixels in the filter.
+ * @param c2          The weight of the corner pixels in the filter.
+ * @param t0          The absolute detection threshold.
+ * @param t1          The detection threshold with respect to edge pixels.
+ * @param t2          The detection threshold with respect to corner pixels.
+ *
+ * @return A new spot detector or \c NULL on error with \c errno set.
+ *
+ * @see img_spot_detector_destroy(), img_detect_spot().
+ */
+img_spot_detector_t *img_spot_detector_new(const int type,
+                                           const long width,
+                                           const double c0,
+                                           const double c1,
+                                           const double c2,
+                                           const double t0,
+                                           const double t1,
+                                           const double t2)
+{
+  img_spot_detector_t *det;
+  size_t size;
+  char *ws;
+  int32_t q[6];
+  int j;
+
+  switch (type) {
+#define CASE(TYPE) case IMG_TYPE_##TYPE: break
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+#undef CASE
+  default:
+    errno = EINVAL;
+    return NULL;
+  }
+  if (width < 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  det = (img_spot_detector_t *)malloc(sizeof(img_spot_detector_t));
+  if (det == NULL) {
+    return NULL;
+  }
+  size = width*sizeof(double);
+  ws = (char *)calloc(7, size);
+  if (ws == NULL) {
+    free(det);
+    return NULL;
+  }
+  for (j = 0; j < 3; ++j) {
+    det->img[j] = ws + j*size;
+    det->flt[j] = ws + (j + 3)*size;
+  }
+  det->zero = ws + 6*size;
+  det->ws = ws;
+  det->spot = NULL;
+  det->nspots = 0;
+  det->maxspots = 0;
+  det->width = width;
+  det->nrows = 0;
+  det->finished = 0;
+  det->type = type;
+  det->exact = integer_filter(type, c0, c1, c2, t0, t1, t2, q);
+  if (det->exact) {
+    det->c0 = q[0];
+    det->c1 = q[1];
+    det->c2 = q[2];
+    det->t0 = q[3];
+    det->t1 = q[4];
+    det->t2 = q[5];
+  } else {
+    det->c0 = c0;
+    det->c1 = c1;
+    det->c2 = c2;
+    det->t0 = t0;
+    det->t1 = t1;
+    det->t2 = t2;
+  }
+  return det;
+}
+
+/**
+ * @brief Destroy a streaming spot detector.
+ *
+ * @param det   The spot detector (can be \c NULL).
+ *
+ * @see img_spot_detector_new().
+ */
+void img_spot_detector_destroy(img_spot_detector_t *det)
+{
+  if (det != NULL) {
+    free(det->ws);
+    if (det->spot != NULL) {
+      free(det->spot);
+    }
+    free(det);
+  }
+}
+
+/**
+ * @brief Provide rows of a frame to a streaming spot detector.
+ *
+ * This function gives the next \a nrows rows of the current frame to the
+ * spot detector \a det.  The spots in a row are detected as soon as the two
+ * next rows have been received.  If the previous frame has been finished
+ * (see img_spot_detector_finish()), a new frame is started and the list of
+ * spots is emptied.
+ *
+ * @param det     The spot detector.
+ * @param src     The address of the first pixel of the rows.
+ * @param stride  The number of pixels between successive rows in \a src.
+ * @param nrows   The number of rows to process.
+ *
+ * @return The number of spots detected so far in the current frame, or -1
+ *         on error with \c errno set.
+ *
+ * @see img_spot_detector_finish(), img_spot_detector_get_spots().
+ */
+long img_spot_detector_push(img_spot_detector_t *det, const void *src,
+                            const long stride, const long nrows)
+{
+  int status;
+
+  if (det == NULL || (src == NULL && nrows > 0)) {
+    errno = EFAULT;
+    return -1L;
+  }
+  if (nrows < 0 || (stride < det->width && nrows > 1)) {
+    errno = EINVAL;
+    return -1L;
+  }
+  if (det->finished) {
+    det->finished = 0;
+    det->nrows = 0;
+    det->nspots = 0;
+  }
+
+#define CALL(TYPE,REAL)                                                 \
+  PUSH_ROWS(TYPE,REAL)(det, (const CPT_CTYPE(TYPE) *)src, stride, nrows)
+#define CASE(TYPE,REAL)                                                 \
+  case IMG_TYPE_##TYPE:                                                 \
+    status = CALL(TYPE, REAL);                                          \
+    break
+#define CASE_INTEGER(TYPE)                                              \
+  case IMG_TYPE_##TYPE:                                                 \
+    status = (det->exact ? CALL(TYPE, INT32) : CALL(TYPE, FLOAT));      \
+    break
+
+  switch (det->type) {
+#ifdef IMG_TYPE_INT8
+    CASE_INTEGER(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE_INTEGER(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE_INTEGER(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE_INTEGER(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32, FLOAT);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32, FLOAT);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64, DOUBLE);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64, DOUBLE);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT, FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE, DOUBLE);
+#endif
+  default:
+    errno = EINVAL;
+    status = IMG_FAILURE;
+  }
+
+#undef CASE
+#undef CASE_INTEGER
+#undef CALL
+
+  return (status == IMG_SUCCESS ? det->nspots : -1L);
+}
+
+/**
+ * @brief Finish the current frame of a streaming spot detector.
+ *
+ * This function completes the detection of spots in the last row of the
+ * frame for which no more rows are given.  The list of spots of the frame
+ * is available until the next call to img_spot_detector_push().
+ *
+ * @param det     The spot detector.
+ *
+ * @return The number of spots detected in the frame, or -1 on error with
+ *         \c errno set.
+ *
+ * @see img_spot_detector_push(), img_spot_detector_get_spots().
+ */
+long img_spot_detector_finish(img_spot_detector_t *det)
+{
+  int status;
+
+  if (det == NULL) {
+    errno = EFAULT;
+    return -1L;
+  }
+  if (det->finished) {
+    return det->nspots;
+  }
+
+#define CASE(TYPE,REAL)                                 \
+  case IMG_TYPE_##TYPE:                                 \
+    status = FINISH(TYPE,REAL)(det);                    \
+    break
+#define CASE_INTEGER(TYPE)                              \
+  case IMG_TYPE_##TYPE:                                 \
+    status = (det->exact ? FINISH(TYPE,INT32)(det) :    \
+              FINISH(TYPE,FLOAT)(det));                 \
+    break
+
+  switch (det->type) {
+#ifdef IMG_TYPE_INT8
+    CASE_INTEGER(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE_INTEGER(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE_INTEGER(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE_INTEGER(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32, FLOAT);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32, FLOAT);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64, DOUBLE);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64, DOUBLE);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT, FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE, DOUBLE);
+#endif
+  default:
+    errno = EINVAL;
+    status = IMG_FAILURE;
+  }
+
+#undef CASE
+#undef CASE_INTEGER
+
+  if (status != IMG_SUCCESS) {
+    return -1L;
+  }
+  det->finished = 1;
+  return det->nspots;
+}
+
+/**
+ * @brief Get the spots detected by a streaming spot detector.
+ *
+ * @param det      The spot detector.
+ * @param number   The address to store the number of spots (can be \c
+ *                 NULL).
+ *
+ * @return The address of the list of spots detected so far in the current
+ *         (or last finished) frame, in raster order.  The list is owned by
+ *         the detector and is valid until the next call to
+ *         img_spot_detector_push() or img_spot_detector_destroy().
+ */
+const img_spot_t *img_spot_detector_get_spots(const img_spot_detector_t *det,
+                                              long *number)
+{
+  if (det == NULL) {
+    errno = EFAULT;
+    if (number != NULL) *number = 0;
+    return NULL;
+  }
+  if (number != NULL) *number = det->nspots;
+  return det->spot;
+}
+
+static int append_spot(img_spot_detector_t *det, long x, long y,
+                       double value)
+{
+  img_spot_t *spot;
+
+  if (det->nspots >= det->maxspots) {
+    long n = (det->maxspots < 64 ? 64 : 2*det->maxspots);
+    spot = (img_spot_t *)realloc(det->spot, n*sizeof(img_spot_t));
+    if (spot == NULL) {
+      return IMG_FAILURE;
+    }
+    det->spot = spot;
+    det->maxspots = n;
+  }
+  spot = &det->spot[det->nspots++];
+  spot->x = x;
+  spot->y = y;
+  spot->value = value;
+  return IMG_SUCCESS;
+}
+
 
 #else /* _IMG_DETECT_C defined */
 
-static long DETECT_SPOT(TYPE)(const pixel_t src[],
+/* Vector operations for REAL_T values. */
+#ifdef VLOAD_PIXELS
+# ifdef INTEGER_FILTER
+#  define vreal_t         vint_t
+#  define vmask_t         vimask_t
+#  define VSET1(a)        VISET1(a)
+#  define VLOADU(p)       VILOADU(p)
+#  define VSTOREU(p,a)    VISTOREU(p, a)
+#  define VADD(a,b)       VIADD(a, b)
+#  define VMUL(a,b)       VIMUL(a, b)
+#  define VMAX(a,b)       VIMAX(a, b)
+#  define VGT(a,b)        VIGT(a, b)
+#  define VAND(m1,m2)     VIAND(m1, m2)
+#  define VFLAGS(m)       VIFLAGS(m)
+#  define VCOUNT(n,m)     VICOUNT(n, m)
+# else
+#  define vreal_t         vfloat_t
+#  define vmask_t         vfmask_t
+#  define VSET1(a)        VFSET1(a)
+#  define VLOADU(p)       VFLOADU(p)
+#  define VSTOREU(p,a)    VFSTOREU(p, a)
+#  define VADD(a,b)       VFADD(a, b)
+#  define VMUL(a,b)       VFMUL(a, b)
+#  define VMAX(a,b)       VFMAX(a, b)
+#  define VGT(a,b)        VFGT(a, b)
+#  define VAND(m1,m2)     VFAND(m1, m2)
+#  define VFLAGS(m)       VFFLAGS(m)
+#  define VCOUNT(n,m)     VFCOUNT(n, m)
+# endif
+#endif
+
+static long DETECT_SPOT(TYPE,REAL)(const pixel_t src[],
                               const index_t width,
                               const index_t height,
                               const real_t c0,
@@ -552,7 +1383,6 @@ static long DETECT_SPOT(TYPE)(const pixel_t src[],
                               int dst[],
                               void* ws)
 {
-  const pixel_t* img0;
   const pixel_t* img1;
   const pixel_t* img2;
   const pixel_t* img3;
@@ -582,17 +1412,17 @@ static long DETECT_SPOT(TYPE)(const pixel_t src[],
 #define ymin 1
   ymax = height - 2;
 
-  /* Initialization of row pointers. */
-  img0 = src;
-  img1 = img0 + width;
+  /* Initialization of row pointers (they are permuted at the beginning of
+     each iteration). */
+  img1 = src;
   img2 = img1 + width;
   img3 = img2 + width;
   flt0 = (real_t*)ws;
   flt1 = flt0 + width;
-  flt2 = flt1 + width*2;
+  flt2 = flt1 + width;
 
   /* Compute the 2 first rows of the filtered image. */
-  FILTER_ROW_BOT(flt1, img0, img1, img2);
+  FILTER_ROW_BOT(flt1, NULL, img1, img2);
   FILTER_ROW_MID(flt2, img1, img2, img3);
 #ifndef CLEAR_RESULT_FIRST
   for (y = 0; y < ymin; ++y) {
@@ -602,7 +1432,7 @@ static long DETECT_SPOT(TYPE)(const pixel_t src[],
 
   for (y = ymin; y <= ymax; ++y) {
     /* Permute the rows of the image and of the filtered image. */
-    PUSH4(img0, img1, img2, img3, img3 + width);
+    PUSH3(img1, img2, img3, img3 + width);
     ROLL3(tmp_ptr, flt0, flt1, flt2);
 
     /* Initialize variables for the start of a row. */
@@ -684,7 +1514,339 @@ static long DETECT_SPOT(TYPE)(const pixel_t src[],
   return count;
 }
 
+#ifdef VLOAD_PIXELS
+
+/* Compute row F of the filtered image given the rows I0, I1 and I2 of the
+   image at Y-1, Y and Y+1 which are all inside the image. */
+static void FILTER_ROW_VEC(TYPE,REAL)(real_t f[], const pixel_t i0[],
+                                 const pixel_t i1[], const pixel_t i2[],
+                                 const index_t width, const real_t c0,
+                                 const real_t c1, const real_t c2)
+{
+  const vreal_t vc0 = VSET1(c0);
+  const vreal_t vc1 = VSET1(c1);
+  const vreal_t vc2 = VSET1(c2);
+  vreal_t vl, vc, vr, hl, hc, hr;
+  real_t s1, s2, s3, s4, s5, s6;
+  index_t x, last = width - 1;
+
+  /* First column. */
+  s2 = (real_t)i0[0] + (real_t)i2[0];
+  s3 = (real_t)i0[1] + (real_t)i2[1];
+  s5 = (real_t)i1[0];
+  s6 = (real_t)i1[1];
+  f[0] = CNVL_BEG;
+
+  /* Columns such that all the neighbours of a vector are inside the row
+     (VL, VC and VR are the vertical sums of the left, central and right
+     neighbours; HL, HC and HR are the corresponding pixels of row Y). */
+  for (x = 1; x + VLEN <= last; x += VLEN) {
+    vl = VADD(VLOAD_PIXELS(&i0[x-1]), VLOAD_PIXELS(&i2[x-1]));
+    vc = VADD(VLOAD_PIXELS(&i0[x]),   VLOAD_PIXELS(&i2[x]));
+    vr = VADD(VLOAD_PIXELS(&i0[x+1]), VLOAD_PIXELS(&i2[x+1]));
+    hl = VLOAD_PIXELS(&i1[x-1]);
+    hc = VLOAD_PIXELS(&i1[x]);
+    hr = VLOAD_PIXELS(&i1[x+1]);
+    VSTOREU(&f[x], VADD(VADD(VMUL(hc, vc0),
+                             VMUL(VADD(VADD(vc, hl), hr), vc1)),
+                        VMUL(VADD(vl, vr), vc2)));
+  }
+
+  /* Remaining columns. */
+  s2 = (real_t)i0[x-1] + (real_t)i2[x-1];
+  s3 = (real_t)i0[x] + (real_t)i2[x];
+  s5 = (real_t)i1[x-1];
+  s6 = (real_t)i1[x];
+  for (; x < last; ++x) {
+    PUSH3(s1, s2, s3, (real_t)i0[x+1] + (real_t)i2[x+1]);
+    PUSH3(s4, s5, s6, (real_t)i1[x+1]);
+    f[x] = CNVL_MID;
+  }
+  f[last] = CNVL_END;
+}
+
+/* Mark the spots in row DST of the detection map given the rows F0, F1 and
+   F2 at Y-1, Y and Y+1 of the filtered image.  Returns the number of spots
+   in the row. */
+static long DETECT_ROW_VEC(TYPE,REAL)(int dst[], const real_t f0[],
+                                 const real_t f1[], const real_t f2[],
+                                 const index_t width, const real_t t0,
+                                 const real_t t1, const real_t t2)
+{
+  const vreal_t vt0 = VSET1(t0);
+  const vreal_t vt1 = VSET1(t1);
+  const vreal_t vt2 = VSET1(t2);
+  vreal_t ml, mc, mr, q1, q2, v5;
+  vmask_t hit;
+  vint_t n = VISET1(0);
+  real_t m1, m2, m3, m4, m5, m6;
+  index_t x, xmax = width - 2;
+  long count;
+
+  for (x = 1; x + VLEN <= xmax + 1; x += VLEN) {
+    ml = VMAX(VLOADU(&f0[x-1]), VLOADU(&f2[x-1]));
+    mc = VMAX(VLOADU(&f0[x]),   VLOADU(&f2[x]));
+    mr = VMAX(VLOADU(&f0[x+1]), VLOADU(&f2[x+1]));
+    v5 = VLOADU(&f1[x]);
+    /* Operands in the order of the scalar code, VMAX yields its second
+       operand and "if (m2 < m6) m2 = m6" keeps m2 if any is a NaN. */
+    q1 = VMAX(VLOADU(&f1[x+1]), VMAX(mc, VLOADU(&f1[x-1])));
+    q2 = VMAX(ml, mr);
+    hit = VAND(VAND(VGT(v5, vt0), VGT(v5, VADD(q1, vt1))),
+               VGT(v5, VADD(q2, vt2)));
+    VISTOREU(&dst[x], VFLAGS(hit));
+    n = VCOUNT(n, hit);
+  }
+  count = VISUM(n);
+  for (; x <= xmax; ++x) {
+    m1 = (f2[x-1] < f0[x-1] ? f0[x-1] : f2[x-1]);
+    m2 = (f2[x]   < f0[x]   ? f0[x]   : f2[x]);
+    m3 = (f2[x+1] < f0[x+1] ? f0[x+1] : f2[x+1]);
+    m4 = f1[x-1];
+    m5 = f1[x];
+    m6 = f1[x+1];
+    if (m5 > t0) {
+      m2 = MAX(m2, m4);
+      if (m2 < m6) m2 = m6;
+      if (m5 > m2 + t1 && m5 > MAX(m1, m3) + t2) {
+        dst[x] = 1;
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+static long DETECT_SPOT_FAST(TYPE,REAL)(const pixel_t src[],
+                                   const index_t width,
+                                   const index_t height,
+                                   const real_t c0,
+                                   const real_t c1,
+                                   const real_t c2,
+                                   const real_t t0,
+                                   const real_t t1,
+                                   const real_t t2,
+                                   int dst[],
+                                   void* ws)
+{
+  const pixel_t* img1;
+  const pixel_t* img2;
+  const pixel_t* img3;
+  real_t* tmp_ptr;
+  real_t* flt0;
+  real_t* flt1;
+  real_t* flt2;
+  real_t s1, s2, s3, s4, s5, s6;
+  long count;
+  index_t y, ymax;
+
+  if (width < VLEN + 2 || height < 3) {
+    return DETECT_SPOT(TYPE,REAL)(src, width, height, c0, c1, c2,
+                             t0, t1, t2, dst, ws);
+  }
+  ymax = height - 2;
+  img1 = src;
+  img2 = img1 + width;
+  img3 = img2 + width;
+  flt0 = (real_t*)ws;
+  flt1 = flt0 + width;
+  flt2 = flt1 + width;
+  FILTER_ROW_BOT(flt1, NULL, img1, img2);
+  FILTER_ROW_MID(flt2, img1, img2, img3);
+#ifndef CLEAR_RESULT_FIRST
+  memset(dst, 0, width*sizeof(dst[0]));
+#endif
+  count = 0L;
+  for (y = 1; y <= ymax; ++y) {
+    PUSH3(img1, img2, img3, img3 + width);
+    ROLL3(tmp_ptr, flt0, flt1, flt2);
+    if (y < ymax) {
+      FILTER_ROW_VEC(TYPE,REAL)(flt2, img1, img2, img3, width, c0, c1, c2);
+    } else {
+      FILTER_ROW_TOP(flt2, img1, img2, NULL);
+    }
+#ifndef CLEAR_RESULT_FIRST
+    memset(&dst[y*width], 0, width*sizeof(dst[0]));
+#endif
+    count += DETECT_ROW_VEC(TYPE,REAL)(&dst[y*width], flt0, flt1, flt2,
+                                  width, t0, t1, t2);
+  }
+#ifndef CLEAR_RESULT_FIRST
+  memset(&dst[(ymax + 1)*width], 0, width*sizeof(dst[0]));
+#endif
+  return count;
+}
+
+#else /* VLOAD_PIXELS not defined */
+
+static long DETECT_SPOT_FAST(TYPE,REAL)(const pixel_t src[],
+                                   const index_t width,
+                                   const index_t height,
+                                   const real_t c0,
+                                   const real_t c1,
+                                   const real_t c2,
+                                   const real_t t0,
+                                   const real_t t1,
+                                   const real_t t2,
+                                   int dst[],
+                                   void* ws)
+{
+  return DETECT_SPOT(TYPE,REAL)(src, width, height, c0, c1, c2,
+                           t0, t1, t2, dst, ws);
+}
+
+#endif /* VLOAD_PIXELS */
+
+/* Compute row F of the filtered image given the rows I0, I1 and I2 of the
+   clean image at Y-1, Y and Y+1 (rows beyond the edges are zero).  The
+   operations are the same as in DETECT_SPOT. */
+static void FILTER(TYPE,REAL)(real_t f[], const real_t i0[],
+                              const real_t i1[], const real_t i2[],
+                              const long width, const real_t c0,
+                              const real_t c1, const real_t c2)
+{
+  real_t s1, s2, s3, s4, s5, s6;
+  long x, last = width - 1;
+
+  s2 = i0[0] + i2[0];
+  s3 = i0[1] + i2[1];
+  s5 = i1[0];
+  s6 = i1[1];
+  f[0] = CNVL_BEG;
+  for (x = 1; x < last; ++x) {
+    PUSH3(s1, s2, s3, i0[x+1] + i2[x+1]);
+    PUSH3(s4, s5, s6, i1[x+1]);
+    f[x] = CNVL_MID;
+  }
+  f[last] = CNVL_END;
+}
+
+/* Detect the spots in row Y of the filtered image given its rows F0, F1 and
+   F2 at Y-1, Y and Y+1. */
+static int DETECT_ROW(TYPE,REAL)(img_spot_detector_t *det,
+                                 const real_t f0[], const real_t f1[],
+                                 const real_t f2[], const long y)
+{
+  const real_t zero = 0;
+  const real_t t0 = det->t0;
+  const real_t t1 = det->t1;
+  const real_t t2 = det->t2;
+  real_t m1, m2, m3, m4, m5, m6, q1, q2, fnew;
+  long x, xmax = det->width - 2;
+
+  m1 = zero;
+  m2 = MAX(f0[0], f2[0]);
+  m3 = MAX(f0[1], f2[1]);
+  m4 = zero;
+  m5 = f1[0];
+  m6 = f1[1];
+  for (x = 1; x <= xmax; ++x) {
+    fnew = f2[x+1];
+    if (fnew < f0[x+1]) {
+      fnew = f0[x+1];
+    }
+    PUSH3(m1, m2, m3, fnew);
+    PUSH3(m4, m5, m6, f1[x+1]);
+    if (m5 > t0) {
+      q1 = MAX(m2, m4);
+      if (q1 < m6) q1 = m6;
+      if (m5 > q1 + t1) {
+        q2 = MAX(m1, m3);
+        if (m5 > q2 + t2 &&
+            append_spot(det, x, y, m5) != IMG_SUCCESS) {
+          return IMG_FAILURE;
+        }
+      }
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+static int PUSH_ROWS(TYPE,REAL)(img_spot_detector_t *det,
+                                const pixel_t src[], const long stride,
+                                const long nrows)
+{
+  const real_t c0 = det->c0;
+  const real_t c1 = det->c1;
+  const real_t c2 = det->c2;
+  const long width = det->width;
+  void *tmp;
+  real_t *dst;
+  long k, r, x;
+
+  for (k = 0; k < nrows; ++k, src += stride) {
+    r = det->nrows++; /* index of the new row in the frame */
+    if (width < 3) {
+      continue;
+    }
+    ROLL3(tmp, det->img[0], det->img[1], det->img[2]);
+    dst = (real_t *)det->img[2];
+    for (x = 0; x < width; ++x) {
+      dst[x] = (real_t)src[x];
+    }
+    if (r >= 1) {
+      /* Compute row R-1 of the filtered image. */
+      ROLL3(tmp, det->flt[0], det->flt[1], det->flt[2]);
+      FILTER(TYPE,REAL)((real_t *)det->flt[2],
+                        (const real_t *)(r >= 2 ? det->img[0] : det->zero),
+                        (const real_t *)det->img[1],
+                        (const real_t *)det->img[2],
+                        width, c0, c1, c2);
+    }
+    if (r >= 3 &&
+        DETECT_ROW(TYPE,REAL)(det, (const real_t *)det->flt[0],
+                              (const real_t *)det->flt[1],
+                              (const real_t *)det->flt[2],
+                              r - 2) != IMG_SUCCESS) {
+      return IMG_FAILURE;
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+static int FINISH(TYPE,REAL)(img_spot_detector_t *det)
+{
+  const long height = det->nrows;
+  void *tmp;
+
+  if (det->width < 3 || height < 2) {
+    return IMG_SUCCESS;
+  }
+
+  /* Compute the last row of the filtered image. */
+  ROLL3(tmp, det->flt[0], det->flt[1], det->flt[2]);
+  FILTER(TYPE,REAL)((real_t *)det->flt[2],
+                    (const real_t *)det->img[1],
+                    (const real_t *)det->img[2],
+                    (const real_t *)det->zero,
+                    det->width, det->c0, det->c1, det->c2);
+  if (height >= 3) {
+    return DETECT_ROW(TYPE,REAL)(det, (const real_t *)det->flt[0],
+                                 (const real_t *)det->flt[1],
+                                 (const real_t *)det->flt[2],
+                                 height - 2);
+  }
+  return IMG_SUCCESS;
+}
+
+#ifdef VLOAD_PIXELS
+# undef vreal_t
+# undef vmask_t
+# undef VSET1
+# undef VLOADU
+# undef VSTOREU
+# undef VADD
+# undef VMUL
+# undef VMAX
+# undef VGT
+# undef VAND
+# undef VFLAGS
+# undef VCOUNT
+#endif
+
 #undef TYPE
 #undef REAL
+#undef VLOAD_PIXELS
+#undef INTEGER_FILTER
 
 #endif /* _IMG_DETECT_C */
@@ -28,8 +28,11 @@
 
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include "img.h"
+#include "img_thread.h"
 
 #ifndef NULL
 # define NULL ((void *)0)
@@ -43,6 +46,452 @@
 
 #define pixel_t    CPT_CTYPE(TYPE)
 
+/* Minimum number of rows per band for parallel processing. */
+#define LINEAR_MIN_ROWS 16
+
+/* Number of sub-pixel phases at which the interpolation kernels are
+   tabulated (the interpolated position is rounded to the nearest phase). */
+#define LINEAR_NPHASES 1024
+
+/* Largest size of the interpolation kernels. */
+#define LINEAR_MAX_KSIZE 6
+
+/* Job to extract a rectangular region by bands of rows of the destination
+   image.  EXTRACT is used for bi-linear interpolation, otherwise RESAMPLE is
+   used with the kernel KER tabulated at LINEAR_NPHASES + 1 phases (KSIZE
+   weights per phase).  For a separable coordinate transform, COL[XP] (resp.
+   ROW[YP]) is the index of the first source column (row) for the
+   destination column XP (row YP) and COL_PHASE[XP] (ROW_PHASE[YP]) the
+   offset of the weights in KER; COL_MIN and COL_MAX are the range of the
+   columns to interpolate along the rows, and WSLEN the size of the
+   workspace for each band. */
+typedef struct _linear_job linear_job_t;
+struct _linear_job {
+  void (*extract)(const void *src, const long src_offset,
+                  const long src_width, const long src_height,
+                  const long src_pitch, void *dst, const long dst_offset,
+                  const long dst_width, const long dst_pitch,
+                  const long dst_y0, const long dst_y1, const double a[6]);
+  void (*resample)(const linear_job_t *job, const long dst_y0,
+                   const long dst_y1, double ws[]);
+  const void *src;
+  void *dst;
+  const double *a;
+  const double *ker;
+  const long *col, *col_phase, *row, *row_phase;
+  long src_offset, src_width, src_height, src_pitch;
+  long dst_offset, dst_width, dst_height, dst_pitch;
+  long ksize, col_min, col_max, wslen;
+};
+
+static int linear_task(void *data, long band, long nbands)
+{
+  linear_job_t *job = (linear_job_t *)data;
+  long y0 = IMG_BAND_START(band, nbands, job->dst_height);
+  long y1 = IMG_BAND_START(band + 1, nbands, job->dst_height);
+
+  if (job->resample != NULL) {
+    double *ws = NULL;
+    if (job->wslen > 0) {
+      ws = (double *)malloc(job->wslen*sizeof(double));
+      if (ws == NULL) {
+        errno = ENOMEM;
+        return IMG_FAILURE;
+      }
+    }
+    job->resample(job, y0, y1, ws);
+    if (ws != NULL) {
+      free(ws);
+    }
+  } else {
+    job->extract(job->src, job->src_offset, job->src_width, job->src_height,
+                 job->src_pitch, job->dst, job->dst_offset, job->dst_width,
+                 job->dst_pitch, y0, y1, job->a);
+  }
+  return IMG_SUCCESS;
+}
+
+/* Keys cubic convolution kernel (with a = -1/2). */
+static double cubic_kernel(double t)
+{
+  t = fabs(t);
+  if (t <= 1.0) {
+    return (1.5*t - 2.5)*t*t + 1.0;
+  } else if (t < 2.0) {
+    return ((-0.5*t + 2.5)*t - 4.0)*t + 2.0;
+  }
+  return 0.0;
+}
+
+/* Lanczos kernel of order 3. */
+static double lanczos3_kernel(double t)
+{
+  const double pi = 3.14159265358979323846;
+  double q;
+
+  t = fabs(t);
+  if (t < 1e-8) {
+    return 1.0;
+  } else if (t < 3.0) {
+    q = pi*t;
+    return 3.0*sin(q)*sin(q/3.0)/(q*q);
+  }
+  return 0.0;
+}
+
+/* Tabulate the interpolation kernel of KSIZE weights at the phases T =
+   P/LINEAR_NPHASES for P = 0, ..., LINEAR_NPHASES.  The K-th weight of a
+   given phase applies to the source pixel at FLOOR(X) - KSIZE/2 + 1 + K when
+   interpolating at X = FLOOR(X) + T.  The weights of each phase are
+   normalized so that their sum is 1. */
+static void tabulate_kernel(double ker[], double (*kernel)(double),
+                            const long ksize)
+{
+  double *w, t, sum;
+  long k, p;
+
+  for (p = 0; p <= LINEAR_NPHASES; ++p) {
+    w = &ker[p*ksize];
+    t = (double)p/(double)LINEAR_NPHASES + (double)(ksize/2 - 1);
+    sum = 0.0;
+    for (k = 0; k < ksize; ++k) {
+      w[k] = kernel(t - (double)k);
+      sum += w[k];
+    }
+    for (k = 0; k < ksize; ++k) {
+      w[k] /= sum;
+    }
+  }
+}
+
+/* Compute the index of the first pixel KSIZE and the offset of the weights
+   in the kernel table to interpolate at position X along a dimension of
+   LENGTH pixels.  Positions outside the image are limited so that the
+   indices are in the range [1 - KSIZE, LENGTH - 1]: the interpolated value
+   does not change as all pixels indices beyond the edges are replaced by
+   the nearest edge. */
+static void locate_taps(double x, const long length, const long ksize,
+                        long *first, long *phase)
+{
+  double xmin = (double)(-ksize), xmax = (double)(length + ksize);
+  double ix;
+  long p;
+
+  if (x < xmin) {
+    x = xmin;
+  } else if (x > xmax) {
+    x = xmax;
+  }
+  ix = floor(x);
+  p = (long)((x - ix)*LINEAR_NPHASES + 0.5);
+  *first = (long)ix - ksize/2 + 1;
+  if (*first < 1 - ksize) {
+    *first = 1 - ksize;
+  } else if (*first > length - 1) {
+    *first = length - 1;
+  }
+  *phase = p*ksize;
+}
+
+/*
+ * Rotation by three shears.  When the inverse coordinate transform is a
+ * rotation: x = t + M.p with M = [c, -s; s, c], M is decomposed as (Paeth):
+ *
+ *     M = X(alpha).Y(beta).X(alpha)
+ *
+ * with X(alpha) = [1, alpha; 0, 1], Y(beta) = [1, 0; beta, 1], alpha =
+ * -s/(1 + c) and beta = s.  The destination image D is then computed from
+ * the (infinitely extended) source image E in three passes, each one being a
+ * 1-D interpolation with a fixed fractional offset for a given row (first
+ * and last passes) or column (second pass):
+ *
+ *     G1(vx,vy) = E(vx + alpha*vy + tx - alpha*ty, vy)
+ *     G2(ux,uy) = G1(ux, beta*ux + uy + ty)
+ *     D(xp,yp)  = G2(xp + alpha*yp, yp)
+ *
+ * The intermediate images G1 and G2 are only computed for the columns
+ * XMIN to XMIN + WIDTH - 1, the rows YMIN to YMIN + HEIGHT - 1 (G1) and 0
+ * to DST_HEIGHT - 1 (G2) needed by the next pass.  If c < 0, the rotation is
+ * written as M = -M' with c' = -c > 0 and the source is read in reverse
+ * order (SIGN = -1) to keep |alpha| <= 1.
+ */
+typedef struct _shear_job shear_job_t;
+struct _shear_job {
+  void (*first_pass)(const shear_job_t *job, long r0, long r1);
+  void (*last_pass)(const shear_job_t *job, long r0, long r1);
+  const linear_job_t *lin; /* source, destination and kernel */
+  double *g1, *g2;         /* intermediate images */
+  long *row, *row_phase;   /* first row and phase for each column of G2 */
+  double alpha, beta, tx;  /* shears and offset of the first pass */
+  long xmin, width, ymin, height;
+  int sign, pass;
+};
+
+/* Find the first pixel and the phase of the kernel weights to interpolate
+   at position X (no limits are imposed). */
+static void shear_taps(const double x, const long ksize,
+                       long *first, long *phase)
+{
+  double ix = floor(x);
+  *first = (long)ix - ksize/2 + 1;
+  *phase = (long)((x - ix)*LINEAR_NPHASES + 0.5)*ksize;
+}
+
+/* Second pass: interpolate along the columns of G1. */
+static void shear_second_pass(const shear_job_t *job, long r0, long r1)
+{
+  const double *ker = job->lin->ker;
+  const long ksize = job->lin->ksize;
+  const long width = job->width;
+  const double *w, *g;
+  double *g2, s;
+  long i, k, uy;
+
+  for (uy = r0; uy < r1; ++uy) {
+    g2 = job->g2 + uy*width;
+    for (i = 0; i < width; ++i) {
+      w = ker + job->row_phase[i];
+      g = job->g1 + (job->row[i] + uy)*width + i;
+      s = 0.0;
+      for (k = 0; k < ksize; ++k, g += width) {
+        s += w[k]*(*g);
+      }
+      g2[i] = s;
+    }
+  }
+}
+
+static int shear_task(void *data, long band, long nbands)
+{
+  shear_job_t *job = (shear_job_t *)data;
+  long nrows = (job->pass == 1 ? job->height : job->lin->dst_height);
+  long r0 = IMG_BAND_START(band, nbands, nrows);
+  long r1 = IMG_BAND_START(band + 1, nbands, nrows);
+
+  if (job->pass == 1) {
+    job->first_pass(job, r0, r1);
+  } else if (job->pass == 2) {
+    shear_second_pass(job, r0, r1);
+  } else {
+    job->last_pass(job, r0, r1);
+  }
+  return IMG_SUCCESS;
+}
+
+/* Check whether the inverse coordinate transform B is a rotation. */
+static int is_rotation(const double b[6])
+{
+  const double eps = 1e-12;
+  return (fabs(b[1] - b[5]) <= eps && fabs(b[2] + b[4]) <= eps &&
+          fabs(b[1]*b[1] + b[4]*b[4] - 1.0) <= eps);
+}
+
+/* Apply the rotation B by three shears (see above). */
+static int shear_rotate(const linear_job_t *lin, const double b[6],
+                        void (*first_pass)(const shear_job_t *job,
+                                           long r0, long r1),
+                        void (*last_pass)(const shear_job_t *job,
+                                          long r0, long r1))
+{
+  shear_job_t job;
+  const long ksize = lin->ksize;
+  const long dst_width = lin->dst_width;
+  const long dst_height = lin->dst_height;
+  double c, s, tx, ty;
+  long f0, f1, i, p, xmax, ymax;
+  size_t size;
+  int pass, status;
+
+  if (b[1] >= 0.0) {
+    job.sign = 1;
+    c = b[1];
+    s = b[4];
+    tx = b[0];
+    ty = b[3];
+  } else {
+    job.sign = -1;
+    c = -b[1];
+    s = -b[4];
+    tx = -b[0];
+    ty = -b[3];
+  }
+  job.alpha = -s/(1.0 + c);
+  job.beta = s;
+  job.tx = tx - job.alpha*ty;
+  job.first_pass = first_pass;
+  job.last_pass = last_pass;
+  job.lin = lin;
+
+  /* Columns of G2 (and G1) needed by the last pass. */
+  shear_taps(0.0, ksize, &f0, &p);
+  shear_taps(job.alpha*(double)(dst_height - 1), ksize, &f1, &p);
+  job.xmin = (f0 < f1 ? f0 : f1);
+  xmax = (f0 > f1 ? f0 : f1) + dst_width + ksize - 2;
+  job.width = xmax - job.xmin + 1;
+
+  /* Rows of G1 needed by the second pass. */
+  shear_taps(job.beta*(double)job.xmin + ty, ksize, &f0, &p);
+  shear_taps(job.beta*(double)xmax + ty, ksize, &f1, &p);
+  job.ymin = (f0 < f1 ? f0 : f1);
+  ymax = (f0 > f1 ? f0 : f1) + dst_height + ksize - 2;
+  job.height = ymax - job.ymin + 1;
+
+  size = (job.height + dst_height)*job.width*sizeof(double) +
+    2*job.width*sizeof(long);
+  job.g1 = (double *)malloc(size);
+  if (job.g1 == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  job.g2 = job.g1 + job.height*job.width;
+  job.row = (long *)(job.g2 + dst_height*job.width);
+  job.row_phase = job.row + job.width;
+  for (i = 0; i < job.width; ++i) {
+    shear_taps(job.beta*(double)(job.xmin + i) + ty, ksize,
+               &job.row[i], &job.row_phase[i]);
+    job.row[i] -= job.ymin;
+  }
+
+  status = IMG_SUCCESS;
+  for (pass = 1; pass <= 3 && status == IMG_SUCCESS; ++pass) {
+    job.pass = pass;
+    status = img_parallel(img_get_num_bands(pass == 1 ? job.height :
+                                            dst_height, LINEAR_MIN_ROWS),
+                          shear_task, &job);
+  }
+  free(job.g1);
+  return status;
+}
+
+/* Find the span of destination pixels XA to XB - 1 of a row for which the
+   bi-linear interpolation at X = AXX*XP + BX and Y = AYX*XP + BY only
+   involves pixels inside the source image; that is, 0 <= X < X_MAX and 0 <=
+   Y < Y_MAX.  As X and Y are monotonic functions of XP (even with rounding
+   errors), the span is first estimated and then adjusted by checking its
+   ends with the same expressions as in the interpolation loop. */
+static void interior_span(double axx, double bx, double x_max,
+                          double ayx, double by, double y_max,
+                          long width, long *xa_ptr, long *xb_ptr)
+{
+  double t0, t1, tmin, tmax;
+  long xa, xb;
+
+#define INSIDE(xp) (axx*(double)(xp) + bx >= 0.0 &&    \
+                    axx*(double)(xp) + bx < x_max &&    \
+                    ayx*(double)(xp) + by >= 0.0 &&     \
+                    ayx*(double)(xp) + by < y_max)
+
+  tmin = 0.0;
+  tmax = (double)width;
+  if (axx != 0.0) {
+    t0 = -bx/axx;
+    t1 = (x_max - bx)/axx;
+    if (t0 > t1) {
+      double t = t0; t0 = t1; t1 = t;
+    }
+    if (t0 > tmin) tmin = t0;
+    if (t1 < tmax) tmax = t1;
+  } else if (bx < 0.0 || bx >= x_max) {
+    tmax = tmin;
+  }
+  if (ayx != 0.0) {
+    t0 = -by/ayx;
+    t1 = (y_max - by)/ayx;
+    if (t0 > t1) {
+      double t = t0; t0 = t1; t1 = t;
+    }
+    if (t0 > tmin) tmin = t0;
+    if (t1 < tmax) tmax = t1;
+  } else if (by < 0.0 || by >= y_max) {
+    tmax = tmin;
+  }
+  if (! (tmin < tmax)) {
+    /* Empty (or not a number). */
+    *xa_ptr = *xb_ptr = width;
+    return;
+  }
+  xa = (long)ceil(tmin);
+  xb = (long)ceil(tmax);
+  if (xb > width) {
+    xb = width;
+  }
+  while (xa < xb && ! INSIDE(xa)) {
+    ++xa;
+  }
+  while (xa > 0 && xa < xb && INSIDE(xa - 1)) {
+    --xa;
+  }
+  while (xb > xa && ! INSIDE(xb - 1)) {
+    --xb;
+  }
+  while (xb < width && xb > xa && INSIDE(xb)) {
+    ++xb;
+  }
+  if (xa >= xb) {
+    xa = xb = width;
+  }
+  *xa_ptr = xa;
+  *xb_ptr = xb;
+
+#undef INSIDE
+}
+
+/* Number of bits of the fractional part of the fixed-point weights used to
+   remap 8-bit integer images.  The sums along the rows are divided by
+   2^REMAP_SHIFT before being combined along the columns so that all
+   computations fit in 32-bit integers (for kernels whose sum of absolute
+   weights is less than 2). */
+#define REMAP_BITS  14
+#define REMAP_SHIFT  7
+
+/* A remap plan stores the first source column COL[I] and row ROW[I] of the
+   interpolation taps and the offsets COL_PHASE[I] and ROW_PHASE[I] of their
+   weights in the kernel tables KER (floating-point) and QKER (fixed-point
+   with REMAP_BITS fractional bits).  Index I is XP + YP*DST_WIDTH for a
+   general remapping; for a separable remapping, the column taps are indexed
+   by XP and the row taps by YP, COL_MIN and COL_MAX are then the range of
+   source columns needed by the interpolation along the rows. */
+struct _img_remap_plan {
+  double *ker;
+  int32_t *qker;
+  int32_t *col, *row;
+  uint16_t *col_phase, *row_phase;
+  long src_width, src_height, dst_width, dst_height, ksize;
+  long col_min, col_max;
+  int separable;
+};
+
+typedef struct _remap_job remap_job_t;
+struct _remap_job {
+  void (*remap)(const remap_job_t *job, const long dst_y0,
+                const long dst_y1, void *ws);
+  const img_remap_plan_t *plan;
+  const void *src;
+  void *dst;
+  long src_offset, src_pitch, dst_offset, dst_pitch, wslen;
+};
+
+static int remap_task(void *data, long band, long nbands)
+{
+  remap_job_t *job = (remap_job_t *)data;
+  long y0 = IMG_BAND_START(band, nbands, job->plan->dst_height);
+  long y1 = IMG_BAND_START(band + 1, nbands, job->plan->dst_height);
+  void *ws = NULL;
+
+  if (job->wslen > 0) {
+    ws = malloc(job->wslen*sizeof(double));
+    if (ws == NULL) {
+      errno = ENOMEM;
+      return IMG_FAILURE;
+    }
+  }
+  job->remap(job, y0, y1, ws);
+  if (ws != NULL) {
+    free(ws);
+  }
+  return IMG_SUCCESS;
+}
+
 /* Manage to include this file with a different data type each time.  The
    handling of "int" is special as "int" can be the same as "short" or "long"
    depending on the compiler. */
@@ -124,7 +573,8 @@
  *
  * This function extracts a rectangular region of size \a dst_width by
  * \a dst_height with a linear change of coordinates by means of bi-linear
- * interpolation.  The coordinate transform is given by the coefficients
+ * interpolation (see img_extract_rectangle_with_interp() for other
+ * interpolation methods).  The coordinate transform is given by the coefficients
  * \a a.  If \a inverse is false, the coefficients are those of the direct
  * transform:
  * @code
@@ -168,7 +618,8 @@
  *         to \c EINVAL if one of the other arguments is invalid or if
  *         the linear transform is singular.
  *
- * @see img_inverse_linear_transform(), img_copy().
+ * @see img_extract_rectangle_with_interp(), img_inverse_linear_transform(),
+ *      img_copy().
  */
 int img_extract_rectangle(const void *src,
                           const int src_type,
@@ -185,7 +636,68 @@ int img_extract_rectangle(const void *src,
                           const double a[6],
                           int inverse)
 {
-  double b[6];
+  return img_extract_rectangle_with_interp(src, src_type, src_offset,
+                                           src_width, src_height, src_pitch,
+                                           dst, dst_type, dst_offset,
+                                           dst_width, dst_height, dst_pitch,
+                                           a, inverse, IMG_INTERP_LINEAR);
+}
+
+/**
+ * @brief Extract a rectangular region with a given interpolation method.
+ *
+ * This function is the same as img_extract_rectangle() except that the
+ * interpolation method is specified by \a interp:
+ *
+ * - \c IMG_INTERP_LINEAR for bi-linear interpolation;
+ * - \c IMG_INTERP_CUBIC for bi-cubic interpolation (Keys cubic convolution
+ *   kernel with \f$a = -1/2\f$, 4x4 source pixels are used);
+ * - \c IMG_INTERP_LANCZOS3 for Lanczos interpolation of order 3 (6x6 source
+ *   pixels are used).
+ *
+ * For the cubic and Lanczos kernels, the weights are tabulated at
+ * \c LINEAR_NPHASES sub-pixel positions (the interpolated position is
+ * rounded to the nearest one) and the pixels beyond the edges of the
+ * source image are replaced by the nearest pixels of the edges.  If the
+ * coordinate transform has no shear nor rotation terms, the interpolation
+ * is separable and is done along the columns and then along the rows.
+ * These kernels may yield values outside the range of the source values,
+ * for integer pixel types the result is rounded and clamped to the limits
+ * of the type.
+ *
+ * @return Normally \c IMG_SUCCESS; \c IMG_FAILURE in case of error
+ *         with \c errno set as for img_extract_rectangle() or to
+ *         \c ENOMEM if there is not enough memory.
+ *
+ * @see img_extract_rectangle().
+ */
+int img_extract_rectangle_with_interp(const void *src,
+                                      const int src_type,
+                                      const long src_offset,
+                                      const long src_width,
+                                      const long src_height,
+                                      const long src_pitch,
+                                      void *dst,
+                                      const int dst_type,
+                                      const long dst_offset,
+                                      const long dst_width,
+                                      const long dst_height,
+                                      const long dst_pitch,
+                                      const double a[6],
+                                      int inverse,
+                                      int interp)
+{
+  linear_job_t job;
+  double b[6], *ker;
+  long *col, *row, xp, yp, n;
+  double (*kernel)(double);
+  void (*resample)(const linear_job_t *job, const long dst_y0,
+                   const long dst_y1, double ws[]);
+  void (*resample_separable)(const linear_job_t *job, const long dst_y0,
+                             const long dst_y1, double ws[]);
+  void (*first_pass)(const shear_job_t *job, long r0, long r1);
+  void (*last_pass)(const shear_job_t *job, long r0, long r1);
+  int status;
 
   if ((src == NULL) || (dst == NULL) || (a == NULL)) {
     errno = EFAULT;
@@ -208,11 +720,30 @@ int img_extract_rectangle(const void *src,
     return IMG_FAILURE;
   }
 
-#define CASE(TYPE) case IMG_TYPE_##TYPE:                            \
-    STATIC_FUNC(extract_rectangle,TYPE)(src, src_offset, src_width, \
-                                        src_height, src_pitch,      \
-                                        dst, dst_offset, dst_width, \
-                                        dst_height, dst_pitch, b);  \
+  switch (interp) {
+  case IMG_INTERP_LINEAR:
+    job.ksize = 0;
+    kernel = NULL;
+    break;
+  case IMG_INTERP_CUBIC:
+    job.ksize = 4;
+    kernel = cubic_kernel;
+    break;
+  case IMG_INTERP_LANCZOS3:
+    job.ksize = 6;
+    kernel = lanczos3_kernel;
+    break;
+  default:
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                                 \
+    job.extract = STATIC_FUNC(extract_rectangle,TYPE);                  \
+    resample = STATIC_FUNC(resample,TYPE);                              \
+    resample_separable = STATIC_FUNC(resample_separable,TYPE);          \
+    first_pass = STATIC_FUNC(shear_first_pass,TYPE);                    \
+    last_pass = STATIC_FUNC(shear_last_pass,TYPE);                      \
     break
 
   switch (src_type) {
@@ -267,7 +798,86 @@ int img_extract_rectangle(const void *src,
 
 #undef CASE
 
-  return IMG_SUCCESS;
+  /* Interpolate the image by bands of rows.  Since the coordinates are
+     computed from the indices of the destination pixels, the result does not
+     depend on the decomposition. */
+  job.src = src;
+  job.dst = dst;
+  job.a = b;
+  job.src_offset = src_offset;
+  job.src_width = src_width;
+  job.src_height = src_height;
+  job.src_pitch = src_pitch;
+  job.dst_offset = dst_offset;
+  job.dst_width = dst_width;
+  job.dst_height = dst_height;
+  job.dst_pitch = dst_pitch;
+  job.resample = NULL;
+  job.ker = NULL;
+  job.col = job.col_phase = job.row = job.row_phase = NULL;
+  job.col_min = job.col_max = job.wslen = 0;
+  if (kernel == NULL) {
+    return img_parallel(img_get_num_bands(dst_height, LINEAR_MIN_ROWS),
+                        linear_task, &job);
+  }
+
+  /* Tabulate the interpolation kernel and, for a separable coordinate
+     transform, locate the source pixels needed by each destination column
+     and row. */
+  ker = (double *)malloc((LINEAR_NPHASES + 1)*job.ksize*sizeof(double));
+  if (ker == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  tabulate_kernel(ker, kernel, job.ksize);
+  job.ker = ker;
+  if ((b[2] != 0.0 || b[4] != 0.0) && is_rotation(b)) {
+    /* Rotation by three shears. */
+    status = shear_rotate(&job, b, first_pass, last_pass);
+    free(ker);
+    return status;
+  }
+  col = NULL;
+  if (b[2] == 0.0 && b[4] == 0.0) {
+    n = dst_width + dst_height;
+    col = (long *)malloc(2*n*sizeof(long));
+    if (col == NULL) {
+      free(ker);
+      errno = ENOMEM;
+      return IMG_FAILURE;
+    }
+    row = col + dst_width;
+    job.col = col;
+    job.row = row;
+    job.col_phase = col + n;
+    job.row_phase = row + n;
+    for (xp = 0; xp < dst_width; ++xp) {
+      locate_taps(b[0] + b[1]*(double)xp, src_width, job.ksize,
+                  &col[xp], &col[xp + n]);
+      if (xp == 0 || col[xp] < job.col_min) {
+        job.col_min = col[xp];
+      }
+      if (xp == 0 || col[xp] > job.col_max) {
+        job.col_max = col[xp];
+      }
+    }
+    job.col_max += job.ksize - 1;
+    for (yp = 0; yp < dst_height; ++yp) {
+      locate_taps(b[3] + b[5]*(double)yp, src_height, job.ksize,
+                  &row[yp], &row[yp + n]);
+    }
+    job.wslen = job.col_max - job.col_min + 1;
+    job.resample = resample_separable;
+  } else {
+    job.resample = resample;
+  }
+  status = img_parallel(img_get_num_bands(dst_height, LINEAR_MIN_ROWS),
+                        linear_task, &job);
+  free(ker);
+  if (col != NULL) {
+    free(col);
+  }
+  return status;
 }
 
 /**
@@ -371,6 +981,549 @@ int img_inverse_linear_transform(const double a[], long ncoefs, double b[])
   return IMG_FAILURE;
 }
 
+/*---------------------------------------------------------------------------*/
+/* REMAPPING */
+
+/* Triangle kernel for bi-linear interpolation. */
+static double linear_kernel(double t)
+{
+  t = fabs(t);
+  return (t < 1.0 ? 1.0 - t : 0.0);
+}
+
+/* Allocate a remap plan (in a single block) with the tabulated kernels, the
+   taps are left undefined. */
+static img_remap_plan_t *new_remap_plan(long src_width, long src_height,
+                                        long dst_width, long dst_height,
+                                        int separable, int interp)
+{
+  img_remap_plan_t *plan;
+  double (*kernel)(double);
+  const int32_t one = ((int32_t)1 << REMAP_BITS);
+  const double *w;
+  int32_t *q, sum;
+  long ksize, ntaps, ncols, nrows, tabsize, k, kmax, p;
+  size_t offset, size;
+
+  if ((src_width <= 0) || (src_height <= 0) ||
+      (src_width > INT32_MAX) || (src_height > INT32_MAX) ||
+      (dst_width <= 0) || (dst_height <= 0)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  switch (interp) {
+  case IMG_INTERP_LINEAR:
+    ksize = 2;
+    kernel = linear_kernel;
+    break;
+  case IMG_INTERP_CUBIC:
+    ksize = 4;
+    kernel = cubic_kernel;
+    break;
+  case IMG_INTERP_LANCZOS3:
+    ksize = 6;
+    kernel = lanczos3_kernel;
+    break;
+  default:
+    errno = EINVAL;
+    return NULL;
+  }
+  if (separable) {
+    ncols = dst_width;
+    nrows = dst_height;
+  } else {
+    ncols = dst_width*dst_height;
+    nrows = ncols;
+  }
+  ntaps = ncols + nrows;
+  tabsize = (LINEAR_NPHASES + 1)*ksize;
+  offset = ((sizeof(img_remap_plan_t) + sizeof(double) - 1)/sizeof(double))
+    *sizeof(double);
+  size = offset + tabsize*(sizeof(double) + sizeof(int32_t)) +
+    ntaps*(sizeof(int32_t) + sizeof(uint16_t));
+  plan = (img_remap_plan_t *)malloc(size);
+  if (plan == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  plan->ker = (double *)((char *)plan + offset);
+  plan->qker = (int32_t *)(plan->ker + tabsize);
+  plan->col = plan->qker + tabsize;
+  plan->row = plan->col + ncols;
+  plan->col_phase = (uint16_t *)(plan->row + nrows);
+  plan->row_phase = plan->col_phase + ncols;
+  plan->src_width = src_width;
+  plan->src_height = src_height;
+  plan->dst_width = dst_width;
+  plan->dst_height = dst_height;
+  plan->ksize = ksize;
+  plan->col_min = 0;
+  plan->col_max = 0;
+  plan->separable = (separable != 0);
+
+  /* Tabulate the kernel and round the weights to fixed-point, the largest
+     weight of each phase takes the rounding error so that the weights still
+     sum to 1. */
+  tabulate_kernel(plan->ker, kernel, ksize);
+  for (p = 0; p <= LINEAR_NPHASES; ++p) {
+    w = plan->ker + p*ksize;
+    q = plan->qker + p*ksize;
+    sum = 0;
+    kmax = 0;
+    for (k = 0; k < ksize; ++k) {
+      q[k] = (int32_t)floor(w[k]*one + 0.5);
+      sum += q[k];
+      if (w[k] > w[kmax]) {
+        kmax = k;
+      }
+    }
+    q[kmax] += one - sum;
+  }
+  return plan;
+}
+
+/* Store the taps of the interpolation at position X along a dimension of
+   LENGTH pixels. */
+static int set_taps(double x, long length, long ksize,
+                    int32_t *first, uint16_t *phase)
+{
+  long j, p;
+
+  if (x != x) {
+    /* Not a number. */
+    return IMG_FAILURE;
+  }
+  locate_taps(x, length, ksize, &j, &p);
+  *first = (int32_t)j;
+  *phase = (uint16_t)p;
+  return IMG_SUCCESS;
+}
+
+/* Compute the range of source columns needed by a separable plan. */
+static void set_column_range(img_remap_plan_t *plan)
+{
+  long xp;
+
+  plan->col_min = plan->col[0];
+  plan->col_max = plan->col[0];
+  for (xp = 1; xp < plan->dst_width; ++xp) {
+    if (plan->col[xp] < plan->col_min) {
+      plan->col_min = plan->col[xp];
+    }
+    if (plan->col[xp] > plan->col_max) {
+      plan->col_max = plan->col[xp];
+    }
+  }
+  plan->col_max += plan->ksize - 1;
+}
+
+/**
+ * @brief Create a plan for remapping images by coordinate maps.
+ *
+ * This function pre-computes the interpolation taps and weights needed to
+ * remap a source image of size \a src_width by \a src_height into a
+ * destination image of size \a dst_width by \a dst_height.  The value of the
+ * destination pixel at (xp,yp) is interpolated in the source image at
+ * position (x[xp + yp*dst_width], y[xp + yp*dst_width]).  If \a separable is
+ * true, the coordinates are separable: \a x has \a dst_width elements and
+ * \a y has \a dst_height elements and the destination pixel at (xp,yp) is
+ * interpolated at (x[xp], y[yp]).  The first pixel has coordinates (0,0) in
+ * the source and destination images and pixels beyond the edges of the
+ * source take the value of the nearest edge pixel.
+ *
+ * The plan can be applied by img_remap_plan_apply() to any number of source
+ * images with the same dimensions without any further coordinate
+ * computations.
+ *
+ * @param src_width   The width of the source image.
+ * @param src_height  The height of the source image.
+ * @param dst_width   The width of the destination image.
+ * @param dst_height  The height of the destination image.
+ * @param x           The abscissae in the source image.
+ * @param y           The ordinates in the source image.
+ * @param separable   Whether the coordinates are separable.
+ * @param interp      The interpolation method: \c IMG_INTERP_LINEAR,
+ *                    \c IMG_INTERP_CUBIC or \c IMG_INTERP_LANCZOS3.
+ *
+ * @return The new plan, \c NULL on failure with \c errno set (\c EFAULT if
+ *         \a x or \a y is \c NULL, \c EINVAL for invalid parameters or
+ *         coordinates which are not a number, \c ENOMEM if memory cannot be
+ *         allocated).  The plan must be destroyed by
+ *         img_remap_plan_destroy().
+ */
+img_remap_plan_t *img_remap_plan_new(long src_width, long src_height,
+                                     long dst_width, long dst_height,
+                                     const double x[], const double y[],
+                                     int separable, int interp)
+{
+  img_remap_plan_t *plan;
+  long i, ncols, nrows;
+
+  if ((x == NULL) || (y == NULL)) {
+    errno = EFAULT;
+    return NULL;
+  }
+  plan = new_remap_plan(src_width, src_height, dst_width, dst_height,
+                        separable, interp);
+  if (plan == NULL) {
+    return NULL;
+  }
+  ncols = (plan->separable ? dst_width : dst_width*dst_height);
+  nrows = (plan->separable ? dst_height : dst_width*dst_height);
+  for (i = 0; i < ncols; ++i) {
+    if (set_taps(x[i], src_width, plan->ksize, &plan->col[i],
+                 &plan->col_phase[i]) != IMG_SUCCESS) {
+      goto bad_coordinate;
+    }
+  }
+  for (i = 0; i < nrows; ++i) {
+    if (set_taps(y[i], src_height, plan->ksize, &plan->row[i],
+                 &plan->row_phase[i]) != IMG_SUCCESS) {
+      goto bad_coordinate;
+    }
+  }
+  if (plan->separable) {
+    set_column_range(plan);
+  }
+  return plan;
+
+ bad_coordinate:
+  free(plan);
+  errno = EINVAL;
+  return NULL;
+}
+
+/* Index of the coefficient of XP^I*YP^J in a polynomial transform. */
+#define POLY_INDEX(i,j) (((i) + (j))*((i) + (j) + 1)/2 + (j))
+
+/* Evaluate the polynomial of degree DEGREE with coefficients C in XP for a
+   given YP. */
+static double poly_eval(int degree, const double c[], double xp, double yp)
+{
+  double r, t;
+  int i, j;
+
+  r = 0.0;
+  for (i = degree; i >= 0; --i) {
+    t = 0.0;
+    for (j = degree - i; j >= 0; --j) {
+      t = t*yp + c[POLY_INDEX(i,j)];
+    }
+    r = r*xp + t;
+  }
+  return r;
+}
+
+/* Initialize the table of forward differences D to evaluate incrementally,
+   for XP = 0, 1, 2, ..., the polynomial of degree DEGREE with coefficients C
+   along the row YP.  D[0] is the value at XP; after this value has been
+   used, the table is updated for XP + 1 by D[K] += D[K + 1] for K = 0, ...,
+   DEGREE - 1. */
+static void poly_init(int degree, const double c[], double yp, double d[])
+{
+  int i, k;
+
+  for (i = 0; i <= degree; ++i) {
+    d[i] = poly_eval(degree, c, (double)i, yp);
+  }
+  for (k = 1; k <= degree; ++k) {
+    for (i = degree; i >= k; --i) {
+      d[i] -= d[i - 1];
+    }
+  }
+}
+
+/* Move the table of forward differences to the next position. */
+static void poly_next(int degree, double d[])
+{
+  int k;
+
+  for (k = 0; k < degree; ++k) {
+    d[k] += d[k + 1];
+  }
+}
+
+/**
+ * @brief Create a plan for remapping images by a polynomial transform.
+ *
+ * This function is similar to img_remap_plan_new() but the source
+ * coordinates of the destination pixel at (xp,yp) are given by two
+ * polynomials of degree \a degree (at most 3) in xp and yp.  The
+ * coefficients are ordered by increasing total degree and, for a given total
+ * degree, by decreasing power of xp:
+ * @code
+ * x = cx[0] + cx[1]*xp + cx[2]*yp
+ *   + cx[3]*xp^2 + cx[4]*xp*yp + cx[5]*yp^2
+ *   + cx[6]*xp^3 + cx[7]*xp^2*yp + cx[8]*xp*yp^2 + cx[9]*yp^3;
+ * @endcode
+ * and similarly for y with \a cy.  There are (degree + 1)*(degree + 2)/2
+ * coefficients for each coordinate (an affine inverse transform, as used by
+ * img_extract_rectangle(), is given by \a degree = 1).  The polynomials are
+ * evaluated incrementally along each row by forward differences.  If x only
+ * depends on xp and y only depends on yp, a separable plan is created.
+ *
+ * @param src_width   The width of the source image.
+ * @param src_height  The height of the source image.
+ * @param dst_width   The width of the destination image.
+ * @param dst_height  The height of the destination image.
+ * @param degree      The degree of the polynomials (1, 2 or 3).
+ * @param cx          The coefficients of the polynomial giving x.
+ * @param cy          The coefficients of the polynomial giving y.
+ * @param interp      The interpolation method.
+ *
+ * @return The new plan, \c NULL on failure with \c errno set.
+ */
+img_remap_plan_t *img_remap_plan_new_polynomial(long src_width,
+                                                long src_height,
+                                                long dst_width,
+                                                long dst_height,
+                                                int degree,
+                                                const double cx[],
+                                                const double cy[],
+                                                int interp)
+{
+  img_remap_plan_t *plan;
+  double dx[4], dy[4];
+  long i, xp, yp;
+  int j, k, separable;
+
+  if ((cx == NULL) || (cy == NULL)) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if ((degree < 1) || (degree > 3)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  separable = 1;
+  for (j = 0; j <= degree && separable; ++j) {
+    for (k = 1; j + k <= degree; ++k) {
+      if (cx[POLY_INDEX(j,k)] != 0.0 || cy[POLY_INDEX(k,j)] != 0.0) {
+        separable = 0;
+        break;
+      }
+    }
+  }
+  plan = new_remap_plan(src_width, src_height, dst_width, dst_height,
+                        separable, interp);
+  if (plan == NULL) {
+    return NULL;
+  }
+  if (separable) {
+    poly_init(degree, cx, 0.0, dx);
+    for (xp = 0; xp < dst_width; ++xp) {
+      if (set_taps(dx[0], src_width, plan->ksize, &plan->col[xp],
+                   &plan->col_phase[xp]) != IMG_SUCCESS) {
+        goto bad_coordinate;
+      }
+      poly_next(degree, dx);
+    }
+    for (yp = 0; yp < dst_height; ++yp) {
+      if (set_taps(poly_eval(degree, cy, 0.0, (double)yp), src_height,
+                   plan->ksize, &plan->row[yp],
+                   &plan->row_phase[yp]) != IMG_SUCCESS) {
+        goto bad_coordinate;
+      }
+    }
+    set_column_range(plan);
+  } else {
+    i = 0;
+    for (yp = 0; yp < dst_height; ++yp) {
+      poly_init(degree, cx, (double)yp, dx);
+      poly_init(degree, cy, (double)yp, dy);
+      for (xp = 0; xp < dst_width; ++xp, ++i) {
+        if (set_taps(dx[0], src_width, plan->ksize, &plan->col[i],
+                     &plan->col_phase[i]) != IMG_SUCCESS ||
+            set_taps(dy[0], src_height, plan->ksize, &plan->row[i],
+                     &plan->row_phase[i]) != IMG_SUCCESS) {
+          goto bad_coordinate;
+        }
+        poly_next(degree, dx);
+        poly_next(degree, dy);
+      }
+    }
+  }
+  return plan;
+
+ bad_coordinate:
+  free(plan);
+  errno = EINVAL;
+  return NULL;
+}
+
+#undef POLY_INDEX
+
+/**
+ * @brief Destroy a remap plan.
+ *
+ * @param plan   The plan to destroy (can be \c NULL).
+ */
+void img_remap_plan_destroy(img_remap_plan_t *plan)
+{
+  if (plan != NULL) {
+    free(plan);
+  }
+}
+
+/**
+ * @brief Remap an image according to a plan.
+ *
+ * This function interpolates the source image into the destination image
+ * with the geometry and the interpolation method of \a plan (see
+ * img_remap_plan_new()).  Images of 8-bit integers are interpolated with
+ * fixed-point arithmetic (weights with 14 fractional bits), other images
+ * with double precision floating-point.  For integer pixel types, the
+ * result is rounded and clamped to the range of the type.
+ *
+ * @param plan        The remap plan.
+ * @param src         The base address of the source image.
+ * @param src_type    The data type of the source image, must be the same
+ *                    as \a dst_type.
+ * @param src_offset  The offset, in pixels relative to the base address, of
+ *                    the first pixel of the source image.
+ * @param src_pitch   The number of pixels between two successive rows of the
+ *                    source image.
+ * @param dst         The base address of the destination image.
+ * @param dst_type    The data type of the destination image.
+ * @param dst_offset  The offset, in pixels relative to the base address, of
+ *                    the first pixel of the destination image.
+ * @param dst_pitch   The number of pixels between two successive rows of the
+ *                    destination image.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE (with \c errno set).
+ */
+int img_remap_plan_apply(const img_remap_plan_t *plan,
+                         const void *src, int src_type,
+                         long src_offset, long src_pitch,
+                         void *dst, int dst_type,
+                         long dst_offset, long dst_pitch)
+{
+  remap_job_t job;
+
+  if ((plan == NULL) || (src == NULL) || (dst == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((src_pitch < plan->src_width) || (dst_pitch < plan->dst_width) ||
+      (src_type != dst_type)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                                 \
+    job.remap = (plan->separable ? STATIC_FUNC(remap_separable,TYPE)    \
+                 : STATIC_FUNC(remap,TYPE));                            \
+    break
+
+  switch (src_type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+  default:
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#undef CASE
+
+  job.plan = plan;
+  job.src = src;
+  job.dst = dst;
+  job.src_offset = src_offset;
+  job.src_pitch = src_pitch;
+  job.dst_offset = dst_offset;
+  job.dst_pitch = dst_pitch;
+  job.wslen = (plan->separable ? plan->col_max - plan->col_min + 1 : 0);
+  return img_parallel(img_get_num_bands(plan->dst_height, LINEAR_MIN_ROWS),
+                      remap_task, &job);
+}
+
+/**
+ * @brief Remap an image by coordinate maps.
+ *
+ * This function interpolates the source image at the positions given by
+ * \a x and \a y to compute the destination image.  It is the same as
+ * creating a plan with img_remap_plan_new(), applying it with
+ * img_remap_plan_apply() and destroying it; a plan should be used to remap
+ * several images with the same geometry.
+ *
+ * @param src         The base address of the source image.
+ * @param src_type    The data type of the source image, must be the same
+ *                    as \a dst_type.
+ * @param src_offset  The offset, in pixels relative to the base address, of
+ *                    the first pixel of the source image.
+ * @param src_width   The width of the source image.
+ * @param src_height  The height of the source image.
+ * @param src_pitch   The number of pixels between two successive rows of the
+ *                    source image.
+ * @param dst         The base address of the destination image.
+ * @param dst_type    The data type of the destination image.
+ * @param dst_offset  The offset, in pixels relative to the base address, of
+ *                    the first pixel of the destination image.
+ * @param dst_width   The width of the destination image.
+ * @param dst_height  The height of the destination image.
+ * @param dst_pitch   The number of pixels between two successive rows of the
+ *                    destination image.
+ * @param x           The abscissae in the source image.
+ * @param y           The ordinates in the source image.
+ * @param separable   Whether the coordinates are separable.
+ * @param interp      The interpolation method.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE (with \c errno set).
+ */
+int img_remap(const void *src, const int src_type,
+              const long src_offset, const long src_width,
+              const long src_height, const long src_pitch,
+              void *dst, const int dst_type, const long dst_offset,
+              const long dst_width, const long dst_height,
+              const long dst_pitch, const double x[], const double y[],
+              int separable, int interp)
+{
+  img_remap_plan_t *plan;
+  int status;
+
+  if ((src == NULL) || (dst == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  plan = img_remap_plan_new(src_width, src_height, dst_width, dst_height,
+                            x, y, separable, interp);
+  if (plan == NULL) {
+    return IMG_FAILURE;
+  }
+  status = img_remap_plan_apply(plan, src, src_type, src_offset, src_pitch,
+                                dst, dst_type, dst_offset, dst_pitch);
+  img_remap_plan_destroy(plan);
+  return status;
+}
+
 #else /* _IMG_LINEAR_C *******************************************************/
 
 /* The CONVERT macro is used to convert an interpolated value to the current
@@ -392,20 +1545,24 @@ int img_inverse_linear_transform(const double a[], long ncoefs, double b[])
 /* FIXME: To simplify the code, it is assumed that DST and SRC are separate
    images which do not share the same memory part.  Some optimizations are
    also possible by using single precision floating point (though taking care
-   of rounding errors) and SIMD instructions. */
+   of rounding errors). */
 
-static void STATIC_FUNC(extract_rectangle,TYPE)(const pixel_t *src,
+static void STATIC_FUNC(extract_rectangle,TYPE)(const void *src_addr,
                                                 const long src_offset,
                                                 const long src_width,
                                                 const long src_height,
                                                 const long src_pitch,
-                                                pixel_t *dst,
+                                                void *dst_addr,
                                                 const long dst_offset,
                                                 const long dst_width,
-                                                const long dst_height,
                                                 const long dst_pitch,
+                                                const long dst_y0,
+                                                const long dst_y1,
                                                 const double a[6])
 {
+  const pixel_t *src = (const pixel_t *)src_addr;
+  pixel_t *dst = (pixel_t *)dst_addr;
+  const pixel_t *p;
   const double zero = 0.0;
   const double one = 1.0;
 #if CPT_IS_INTEGER(TYPE)
@@ -413,10 +1570,10 @@ static void STATIC_FUNC(extract_rectangle,TYPE)(const pixel_t *src,
 #endif
   double x, x_max, y, y_max, u0, u1, v0, v1, tx, ty;
   double axx, axy, ayx, ayy, bx, by, cx, cy;
-  long xp, yp, x0, y0, x1, y1;
+  long xp, yp, x0, y0, x1, y1, xa, xb;
 
   src += src_offset;
-  dst += dst_offset;
+  dst += dst_offset + dst_y0*dst_pitch;
   x_max = src_width - one;
   y_max = src_height - one;
 
@@ -429,11 +1586,38 @@ static void STATIC_FUNC(extract_rectangle,TYPE)(const pixel_t *src,
   ayy = a[5];
 
   /* Interpolate image (bilinear interpolation). */
-  for (yp = 0; yp < dst_height; ++yp, dst += dst_pitch) {
+  for (yp = dst_y0; yp < dst_y1; ++yp, dst += dst_pitch) {
     ty = (double)yp;
     bx = axy*ty + cx;
     by = ayy*ty + cy;
+
+    /* Destination pixels XA to XB - 1 have their 4 neighbors inside the
+       source image, the others are clamped to the edges. */
+    interior_span(axx, bx, x_max, ayx, by, y_max, dst_width, &xa, &xb);
+
     for (xp = 0; xp < dst_width; ++xp) {
+      if (xp == xa) {
+        /* Interior span: no bounds checks.  The coordinates are computed as
+           for the other pixels so that the result does not depend on the
+           spans. */
+        for (; xp < xb; ++xp) {
+          tx = (double)xp;
+          x = axx*tx + bx;
+          y = ayx*tx + by;
+          x0 = (long)x;
+          y0 = (long)y;
+          u1 = x - x0;
+          u0 = one - u1;
+          v1 = y - y0;
+          v0 = one - v1;
+          p = src + x0 + src_pitch*y0;
+          dst[xp] = CONVERT(u0*(v0*p[0] + v1*p[src_pitch]) +
+                            u1*(v0*p[1] + v1*p[src_pitch + 1]));
+        }
+        if (xp >= dst_width) {
+          break;
+        }
+      }
       tx = (double)xp;
       x = axx*tx + bx;
       y = ayx*tx + by;
@@ -477,6 +1661,452 @@ static void STATIC_FUNC(extract_rectangle,TYPE)(const pixel_t *src,
   }
 
 }
+
+/* Images of 8-bit integers are remapped with fixed-point arithmetic (see
+   REMAP_BITS).  For 16-bit integers, the rounding of the weights would yield
+   errors of several levels. */
+#if CPT_IS_INT8(TYPE) || CPT_IS_UINT8(TYPE)
+# define REMAP_FIXED 1
+#endif
+
+/* Convert an interpolated value to the pixel type (interpolation kernels
+   with negative lobes may yield values beyond the limits of the type). */
+#if CPT_IS_INTEGER(TYPE)
+# if CPT_IS_INT8(TYPE)
+#  define PIXEL_MIN INT8_MIN
+#  define PIXEL_MAX INT8_MAX
+# elif CPT_IS_UINT8(TYPE)
+#  define PIXEL_MIN 0
+#  define PIXEL_MAX UINT8_MAX
+# elif CPT_IS_INT16(TYPE)
+#  define PIXEL_MIN INT16_MIN
+#  define PIXEL_MAX INT16_MAX
+# elif CPT_IS_UINT16(TYPE)
+#  define PIXEL_MIN 0
+#  define PIXEL_MAX UINT16_MAX
+# elif CPT_IS_INT32(TYPE)
+#  define PIXEL_MIN INT32_MIN
+#  define PIXEL_MAX INT32_MAX
+# elif CPT_IS_UINT32(TYPE)
+#  define PIXEL_MIN 0
+#  define PIXEL_MAX UINT32_MAX
+# elif CPT_IS_INT64(TYPE)
+#  define PIXEL_MIN INT64_MIN
+#  define PIXEL_MAX INT64_MAX
+# else
+#  define PIXEL_MIN 0
+#  define PIXEL_MAX UINT64_MAX
+# endif
+static pixel_t STATIC_FUNC(from_double,TYPE)(double value)
+{
+  const double half = 0.5;
+  double r = CONVERT(value);
+  if (r <= (double)PIXEL_MIN) {
+    return PIXEL_MIN;
+  }
+  if (r >= (double)PIXEL_MAX) {
+    return PIXEL_MAX;
+  }
+  return (pixel_t)r;
+}
+# ifdef REMAP_FIXED
+/* Same as from_double for a fixed-point value with 2*REMAP_BITS -
+   REMAP_SHIFT fractional bits. */
+static pixel_t STATIC_FUNC(from_fixed,TYPE)(int32_t value)
+{
+  const int bits = 2*REMAP_BITS - REMAP_SHIFT;
+  const int32_t half = ((int32_t)1 << (bits - 1));
+  int32_t r = (value >= 0 ? (value + half) >> bits :
+               -((half - 1 - value) >> bits));
+  if (r <= PIXEL_MIN) {
+    return PIXEL_MIN;
+  }
+  if (r >= PIXEL_MAX) {
+    return PIXEL_MAX;
+  }
+  return (pixel_t)r;
+}
+# endif
+# undef PIXEL_MIN
+# undef PIXEL_MAX
+# define FROM_DOUBLE(value) STATIC_FUNC(from_double,TYPE)(value)
+#else
+# define FROM_DOUBLE(value) ((pixel_t)(value))
+#endif
+
+/* Interpolate the destination rows DST_Y0 to DST_Y1 - 1 for any affine
+   coordinate transform. */
+static void STATIC_FUNC(resample,TYPE)(const linear_job_t *job,
+                                       const long dst_y0,
+                                       const long dst_y1,
+                                       double ws[])
+{
+  const pixel_t *src = (const pixel_t *)job->src + job->src_offset;
+  pixel_t *dst = (pixel_t *)job->dst + job->dst_offset + dst_y0*job->dst_pitch;
+  const double *a = job->a;
+  const double *ker = job->ker;
+  const double *wx, *wy;
+  const long ksize = job->ksize;
+  const long width = job->src_width;
+  const long height = job->src_height;
+  const long pitch = job->src_pitch;
+  const long dst_width = job->dst_width;
+  const pixel_t *p;
+  long xi[LINEAR_MAX_KSIZE], yi[LINEAR_MAX_KSIZE];
+  long xp, yp, x0, y0, px, py, j, k;
+  double bx, by, s, sum;
+
+  (void)ws; /* no workspace needed */
+  for (yp = dst_y0; yp < dst_y1; ++yp, dst += job->dst_pitch) {
+    bx = a[2]*(double)yp + a[0];
+    by = a[5]*(double)yp + a[3];
+    for (xp = 0; xp < dst_width; ++xp) {
+      locate_taps(a[1]*(double)xp + bx, width, ksize, &x0, &px);
+      locate_taps(a[4]*(double)xp + by, height, ksize, &y0, &py);
+      wx = ker + px;
+      wy = ker + py;
+      sum = 0.0;
+      if (x0 >= 0 && x0 + ksize <= width && y0 >= 0 && y0 + ksize <= height) {
+        /* All the needed pixels are inside the source image. */
+        p = src + x0 + y0*pitch;
+        for (j = 0; j < ksize; ++j, p += pitch) {
+          s = 0.0;
+          for (k = 0; k < ksize; ++k) {
+            s += wx[k]*p[k];
+          }
+          sum += wy[j]*s;
+        }
+      } else {
+        /* Replace the pixels beyond the edges by the nearest ones. */
+        for (k = 0; k < ksize; ++k) {
+          xi[k] = (x0 + k < 0 ? 0 : (x0 + k >= width ? width - 1 : x0 + k));
+          yi[k] = (y0 + k < 0 ? 0 : (y0 + k >= height ? height - 1 : y0 + k));
+        }
+        for (j = 0; j < ksize; ++j) {
+          p = src + yi[j]*pitch;
+          s = 0.0;
+          for (k = 0; k < ksize; ++k) {
+            s += wx[k]*p[xi[k]];
+          }
+          sum += wy[j]*s;
+        }
+      }
+      dst[xp] = FROM_DOUBLE(sum);
+    }
+  }
+}
+
+/* Interpolate the destination rows DST_Y0 to DST_Y1 - 1 for a separable
+   coordinate transform.  For each destination row, the source image is
+   first interpolated along the columns into the workspace WS (for the
+   source columns JOB->COL_MIN to JOB->COL_MAX), which is then interpolated
+   along the row. */
+static void STATIC_FUNC(resample_separable,TYPE)(const linear_job_t *job,
+                                                 const long dst_y0,
+                                                 const long dst_y1,
+                                                 double ws[])
+{
+  const pixel_t *src = (const pixel_t *)job->src + job->src_offset;
+  pixel_t *dst = (pixel_t *)job->dst + job->dst_offset + dst_y0*job->dst_pitch;
+  const double *ker = job->ker;
+  const double *w, *q;
+  const long ksize = job->ksize;
+  const long width = job->src_width;
+  const long height = job->src_height;
+  const long pitch = job->src_pitch;
+  const long dst_width = job->dst_width;
+  const long col_min = job->col_min;
+  const long col_max = job->col_max;
+  const long *col = job->col;
+  const long *col_phase = job->col_phase;
+  const pixel_t *p[LINEAR_MAX_KSIZE];
+  long c, c0, c1, xp, yp, j, k, r;
+  double s;
+
+  /* Columns C0 to C1 are inside the source image. */
+  c0 = (col_min > 0 ? col_min : 0);
+  c1 = (col_max < width - 1 ? col_max : width - 1);
+  for (yp = dst_y0; yp < dst_y1; ++yp, dst += job->dst_pitch) {
+    w = ker + job->row_phase[yp];
+    for (j = 0; j < ksize; ++j) {
+      r = job->row[yp] + j;
+      p[j] = src + (r < 0 ? 0 : (r >= height ? height - 1 : r))*pitch;
+    }
+    for (c = c0; c <= c1; ++c) {
+      s = 0.0;
+      for (j = 0; j < ksize; ++j) {
+        s += w[j]*p[j][c];
+      }
+      ws[c - col_min] = s;
+    }
+    for (c = col_min; c < c0; ++c) {
+      ws[c - col_min] = ws[c0 - col_min];
+    }
+    for (c = c1 + 1; c <= col_max; ++c) {
+      ws[c - col_min] = ws[c1 - col_min];
+    }
+    for (xp = 0; xp < dst_width; ++xp) {
+      w = ker + col_phase[xp];
+      q = ws + (col[xp] - col_min);
+      s = 0.0;
+      for (k = 0; k < ksize; ++k) {
+        s += w[k]*q[k];
+      }
+      dst[xp] = FROM_DOUBLE(s);
+    }
+  }
+}
+
+/* First pass of the rotation by three shears: interpolate along the rows of
+   the source to compute the rows R0 to R1 - 1 of G1. */
+static void STATIC_FUNC(shear_first_pass,TYPE)(const shear_job_t *job,
+                                               long r0, long r1)
+{
+  const linear_job_t *lin = job->lin;
+  const pixel_t *src = (const pixel_t *)lin->src + lin->src_offset;
+  const long ksize = lin->ksize;
+  const long src_width = lin->src_width;
+  const long src_height = lin->src_height;
+  const long width = job->width;
+  const long sign = job->sign;
+  const pixel_t *p, *q;
+  const double *w;
+  double *g1, s;
+  long first, phase, i, i0, i1, j, k, r, vy;
+
+  for (r = r0; r < r1; ++r) {
+    g1 = job->g1 + r*width;
+    vy = job->ymin + r;
+    j = sign*vy;
+    if (j < 0) {
+      j = 0;
+    } else if (j >= src_height) {
+      j = src_height - 1;
+    }
+    p = src + j*lin->src_pitch;
+    shear_taps(sign*(job->alpha*(double)vy + job->tx), ksize,
+               &first, &phase);
+    w = lin->ker + phase;
+
+    /* The K-th tap of the column I of G1 is the source pixel FIRST + K +
+       SIGN*(XMIN + I) which is inside the source row for I0 <= I < I1. */
+    first += sign*job->xmin;
+    if (sign > 0) {
+      i0 = -first;
+      i1 = src_width - ksize + 1 - first;
+    } else {
+      i0 = first - (src_width - ksize);
+      i1 = first + 1;
+    }
+    if (i0 < 0) {
+      i0 = 0;
+    }
+    if (i1 > width) {
+      i1 = width;
+    }
+    if (i1 < i0) {
+      i1 = i0;
+    }
+    for (i = 0; i < width; ++i) {
+      if (i == i0) {
+        for (; i < i1; ++i) {
+          q = p + first + sign*i;
+          s = 0.0;
+          for (k = 0; k < ksize; ++k) {
+            s += w[k]*q[k];
+          }
+          g1[i] = s;
+        }
+        if (i >= width) {
+          break;
+        }
+      }
+      s = 0.0;
+      for (k = 0; k < ksize; ++k) {
+        j = first + sign*i + k;
+        if (j < 0) {
+          j = 0;
+        } else if (j >= src_width) {
+          j = src_width - 1;
+        }
+        s += w[k]*p[j];
+      }
+      g1[i] = s;
+    }
+  }
+}
+
+/* Last pass of the rotation by three shears: interpolate along the rows of G2
+   to compute the destination rows R0 to R1 - 1. */
+static void STATIC_FUNC(shear_last_pass,TYPE)(const shear_job_t *job,
+                                              long r0, long r1)
+{
+  const linear_job_t *lin = job->lin;
+  pixel_t *dst = (pixel_t *)lin->dst + lin->dst_offset + r0*lin->dst_pitch;
+  const long ksize = lin->ksize;
+  const long dst_width = lin->dst_width;
+  const double *w, *g;
+  double s;
+  long first, phase, k, xp, yp;
+
+  for (yp = r0; yp < r1; ++yp, dst += lin->dst_pitch) {
+    shear_taps(job->alpha*(double)yp, ksize, &first, &phase);
+    w = lin->ker + phase;
+    g = job->g2 + yp*job->width + (first - job->xmin);
+    for (xp = 0; xp < dst_width; ++xp, ++g) {
+      s = 0.0;
+      for (k = 0; k < ksize; ++k) {
+        s += w[k]*g[k];
+      }
+      dst[xp] = FROM_DOUBLE(s);
+    }
+  }
+}
+
+#ifdef REMAP_FIXED
+# define REMAP_ROW(s)      ((s)/((int32_t)1 << REMAP_SHIFT))
+# define REMAP_RESULT(sum) STATIC_FUNC(from_fixed,TYPE)(sum)
+#else
+# define REMAP_ROW(s)      (s)
+# define REMAP_RESULT(sum) FROM_DOUBLE(sum)
+#endif
+
+/* Remap the destination rows DST_Y0 to DST_Y1 - 1 for a general plan. */
+static void STATIC_FUNC(remap,TYPE)(const remap_job_t *job,
+                                    const long dst_y0,
+                                    const long dst_y1,
+                                    void *ws)
+{
+  const img_remap_plan_t *plan = job->plan;
+  const pixel_t *src = (const pixel_t *)job->src + job->src_offset;
+  pixel_t *dst = (pixel_t *)job->dst + job->dst_offset + dst_y0*job->dst_pitch;
+#ifdef REMAP_FIXED
+  const int32_t *ker = plan->qker;
+  const int32_t *wx, *wy;
+  int32_t s, sum;
+#else
+  const double *ker = plan->ker;
+  const double *wx, *wy;
+  double s, sum;
+#endif
+  const long ksize = plan->ksize;
+  const long width = plan->src_width;
+  const long height = plan->src_height;
+  const long pitch = job->src_pitch;
+  const long dst_width = plan->dst_width;
+  const pixel_t *p;
+  long xi[LINEAR_MAX_KSIZE], yi[LINEAR_MAX_KSIZE];
+  long i, xp, yp, x0, y0, j, k;
+
+  (void)ws; /* no workspace needed */
+  for (yp = dst_y0; yp < dst_y1; ++yp, dst += job->dst_pitch) {
+    i = yp*dst_width;
+    for (xp = 0; xp < dst_width; ++xp, ++i) {
+      x0 = plan->col[i];
+      y0 = plan->row[i];
+      wx = ker + plan->col_phase[i];
+      wy = ker + plan->row_phase[i];
+      sum = 0;
+      if (x0 >= 0 && x0 + ksize <= width && y0 >= 0 && y0 + ksize <= height) {
+        /* All the needed pixels are inside the source image. */
+        p = src + x0 + y0*pitch;
+        for (j = 0; j < ksize; ++j, p += pitch) {
+          s = 0;
+          for (k = 0; k < ksize; ++k) {
+            s += wx[k]*p[k];
+          }
+          sum += wy[j]*REMAP_ROW(s);
+        }
+      } else {
+        /* Replace the pixels beyond the edges by the nearest ones. */
+        for (k = 0; k < ksize; ++k) {
+          xi[k] = (x0 + k < 0 ? 0 : (x0 + k >= width ? width - 1 : x0 + k));
+          yi[k] = (y0 + k < 0 ? 0 : (y0 + k >= height ? height - 1 : y0 + k));
+        }
+        for (j = 0; j < ksize; ++j) {
+          p = src + yi[j]*pitch;
+          s = 0;
+          for (k = 0; k < ksize; ++k) {
+            s += wx[k]*p[xi[k]];
+          }
+          sum += wy[j]*REMAP_ROW(s);
+        }
+      }
+      dst[xp] = REMAP_RESULT(sum);
+    }
+  }
+}
+
+/* Remap the destination rows DST_Y0 to DST_Y1 - 1 for a separable plan.  As
+   for resample_separable, each destination row is first interpolated along
+   the columns of the source into the workspace WS. */
+static void STATIC_FUNC(remap_separable,TYPE)(const remap_job_t *job,
+                                              const long dst_y0,
+                                              const long dst_y1,
+                                              void *ws)
+{
+  const img_remap_plan_t *plan = job->plan;
+  const pixel_t *src = (const pixel_t *)job->src + job->src_offset;
+  pixel_t *dst = (pixel_t *)job->dst + job->dst_offset + dst_y0*job->dst_pitch;
+#ifdef REMAP_FIXED
+  const int32_t *ker = plan->qker;
+  const int32_t *w, *q;
+  int32_t *row = (int32_t *)ws;
+  int32_t s, sum;
+#else
+  const double *ker = plan->ker;
+  const double *w, *q;
+  double *row = (double *)ws;
+  double s, sum;
+#endif
+  const long ksize = plan->ksize;
+  const long width = plan->src_width;
+  const long height = plan->src_height;
+  const long pitch = job->src_pitch;
+  const long dst_width = plan->dst_width;
+  const long col_min = plan->col_min;
+  const long col_max = plan->col_max;
+  const pixel_t *p[LINEAR_MAX_KSIZE];
+  long c, c0, c1, xp, yp, j, k, r;
+
+  /* Columns C0 to C1 are inside the source image. */
+  c0 = (col_min > 0 ? col_min : 0);
+  c1 = (col_max < width - 1 ? col_max : width - 1);
+  for (yp = dst_y0; yp < dst_y1; ++yp, dst += job->dst_pitch) {
+    w = ker + plan->row_phase[yp];
+    for (j = 0; j < ksize; ++j) {
+      r = plan->row[yp] + j;
+      p[j] = src + (r < 0 ? 0 : (r >= height ? height - 1 : r))*pitch;
+    }
+    for (c = c0; c <= c1; ++c) {
+      s = 0;
+      for (j = 0; j < ksize; ++j) {
+        s += w[j]*p[j][c];
+      }
+      row[c - col_min] = REMAP_ROW(s);
+    }
+    for (c = col_min; c < c0; ++c) {
+      row[c - col_min] = row[c0 - col_min];
+    }
+    for (c = c1 + 1; c <= col_max; ++c) {
+      row[c - col_min] = row[c1 - col_min];
+    }
+    for (xp = 0; xp < dst_width; ++xp) {
+      w = ker + plan->col_phase[xp];
+      q = row + (plan->col[xp] - col_min);
+      sum = 0;
+      for (k = 0; k < ksize; ++k) {
+        sum += w[k]*q[k];
+      }
+      dst[xp] = REMAP_RESULT(sum);
+    }
+  }
+}
+
+#undef REMAP_ROW
+#undef REMAP_RESULT
+#undef REMAP_FIXED
+#undef FROM_DOUBLE
 #undef CONVERT
 #undef TYPE
 
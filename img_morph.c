@@ -28,8 +28,12 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <math.h>
 
 #include "img.h"
+#include "img_context.h"
+#include "img_stats.h"
+#include "img_thread.h"
 
 
 /* Definitions of public functions. */
@@ -50,13 +54,345 @@ extern int img_morph_dilation(int type, long width, long height,
                               long r, long ws[],
                               void *lmax, long lmax_pitch);
 
+extern int img_morph_opening(int type, long width, long height,
+                             const void *img, long img_pitch, long r,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_closing(int type, long width, long height,
+                             const void *img, long img_pitch, long r,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_top_hat(int type, long width, long height,
+                             const void *img, long img_pitch,
+                             long r, long s, int black,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_enhance(int type, long width, long height,
+                             const void *img, long img_pitch,
+                             long r, double s, long niter,
+                             void *dst, long dst_pitch);
+
+extern int img_morph_trilevel(int type, long width, long height,
+                              const void *img, long img_pitch, long r,
+                              double atol, double rtol,
+                              double black, double white,
+                              unsigned char dst[], long dst_pitch);
+
 
 /* Definitions that will be expanded by the template code. */
 
 #define MORPH_LMIN_LMAX(TYPE) CPT_JOIN(img_morph_lmin_lmax_,CPT_ABBREV(TYPE))
+#define MORPH_FAST(TYPE)      CPT_JOIN(img_morph_fast_,CPT_ABBREV(TYPE))
+#define MORPH_FEED(TYPE)      CPT_JOIN(img_morph_feed_,CPT_ABBREV(TYPE))
+#define MORPH_ROW(TYPE)       CPT_JOIN(img_morph_row_,CPT_ABBREV(TYPE))
+#define MORPH_PIPELINE(TYPE)  CPT_JOIN(img_morph_pipeline_,CPT_ABBREV(TYPE))
+#define MORPH_ENHANCE(TYPE)   CPT_JOIN(img_morph_enhance_,CPT_ABBREV(TYPE))
+#define MORPH_TRILEVEL(TYPE)  CPT_JOIN(img_morph_trilevel_,CPT_ABBREV(TYPE))
+#define MORPH_CACHE_FEED(TYPE) CPT_JOIN(img_morph_cache_feed_,CPT_ABBREV(TYPE))
+#define MORPH_CACHED(TYPE)    CPT_JOIN(img_morph_cached_,CPT_ABBREV(TYPE))
 
 #define pixel_t               CPT_CTYPE(TYPE)
 
+/*
+ * Radius above which the disk structuring element is decomposed into
+ * horizontal chords processed by the van Herk/Gil-Werman algorithm.  For
+ * smaller radii, the brute force method is faster.
+ */
+#define MORPH_FAST_RADIUS     5
+
+/*
+ * Maximum number of chained stages in a pipeline of morpho-math operations
+ * (4 for a top-hat filter with smoothing).
+ */
+#define MORPH_MAX_STAGES      4
+
+/*
+ * Minimum number of rows per band for parallel processing.
+ */
+#define MORPH_MIN_ROWS        16
+
+/*
+ * A stage performs an erosion or a dilation of a stream of rows.  The source
+ * rows are either taken from an image or produced by a previous stage, so
+ * that compound operations (opening, closing, top-hat) can be applied
+ * without storing intermediate images.  For every source row, a table of the
+ * running extrema over windows of 1, 2, 4, ... pixels is built by recursive
+ * doubling (in the spirit of the van Herk/Gil-Werman algorithm).  The disk
+ * structuring element is decomposed in horizontal chords, the extremum along
+ * a chord of any length is given by the extremum of two overlapping entries
+ * of the table.  The source rows are extended by replicating their edge
+ * values (which does not change the result and avoids special cases) and the
+ * tables of the last 2*R + 1 rows are kept in a rolling buffer.  The first
+ * level of each table is a copy of the source row, which remains available
+ * until the table is overwritten.
+ */
+typedef struct _morph_stage morph_stage_t;
+struct _morph_stage {
+  const void *img;      /* source image (if PREV is NULL) */
+  morph_stage_t *prev;  /* previous stage (NULL if none) */
+  long *off;            /* half-lengths of chords, OFF[-R] to OFF[R] */
+  void *table;          /* rolling buffer of tables */
+  long img_pitch;       /* number of elements per row of IMG */
+  long width, height;   /* dimensions of the images */
+  long r;               /* radius of the structuring element */
+  long pad;             /* number of replicated pixels on each side */
+  long n;               /* length of the padded rows */
+  long nrows;           /* number of tables in the rolling buffer */
+  long levels;          /* number of levels per table */
+  long stride;          /* number of elements per table */
+  long count;           /* number of source rows processed so far */
+  int max;              /* compute maxima instead of minima? */
+  int owner;            /* OFF and TABLE are owned by the stage? */
+};
+
+/*
+ * Fill the array OFF with the range of DX for any DY.  OFF is the center of
+ * an array of 2*R + 1 elements.  To lie inside the neighborhood, the
+ * condition is:
+ *
+ *    sqrt(dx*dx + dy*dy) < r + 0.5
+ *
+ * Taking the square and accounting for the fact that DX, DY and R are
+ * integers yields:
+ *
+ *    dx*dx <= (r + 1)*r - dy*dy
+ */
+void img_morph_disk(long r, long off[])
+{
+  long dx, dy;
+
+  for (dy = 0; dy <= r; ++dy) {
+    long t = (r + 1)*r - dy*dy;
+    dx = r;
+    while (dx*dx > t) {
+      --dx;
+    }
+    off[ dy] = dx;
+    off[-dy] = dx;
+  }
+}
+
+static void morph_stage_destroy(morph_stage_t *stage)
+{
+  if (! stage->owner) {
+    stage->off = NULL;
+    stage->table = NULL;
+    return;
+  }
+  if (stage->off != NULL) {
+    free((void *)(stage->off - stage->r));
+    stage->off = NULL;
+  }
+  if (stage->table != NULL) {
+    free(stage->table);
+    stage->table = NULL;
+  }
+}
+
+/* Number of levels of the tables of running extrema for radius R, such that
+   2^(LEVELS-1) <= 2*R + 1 < 2^LEVELS. */
+static long morph_levels(long r)
+{
+  long levels = 1;
+  while ((2L << (levels - 1)) <= 2*r + 1) {
+    ++levels;
+  }
+  return levels;
+}
+
+/* Size (in bytes) of the rolling buffer of tables of a stage. */
+static size_t morph_stage_size(long width, long height, long r,
+                               size_t elsize)
+{
+  return ((2*r + 1 < height ? 2*r + 1 : height)*morph_levels(r)
+          *(width + 2*r)*elsize);
+}
+
+/*
+ * Initialize a stage, the source rows are taken from PREV if non-NULL, from
+ * IMG otherwise.  If TABLE and OFF are both non-NULL, they are used as the
+ * rolling buffer (of morph_stage_size bytes) and as the half-lengths of the
+ * chords (OFF[-R] to OFF[R]) instead of being allocated and computed.
+ * Returns IMG_FAILURE (with errno set) if memory cannot be allocated.
+ */
+static int morph_stage_init(morph_stage_t *stage, morph_stage_t *prev,
+                            const void *img, long img_pitch,
+                            long width, long height, long r, int max,
+                            size_t elsize, void *table, const long *off)
+{
+  long *buf;
+
+  stage->img = img;
+  stage->prev = prev;
+  stage->img_pitch = img_pitch;
+  stage->width = width;
+  stage->height = height;
+  stage->r = r;
+  stage->pad = r;
+  stage->n = width + 2*r;
+  stage->nrows = (2*r + 1 < height ? 2*r + 1 : height);
+  stage->levels = morph_levels(r);
+  stage->stride = stage->levels*stage->n;
+  stage->count = 0;
+  stage->max = max;
+  if (table != NULL && off != NULL) {
+    stage->table = table;
+    stage->off = (long *)off;
+    stage->owner = 0;
+    return IMG_SUCCESS;
+  }
+  stage->owner = 1;
+  stage->table = malloc(stage->nrows*stage->stride*elsize);
+  buf = (long *)malloc((2*r + 1)*sizeof(long));
+  stage->off = (buf != NULL ? buf + r : NULL);
+  if (stage->table == NULL || stage->off == NULL) {
+    morph_stage_destroy(stage);
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  img_morph_disk(r, stage->off);
+  IMG_STATS_ALLOC(IMG_STATS_MORPH, (stage->nrows*stage->stride*elsize +
+                                    (2*r + 1)*sizeof(long)));
+  return IMG_SUCCESS;
+}
+
+/*
+ * Prepare stage S (and the previous ones) to produce output rows starting at
+ * row Y.  The source rows needed by row Y (the halo of a band of rows) will
+ * be processed again.
+ */
+static void morph_stage_seek(morph_stage_t *s, long y)
+{
+  for (; s != NULL; s = s->prev) {
+    y = (y > s->r ? y - s->r : 0);
+    s->count = y;
+  }
+}
+
+/*
+ * A job is a morpho-math operation applied by bands of rows.  ROWS is the
+ * function which processes the rows Y0 to Y1 - 1 of band number BAND.  Each
+ * band has its own stages, so that the result does not depend on the
+ * decomposition in bands.  If TABLES is not NULL, the rolling buffers of
+ * the K-th stage of band BAND is TABLES[BAND*MORPH_MAX_STAGES + K] (taken
+ * from a workspace context) and the stages use the chords given by OFF.
+ */
+typedef struct _morph_job morph_job_t;
+struct _morph_job {
+  int (*rows)(morph_job_t *job, long y0, long y1, long band);
+  const void *img;      /* source image */
+  void *dst;            /* destination image */
+  void *lmin, *lmax;    /* destinations of erosion and dilation */
+  const long *off;      /* half-lengths of chords, OFF[-R] to OFF[R] */
+  void *const *tables;  /* rolling buffers of the stages or NULL */
+  const img_morph_cache_t *cache; /* tables of all the rows or NULL */
+  const long *rs;       /* radii of the stages of a pipeline */
+  const int *maxs;      /* kinds of the stages of a pipeline */
+  double *sum;          /* partial sums, one per row */
+  int *changed;         /* changed flags, one per band */
+  double s, alpha, beta;     /* parameters of the enhancement */
+  double cmin, black, white; /* parameters of the classification */
+  long width, height;   /* dimensions of the images */
+  long r;               /* radius of the structuring element */
+  long img_pitch, dst_pitch, lmin_pitch, lmax_pitch;
+  int nstages, ref, mode; /* parameters of a pipeline */
+};
+
+/*
+ * A morphology cache has a stage for the minima and a stage for the maxima
+ * whose buffers hold the tables of all the rows of the image (NROWS is the
+ * height of the image) with rows padded for the maximum radius RMAX.  The
+ * output rows for a radius R <= RMAX are computed from a copy of a stage
+ * with the radius and the chords of R: the chords are shorter, the tables
+ * have enough levels and the padding is larger than needed.
+ */
+struct _img_morph_cache {
+  morph_stage_t stage[2]; /* minima and maxima, TABLE is NULL if not cached */
+  long *off;              /* half-lengths of chords for RMAX */
+  long width, height, rmax;
+  int type, what;
+};
+
+static int morph_task(void *data, long band, long nbands)
+{
+  morph_job_t *job = (morph_job_t *)data;
+  return job->rows(job, IMG_BAND_START(band, nbands, job->height),
+                   IMG_BAND_START(band + 1, nbands, job->height), band);
+}
+
+/*
+ * Get the number of bands of rows for operations whose overall radius is R
+ * given the number of threads.  Bands are not smaller than 2*R rows to limit
+ * the overheads of the halos.
+ */
+static long morph_num_bands(long height, long r)
+{
+  return img_get_num_bands(height, (2*r > MORPH_MIN_ROWS ?
+                                    2*r : MORPH_MIN_ROWS));
+}
+
+/*
+ * Check whether image B overlaps image A in memory.  Operations performed
+ * in-place are done by a single band of rows.
+ */
+static int morph_overlap(const void *a, long a_pitch,
+                         const void *b, long b_pitch,
+                         long width, long height, size_t elsize)
+{
+  const char *a_end, *b_end;
+
+  if (a == NULL || b == NULL) {
+    return 0;
+  }
+  a_end = (const char *)a + ((height - 1)*a_pitch + width)*elsize;
+  b_end = (const char *)b + ((height - 1)*b_pitch + width)*elsize;
+  return ((const char *)a < b_end && (const char *)b < a_end);
+}
+
+/*
+ * Reserve in context CTX the rolling buffers of SIZE bytes for NSTAGES
+ * stages in each of NBANDS bands (see morph_job_t).  Returns the list of
+ * buffers or NULL with errno set on error.
+ */
+static void *const *morph_tables(img_context_t *ctx, long nbands,
+                                 int nstages, size_t size)
+{
+  long band;
+  int k;
+
+  IMG_CONTEXT_SET_PHASE(ctx, IMG_STATS_MORPH);
+  for (band = nbands - 1; band >= 0; --band) {
+    for (k = nstages - 1; k >= 0; --k) {
+      if (img_context_buffer(ctx, band*MORPH_MAX_STAGES + k,
+                             size) == NULL) {
+        return NULL;
+      }
+    }
+  }
+  return ctx->buf;
+}
+
+static int morph_lmin_lmax(img_context_t *ctx, int type,
+                           long width, long height,
+                           const void *img, long img_pitch,
+                           long r, const long off[],
+                           void *lmin, long lmin_pitch,
+                           void *lmax, long lmax_pitch);
+
+static int morph_pipeline(img_context_t *ctx, int type,
+                          long width, long height,
+                          const void *img, long img_pitch,
+                          int nstages, const long rs[], const int maxs[],
+                          int ref, int mode, void *dst, long dst_pitch);
+
+static int morph_trilevel(const img_morph_cache_t *cache, int type,
+                          long width, long height,
+                          const void *img, long img_pitch,
+                          long r, const long off[],
+                          double atol, double rtol,
+                          double black, double white,
+                          unsigned char dst[], long dst_pitch);
+
 
 /* Manage to include this file with a different data type each time. */
 
@@ -139,6 +475,15 @@ extern int img_morph_dilation(int type, long width, long height,
  * an image.  The neighborhood of each pixel is defined by a structuring
  * element which is a disk of radius \a r centered at the pixel of interest.
  *
+ * For a radius larger or equal \c MORPH_FAST_RADIUS, the disk is decomposed
+ * into horizontal chords and the local extrema along each chord are obtained
+ * from tables of running extrema built once per row (in the spirit of the van
+ * Herk/Gil-Werman algorithm), so that the cost per pixel grows as O(R)
+ * instead of O(R^2).  The results are exactly the same as with the
+ * brute force method (which is used for smaller radii or if the additional
+ * workspace cannot be allocated).  In particular, for floating-point types,
+ * NaN neighbors are ignored while a NaN central pixel yields a NaN result.
+ *
  * @param type        The type identifier of the input image \a img and
  *                    outputs \a lmin and \a lmax.
  * @param width       The image width.
@@ -167,6 +512,40 @@ int img_morph_lmin_lmax(int type, long width, long height,
     errno = EFAULT;
     return IMG_FAILURE;
   }
+  if (r < 0) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+  /* Fill the offset array with the range of DX for any DY. */
+  img_morph_disk(r, ws + r);
+
+  return morph_lmin_lmax(NULL, type, width, height, img, img_pitch,
+                         r, ws + r, lmin, lmin_pitch, lmax, lmax_pitch);
+}
+
+/*
+ * Compute local minima and/or maxima of an image (see img_morph_lmin_lmax)
+ * given the half-lengths of the chords of the disk, OFF[-R] to OFF[R].  If
+ * CTX is not NULL, the workspace is taken from this context.
+ */
+static int morph_lmin_lmax(img_context_t *ctx, int type,
+                           long width, long height,
+                           const void *img, long img_pitch,
+                           long r, const long off[],
+                           void *lmin, long lmin_pitch,
+                           void *lmax, long lmax_pitch)
+{
+  morph_job_t job;
+  size_t elsize;
+  long nbands;
+  int status;
+  IMG_STATS_TIMER(tic)
+
+  if (img == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
   if ((r < 0) || (width <= 0) || (height <= 0) || (img_pitch < width)
       || ((lmin != NULL) && (lmin_pitch < width))
       || ((lmax != NULL) && (lmax_pitch < width))) {
@@ -174,10 +553,9 @@ int img_morph_lmin_lmax(int type, long width, long height,
     return IMG_FAILURE;
   }
 
-#define CASE(TYPE) case IMG_TYPE_##TYPE:                                  \
-  MORPH_LMIN_LMAX(TYPE)(width, height, (const CPT_CTYPE(TYPE) *)img,      \
-                        img_pitch, r, ws, (CPT_CTYPE(TYPE) *)lmin,        \
-                        lmin_pitch, (CPT_CTYPE(TYPE) *)lmax, lmax_pitch); \
+#define CASE(TYPE) case IMG_TYPE_##TYPE:        \
+  job.rows = MORPH_LMIN_LMAX(TYPE);             \
+  elsize = sizeof(CPT_CTYPE(TYPE));             \
   break
 
   switch (type) {
@@ -233,7 +611,36 @@ int img_morph_lmin_lmax(int type, long width, long height,
 
 #undef CASE
 
-  return IMG_SUCCESS;
+  job.img = img;
+  job.img_pitch = img_pitch;
+  job.lmin = lmin;
+  job.lmin_pitch = lmin_pitch;
+  job.lmax = lmax;
+  job.lmax_pitch = lmax_pitch;
+  job.off = off;
+  job.tables = NULL;
+  job.width = width;
+  job.height = height;
+  job.r = r;
+  IMG_STATS_START(tic);
+  nbands = morph_num_bands(height, r);
+  if (nbands > 1 &&
+      (morph_overlap(img, img_pitch, lmin, lmin_pitch, width, height, elsize)
+       || morph_overlap(img, img_pitch, lmax, lmax_pitch, width, height,
+                        elsize))) {
+    nbands = 1;
+  }
+  if (ctx != NULL && r >= MORPH_FAST_RADIUS) {
+    job.tables = morph_tables(ctx, nbands, 2,
+                              morph_stage_size(width, height, r, elsize));
+    if (job.tables == NULL) {
+      return IMG_FAILURE;
+    }
+  }
+  status = img_parallel(nbands, morph_task, &job);
+  IMG_STATS_STOP(IMG_STATS_MORPH, tic, width*height*((lmin != NULL) +
+                                                    (lmax != NULL)));
+  return status;
 }
 
 /**
@@ -301,119 +708,1633 @@ int img_morph_dilation(int type, long width, long height,
                              r, ws, NULL, 0, lmax, lmax_pitch);
 }
 
-/*---------------------------------------------------------------------------*/
-
-#else /* _IMG_MORPH_C defined */
-
-static void MORPH_LMIN_LMAX(TYPE)(const long width, const long height,
-                                  const pixel_t img[], const long img_pitch,
-                                  const long r, long ws[],
-                                  pixel_t lmin[], const long lmin_pitch,
-                                  pixel_t lmax[], const long lmax_pitch)
+/*
+ * Apply a pipeline of NSTAGES erosions or dilations of radii RS[] to an
+ * image.  MAXS[] specifies which stages are dilations.  If MODE is non-zero,
+ * the difference between the output of the pipeline and the source rows of
+ * stage REF is stored: OUTPUT - SOURCE if MODE > 0, SOURCE - OUTPUT if
+ * MODE < 0.  If CTX is not NULL, the rolling buffers of the stages are taken
+ * from this context and all the radii must be equal to the one of the
+ * context.
+ */
+static int morph_pipeline(img_context_t *ctx, int type,
+                          long width, long height,
+                          const void *img, long img_pitch,
+                          int nstages, const long rs[], const int maxs[],
+                          int ref, int mode, void *dst, long dst_pitch)
 {
-  pixel_t pval, pmin, pmax; /* pixel values */
-  long dx, dy, dx0, dx1, dy0, dy1; /* offsets and bounds */
-  long x, y; /* coordinates in source/destination image */
-  long *off;
+  morph_job_t job;
+  size_t elsize, size, maxsize;
+  long nbands, rsum = 0;
+  int k, status;
+  IMG_STATS_TIMER(tic)
 
-  /*
-   * Fill the offset array with the range of DX for any DY.  To lie inside the
-   * neighborhood, the condition is:
-   *
-   *    sqrt(dx*dx + dy*dy) < r + 0.5
-   *
-   * Taking the square and accounting for the fact that DX, DY and R are
-   * integers yields:
-   *
-   *    dx*dx <= (r + 1)*r - dy*dy
-   */
-  off = ws + r;
-  for (dy = 0; dy <= r; ++dy) {
-    long t = (r + 1)*r - dy*dy;
-    dx = r;
-    while (dx*dx > t) {
-      --dx;
+  if ((img == NULL) || (dst == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((width <= 0) || (height <= 0) || (img_pitch < width)
+      || (dst_pitch < width)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  for (k = 0; k < nstages; ++k) {
+    if (rs[k] < 0) {
+      errno = EINVAL;
+      return IMG_FAILURE;
     }
-    off[ dy] = dx;
-    off[-dy] = dx;
+    rsum += rs[k];
   }
 
-  /*
-   * The following macro set inclusive endpoints [START,STOP] of range
-   * for position POS +/- SPAN along axis of lenght LEN.
-   */
-#define SET_RANGE(pos, len, span, start, stop) \
-    start = ((pos) >= (span) ? -(span) : -(pos)); \
-    stop = ((pos) + (span) < (len) ? (span) : (len) - 1 - (pos))
+#define CASE(TYPE) case IMG_TYPE_##TYPE:        \
+  job.rows = MORPH_PIPELINE(TYPE);              \
+  elsize = sizeof(CPT_CTYPE(TYPE));             \
+  break
 
-  /*
-   * Perfom the morpho-math operation(s).
-   */
-  if (lmin != (pixel_t *)NULL && lmax != (pixel_t *)NULL) {
-    for (y = 0; y < height; ++y) {
-      SET_RANGE(y, height, r, dy0, dy1);
-      for (x = 0; x < width; ++x) {
-        const pixel_t *cur = &img[x + img_pitch*y];
-        pmin = pmax = cur[0];
-        for (dy = dy0; dy <= dy1; ++dy) {
-          const pixel_t *fast = &cur[img_pitch*dy];
-          long t = off[dy];
-          SET_RANGE(x, width, t, dx0, dx1);
-          for (dx = dx0; dx <= dx1; ++dx) {
-            pval = fast[dx];
-            if (pval < pmin) pmin = pval;
-            if (pval > pmax) pmax = pval;
-          }
-        }
-        lmin[x + lmin_pitch*y] = pmin;
-        lmax[x + lmax_pitch*y] = pmax;
-      }
-    }
-  } else if (lmin != (pixel_t *)NULL) {
-    for (y = 0; y < height; ++y) {
-      SET_RANGE(y, height, r, dy0, dy1);
-      for (x = 0; x < width; ++x) {
-        const pixel_t *cur = &img[x + img_pitch*y];
-        pmin = cur[0];
-        for (dy = dy0; dy <= dy1; ++dy) {
-          const pixel_t *fast = &cur[img_pitch*dy];
-          long t = off[dy];
-          SET_RANGE(x, width, t, dx0, dx1);
-          for (dx = dx0; dx <= dx1; ++dx) {
-            pval = fast[dx];
-            if (pval < pmin) pmin = pval;
-          }
-        }
-        lmin[x + lmin_pitch*y] = pmin;
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+  default:
+    /* Bad pixel type. */
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#undef CASE
+
+  job.img = img;
+  job.img_pitch = img_pitch;
+  job.dst = dst;
+  job.dst_pitch = dst_pitch;
+  job.rs = rs;
+  job.maxs = maxs;
+  job.width = width;
+  job.height = height;
+  job.nstages = nstages;
+  job.ref = ref;
+  job.mode = mode;
+  job.off = NULL;
+  job.tables = NULL;
+  IMG_STATS_START(tic);
+  nbands = morph_num_bands(height, rsum);
+  if (nbands > 1 && morph_overlap(img, img_pitch, dst, dst_pitch,
+                                  width, height, elsize)) {
+    nbands = 1;
+  }
+  if (ctx != NULL) {
+    maxsize = 0;
+    for (k = 0; k < nstages; ++k) {
+      size = morph_stage_size(width, height, rs[k], elsize);
+      if (size > maxsize) {
+        maxsize = size;
       }
     }
-  } else if (lmax != (pixel_t *)NULL) {
-    for (y = 0; y < height; ++y) {
-      SET_RANGE(y, height, r, dy0, dy1);
-      for (x = 0; x < width; ++x) {
-        const pixel_t *cur = &img[x + img_pitch*y];
-        pmax = cur[0];
-        for (dy = dy0; dy <= dy1; ++dy) {
-          const pixel_t *fast = &cur[img_pitch*dy];
-          long t = off[dy];
-          SET_RANGE(x, width, t, dx0, dx1);
-          for (dx = dx0; dx <= dx1; ++dx) {
-            pval = fast[dx];
-            if (pval > pmax) pmax = pval;
-          }
-        }
-        lmax[x + lmax_pitch*y] = pmax;
-      }
+    job.off = ctx->off;
+    job.tables = morph_tables(ctx, nbands, nstages, maxsize);
+    if (job.tables == NULL) {
+      return IMG_FAILURE;
     }
   }
+  status = img_parallel(nbands, morph_task, &job);
+  IMG_STATS_STOP(IMG_STATS_MORPH, tic, width*height*nstages);
+  return status;
+}
 
-  /*
-   * Destroy "local" macro.
-   */
-#undef SET_RANGE
+/**
+ * @brief Morpho-math opening of an image.
+ *
+ * This function performs a morpho-math opening (an erosion followed by a
+ * dilation) of an image by a disk of radius \a r.  The rows are streamed
+ * through the two operations, so the intermediate erosion is never stored as
+ * a whole image.  The result is exactly the same as calling
+ * img_morph_erosion() and then img_morph_dilation().  The operation can be
+ * performed in-place (\a dst = \a img with the same pitch).
+ *
+ * @param type        The type identifier of the input image \a img and
+ *                    output \a dst.
+ * @param width       The image width.
+ * @param height      The image height.
+ * @param img         The input image.
+ * @param img_pitch   The number of elements per row of \a img.
+ * @param r           The radius of the neighborhood, must be non-negative.
+ * @param dst         The address of array to store the result.
+ * @param dst_pitch   The number of elements per row of \a dst.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ *
+ * @see img_morph_closing(), img_morph_top_hat(), img_morph_lmin_lmax().
+ */
+int img_morph_opening(int type, long width, long height,
+                      const void *img, long img_pitch, long r,
+                      void *dst, long dst_pitch)
+{
+  long rs[2];
+  int maxs[2];
+
+  rs[0] = r; maxs[0] = 0;
+  rs[1] = r; maxs[1] = 1;
+  return morph_pipeline(NULL, type, width, height, img, img_pitch,
+                        2, rs, maxs, 0, 0, dst, dst_pitch);
+}
+
+/**
+ * @brief Morpho-math closing of an image.
+ *
+ * This function performs a morpho-math closing (a dilation followed by an
+ * erosion) of an image by a disk of radius \a r.  See img_morph_opening()
+ * for a description of the arguments.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ *
+ * @see img_morph_opening(), img_morph_top_hat(), img_morph_lmin_lmax().
+ */
+int img_morph_closing(int type, long width, long height,
+                      const void *img, long img_pitch, long r,
+                      void *dst, long dst_pitch)
+{
+  long rs[2];
+  int maxs[2];
+
+  rs[0] = r; maxs[0] = 1;
+  rs[1] = r; maxs[1] = 0;
+  return morph_pipeline(NULL, type, width, height, img, img_pitch,
+                        2, rs, maxs, 0, 0, dst, dst_pitch);
+}
+
+/**
+ * @brief Morpho-math top-hat filter.
+ *
+ * This function applies a white or black top-hat filter to an image.  The
+ * white top-hat is IMG - OPENING(IMG, R) and the black top-hat is
+ * CLOSING(IMG, R) - IMG.  If \a s > 0, IMG is first smoothed by a closing
+ * (for the white top-hat) or an opening (for the black top-hat) of radius
+ * \a s.  All the operations and the difference are streamed row by row, no
+ * intermediate images are stored.  The difference is computed in the pixel
+ * type of the image.  The operation can be performed in-place (\a dst =
+ * \a img with the same pitch).
+ *
+ * @param type        The type identifier of the input image \a img and
+ *                    output \a dst.
+ * @param width       The image width.
+ * @param height      The image height.
+ * @param img         The input image.
+ * @param img_pitch   The number of elements per row of \a img.
+ * @param r           The radius of the structuring element for the feature
+ *                    detection, must be non-negative.
+ * @param s           The radius of the structuring element for the
+ *                    smoothing, 0 for no smoothing.
+ * @param black       Non-zero for a black top-hat, zero for a white one.
+ * @param dst         The address of array to store the result.
+ * @param dst_pitch   The number of elements per row of \a dst.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ *
+ * @see img_morph_opening(), img_morph_closing().
+ */
+int img_morph_top_hat(int type, long width, long height,
+                      const void *img, long img_pitch,
+                      long r, long s, int black,
+                      void *dst, long dst_pitch)
+{
+  long rs[MORPH_MAX_STAGES];
+  int maxs[MORPH_MAX_STAGES];
+  int n = 0;
+
+  if (s > 0) {
+    rs[n] = s; maxs[n] = (black ? 0 : 1); ++n;
+    rs[n] = s; maxs[n] = (black ? 1 : 0); ++n;
+  } else if (s < 0) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  rs[n] = r; maxs[n] = (black ? 1 : 0); ++n;
+  rs[n] = r; maxs[n] = (black ? 0 : 1); ++n;
+  return morph_pipeline(NULL, type, width, height, img, img_pitch,
+                        n, rs, maxs, n - 2, (black ? 1 : -1),
+                        dst, dst_pitch);
+}
+
+/**
+ * @brief Edge preserving enhancement of an image.
+ *
+ * This function rescales the values of an image in a non-linear way between
+ * the local minimum and the local maximum in a disk of radius \a r centered
+ * at every pixel.  If \a s >= 0, the rescaling function is a sigmoid with
+ * shape factor \a s (the larger \a s, the steeper the sigmoid).  If \a s <
+ * 0, a step-like rescaling function is chosen: every pixel is set to either
+ * the local minimum or the local maximum which one is the closest (this is
+ * the "toggle filter" of Kramer & Bruckner).  For integer types, the result
+ * is rounded to the nearest integer.
+ *
+ * The filter can be iterated \a niter times to achieve deblurring of the
+ * image.  With a single thread, all iterations are done in the destination
+ * image, the rows being streamed through the local minimum and maximum
+ * computations, so that no other image-sized buffers are needed; with
+ * several threads, a temporary image is needed.  The iterations stop as soon
+ * as the image no longer changes.  The operation can be performed in-place
+ * (\a dst = \a img with the same pitch).
+ *
+ * @param type        The type identifier of the input image \a img and
+ *                    output \a dst.
+ * @param width       The image width.
+ * @param height      The image height.
+ * @param img         The input image.
+ * @param img_pitch   The number of elements per row of \a img.
+ * @param r           The radius of the neighborhood, must be non-negative.
+ * @param s           The shape factor of the sigmoid, negative for the
+ *                    step-like rescaling.
+ * @param niter       The number of iterations, must be non-negative.
+ * @param dst         The address of array to store the result.
+ * @param dst_pitch   The number of elements per row of \a dst.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ *
+ * @see img_morph_lmin_lmax(), img_morph_trilevel().
+ */
+int img_morph_enhance(int type, long width, long height,
+                      const void *img, long img_pitch,
+                      long r, double s, long niter,
+                      void *dst, long dst_pitch)
+{
+  morph_job_t job;
+  void *tmp = NULL;
+  size_t elsize;
+  double hi = 0.0, lo = 0.0;
+  long iter, nbands, k;
+  int changed, status = IMG_SUCCESS;
+
+  if ((img == NULL) || (dst == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((r < 0) || (niter < 0) || (width <= 0) || (height <= 0)
+      || (img_pitch < width) || (dst_pitch < width)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#define CASE(TYPE) case IMG_TYPE_##TYPE:        \
+  job.rows = MORPH_ENHANCE(TYPE);               \
+  elsize = sizeof(CPT_CTYPE(TYPE));             \
+  break
+
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+  default:
+    /* Bad pixel type. */
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#undef CASE
+
+  job.s = s;
+  job.alpha = 0.0;
+  job.beta = 0.0;
+  if (s >= 0.0) {
+    /* Pre-compute the range of the sigmoid function to detect early return
+       with no change.  We use the sigmoid function f(t) = 1/(1 + exp(-t))
+       for the rescaling function g(t) = alpha*f(s*t) + beta with (ALPHA,BETA)
+       chosen to map the range [-1,1] into [0,1]. */
+    hi = 1.0/(1.0 + exp(-s));
+    lo = ((hi == 1.0) ? 0.0 : 1.0/(1.0 + exp(s)));
+    if (hi != lo) {
+      job.alpha = 1.0/(hi - lo);
+      job.beta = job.alpha*lo;
+    }
+  }
+  if (niter == 0 || (s >= 0.0 && hi == lo)) {
+    if (dst != img || dst_pitch != img_pitch) {
+      return img_copy(width, height, img, type, 0, img_pitch,
+                      dst, type, 0, dst_pitch);
+    }
+    return IMG_SUCCESS;
+  }
+
+  /* With a single band, all iterations are done in the destination image.
+     Otherwise, the bands of an iteration must not overwrite the source of
+     the other bands, so the iterations alternate between the destination
+     image and a temporary image (the first iteration is done in the
+     temporary image if the destination overlaps the source).  If the
+     temporary image cannot be allocated, a single band is used. */
+  nbands = morph_num_bands(height, r);
+  if (nbands > 1) {
+    tmp = malloc(width*height*elsize);
+    if (tmp == NULL) {
+      nbands = 1;
+    }
+  }
+  job.changed = (int *)malloc(nbands*sizeof(int));
+  if (job.changed == NULL) {
+    errno = ENOMEM;
+    status = IMG_FAILURE;
+    goto done;
+  }
+  job.img = img;
+  job.img_pitch = img_pitch;
+  if (nbands > 1 && morph_overlap(img, img_pitch, dst, dst_pitch,
+                                  width, height, elsize)) {
+    job.dst = tmp;
+    job.dst_pitch = width;
+  } else {
+    job.dst = dst;
+    job.dst_pitch = dst_pitch;
+  }
+  job.width = width;
+  job.height = height;
+  job.r = r;
+  for (iter = 0; iter < niter; ++iter) {
+    if (img_parallel(nbands, morph_task, &job) != IMG_SUCCESS) {
+      status = IMG_FAILURE;
+      goto done;
+    }
+    changed = 0;
+    for (k = 0; k < nbands; ++k) {
+      changed |= job.changed[k];
+    }
+    if (! changed || iter == niter - 1) {
+      break;
+    }
+    job.img = job.dst;
+    job.img_pitch = job.dst_pitch;
+    if (nbands > 1) {
+      if (job.dst == tmp) {
+        job.dst = dst;
+        job.dst_pitch = dst_pitch;
+      } else {
+        job.dst = tmp;
+        job.dst_pitch = width;
+      }
+    }
+  }
+  if (job.dst == tmp) {
+    status = img_copy(width, height, tmp, type, 0, width,
+                      dst, type, 0, dst_pitch);
+  }
+
+ done:
+  if (job.changed != NULL) {
+    free((void *)job.changed);
+  }
+  if (tmp != NULL) {
+    free(tmp);
+  }
+  return status;
+}
+
+/**
+ * @brief Three-level classification of an image.
+ *
+ * This function classifies every pixel of an image as "black" (0), "grey"
+ * (1) or "white" (2) given the local minimum LMIN and the local maximum LMAX
+ * in a disk of radius \a r centered at the pixel.  With C = LMAX - LMIN the
+ * local contrast, a pixel is grey if C < CMIN; otherwise it is white if
+ * PIXEL >= LMAX - \a white*C, black if PIXEL <= LMIN + \a black*C, and grey
+ * if none of these hold.  CMIN = max(\a atol, \a rtol*AVG(C)) where AVG(C)
+ * is the average local contrast; if \a rtol is non-zero, two passes are
+ * needed.  For integer types, CMIN is rounded to the nearest integer.  With
+ * \a white = \a black = 0.5, a pixel is white or black, which one is the
+ * closest (white in case of a tie).
+ *
+ * @param type        The type identifier of the input image \a img.
+ * @param width       The image width.
+ * @param height      The image height.
+ * @param img         The input image.
+ * @param img_pitch   The number of elements per row of \a img.
+ * @param r           The radius of the neighborhood, must be non-negative.
+ * @param atol        The absolute minimum contrast.
+ * @param rtol        The minimum contrast relative to the average one.
+ * @param black       The fraction of "black" levels in a neighborhood.
+ * @param white       The fraction of "white" levels in a neighborhood.
+ * @param dst         The address of array to store the result.
+ * @param dst_pitch   The number of elements per row of \a dst.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ *
+ * @see img_morph_lmin_lmax(), img_morph_enhance().
+ */
+int img_morph_trilevel(int type, long width, long height,
+                       const void *img, long img_pitch, long r,
+                       double atol, double rtol, double black, double white,
+                       unsigned char dst[], long dst_pitch)
+{
+  if ((img == NULL) || (dst == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((r < 0) || (width <= 0) || (height <= 0)
+      || (img_pitch < width) || (dst_pitch < width)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  return morph_trilevel(NULL, type, width, height, img, img_pitch, r, NULL,
+                        atol, rtol, black, white, dst, dst_pitch);
+}
+
+/*
+ * Three-level classification (see img_morph_trilevel).  If CACHE is not
+ * NULL, the local extrema are computed from the tables of the cache with the
+ * chords OFF[-R] to OFF[R] and IMG is not used.
+ */
+static int morph_trilevel(const img_morph_cache_t *cache, int type,
+                          long width, long height,
+                          const void *img, long img_pitch,
+                          long r, const long off[],
+                          double atol, double rtol,
+                          double black, double white,
+                          unsigned char dst[], long dst_pitch)
+{
+  morph_job_t job;
+  double sum;
+  long nbands, y;
+
+#define CASE(TYPE) case IMG_TYPE_##TYPE:        \
+  job.rows = MORPH_TRILEVEL(TYPE);              \
+  break
+
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+  default:
+    /* Bad pixel type. */
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+
+#undef CASE
+
+  job.img = img;
+  job.img_pitch = img_pitch;
+  job.dst = dst;
+  job.dst_pitch = dst_pitch;
+  job.cache = cache;
+  job.off = off;
+  job.width = width;
+  job.height = height;
+  job.r = r;
+  job.black = black;
+  job.white = white;
+  /* With a cache, the bands have no halos to process. */
+  nbands = morph_num_bands(height, (cache != NULL ? 0 : r));
+
+  /* Compute the threshold for the local contrast.  The partial sums of the
+     rows are added in order so that the result does not depend on the
+     number of bands. */
+  job.cmin = atol;
+  job.sum = NULL;
+  if (rtol != 0.0) {
+    job.sum = (double *)malloc(height*sizeof(double));
+    if (job.sum == NULL) {
+      errno = ENOMEM;
+      return IMG_FAILURE;
+    }
+    if (img_parallel(nbands, morph_task, &job) != IMG_SUCCESS) {
+      free((void *)job.sum);
+      return IMG_FAILURE;
+    }
+    sum = 0.0;
+    for (y = 0; y < height; ++y) {
+      sum += job.sum[y];
+    }
+    free((void *)job.sum);
+    job.sum = NULL;
+    sum *= rtol/((double)width*(double)height);
+    if (sum > job.cmin) job.cmin = sum;
+  }
+
+  /* Classify the pixels. */
+  return img_parallel(nbands, morph_task, &job);
+}
+
+/**
+ * @brief Morpho-math operation with a workspace context.
+ *
+ * This function applies an erosion, a dilation, an opening or a closing by
+ * the disk of the radius of the context \a ctx to an image of the type and
+ * dimensions of the context.  The result is the same as with
+ * img_morph_erosion(), img_morph_dilation(), img_morph_opening() or
+ * img_morph_closing(), but the chords of the disk are not computed again and
+ * the rolling buffers are taken from the context, so that no memory is
+ * allocated once the first call with the same number of threads is done.
+ *
+ * @param ctx         The workspace context.
+ * @param op          The operation: \c IMG_MORPH_EROSION, \c
+ *                    IMG_MORPH_DILATION, \c IMG_MORPH_OPENING or \c
+ *                    IMG_MORPH_CLOSING.
+ * @param img         The input image.
+ * @param img_pitch   The number of elements per row of \a img.
+ * @param dst         The address of array to store the result.
+ * @param dst_pitch   The number of elements per row of \a dst.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ *
+ * @see img_context_new(), img_context_morph_lmin_lmax().
+ */
+int img_context_morph(img_context_t *ctx, int op,
+                      const void *img, long img_pitch,
+                      void *dst, long dst_pitch)
+{
+  long rs[2];
+  int maxs[2];
+
+  if (ctx == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  switch (op) {
+  case IMG_MORPH_EROSION:
+    return morph_lmin_lmax(ctx, ctx->type, ctx->width, ctx->height,
+                           img, img_pitch, ctx->r, ctx->off,
+                           dst, dst_pitch, NULL, 0);
+  case IMG_MORPH_DILATION:
+    return morph_lmin_lmax(ctx, ctx->type, ctx->width, ctx->height,
+                           img, img_pitch, ctx->r, ctx->off,
+                           NULL, 0, dst, dst_pitch);
+  case IMG_MORPH_OPENING:
+  case IMG_MORPH_CLOSING:
+    rs[0] = ctx->r; maxs[0] = (op == IMG_MORPH_CLOSING);
+    rs[1] = ctx->r; maxs[1] = (op == IMG_MORPH_OPENING);
+    return morph_pipeline(ctx, ctx->type, ctx->width, ctx->height,
+                          img, img_pitch, 2, rs, maxs, 0, 0,
+                          dst, dst_pitch);
+  }
+  errno = EINVAL;
+  return IMG_FAILURE;
+}
+
+/**
+ * @brief Local minima and maxima with a workspace context.
+ *
+ * This function is the same as img_morph_lmin_lmax() for an image of the
+ * type and dimensions of the context \a ctx and for the radius of the
+ * context.  See img_context_morph().
+ *
+ * @param ctx         The workspace context.
+ * @param img         The input image.
+ * @param img_pitch   The number of elements per row of \a img.
+ * @param lmin        The address of array to store local minima or \c NULL.
+ * @param lmin_pitch  The number of elements per row of \a lmin.
+ * @param lmax        The address of array to store local maxima or \c NULL.
+ * @param lmax_pitch  The number of elements per row of \a lmax.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE.
+ */
+int img_context_morph_lmin_lmax(img_context_t *ctx,
+                                const void *img, long img_pitch,
+                                void *lmin, long lmin_pitch,
+                                void *lmax, long lmax_pitch)
+{
+  if (ctx == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  return morph_lmin_lmax(ctx, ctx->type, ctx->width, ctx->height,
+                         img, img_pitch, ctx->r, ctx->off,
+                         lmin, lmin_pitch, lmax, lmax_pitch);
+}
+
+/*---------------------------------------------------------------------------*/
+/* MORPHOLOGY CACHES */
+
+/*
+ * Set the function applied by bands of rows for building (BUILD true) or
+ * using a morphology cache with pixels of type TYPE.  Returns the size of
+ * the pixels or 0 for an unsupported type.
+ */
+static size_t morph_cache_rows(morph_job_t *job, int type, int build)
+{
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                                \
+  job->rows = (build ? MORPH_CACHE_FEED(TYPE) : MORPH_CACHED(TYPE));    \
+  return sizeof(CPT_CTYPE(TYPE))
+
+  switch (type) {
+#ifdef IMG_TYPE_INT8
+    CASE(INT8);
+#endif
+#ifdef IMG_TYPE_UINT8
+    CASE(UINT8);
+#endif
+#ifdef IMG_TYPE_INT16
+    CASE(INT16);
+#endif
+#ifdef IMG_TYPE_UINT16
+    CASE(UINT16);
+#endif
+#ifdef IMG_TYPE_INT32
+    CASE(INT32);
+#endif
+#ifdef IMG_TYPE_UINT32
+    CASE(UINT32);
+#endif
+#ifdef IMG_TYPE_INT64
+    CASE(INT64);
+#endif
+#ifdef IMG_TYPE_UINT64
+    CASE(UINT64);
+#endif
+#ifdef IMG_TYPE_FLOAT
+    CASE(FLOAT);
+#endif
+#ifdef IMG_TYPE_DOUBLE
+    CASE(DOUBLE);
+#endif
+  default:
+    return 0;
+  }
+
+#undef CASE
+}
+
+/**
+ * @brief Create a morphology cache.
+ *
+ * A morphology cache stores, for every row of an image, the tables of
+ * running minima and/or maxima over windows of 1, 2, 4, ... pixels up to the
+ * length of the longest chord of the disk of radius \a rmax (see
+ * img_morph_lmin_lmax()).  The tables are built once, in parallel by bands
+ * of rows, then the local extrema of the image for any radius up to \a rmax
+ * (see img_morph_cache_lmin_lmax() and img_morph_cache_trilevel()) only
+ * combine two entries of the tables per row of the disk, without the
+ * overheads of the halos of the bands.  This is suitable for multi-scale
+ * processing where the same image is filtered with several radii.  The
+ * cache keeps a copy of the image (the first level of the tables) so the
+ * image may be modified or freed after the creation of the cache.
+ *
+ * The memory used for each kind of extrema is N*(W + 2*\a rmax)*H pixels
+ * with W and H the dimensions of the image and N the smallest integer such
+ * that 2*\a rmax + 1 < 2^N; for instance, 6 times the size of a large image
+ * for \a rmax = 21.  For a single radius, img_morph_lmin_lmax() is
+ * faster.
+ *
+ * @param type       The pixel type of the image.
+ * @param width      The width of the image.
+ * @param height     The height of the image.
+ * @param img        The image.
+ * @param img_pitch  The number of elements per row of \a img.
+ * @param rmax       The maximum radius, must be non-negative.
+ * @param what       The extrema to store: \c IMG_MORPH_CACHE_MIN for the
+ *                   erosions, \c IMG_MORPH_CACHE_MAX for the dilations or
+ *                   \c IMG_MORPH_CACHE_BOTH.
+ *
+ * @return A new cache or \c NULL on error with \c errno set.
+ *
+ * @see img_morph_cache_destroy(), img_morph_cache_lmin_lmax(),
+ *      img_morph_cache_trilevel().
+ */
+img_morph_cache_t *img_morph_cache_new(int type, long width, long height,
+                                       const void *img, long img_pitch,
+                                       long rmax, int what)
+{
+  img_morph_cache_t *cache;
+  morph_job_t job;
+  size_t elsize, size;
+  long *off;
+  int k, status;
+  IMG_STATS_TIMER(tic)
+
+  if (img == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (width <= 0 || height <= 0 || img_pitch < width || rmax < 0 ||
+      what < IMG_MORPH_CACHE_MIN || what > IMG_MORPH_CACHE_BOTH) {
+    errno = EINVAL;
+    return NULL;
+  }
+  elsize = morph_cache_rows(&job, type, 1);
+  if (elsize == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  IMG_STATS_START(tic);
+  cache = (img_morph_cache_t *)malloc(sizeof(img_morph_cache_t));
+  if (cache == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  cache->stage[0].table = cache->stage[1].table = NULL;
+  cache->width = width;
+  cache->height = height;
+  cache->rmax = rmax;
+  cache->type = type;
+  cache->what = what;
+  off = (long *)malloc((2*rmax + 1)*sizeof(long));
+  cache->off = (off != NULL ? off + rmax : NULL);
+  if (off == NULL) {
+    goto nomem;
+  }
+  img_morph_disk(rmax, cache->off);
+  size = height*morph_levels(rmax)*(width + 2*rmax)*elsize;
+  for (k = 0; k < 2; ++k) {
+    morph_stage_t *stage = &cache->stage[k];
+    void *table;
+    if ((what & (k == 0 ? IMG_MORPH_CACHE_MIN : IMG_MORPH_CACHE_MAX)) == 0) {
+      continue;
+    }
+    table = malloc(size);
+    if (table == NULL) {
+      goto nomem;
+    }
+    IMG_STATS_ALLOC(IMG_STATS_MORPH, size);
+    morph_stage_init(stage, NULL, img, img_pitch, width, height, rmax, k,
+                     elsize, table, cache->off);
+    stage->nrows = height;
+  }
+  job.cache = cache;
+  job.width = width;
+  job.height = height;
+  status = img_parallel(img_get_num_bands(height, MORPH_MIN_ROWS),
+                        morph_task, &job);
+  IMG_STATS_STOP(IMG_STATS_MORPH, tic, width*height);
+  if (status != IMG_SUCCESS) {
+    int code = errno;
+    img_morph_cache_destroy(cache);
+    errno = code;
+    return NULL;
+  }
+  for (k = 0; k < 2; ++k) {
+    cache->stage[k].img = NULL;
+    cache->stage[k].count = height;
+  }
+  return cache;
+
+ nomem:
+  img_morph_cache_destroy(cache);
+  errno = ENOMEM;
+  return NULL;
+}
+
+/**
+ * @brief Destroy a morphology cache.
+ *
+ * @param cache  The cache to destroy (may be \c NULL).
+ */
+void img_morph_cache_destroy(img_morph_cache_t *cache)
+{
+  int k;
+
+  if (cache != NULL) {
+    for (k = 0; k < 2; ++k) {
+      if (cache->stage[k].table != NULL) {
+        free(cache->stage[k].table);
+      }
+    }
+    if (cache->off != NULL) {
+      free((void *)(cache->off - cache->rmax));
+    }
+    free(cache);
+  }
+}
+
+int img_morph_cache_get_type(const img_morph_cache_t *cache)
+{
+  return (cache != NULL ? cache->type : -1);
+}
+
+long img_morph_cache_get_width(const img_morph_cache_t *cache)
+{
+  return (cache != NULL ? cache->width : -1L);
+}
+
+long img_morph_cache_get_height(const img_morph_cache_t *cache)
+{
+  return (cache != NULL ? cache->height : -1L);
+}
+
+long img_morph_cache_get_radius(const img_morph_cache_t *cache)
+{
+  return (cache != NULL ? cache->rmax : -1L);
+}
+
+int img_morph_cache_get_what(const img_morph_cache_t *cache)
+{
+  return (cache != NULL ? cache->what : 0);
+}
+
+/* Get the chords of the disk of radius R for a query of a cache, OFF[-R] to
+   OFF[R], to be freed with free(OFF - R).  Returns NULL with errno set on
+   error. */
+static long *morph_cache_chords(const img_morph_cache_t *cache, long r)
+{
+  long *off;
+
+  if (r == cache->rmax) {
+    return cache->off;
+  }
+  off = (long *)malloc((2*r + 1)*sizeof(long));
+  if (off == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  img_morph_disk(r, off + r);
+  return off + r;
+}
+
+/**
+ * @brief Local minima and maxima from a morphology cache.
+ *
+ * This function yields the same results as img_morph_lmin_lmax() for the
+ * image of the cache and a radius \a r at most equal to the radius of the
+ * cache.  The destinations may be any arrays, including the source image of
+ * the cache.
+ *
+ * @param cache       The morphology cache.
+ * @param r           The radius of the structuring element.
+ * @param lmin        The address of array to store local minima or \c NULL
+ *                    (must be \c NULL if the minima are not cached).
+ * @param lmin_pitch  The number of elements per row of \a lmin.
+ * @param lmax        The address of array to store local maxima or \c NULL
+ *                    (must be \c NULL if the maxima are not cached).
+ * @param lmax_pitch  The number of elements per row of \a lmax.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ *
+ * @see img_morph_cache_new(), img_morph_lmin_lmax().
+ */
+int img_morph_cache_lmin_lmax(const img_morph_cache_t *cache, long r,
+                              void *lmin, long lmin_pitch,
+                              void *lmax, long lmax_pitch)
+{
+  morph_job_t job;
+  long *off;
+  int status;
+  IMG_STATS_TIMER(tic)
+
+  if (cache == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (r < 0 || r > cache->rmax
+      || (lmin != NULL && (lmin_pitch < cache->width ||
+                           cache->stage[0].table == NULL))
+      || (lmax != NULL && (lmax_pitch < cache->width ||
+                           cache->stage[1].table == NULL))) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  IMG_STATS_START(tic);
+  off = morph_cache_chords(cache, r);
+  if (off == NULL) {
+    return IMG_FAILURE;
+  }
+  morph_cache_rows(&job, cache->type, 0);
+  job.cache = cache;
+  job.lmin = lmin;
+  job.lmin_pitch = lmin_pitch;
+  job.lmax = lmax;
+  job.lmax_pitch = lmax_pitch;
+  job.off = off;
+  job.width = cache->width;
+  job.height = cache->height;
+  job.r = r;
+  status = img_parallel(morph_num_bands(cache->height, 0), morph_task, &job);
+  if (off != cache->off) {
+    free((void *)(off - r));
+  }
+  IMG_STATS_STOP(IMG_STATS_MORPH, tic,
+                 cache->width*cache->height*((lmin != NULL) +
+                                             (lmax != NULL)));
+  return status;
+}
+
+/**
+ * @brief Three-level classification from a morphology cache.
+ *
+ * This function yields the same result as img_morph_trilevel() for the image
+ * of the cache and a radius \a r at most equal to the radius of the cache.
+ * Both the minima and the maxima must be cached.
+ *
+ * @param cache       The morphology cache.
+ * @param r           The radius of the neighborhood.
+ * @param atol        The absolute minimum contrast.
+ * @param rtol        The minimum contrast relative to the average one.
+ * @param black       The fraction of "black" levels in a neighborhood.
+ * @param white       The fraction of "white" levels in a neighborhood.
+ * @param dst         The address of array to store the result.
+ * @param dst_pitch   The number of elements per row of \a dst.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ *
+ * @see img_morph_cache_new(), img_morph_trilevel().
+ */
+int img_morph_cache_trilevel(const img_morph_cache_t *cache, long r,
+                             double atol, double rtol,
+                             double black, double white,
+                             unsigned char dst[], long dst_pitch)
+{
+  long *off;
+  int status;
+
+  if (cache == NULL || dst == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (r < 0 || r > cache->rmax || dst_pitch < cache->width
+      || cache->what != IMG_MORPH_CACHE_BOTH) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  off = morph_cache_chords(cache, r);
+  if (off == NULL) {
+    return IMG_FAILURE;
+  }
+  status = morph_trilevel(cache, cache->type, cache->width, cache->height,
+                          NULL, 0, r, off, atol, rtol, black, white,
+                          dst, dst_pitch);
+  if (off != cache->off) {
+    free((void *)(off - r));
+  }
+  return status;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#else /* _IMG_MORPH_C defined */
+
+/*
+ * Minimum and maximum of two values.  For floating-point types, NaN's are
+ * ignored (the result is NaN only if both operands are NaN) so that these
+ * operations are associative and yield the same result as the brute force
+ * method whatever the order of the operands.  The two tests are combined by
+ * a bitwise or, not a logical one, so that the loops of the fast method are
+ * branch free and can be vectorized.
+ */
+#if CPT_IS_REAL(TYPE)
+# define MORPH_MIN(a, b) (((b) < (a)) | ((a) != (a)) ? (b) : (a))
+# define MORPH_MAX(a, b) (((b) > (a)) | ((a) != (a)) ? (b) : (a))
+#else
+# define MORPH_MIN(a, b) ((b) < (a) ? (b) : (a))
+# define MORPH_MAX(a, b) ((b) > (a) ? (b) : (a))
+#endif
+
+/*
+ * Difference of two pixel values as a double.  For floating-point types, the
+ * difference is computed in the pixel type (as Yorick does); for integer
+ * types, it is computed in double precision to avoid overflows.  ROUND
+ * converts a double to the pixel type.
+ */
+#if CPT_IS_REAL(TYPE)
+# define MORPH_DIFF(a, b) ((double)((a) - (b)))
+# define MORPH_ROUND(val) ((pixel_t)(val))
+#else
+# define MORPH_DIFF(a, b) ((double)(a) - (double)(b))
+# define MORPH_ROUND(val) ((pixel_t)floor((val) + 0.5))
+#endif
+
+static void MORPH_ROW(TYPE)(const morph_stage_t *s, long y, pixel_t dst[]);
+
+/*
+ * Make sure that source rows 0 to Y (inclusive) have been processed by stage
+ * S.  The source rows are taken from the previous stage (if any) which is
+ * fed as needed.
+ */
+static void MORPH_FEED(TYPE)(morph_stage_t *s, long y)
+{
+  const long n = s->n, pad = s->pad, width = s->width;
+  long c, i, j, x;
+
+  while ((c = s->count) <= y) {
+    pixel_t *t0 = (pixel_t *)s->table + (c % s->nrows)*s->stride;
+    pixel_t *row = t0 + pad;
+    if (s->prev == NULL) {
+      const pixel_t *src = (const pixel_t *)s->img + s->img_pitch*c;
+      for (x = 0; x < width; ++x) {
+        row[x] = src[x];
+      }
+    } else {
+      morph_stage_t *p = s->prev;
+      MORPH_FEED(TYPE)(p, (c + p->r < p->height ? c + p->r : p->height - 1));
+      MORPH_ROW(TYPE)(p, c, row);
+    }
+    for (i = 0; i < pad; ++i) {
+      t0[i] = row[0];
+      t0[n - 1 - i] = row[width - 1];
+    }
+#define BUILD(OP)                                       \
+    for (j = 1; j < s->levels; ++j) {                   \
+      const pixel_t *prev = t0 + (j - 1)*n;             \
+      pixel_t *curr = t0 + j*n;                         \
+      const long h = 1L << (j - 1), m = n - 2*h;        \
+      for (i = 0; i <= m; ++i) {                        \
+        curr[i] = OP(prev[i], prev[i + h]);             \
+      }                                                 \
+    }
+    if (s->max) {
+      BUILD(MORPH_MAX);
+    } else {
+      BUILD(MORPH_MIN);
+    }
+#undef BUILD
+    s->count = c + 1;
+  }
+}
+
+/*
+ * Compute the output row Y of stage S.  Source rows up to Y + R must have
+ * been processed (see MORPH_FEED).
+ */
+static void MORPH_ROW(TYPE)(const morph_stage_t *s, long y, pixel_t dst[])
+{
+  const long n = s->n, r = s->r, pad = s->pad, width = s->width;
+  const long dy0 = (y >= r ? -r : -y);
+  const long dy1 = (y + r < s->height ? r : s->height - 1 - y);
+  const pixel_t *table = (const pixel_t *)s->table;
+  long dy, j, k, q, x;
+
+#define CHORDS(OP)                                              \
+  for (dy = dy0; dy <= dy1; ++dy) {                             \
+    const pixel_t *row;                                         \
+    k = s->off[dy];                                             \
+    j = 0;                                                      \
+    while ((2L << j) <= 2*k + 1) {                              \
+      ++j;                                                      \
+    }                                                           \
+    q = 2*k + 1 - (1L << j);                                    \
+    row = table + ((y + dy) % s->nrows)*s->stride + j*n + pad - k; \
+    if (dy == dy0) {                                            \
+      for (x = 0; x < width; ++x) {                             \
+        dst[x] = OP(row[x], row[x + q]);                        \
+      }                                                         \
+    } else {                                                    \
+      for (x = 0; x < width; ++x) {                             \
+        pixel_t val = OP(row[x], row[x + q]);                   \
+        dst[x] = OP(dst[x], val);                               \
+      }                                                         \
+    }                                                           \
+  }
+  if (s->max) {
+    CHORDS(MORPH_MAX);
+  } else {
+    CHORDS(MORPH_MIN);
+  }
+#undef CHORDS
+
+#if CPT_IS_REAL(TYPE)
+  /* The brute force method yields NaN where the central pixel is NaN. */
+  {
+    const pixel_t *cur = table + (y % s->nrows)*s->stride + pad;
+    for (x = 0; x < width; ++x) {
+      if (cur[x] != cur[x]) {
+        dst[x] = cur[x];
+      }
+    }
+  }
+#endif
+}
+
+/*
+ * Compute local minima and/or maxima over a disk of radius R by decomposing
+ * the disk into horizontal chords.  Only rows Y0 to Y1 - 1 are computed.
+ * If TABLES is not NULL, TABLES[0] and TABLES[1] are the rolling buffers for
+ * the minima and the maxima and OFF gives the chords.  Returns IMG_FAILURE
+ * if the workspace cannot be allocated.
+ */
+static int MORPH_FAST(TYPE)(const long width, const long height,
+                            const pixel_t img[], const long img_pitch,
+                            const long r,
+                            pixel_t lmin[], const long lmin_pitch,
+                            pixel_t lmax[], const long lmax_pitch,
+                            const long y0, const long y1,
+                            void *const tables[], const long off[])
+{
+  morph_stage_t smin, smax;
+  long y, ylast;
+
+  smin.off = smax.off = NULL;
+  smin.table = smax.table = NULL;
+  smin.owner = smax.owner = 1;
+  if ((lmin != NULL
+       && morph_stage_init(&smin, NULL, img, img_pitch, width, height,
+                           r, 0, sizeof(pixel_t),
+                           (tables != NULL ? tables[0] : NULL),
+                           off) != IMG_SUCCESS) ||
+      (lmax != NULL
+       && morph_stage_init(&smax, NULL, img, img_pitch, width, height,
+                           r, 1, sizeof(pixel_t),
+                           (tables != NULL ? tables[1] : NULL),
+                           off) != IMG_SUCCESS)) {
+    morph_stage_destroy(&smin);
+    morph_stage_destroy(&smax);
+    return IMG_FAILURE;
+  }
+  if (lmin != NULL) {
+    morph_stage_seek(&smin, y0);
+  }
+  if (lmax != NULL) {
+    morph_stage_seek(&smax, y0);
+  }
+  for (y = y0; y < y1; ++y) {
+    ylast = (y + r < height ? y + r : height - 1);
+    if (lmin != NULL) {
+      MORPH_FEED(TYPE)(&smin, ylast);
+      MORPH_ROW(TYPE)(&smin, y, &lmin[lmin_pitch*y]);
+    }
+    if (lmax != NULL) {
+      MORPH_FEED(TYPE)(&smax, ylast);
+      MORPH_ROW(TYPE)(&smax, y, &lmax[lmax_pitch*y]);
+    }
+  }
+  morph_stage_destroy(&smin);
+  morph_stage_destroy(&smax);
+  return IMG_SUCCESS;
+}
+
+/*
+ * Apply a pipeline of erosions/dilations (see morph_pipeline) to rows Y0 to
+ * Y1 - 1.
+ */
+static int MORPH_PIPELINE(TYPE)(morph_job_t *job, long y0, long y1, long band)
+{
+  const long width = job->width, height = job->height;
+  const long dst_pitch = job->dst_pitch;
+  const int nstages = job->nstages, mode = job->mode;
+  pixel_t *dst = (pixel_t *)job->dst;
+  morph_stage_t stage[MORPH_MAX_STAGES], *last;
+  long x, y;
+  int k, status = IMG_SUCCESS;
+
+  for (k = 0; k < nstages; ++k) {
+    stage[k].off = NULL;
+    stage[k].table = NULL;
+    stage[k].owner = 1;
+  }
+  for (k = 0; k < nstages; ++k) {
+    if (morph_stage_init(&stage[k], (k > 0 ? &stage[k - 1] : NULL),
+                         job->img, job->img_pitch, width, height,
+                         job->rs[k], job->maxs[k], sizeof(pixel_t),
+                         (job->tables != NULL ?
+                          job->tables[band*MORPH_MAX_STAGES + k] : NULL),
+                         job->off) != IMG_SUCCESS) {
+      status = IMG_FAILURE;
+      goto done;
+    }
+  }
+  last = &stage[nstages - 1];
+  morph_stage_seek(last, y0);
+  for (y = y0; y < y1; ++y) {
+    pixel_t *out = &dst[dst_pitch*y];
+    MORPH_FEED(TYPE)(last, (y + last->r < height ? y + last->r : height - 1));
+    MORPH_ROW(TYPE)(last, y, out);
+    if (mode != 0) {
+      /* The source row Y of the reference stage is still in its rolling
+         buffer because the stages are fed at least up to row Y. */
+      const morph_stage_t *s = &stage[job->ref];
+      const pixel_t *src = ((const pixel_t *)s->table
+                            + (y % s->nrows)*s->stride + s->pad);
+      if (mode > 0) {
+        for (x = 0; x < width; ++x) {
+          out[x] = out[x] - src[x];
+        }
+      } else {
+        for (x = 0; x < width; ++x) {
+          out[x] = src[x] - out[x];
+        }
+      }
+    }
+  }
+
+ done:
+  for (k = 0; k < nstages; ++k) {
+    morph_stage_destroy(&stage[k]);
+  }
+  return status;
+}
+
+/*
+ * Apply one iteration of the enhancement filter (see img_morph_enhance) to
+ * rows Y0 to Y1 - 1.  Whether some pixels have changed is stored in
+ * JOB->CHANGED[BAND].
+ */
+static int MORPH_ENHANCE(TYPE)(morph_job_t *job, long y0, long y1, long band)
+{
+  const long width = job->width, height = job->height, r = job->r;
+  const long dst_pitch = job->dst_pitch;
+  const double s = job->s, alpha = job->alpha, beta = job->beta;
+  pixel_t *dst = (pixel_t *)job->dst;
+  morph_stage_t smin, smax;
+  pixel_t *lmin, *lmax;
+  long x, y, ylast;
+  int changed = 0, status = IMG_SUCCESS;
+
+  smin.off = smax.off = NULL;
+  smin.table = smax.table = NULL;
+  smin.owner = smax.owner = 1;
+  lmin = (pixel_t *)malloc(2*width*sizeof(pixel_t));
+  if (lmin == NULL
+      || morph_stage_init(&smin, NULL, job->img, job->img_pitch, width,
+                          height, r, 0, sizeof(pixel_t),
+                          NULL, NULL) != IMG_SUCCESS
+      || morph_stage_init(&smax, NULL, job->img, job->img_pitch, width,
+                          height, r, 1, sizeof(pixel_t),
+                          NULL, NULL) != IMG_SUCCESS) {
+    errno = ENOMEM;
+    status = IMG_FAILURE;
+    goto done;
+  }
+  lmax = lmin + width;
+
+  morph_stage_seek(&smin, y0);
+  morph_stage_seek(&smax, y0);
+  for (y = y0; y < y1; ++y) {
+    /* The source row Y is still in the rolling buffer of the stages, the
+       destination row can therefore overwrite the source. */
+    const pixel_t *src;
+    pixel_t *out = &dst[dst_pitch*y];
+    ylast = (y + r < height ? y + r : height - 1);
+    MORPH_FEED(TYPE)(&smin, ylast);
+    MORPH_FEED(TYPE)(&smax, ylast);
+    MORPH_ROW(TYPE)(&smin, y, lmin);
+    MORPH_ROW(TYPE)(&smax, y, lmax);
+    src = ((const pixel_t *)smin.table
+           + (y % smin.nrows)*smin.stride + smin.pad);
+    if (s < 0.0) {
+      /* Staircase remapping of values. */
+      for (x = 0; x < width; ++x) {
+        pixel_t a = src[x], amin = lmin[x], amax = lmax[x];
+        pixel_t b = (MORPH_DIFF(a, amin) >= MORPH_DIFF(amax, a)
+                     ? amax : amin);
+        if (b != a) changed = 1;
+        out[x] = b;
+      }
+    } else {
+      /* Remapping of values with a sigmoid. */
+      for (x = 0; x < width; ++x) {
+        pixel_t a = src[x], amin = lmin[x], amax = lmax[x];
+        if (amin < a && a < amax) {
+          double t = ((MORPH_DIFF(a, amin) - MORPH_DIFF(amax, a))
+                      /MORPH_DIFF(amax, amin));
+          double f = alpha/(1.0 + exp(-s*t)) - beta;
+          pixel_t b = MORPH_ROUND(f*amax + (1.0 - f)*amin);
+          if (b != a) changed = 1;
+          out[x] = b;
+        } else {
+          out[x] = a;
+        }
+      }
+    }
+  }
+  job->changed[band] = changed;
+
+ done:
+  if (lmin != NULL) {
+    free((void *)lmin);
+  }
+  morph_stage_destroy(&smin);
+  morph_stage_destroy(&smax);
+  return status;
+}
+
+/*
+ * Apply the three-level classification (see img_morph_trilevel) to rows Y0
+ * to Y1 - 1.  If JOB->SUM is not NULL, the sum of the local contrasts of
+ * every row Y is stored in JOB->SUM[Y] instead.
+ */
+static int MORPH_TRILEVEL(TYPE)(morph_job_t *job, long y0, long y1, long band)
+{
+  const long width = job->width, height = job->height, r = job->r;
+  const long dst_pitch = job->dst_pitch;
+  const double black = job->black, white = job->white;
+  unsigned char *dst = (unsigned char *)job->dst;
+  morph_stage_t smin, smax;
+  double cmin;
+  pixel_t *lmin, *lmax;
+  long x, y, ylast;
+  int status = IMG_SUCCESS;
+
+  (void)band;
+  if (job->cache != NULL) {
+    /* All the rows of the cache have been processed, feeding the stages
+       does nothing. */
+    smin = job->cache->stage[0];
+    smax = job->cache->stage[1];
+    smin.r = smax.r = r;
+    smin.off = smax.off = (long *)job->off;
+  } else {
+    smin.off = smax.off = NULL;
+    smin.table = smax.table = NULL;
+    smin.owner = smax.owner = 1;
+  }
+  lmin = (pixel_t *)malloc(2*width*sizeof(pixel_t));
+  if (lmin == NULL
+      || (job->cache == NULL
+          && (morph_stage_init(&smin, NULL, job->img, job->img_pitch, width,
+                               height, r, 0, sizeof(pixel_t),
+                               NULL, NULL) != IMG_SUCCESS
+              || morph_stage_init(&smax, NULL, job->img, job->img_pitch,
+                                  width, height, r, 1, sizeof(pixel_t),
+                                  NULL, NULL) != IMG_SUCCESS))) {
+    errno = ENOMEM;
+    status = IMG_FAILURE;
+    goto done;
+  }
+  lmax = lmin + width;
+  if (job->cache == NULL) {
+    morph_stage_seek(&smin, y0);
+    morph_stage_seek(&smax, y0);
+  }
+
+#define LOCAL_EXTREMA                                   \
+  ylast = (y + r < height ? y + r : height - 1);        \
+  MORPH_FEED(TYPE)(&smin, ylast);                       \
+  MORPH_FEED(TYPE)(&smax, ylast);                       \
+  MORPH_ROW(TYPE)(&smin, y, lmin);                      \
+  MORPH_ROW(TYPE)(&smax, y, lmax)
+
+  if (job->sum != NULL) {
+    /* Integrate the local contrast. */
+    for (y = y0; y < y1; ++y) {
+      double sum = 0.0;
+      LOCAL_EXTREMA;
+      for (x = 0; x < width; ++x) {
+        sum += MORPH_DIFF(lmax[x], lmin[x]);
+      }
+      job->sum[y] = sum;
+    }
+    goto done;
+  }
+#if CPT_IS_REAL(TYPE)
+  cmin = job->cmin;
+#else
+  cmin = floor(job->cmin + 0.5);
+#endif
+
+  /* Classify the pixels.  The tests are written so as to exactly compare
+     the distances to the local extrema when WHITE = BLACK = 1/2. */
+  for (y = y0; y < y1; ++y) {
+    const pixel_t *src;
+    unsigned char *out = &dst[dst_pitch*y];
+    LOCAL_EXTREMA;
+    src = ((const pixel_t *)smin.table
+           + (y % smin.nrows)*smin.stride + smin.pad);
+    for (x = 0; x < width; ++x) {
+      double d0 = MORPH_DIFF(src[x], lmin[x]);
+      double d1 = MORPH_DIFF(lmax[x], src[x]);
+      if (MORPH_DIFF(lmax[x], lmin[x]) < cmin) {
+        out[x] = 1;
+      } else if (white*d0 >= (1.0 - white)*d1) {
+        out[x] = 2;
+      } else if (black*d1 >= (1.0 - black)*d0) {
+        out[x] = 0;
+      } else {
+        out[x] = 1;
+      }
+    }
+  }
+
+#undef LOCAL_EXTREMA
+
+ done:
+  if (lmin != NULL) {
+    free((void *)lmin);
+  }
+  morph_stage_destroy(&smin);
+  morph_stage_destroy(&smax);
+  return status;
+}
+
+/*
+ * Build the tables of rows Y0 to Y1 - 1 in the stages of a morphology cache.
+ * The rows are taken from the source image and processed independently, so
+ * every band works with its own copy of the stages.
+ */
+static int MORPH_CACHE_FEED(TYPE)(morph_job_t *job, long y0, long y1,
+                                  long band)
+{
+  int k;
+
+  (void)band;
+  for (k = 0; k < 2; ++k) {
+    morph_stage_t s = job->cache->stage[k];
+    if (s.table != NULL) {
+      s.count = y0;
+      MORPH_FEED(TYPE)(&s, y1 - 1);
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+/*
+ * Compute local minima and/or maxima of rows Y0 to Y1 - 1 from the tables of
+ * a morphology cache.
+ */
+static int MORPH_CACHED(TYPE)(morph_job_t *job, long y0, long y1, long band)
+{
+  morph_stage_t smin = job->cache->stage[0], smax = job->cache->stage[1];
+  pixel_t *lmin = (pixel_t *)job->lmin;
+  pixel_t *lmax = (pixel_t *)job->lmax;
+  long y;
+
+  (void)band;
+  smin.r = smax.r = job->r;
+  smin.off = smax.off = (long *)job->off;
+  for (y = y0; y < y1; ++y) {
+    if (lmin != NULL) {
+      MORPH_ROW(TYPE)(&smin, y, &lmin[job->lmin_pitch*y]);
+    }
+    if (lmax != NULL) {
+      MORPH_ROW(TYPE)(&smax, y, &lmax[job->lmax_pitch*y]);
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+/*
+ * Compute local minima and/or maxima of rows Y0 to Y1 - 1.
+ */
+static int MORPH_LMIN_LMAX(TYPE)(morph_job_t *job, long y0, long y1,
+                                 long band)
+{
+  const long width = job->width, height = job->height, r = job->r;
+  const long img_pitch = job->img_pitch;
+  const long lmin_pitch = job->lmin_pitch, lmax_pitch = job->lmax_pitch;
+  const pixel_t *img = (const pixel_t *)job->img;
+  pixel_t *lmin = (pixel_t *)job->lmin;
+  pixel_t *lmax = (pixel_t *)job->lmax;
+  const long *off = job->off; /* range of DX for any DY */
+  pixel_t pval, pmin, pmax; /* pixel values */
+  long dx, dy, dx0, dx1, dy0, dy1; /* offsets and bounds */
+  long x, y; /* coordinates in source/destination image */
+
+  /*
+   * Use the fast method if the radius is large enough and if the workspace
+   * can be allocated.
+   */
+  if (r >= MORPH_FAST_RADIUS
+      && MORPH_FAST(TYPE)(width, height, img, img_pitch, r,
+                          lmin, lmin_pitch, lmax, lmax_pitch, y0, y1,
+                          (job->tables != NULL ?
+                           job->tables + band*MORPH_MAX_STAGES : NULL),
+                          off) == IMG_SUCCESS) {
+    return IMG_SUCCESS;
+  }
+
+  /*
+   * The following macro set inclusive endpoints [START,STOP] of range
+   * for position POS +/- SPAN along axis of lenght LEN.
+   */
+#define SET_RANGE(pos, len, span, start, stop) \
+    start = ((pos) >= (span) ? -(span) : -(pos)); \
+    stop = ((pos) + (span) < (len) ? (span) : (len) - 1 - (pos))
+
+  /*
+   * Perfom the morpho-math operation(s).
+   */
+  if (lmin != (pixel_t *)NULL && lmax != (pixel_t *)NULL) {
+    for (y = y0; y < y1; ++y) {
+      SET_RANGE(y, height, r, dy0, dy1);
+      for (x = 0; x < width; ++x) {
+        const pixel_t *cur = &img[x + img_pitch*y];
+        pmin = pmax = cur[0];
+        for (dy = dy0; dy <= dy1; ++dy) {
+          const pixel_t *fast = &cur[img_pitch*dy];
+          long t = off[dy];
+          SET_RANGE(x, width, t, dx0, dx1);
+          for (dx = dx0; dx <= dx1; ++dx) {
+            pval = fast[dx];
+            if (pval < pmin) pmin = pval;
+            if (pval > pmax) pmax = pval;
+          }
+        }
+        lmin[x + lmin_pitch*y] = pmin;
+        lmax[x + lmax_pitch*y] = pmax;
+      }
+    }
+  } else if (lmin != (pixel_t *)NULL) {
+    for (y = y0; y < y1; ++y) {
+      SET_RANGE(y, height, r, dy0, dy1);
+      for (x = 0; x < width; ++x) {
+        const pixel_t *cur = &img[x + img_pitch*y];
+        pmin = cur[0];
+        for (dy = dy0; dy <= dy1; ++dy) {
+          const pixel_t *fast = &cur[img_pitch*dy];
+          long t = off[dy];
+          SET_RANGE(x, width, t, dx0, dx1);
+          for (dx = dx0; dx <= dx1; ++dx) {
+            pval = fast[dx];
+            if (pval < pmin) pmin = pval;
+          }
+        }
+        lmin[x + lmin_pitch*y] = pmin;
+      }
+    }
+  } else if (lmax != (pixel_t *)NULL) {
+    for (y = y0; y < y1; ++y) {
+      SET_RANGE(y, height, r, dy0, dy1);
+      for (x = 0; x < width; ++x) {
+        const pixel_t *cur = &img[x + img_pitch*y];
+        pmax = cur[0];
+        for (dy = dy0; dy <= dy1; ++dy) {
+          const pixel_t *fast = &cur[img_pitch*dy];
+          long t = off[dy];
+          SET_RANGE(x, width, t, dx0, dx1);
+          for (dx = dx0; dx <= dx1; ++dx) {
+            pval = fast[dx];
+            if (pval > pmax) pmax = pval;
+          }
+        }
+        lmax[x + lmax_pitch*y] = pmax;
+      }
+    }
+  }
+
+  /*
+   * Destroy "local" macro.
+   */
+#undef SET_RANGE
+
+  return IMG_SUCCESS;
 }
 
 /* Undefine macro(s) that may be re-defined to avoid warnings. */
+#undef MORPH_MIN
+#undef MORPH_MAX
+#undef MORPH_DIFF
+#undef MORPH_ROUND
 #undef TYPE
 
 #endif /* _IMG_MORPH_C defined */
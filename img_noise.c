@@ -31,22 +31,336 @@
 #include <errno.h>
 
 #include "img.h"
+#include "img_thread.h"
 
 
-/* Definitions of public functions. */
+/* Definitions that will be expanded by the template code. */
+
+#define NOISE_DIFF(TYPE)  CPT_JOIN(noise_diff_,CPT_ABBREV(TYPE))
+
+/* Minimum number of rows per band for parallel processing. */
+#define NOISE_MIN_ROWS 16
+
+/* Number of bins of the histograms and number of successive histograms
+   (each one zooming on the bin of the previous one where is the median) to
+   compute the median of the absolute differences. */
+#define NOISE_NBINS 1024
+#define NOISE_ZOOMS 3
+
+/* Clipping level (relative to the standard deviation), maximum number of
+   iterations and relative tolerance for the clipped RMS.  The correction
+   factor is the ratio of the standard deviation of a Gaussian distribution
+   to that of the same distribution truncated at the clipping level. */
+#define NOISE_CLIP_LEVEL      3.0
+#define NOISE_CLIP_CORRECTION 1.0136063
+#define NOISE_CLIP_MAXITER    20
+#define NOISE_CLIP_TOLERANCE  1e-4
+
+/* Standard deviation of a Gaussian distribution in units of its median
+   absolute deviation. */
+#define NOISE_MAD_FACTOR 1.4826022185056018
+
+/* The noise is estimated from the second differences:
+
+       R(X,Y) = A(X-1,Y-1) - A(X,Y-1) - A(X-1,Y) + A(X,Y)
+
+   for 1 <= X < WIDTH and 1 <= Y < HEIGHT.  For a white noise of standard
+   deviation SIGMA, R has a standard deviation of 2*SIGMA.  A pass of an
+   estimator accumulates either the sum of the squared differences and the
+   number of differences such that |R| <= THRESHOLD or the histogram of
+   |R| over [LO,LO + NOISE_NBINS*STEP) and the number of values below LO
+   (values above the range are ignored). */
+typedef struct _noise_pass noise_pass_t;
+struct _noise_pass {
+  int hist;          /* compute the histogram? */
+  double threshold;  /* maximum |R| for the sums, ignored if < 0 */
+  double lo, step;   /* histogram range */
+  double sum;        /* sum of R^2 */
+  long count;        /* number of R's in the sum */
+  long below;        /* number of |R| < LO */
+  long *bins;        /* histogram (NOISE_NBINS bins) */
+};
+
+/* Accumulate the N values in R. */
+static void noise_accumulate(noise_pass_t *pass, const double r[], long n)
+{
+  long i, k;
+
+  if (pass->hist) {
+    const double lo = pass->lo;
+    const double q = 1.0/pass->step;
+    long *bins = pass->bins;
+    double t;
+    for (i = 0; i < n; ++i) {
+      t = (fabs(r[i]) - lo)*q;
+      if (t < 0.0) {
+        ++pass->below;
+      } else if (t < NOISE_NBINS) {
+        k = (long)t;
+        ++bins[k < NOISE_NBINS ? k : NOISE_NBINS - 1];
+      }
+    }
+  } else if (pass->threshold < 0.0) {
+    double s = 0.0;
+    for (i = 0; i < n; ++i) {
+      s += r[i]*r[i];
+    }
+    pass->sum += s;
+    pass->count += n;
+  } else {
+    const double thr = pass->threshold;
+    double s = 0.0;
+    for (i = k = 0; i < n; ++i) {
+      if (fabs(r[i]) <= thr) {
+        s += r[i]*r[i];
+        ++k;
+      }
+    }
+    pass->sum += s;
+    pass->count += k;
+  }
+}
 
-extern double img_estimate_noise(const int type,
-                                 const void *img,
-                                 const long offset,
-                                 const long width,
-                                 const long height,
-                                 const long stride,
-                                 const int method);
+/* Function to compute the second differences along a row. */
+typedef void noise_diff_t(const void *img, long stride, long x0, long x1,
+                          long y, double r[]);
 
+/* Run a pass of an estimator over all the differences of a source. */
+typedef int noise_source_t(void *src, noise_pass_t *pass);
 
-/* Definitions that will be expanded by the template code. */
+/* Source of differences stored in a buffer. */
+typedef struct _noise_buffer noise_buffer_t;
+struct _noise_buffer {
+  const double *r;
+  long n;
+};
+
+static int noise_buffer_pass(void *src, noise_pass_t *pass)
+{
+  noise_buffer_t *buf = (noise_buffer_t *)src;
+  noise_accumulate(pass, buf->r, buf->n);
+  return IMG_SUCCESS;
+}
+
+/* Estimate the noise level by METHOD given the SOURCE of the NDIFS
+   differences of an image of NPIXELS pixels, BINS is a workspace for the
+   histograms.  Return the noise level or -1 with errno set on error. */
+static double noise_estimate(noise_source_t *source, void *src,
+                             long ndifs, long npixels, int method,
+                             long bins[])
+{
+  noise_pass_t pass;
+  double rms, sigma, prev, lo, step;
+  long j, k, iter, rank;
+
+  if (ndifs < 1) {
+    return 0.0;
+  }
+  pass.hist = 0;
+  pass.threshold = -1.0;
+  pass.sum = 0.0;
+  pass.count = 0;
+  pass.bins = bins;
+  if (source(src, &pass) != IMG_SUCCESS) {
+    return -1.0;
+  }
+  if (method == IMG_NOISE_RMS) {
+    return sqrt(pass.sum/(4.0*npixels));
+  }
+  rms = sqrt(pass.sum/ndifs);
+  if (rms <= 0.0) {
+    return 0.0;
+  }
+
+  if (method == IMG_NOISE_MAD) {
+    /* The median of |R| is less than SQRT(2)*RMS.  Each histogram zooms on
+       the bin of the previous one where is the median. */
+    rank = ndifs/2;
+    lo = 0.0;
+    step = 1.5*rms/NOISE_NBINS;
+    pass.hist = 1;
+    for (iter = 0; iter < NOISE_ZOOMS; ++iter) {
+      for (j = 0; j < NOISE_NBINS; ++j) {
+        bins[j] = 0;
+      }
+      pass.lo = lo;
+      pass.step = step;
+      pass.below = 0;
+      if (source(src, &pass) != IMG_SUCCESS) {
+        return -1.0;
+      }
+      k = pass.below;
+      for (j = 0; j < NOISE_NBINS - 1 && k + bins[j] <= rank; ++j) {
+        k += bins[j];
+      }
+      if (iter == NOISE_ZOOMS - 1 || bins[j] < 1) {
+        /* Interpolate in the last bin. */
+        if (bins[j] > 0) {
+          lo += step*((rank - k + 0.5)/bins[j]);
+        }
+        break;
+      }
+      lo += j*step;
+      step /= NOISE_NBINS;
+    }
+    return 0.5*NOISE_MAD_FACTOR*lo;
+  }
+
+  if (method == IMG_NOISE_CLIPPED_RMS) {
+    sigma = rms;
+    for (iter = 0; iter < NOISE_CLIP_MAXITER; ++iter) {
+      prev = sigma;
+      pass.threshold = NOISE_CLIP_LEVEL*sigma;
+      pass.sum = 0.0;
+      pass.count = 0;
+      if (source(src, &pass) != IMG_SUCCESS) {
+        return -1.0;
+      }
+      if (pass.count < 1) {
+        break;
+      }
+      sigma = NOISE_CLIP_CORRECTION*sqrt(pass.sum/pass.count);
+      if (fabs(sigma - prev) <= NOISE_CLIP_TOLERANCE*prev) {
+        break;
+      }
+    }
+    return 0.5*sigma;
+  }
 
-#define ESTIMATE_NOISE(TYPE)  CPT_JOIN(img_estimate_noise_,CPT_ABBREV(TYPE))
+  errno = EINVAL;
+  return -1.0;
+}
+
+/* Job to run the passes of an estimator over the differences of a whole
+   image by bands of rows.  To have a result which does not depend on the
+   number of threads, there are one partial sum and one count per row (the
+   partial sums are added in order) and one histogram per band. */
+typedef struct _noise_job noise_job_t;
+struct _noise_job {
+  noise_diff_t *diff;
+  const void *img;
+  noise_pass_t *pass;
+  double *sum, *work;
+  long *count, *below, *bins;
+  long width, height, stride, nbands;
+};
+
+static int noise_task(void *data, long band, long nbands)
+{
+  noise_job_t *job = (noise_job_t *)data;
+  noise_pass_t pass = *job->pass;
+  double *r = job->work + band*job->width;
+  long n = job->height - 1;
+  long y, y0 = 1 + IMG_BAND_START(band, nbands, n);
+  long y1 = 1 + IMG_BAND_START(band + 1, nbands, n);
+  long j;
+
+  if (pass.hist) {
+    pass.below = 0;
+    pass.bins = job->bins + band*NOISE_NBINS;
+    for (j = 0; j < NOISE_NBINS; ++j) {
+      pass.bins[j] = 0;
+    }
+  }
+  for (y = y0; y < y1; ++y) {
+    job->diff(job->img, job->stride, 1, job->width, y, r);
+    pass.sum = 0.0;
+    pass.count = 0;
+    noise_accumulate(&pass, r, job->width - 1);
+    job->sum[y] = pass.sum;
+    job->count[y] = pass.count;
+  }
+  job->below[band] = pass.below;
+  return IMG_SUCCESS;
+}
+
+static int noise_image_pass(void *src, noise_pass_t *pass)
+{
+  noise_job_t *job = (noise_job_t *)src;
+  long band, j, y;
+  const long *bins;
+
+  job->pass = pass;
+  if (img_parallel(job->nbands, noise_task, job) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  if (pass->hist) {
+    for (band = 0; band < job->nbands; ++band) {
+      pass->below += job->below[band];
+      bins = job->bins + band*NOISE_NBINS;
+      for (j = 0; j < NOISE_NBINS; ++j) {
+        pass->bins[j] += bins[j];
+      }
+    }
+  } else {
+    for (y = 1; y < job->height; ++y) {
+      pass->sum += job->sum[y];
+      pass->count += job->count[y];
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+/* Job to compute a map of the noise level by bands of rows of tiles.  The
+   rows of tiles J0 to J0 + NY - 1 are processed, IMG is the address of the
+   pixel (0,ROW0) of the image. */
+typedef struct _noise_map_job noise_map_job_t;
+struct _noise_map_job {
+  noise_diff_t *diff;
+  const void *img;
+  double *map;
+  long width, height, stride, row0;
+  long tile_width, tile_height, nx, ny, j0;
+  int method;
+};
+
+static int noise_map_task(void *data, long band, long nbands)
+{
+  const noise_map_job_t *job = (const noise_map_job_t *)data;
+  const long tw = job->tile_width, th = job->tile_height;
+  noise_buffer_t buf;
+  double *r, *map;
+  long *bins;
+  long i, j, j0, j1, x0, x1, y0, y1, y;
+  int status = IMG_SUCCESS;
+
+  r = (double *)malloc(tw*th*sizeof(double) + NOISE_NBINS*sizeof(long));
+  if (r == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  bins = (long *)(r + tw*th);
+  buf.r = r;
+  j0 = job->j0 + IMG_BAND_START(band, nbands, job->ny);
+  j1 = job->j0 + IMG_BAND_START(band + 1, nbands, job->ny);
+  for (j = j0; j < j1; ++j) {
+    /* The differences are attributed to the tile of their last pixel. */
+    y0 = j*th;
+    y1 = (y0 + th < job->height ? y0 + th : job->height);
+    map = job->map + j*job->nx;
+    for (i = 0; i < job->nx; ++i) {
+      x0 = i*tw;
+      x1 = (x0 + tw < job->width ? x0 + tw : job->width);
+      buf.n = 0;
+      if (x1 - (x0 > 1 ? x0 : 1) > 0) {
+        for (y = (y0 > 1 ? y0 : 1); y < y1; ++y) {
+          job->diff(job->img, job->stride, (x0 > 1 ? x0 : 1), x1,
+                    y - job->row0, r + buf.n);
+          buf.n += x1 - (x0 > 1 ? x0 : 1);
+        }
+      }
+      map[i] = noise_estimate(noise_buffer_pass, &buf, buf.n,
+                              (x1 - x0)*(y1 - y0), job->method, bins);
+      if (map[i] < 0.0) {
+        status = IMG_FAILURE;
+        goto done;
+      }
+    }
+  }
+ done:
+  free((void *)r);
+  return status;
+}
 
 #define pixel_t               CPT_CTYPE(TYPE)
 
@@ -125,45 +439,16 @@ extern double img_estimate_noise(const int type,
 #endif
 */
 
-/**
- * @brief Estimate the noise level in a sub-image.
- *
- * This function estimates the noise level in a rectangular ROI (region of
- * interest) of image \a img.
- *
- * @param type        The type identifier of the input image \a img.
- * @param img         The input image.
- * @param offset      The offset (in pixels w.r.t. \a img) of the first pixel
- *                    of the ROI.
- * @param width       The width of the ROI.
- * @param height      The height of the ROI.
- * @param pitch       The number of elements per row of \a img.
- * @param method      The method used to estimate the noise level (irrelevant
- *                    for the moment).
- *
- * @return The estimated noise level; -1.0 on error.
- */
-extern double img_estimate_noise(const int type, const void *img,
-                                 const long offset, const long width,
-                                 const long height, const long stride,
-                                 const int method)
+/* Get the function computing the differences for pixel TYPE and the
+   address of the first pixel of the ROI.  Return IMG_SUCCESS or
+   IMG_FAILURE with errno set. */
+static int noise_setup(int type, const void *img, long offset,
+                       noise_diff_t **diff, const void **roi)
 {
-  double result;
-
-  if (img == NULL) {
-    errno = EFAULT;
-    return -1.0;
-  }
-  if ((width < 1) || (height < 1) || (stride < width)) {
-    errno = EINVAL;
-    return -1.0;
-  }
-
-#define CASE(TYPE) case IMG_TYPE_##TYPE:                                 \
-    result = ESTIMATE_NOISE(TYPE)((const CPT_CTYPE(TYPE) *)img, offset, \
-                                  width, height, stride, method);        \
-  break
-
+#define CASE(TYPE) case IMG_TYPE_##TYPE:                \
+    *diff = NOISE_DIFF(TYPE);                          \
+    *roi = (const CPT_CTYPE(TYPE) *)img + offset;      \
+    return IMG_SUCCESS
   switch (type) {
 #ifdef IMG_TYPE_INT8
     CASE(INT8);
@@ -212,44 +497,243 @@ extern double img_estimate_noise(const int type, const void *img,
   default:
     /* Bad pixel type. */
     errno = EINVAL;
-    result = -1.0;
+    return IMG_FAILURE;
   }
-
 #undef CASE
+}
 
+/**
+ * @brief Estimate the noise level in a sub-image.
+ *
+ * This function estimates the noise level in a rectangular ROI (region of
+ * interest) of image \a img.  The noise level is estimated from the second
+ * differences between adjacent pixels, which are insensitive to a smooth
+ * background.  The root mean square of the differences is biased by edges
+ * and spots which are less important with the robust estimators: the
+ * median of the absolute differences (computed from their histogram) and
+ * the iteratively clipped root mean square.
+ *
+ * @param type        The type identifier of the input image \a img.
+ * @param img         The input image.
+ * @param offset      The offset (in pixels w.r.t. \a img) of the first pixel
+ *                    of the ROI.
+ * @param width       The width of the ROI.
+ * @param height      The height of the ROI.
+ * @param stride      The number of elements per row of \a img.
+ * @param method      The method used to estimate the noise level:
+ *                    \c IMG_NOISE_RMS, \c IMG_NOISE_MAD or
+ *                    \c IMG_NOISE_CLIPPED_RMS.
+ *
+ * @return The estimated noise level; -1.0 on error.
+ */
+extern double img_estimate_noise(const int type, const void *img,
+                                 const long offset, const long width,
+                                 const long height, const long stride,
+                                 const int method)
+{
+  noise_job_t job;
+  double result;
+  long *bins;
+
+  if (img == NULL) {
+    errno = EFAULT;
+    return -1.0;
+  }
+  if ((width < 1) || (height < 1) || (stride < width) ||
+      (method < IMG_NOISE_RMS) || (method > IMG_NOISE_CLIPPED_RMS)) {
+    errno = EINVAL;
+    return -1.0;
+  }
+  if (noise_setup(type, img, offset, &job.diff, &job.img) != IMG_SUCCESS) {
+    return -1.0;
+  }
+  if ((width < 2) || (height < 2)) {
+    return 0.0;
+  }
+  job.width = width;
+  job.height = height;
+  job.stride = stride;
+  job.nbands = img_get_num_bands(height - 1, NOISE_MIN_ROWS);
+
+  /* Allocate the workspaces: one row of differences per band, one sum per
+     row, one count per row and, for the median, one histogram per band.
+     The first NOISE_NBINS histogram bins are for the final histogram. */
+  job.sum = (double *)malloc((job.nbands*width + height)*sizeof(double));
+  bins = (long *)malloc((height + job.nbands +
+                         (method == IMG_NOISE_MAD ?
+                          (job.nbands + 1)*NOISE_NBINS : 0))*sizeof(long));
+  if ((job.sum == NULL) || (bins == NULL)) {
+    if (job.sum != NULL) free((void *)job.sum);
+    if (bins != NULL) free((void *)bins);
+    errno = ENOMEM;
+    return -1.0;
+  }
+  job.work = job.sum + height;
+  job.count = bins;
+  job.below = job.count + height;
+  job.bins = job.below + job.nbands + NOISE_NBINS;
+  result = noise_estimate(noise_image_pass, &job, (width - 1)*(height - 1),
+                          width*height, method, job.below + job.nbands);
+  free((void *)job.sum);
+  free((void *)bins);
   return result;
 }
 
+/**
+ * @brief Compute a map of the noise level in a sub-image.
+ *
+ * This function estimates the noise level in every tile of a rectangular
+ * ROI (region of interest) of image \a img.  The ROI is split into \a nx
+ * by \a ny tiles with \a nx = ceil(\a width/\a tile_width) and
+ * \a ny = ceil(\a height/\a tile_height), the last tiles of a row or of a
+ * column may be smaller.  The noise level in each tile is estimated as by
+ * img_estimate_noise() but the image is read only once and the tiles are
+ * processed in parallel.
+ *
+ * @param type        The type identifier of the input image \a img.
+ * @param img         The input image.
+ * @param offset      The offset (in pixels w.r.t. \a img) of the first pixel
+ *                    of the ROI.
+ * @param width       The width of the ROI.
+ * @param height      The height of the ROI.
+ * @param stride      The number of elements per row of \a img.
+ * @param tile_width  The width of the tiles (at least 2).
+ * @param tile_height The height of the tiles (at least 2).
+ * @param method      The method used to estimate the noise level (see
+ *                    img_estimate_noise()).
+ * @param map         The output \a nx by \a ny map, the noise level in the
+ *                    tile (i,j) is stored in \a map[i + j*nx].
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ */
+extern int img_estimate_noise_map(const int type, const void *img,
+                                  const long offset, const long width,
+                                  const long height, const long stride,
+                                  const long tile_width,
+                                  const long tile_height,
+                                  const int method, double map[])
+{
+  noise_map_job_t job;
+
+  if ((img == NULL) || (map == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((width < 1) || (height < 1) || (stride < width) ||
+      (tile_width < 2) || (tile_height < 2) ||
+      (method < IMG_NOISE_RMS) || (method > IMG_NOISE_CLIPPED_RMS)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  if (noise_setup(type, img, offset, &job.diff, &job.img) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  job.map = map;
+  job.width = width;
+  job.height = height;
+  job.stride = stride;
+  job.row0 = 0;
+  job.tile_width = tile_width;
+  job.tile_height = tile_height;
+  job.nx = (width + tile_width - 1)/tile_width;
+  job.ny = (height + tile_height - 1)/tile_height;
+  job.j0 = 0;
+  job.method = method;
+  return img_parallel(img_get_num_bands(job.ny, 1), noise_map_task, &job);
+}
+
+/**
+ * @brief Compute a map of the noise level by bands of rows.
+ *
+ * This function is the same as img_estimate_noise_map() for the whole image
+ * of the source \a src, but the image is read by bands of full rows of
+ * tiles (as many rows of tiles as threads) plus the row above them, needed
+ * by the differences.  The result is the same as for the whole image.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ *
+ * @see img_estimate_noise_map(), img_tile_source_new().
+ */
+extern int img_tile_estimate_noise_map(img_tile_source_t *src,
+                                       long tile_width, long tile_height,
+                                       int method, double map[])
+{
+  noise_map_job_t job;
+  void *buf;
+  long ny, nrows, y0, y1;
+  int status, code;
+
+  if ((src == NULL) || (map == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if ((tile_width < 2) || (tile_height < 2) ||
+      (method < IMG_NOISE_RMS) || (method > IMG_NOISE_CLIPPED_RMS)) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  job.map = map;
+  job.width = img_tile_source_get_width(src);
+  job.height = img_tile_source_get_height(src);
+  job.stride = job.width;
+  job.tile_width = tile_width;
+  job.tile_height = tile_height;
+  job.nx = (job.width + tile_width - 1)/tile_width;
+  ny = (job.height + tile_height - 1)/tile_height;
+  job.method = method;
+  nrows = img_get_num_threads();
+  if (nrows > ny) {
+    nrows = ny;
+  }
+  buf = malloc((nrows*tile_height + 1)*job.width*
+               img_get_pixel_size(img_tile_source_get_type(src)));
+  if (buf == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  status = noise_setup(img_tile_source_get_type(src), buf, 0,
+                       &job.diff, &job.img);
+  for (job.j0 = 0; job.j0 < ny && status == IMG_SUCCESS; job.j0 += nrows) {
+    job.ny = (job.j0 + nrows < ny ? nrows : ny - job.j0);
+    y0 = job.j0*tile_height;
+    y1 = (job.j0 + job.ny)*tile_height;
+    job.row0 = (y0 > 0 ? y0 - 1 : 0);
+    status = img_tile_read(src, 0, job.row0, job.width,
+                           (y1 < job.height ? y1 : job.height) - job.row0,
+                           buf, job.width);
+    if (status == IMG_SUCCESS) {
+      status = img_parallel(img_get_num_bands(job.ny, 1), noise_map_task,
+                            &job);
+    }
+  }
+  code = errno;
+  free(buf);
+  errno = code;
+  return status;
+}
+
 #else /* _IMG_NOISE_C ********************************************************/
 
-static double ESTIMATE_NOISE(TYPE)(const pixel_t *img,
-                                   const long offset,
-                                   const long width,
-                                   const long height,
-                                   const long stride,
-                                   const int method)
+/* Store in R[X - X0] the second difference at (X,Y) for all X in [X0,X1)
+   (with X0 >= 1 and Y >= 1). */
+static void NOISE_DIFF(TYPE)(const void *img, long stride, long x0, long x1,
+                             long y, double r[])
 {
   const pixel_t *row0, *row1;
-  double a00, a01, a10, a11, r, s;
-  long x, y;
-
-  s = 0.0;
-  row1 = img + offset;
-  for (y = 1; y < height; ++y) {
-    row0 = row1;
-    row1 += stride;
-    a01 = row0[0];
-    a11 = row1[0];
-    for (x = 1; x < width; ++x) {
-      a00 = a01;
-      a01 = row0[x];
-      a10 = a11;
-      a11 = row1[x];
-      r = a00 - a01 - a10 + a11;
-      s += r*r;
-    }
+  double a00, a01, a10, a11;
+  long x;
+
+  row1 = (const pixel_t *)img + y*stride;
+  row0 = row1 - stride;
+  a01 = row0[x0 - 1];
+  a11 = row1[x0 - 1];
+  for (x = x0; x < x1; ++x) {
+    a00 = a01;
+    a01 = row0[x];
+    a10 = a11;
+    a11 = row1[x];
+    r[x - x0] = a00 - a01 - a10 + a11;
   }
-  return sqrt(s/(4.0*width*height));
 }
 
 /* Undefine macro(s) that may be re-defined to avoid warnings. */
@@ -34,6 +34,9 @@
 
 #include "c_pseudo_template.h"
 #include "img.h"
+#include "img_context.h"
+#include "img_stats.h"
+#include "img_thread.h"
 #include "itemstack.h"
 #include "itempool.h"
 
@@ -93,8 +96,26 @@ static int failure(int code)
 /* Definitions that will be expanded by the template code. */
 
 #define BUILD_LINKS(TYPE)  CPT_JOIN2(build_links_, CPT_ABBREV(TYPE))
+#define PIXELS_MOMENTS(TYPE) CPT_JOIN2(pixels_moments_, CPT_ABBREV(TYPE))
+#define RUN_MOMENTS(TYPE)  CPT_JOIN2(run_moments_, CPT_ABBREV(TYPE))
 #define pixel_t            CPT_CTYPE(TYPE)
 
+/* Functions to integrate the moments of the pixels of a segment.  The sums
+   SUM[0] to SUM[5] are respectively incremented by the sums of V, V*DX,
+   V*DY, V*DX*DX, V*DX*DY and V*DY*DY, with V the pixel value and (DX,DY)
+   the pixel coordinates relative to (XO,YO).  PIXELS_MOMENTS integrates the
+   pixels given by their indices in a WIDTH by HEIGHT region of interest,
+   RUN_MOMENTS integrates the pixels from X0 to X1 (inclusive) of the Y-th
+   row of the region of interest. */
+typedef void pixels_moments_t(const void *img, const long offset,
+                              const long stride, const long width,
+                              const long index[], const long count,
+                              const long xo, const long yo, double sum[]);
+typedef void run_moments_t(const void *img, const long offset,
+                           const long stride, const long x0,
+                           const long x1, const long y,
+                           const long xo, const long yo, double sum[]);
+
 
 /* Manage to include this file with a different data type each time. */
 
@@ -173,6 +194,7 @@ static int failure(int code)
 
 typedef struct _bbox      bbox_t;
 typedef struct _point     point_t;
+typedef struct _wide_point wide_point_t;
 typedef struct _segment   segment_t;
 typedef struct _chainable chainable_t;
 typedef struct _chainlink chainlink_t;
@@ -182,11 +204,26 @@ struct _bbox {
   double xmin, xmax, ymin, ymax;
 };
 
+/* The coordinates of the pixels of a segment are stored relative to the
+   origin (XMIN,YMIN) of its bounding box.  Compact points are used when the
+   bounding box is at most COMPACT_SIZE pixels wide and high, wide points
+   otherwise.  Hence large images only cost more memory for their large
+   segments. */
 struct _point {
-  uint16_t link;
-  int16_t x, y;
+  uint16_t x, y;
+  uint8_t link;
+};
+
+struct _wide_point {
+  int32_t x, y;
+  uint8_t link;
 };
 
+#define COMPACT_SIZE  ((long)UINT16_MAX + 1L)
+#define WIDE_SIZE     ((long)INT32_MAX + 1L)
+#define IS_COMPACT(s) ((s)->width <= COMPACT_SIZE && \
+                       (s)->height <= COMPACT_SIZE)
+
 /* Members common to all "chainable" items. */
 #define CHAINABLE_MEMBERS                                               \
   long level;             /* = 0 for segments, >= 1 for links */        \
@@ -203,10 +240,13 @@ struct _segment {
 
   /* Members specific to segments. */
   double xcen, ycen; /* coordinate of center */
-  point_t *point; /* coordinate of pixels */
+  void *point; /* coordinates of pixels (point_t or wide_point_t) */
   long count; /* number of pixels */
   long xmin, xmax, ymin, ymax; /* bounding box */
   long width, height; /* width and height of bounding box */
+  double flux; /* sum of pixel values */
+  double xbar, ybar; /* intensity weighted centroid */
+  double mxx, mxy, myy; /* intensity weighted centered second moments */
 };
 
 struct _chainlink {
@@ -227,11 +267,46 @@ struct _chain {
   double xmin, xmax, ymin, ymax;
   double a[4];
   long length;
+  int state; /* CHAIN_UNFITTED, CHAIN_FITTED or CHAIN_REJECTED */
   chain_t *next;
   segment_t *segment[1]; /* actual size is sufficient for LENGTH segments */
 };
 
-static void get_bbox(bbox_t *bbox, const segment_t *s, const double a[]);
+/* Number of bytes for a chain of LENGTH segments, rounded up as for the
+   items of an arena. */
+#define CHAIN_ALIGN (sizeof(double) >= sizeof(void *) ? \
+                     sizeof(double) : sizeof(void *))
+#define CHAIN_SIZE(length)                                          \
+  (((OFFSET_OF(chain_t, segment) + (length)*sizeof(void *) +        \
+     CHAIN_ALIGN - 1)/CHAIN_ALIGN)*CHAIN_ALIGN)
+
+/* States of a chain: its shears and bounding box are not yet fitted, are
+   fitted, or the fit failed. */
+#define CHAIN_UNFITTED 0
+#define CHAIN_FITTED   1
+#define CHAIN_REJECTED 2
+
+/* Number of chain-links in the first block of memory of the arena used to
+   build the chains. */
+#define CHAINLINK_ARENA_SIZE 1024
+
+/* Minimum number of chains per band for fitting the chains in parallel. */
+#define CHAIN_MIN_BAND 8
+
+/* The pixels of the segments of a chain which are used by the fits (those
+   on the boundary of the segments) gathered as a structure of arrays: the
+   coordinates of the pixels of the K-th segment are X[I] and Y[I] for I from
+   FIRST[K] to FIRST[K+1] - 1.  SIZE and LENGTH are the allocated numbers of
+   pixels and of segments. */
+typedef struct _chain_pixels chain_pixels_t;
+struct _chain_pixels {
+  double *x, *y;
+  long *first;
+  long size, length;
+};
+
+static void get_bbox(bbox_t *bbox, const chain_pixels_t *pix, long k,
+                     const double a[]);
 
 /*---------------------------------------------------------------------------*/
 /* Private data. */
@@ -239,9 +314,10 @@ static void get_bbox(bbox_t *bbox, const segment_t *s, const double a[]);
 /* A private stack of items is used to manage temporary memory needed
    by the various routines. This makes the code robust to interrupts (for
    instance when linking with Yorick) and easier to write avoiding memory
-   leaks but this is not thread safe (for the moment). */
+   leaks.  Each thread has its own stack (see img_get_private_stack) which is
+   stored in the local variable STACK of the routines, so that the routines
+   are reentrant. */
 
-static itemstack_t *stack = NULL;
 static void *clear_and_pop(itemstack_t *stack);
 
 #define DUMP_STACK(n)       itemstack_dump(stack, (n), stderr)
@@ -249,10 +325,9 @@ static void *clear_and_pop(itemstack_t *stack);
 #define POP_STACK(nil)      clear_and_pop(stack)
 
 #define SETUP_STACK(errcode)                    \
-  if (stack == NULL) {                          \
-    stack = itemstack_new(0);                   \
-    if (stack == NULL) return errcode;          \
-  } else CLEAR_STACK()
+  stack = img_get_private_stack();              \
+  if (stack == NULL) return errcode;            \
+  CLEAR_STACK()
 
 #define PUSH_NEW_ARRAY(TYPE, NUMBER)  \
   ((TYPE *)itemstack_push_dynamic(stack, (NUMBER)*sizeof(TYPE), 0))
@@ -265,6 +340,24 @@ typedef void destroy_t(void *);
 #define PUSH_ITEM(ITEM, DESTROY)  itemstack_push(stack, ITEM, DESTROY)
 #define DROP_ITEM(NUMBER)         itemstack_drop(stack, NUMBER)
 
+/* When a workspace context CTX is provided, the temporary arrays of the
+   segmentation are the scratch buffers of the context (SLOT is the index of
+   the buffer) instead of being pushed on the stack. */
+static void *scratch(itemstack_t *stack, img_context_t *ctx, long slot,
+                     size_t size, int zero);
+
+#define NEW_SCRATCH(TYPE, NUMBER, SLOT)                                 \
+  ((TYPE *)scratch(stack, ctx, SLOT, (NUMBER)*sizeof(TYPE), 0))
+
+#define NEW_SCRATCH_ZERO(TYPE, NUMBER, SLOT)                            \
+  ((TYPE *)scratch(stack, ctx, SLOT, (NUMBER)*sizeof(TYPE), 1))
+
+#define SCRATCH_INDEX   0
+#define SCRATCH_LINK    1
+#define SCRATCH_START   2
+#define SCRATCH_PARENT  3
+#define SCRATCH_SEGMENT 4
+
 /*---------------------------------------------------------------------------*/
 /* High level segmentation. */
 
@@ -273,47 +366,110 @@ struct _img_segmentation {
   segment_t *segment; /* array of segments */
   long number;        /* number of segments */
   long width, height; /* size of the source image */
-  point_t point[1];   /* points in all segments */
+  long nwide;         /* number of wide points */
+  wide_point_t wide[1]; /* points in all segments, wide ones first */
 };
 
-static img_segmentation_t *allocate(long npoints, long nsegments);
+static img_segmentation_t *allocate(long nwide, long ncompact,
+                                    long nsegments);
+static void assign_points(img_segmentation_t *ws);
 
-img_segmentation_t *img_segmentation_new(const void *img,
-					 const int type,
-					 const long offset,
-					 const long width,
-					 const long height,
-					 const long stride,
-					 const double threshold)
+/* While a segment is being built, its members FLUX, XBAR, YBAR, MXX, MXY
+   and MYY store the sums integrated by the moments functions relative to
+   the origin (XCEN,YCEN) which is the first pixel of the segment.  They are
+   converted into the moments by create().  */
+static void set_moments(segment_t *s, long xo, long yo, const double sum[])
 {
-  img_segmentation_t *ws;
-  link_t *link;
-  point_t *point;
-  long i, j, nsegments, npixels;
-  long *region, *index;
-  int status;
+  s->xcen = xo;
+  s->ycen = yo;
+  s->flux = sum[0];
+  s->xbar = sum[1];
+  s->ybar = sum[2];
+  s->mxx = sum[3];
+  s->mxy = sum[4];
+  s->myy = sum[5];
+}
 
-  /* Setup memory managment. */
-  SETUP_STACK(NULL);
-  ws = NULL;
+static void add_moments(segment_t *s, const double sum[])
+{
+  s->flux += sum[0];
+  s->xbar += sum[1];
+  s->ybar += sum[2];
+  s->mxx += sum[3];
+  s->mxy += sum[4];
+  s->myy += sum[5];
+}
 
-  /* Allocate enough space to index the maximum number of regions (this is
-     done before the "link" array to allow for dropping this later when no
-     longer needed). */
-  npixels = width*height;
-  index = PUSH_NEW_ARRAY(long, 2*npixels);
-  if (index == NULL) {
-    goto done;
+/* The runs of pixels are merged by a union-find algorithm where PARENT[R] is
+   the parent of run R and the root of a set is its run of lowest index.
+   find_run() yields the root of the set of run R (with path halving),
+   merge_runs() merges the sets of runs A and B. */
+static long find_run(long parent[], long r)
+{
+  while (parent[r] != r) {
+    parent[r] = parent[parent[r]];
+    r = parent[r];
   }
+  return r;
+}
 
-  /* Build the links of the pixels. */
-  link = PUSH_NEW_ARRAY(link_t, npixels);
+static void merge_runs(long parent[], long a, long b)
+{
+  a = find_run(parent, a);
+  b = find_run(parent, b);
+  if (a < b) {
+    parent[b] = a;
+  } else if (b < a) {
+    parent[a] = b;
+  }
+}
+static img_segmentation_t *create(segment_t segment[],
+                                  const long nsegments,
+                                  const long width, const long height);
+
+/* Store the K-th pixel (X,Y) of segment S. */
+static void set_point(segment_t *s, long k, long x, long y, int link)
+{
+  if (IS_COMPACT(s)) {
+    point_t *p = (point_t *)s->point + k;
+    p->x = x - s->xmin;
+    p->y = y - s->ymin;
+    p->link = link;
+  } else {
+    wide_point_t *p = (wide_point_t *)s->point + k;
+    p->x = x - s->xmin;
+    p->y = y - s->ymin;
+    p->link = link;
+  }
+}
+static img_segmentation_t *segment_runs(itemstack_t *stack,
+                                        img_context_t *ctx,
+                                        const link_t link[],
+                                        const void *img,
+                                        const long offset,
+                                        const long width,
+                                        const long height,
+                                        const long stride,
+                                        run_moments_t *moments);
+
+/* Build the links of the WIDTH by HEIGHT pixels of an image of type TYPE
+   and get the functions to integrate the moments of its pixels.  Return
+   IMG_SUCCESS or IMG_FAILURE with errno set. */
+static int build_links(const void *img, const int type, const long offset,
+                       const long stride, link_t link[], const long width,
+                       const long height, const double threshold,
+                       pixels_moments_t **pixels_moments,
+                       run_moments_t **run_moments)
+{
+  int status;
 
 #define CASE(TYPE)                                                      \
   case IMG_TYPE_##TYPE:                                                 \
     status = BUILD_LINKS(TYPE)((const CPT_CTYPE(TYPE) *)img, offset,    \
                                stride, link, 0, width, width, height,   \
                                threshold);                              \
+    *pixels_moments = PIXELS_MOMENTS(TYPE);                             \
+    *run_moments = RUN_MOMENTS(TYPE);                                   \
     break
 
   switch (type) {
@@ -365,115 +521,1000 @@ img_segmentation_t *img_segmentation_new(const void *img,
     errno = EINVAL;
     status = IMG_FAILURE;
   }
-  if (status != IMG_SUCCESS) {
+
+#undef CASE
+
+  return status;
+}
+
+static img_segmentation_t *segmentation_new(img_context_t *ctx,
+                                            const void *img,
+                                            const int type,
+                                            const long offset,
+                                            const long width,
+                                            const long height,
+                                            const long stride,
+                                            const double threshold,
+                                            const int method);
+
+img_segmentation_t *img_segmentation_new(const void *img,
+					 const int type,
+					 const long offset,
+					 const long width,
+					 const long height,
+					 const long stride,
+					 const double threshold)
+{
+  return img_segmentation_new_with_method(img, type, offset, width, height,
+                                          stride, threshold,
+                                          IMG_SEGMENTATION_FLOOD_FILL);
+}
+
+/**
+ * @brief Segment an image with a given method.
+ *
+ * This function is the same as img_segmentation_new() except that the
+ * method to collect the pixels of the segments can be chosen.  With \c
+ * IMG_SEGMENTATION_FLOOD_FILL, the segments are built by a flood fill of the
+ * linked pixels, this requires 17 bytes of workspace per pixel.  With \c
+ * IMG_SEGMENTATION_RUNS, the runs of linked pixels along the rows are merged
+ * by a union-find algorithm, this only requires one byte per pixel plus 16
+ * bytes per run and the image is scanned sequentially.  Both methods yield
+ * the same segments in the same order (by increasing index of their first
+ * pixel) with the same bounding boxes; but the pixels of a segment are
+ * stored in breadth-first order by the former method and in raster order by
+ * the latter.
+ *
+ * @param img         The address of the image.
+ * @param type        The type identifier of the image.
+ * @param offset      The offset (in pixels) of the first pixel of the region
+ *                    of interest.
+ * @param width       The width of the region of interest.
+ * @param height      The height of the region of interest.
+ * @param stride      The number of elements per row of the image.
+ * @param threshold   The threshold for linking neighbor pixels.
+ * @param method      The segmentation method.
+ *
+ * @return A new segmentation or \c NULL on error with \c errno set.
+ *
+ * @see img_segmentation_new(), img_segmentation_unlink().
+ */
+img_segmentation_t *img_segmentation_new_with_method(const void *img,
+                                                     const int type,
+                                                     const long offset,
+                                                     const long width,
+                                                     const long height,
+                                                     const long stride,
+                                                     const double threshold,
+                                                     const int method)
+{
+  return segmentation_new(NULL, img, type, offset, width, height, stride,
+                          threshold, method);
+}
+
+/**
+ * @brief Segment an image with a workspace context.
+ *
+ * This function is the same as img_segmentation_new_with_method() for an
+ * image of the type and dimensions of the context \a ctx, but the temporary
+ * arrays are taken from the context instead of being allocated for every
+ * call.  Only the resulting segmentation is allocated.
+ *
+ * @param ctx         The workspace context.
+ * @param img         The address of the image.
+ * @param offset      The offset (in pixels) of the first pixel of the region
+ *                    of interest.
+ * @param stride      The number of elements per row of the image.
+ * @param threshold   The threshold for linking neighbor pixels.
+ * @param method      The segmentation method.
+ *
+ * @return A new segmentation or \c NULL on error with \c errno set.
+ *
+ * @see img_context_new(), img_segmentation_new_with_method().
+ */
+img_segmentation_t *img_context_segmentation_new(img_context_t *ctx,
+                                                 const void *img,
+                                                 const long offset,
+                                                 const long stride,
+                                                 const double threshold,
+                                                 const int method)
+{
+  if (ctx == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  return segmentation_new(ctx, img, ctx->type, offset, ctx->width,
+                          ctx->height, stride, threshold, method);
+}
+
+static img_segmentation_t *segmentation_new(img_context_t *ctx,
+                                            const void *img,
+                                            const int type,
+                                            const long offset,
+                                            const long width,
+                                            const long height,
+                                            const long stride,
+                                            const double threshold,
+                                            const int method)
+{
+  img_segmentation_t *ws;
+  itemstack_t *stack;
+  segment_t *segment;
+  link_t *link;
+  pixels_moments_t *pixels_moments;
+  run_moments_t *run_moments;
+  long i, j, nsegments, npixels;
+  long *region, *index;
+  IMG_STATS_TIMER(tic)
+  IMG_STATS_TIMER(toc)
+
+  /* Setup memory managment. */
+  SETUP_STACK(NULL);
+  IMG_STATS_START(tic);
+  ws = NULL;
+  if (width > WIDE_SIZE || height > WIDE_SIZE) {
+    errno = EINVAL;
+    goto done;
+  }
+
+  /* Allocate enough space to index the maximum number of regions (this is
+     done before the "link" array to allow for dropping this later when no
+     longer needed). */
+  npixels = width*height;
+  if (method == IMG_SEGMENTATION_FLOOD_FILL) {
+    index = NEW_SCRATCH(long, 2*npixels, SCRATCH_INDEX);
+    if (index == NULL) {
+      goto done;
+    }
+  } else if (method == IMG_SEGMENTATION_RUNS) {
+    index = NULL;
+  } else {
+    errno = EINVAL;
     goto done;
   }
 
-#undef CASE
+  /* Build the links of the pixels. */
+  link = NEW_SCRATCH(link_t, npixels, SCRATCH_LINK);
+  if (link == NULL) {
+    goto done;
+  }
+  IMG_STATS_START(toc);
+  if (build_links(img, type, offset, stride, link, width, height,
+                  threshold, &pixels_moments, &run_moments) != IMG_SUCCESS) {
+    goto done;
+  }
+  IMG_STATS_STOP(IMG_STATS_BUILD_LINKS, toc, npixels);
+
+  if (method == IMG_SEGMENTATION_RUNS) {
+    ws = segment_runs(stack, ctx, link, img, offset, width, height, stride,
+                      run_moments);
+    goto done;
+  }
+
+  /* This macro stores IDX-th pixel into current segment. */
+#define STORE(IDX)				\
+  link[IDX] |= OWNED;				\
+  region[++size] = (IDX)
+
+  /* This macro stores IDX-th pixel into current segment if current
+     pixel is linked to direction DIR. */
+#define CHECK(DIR, IDX)				\
+  if ((s & (DIR)) != 0) {			\
+    long _i = (IDX);				\
+    if ((link[_i] & OWNED) == 0) {		\
+      STORE(_i);                                \
+    }						\
+  }
+
+  /* Build the segments. */
+#define OWNED  IMG_LINK_OWNED
+  IMG_STATS_START(toc);
+  nsegments = 0;
+  region = index;
+  for (i = 0; i < npixels; ++i) {
+    /* Check whether current pixel is not already owned by a segment. */
+    if ((link[i] & OWNED) == 0) {
+      long size = 0;
+      STORE(i);
+      for (j = 1; j <= size; ++j) {
+        long k = region[j];
+        int s = link[k];
+        CHECK(IMG_LINK_WEST,  k - 1);
+	CHECK(IMG_LINK_EAST,  k + 1);
+	CHECK(IMG_LINK_SOUTH, k - width);
+	CHECK(IMG_LINK_NORTH, k + width);
+      }
+      region[0] = size; /* store the number of pixels in the region */
+      region += (size + 1); /* move to base of next region */
+      ++nsegments;
+    }
+  }
+
+#undef CHECK
+#undef STORE
+
+  /* Compute the bounding boxes and the moments of the segments. */
+  segment = NEW_SCRATCH_ZERO(segment_t, nsegments, SCRATCH_SEGMENT);
+  if (segment == NULL) {
+    goto done;
+  }
+  region = index;
+  for (i = 0; i < nsegments; ++i) {
+    long x, xmin, xmax, y, ymin, ymax, k;
+    long count = region[0]; /* number of elements in the current region */
+    double sum[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    k = region[1];
+    ymin = ymax = k/width;
+    xmin = xmax = k - ymin*width;
+    pixels_moments(img, offset, stride, width, region + 1, count,
+                   xmin, ymin, sum);
+    set_moments(&segment[i], xmin, ymin, sum);
+    for (j = 2; j <= count; ++j) {
+      k = region[j];
+      y = k/width;
+      x = k - y*width;
+      if (x < xmin) xmin = x;
+      if (x > xmax) xmax = x;
+      if (y < ymin) ymin = y;
+      if (y > ymax) ymax = y;
+    }
+    segment[i].count = count;
+    segment[i].xmin = xmin;
+    segment[i].xmax = xmax;
+    segment[i].ymin = ymin;
+    segment[i].ymax = ymax;
+    region += count + 1;
+  }
+
+  /* Create the image segmentation object and store the pixels of the
+     segments in the order they have been collected. */
+  ws = create(segment, nsegments, width, height);
+  if (ws == NULL) {
+    goto done;
+  }
+  region = index;
+  for (i = 0; i < nsegments; ++i) {
+    segment_t *s = &ws->segment[i];
+    long count = region[0];
+    for (j = 0; j < count; ++j) {
+      long k = region[j + 1];
+      long y = k/width;
+      set_point(s, j, k - y*width, y, link[k] & ~OWNED);
+    }
+    region += count + 1;
+  }
+  IMG_STATS_STOP(IMG_STATS_FLOOD_FILL, toc, npixels);
+
+#undef OWNED
+
+  /* Free all stacked memory blocks and return the result. */
+ done:
+  CLEAR_STACK();
+  if (ws != NULL) {
+    IMG_STATS_STOP(IMG_STATS_SEGMENTATION, tic, ws->number);
+  }
+  return ws;
+}
+
+/* Label the runs of the Y-th row, whose links are ROW, and merge them with
+   the vertically linked runs of the previous row.  R is the number of runs
+   so far, *FIRST is the index of the first run of the previous row on entry
+   and that of the current row on return.  Returns the number of runs after
+   this row. */
+static long label_runs(const link_t row[], const long y, const long width,
+                       long start[], long parent[], long r, long *first)
+{
+  long q, a, b, i, x, top;
+
+  /* Q is the run of the pixel below the current one, A and B are the last
+     merged runs. */
+  q = *first;
+  top = *first = r;
+  a = b = -1;
+  for (x = 0; x < width; ++x) {
+    i = y*width + x;
+    if ((row[x] & IMG_LINK_WEST) == 0) {
+      start[r] = i;
+      parent[r] = r;
+      ++r;
+    }
+    if ((row[x] & IMG_LINK_SOUTH) != 0) {
+      while (q + 1 < top && start[q + 1] <= i - width) {
+        ++q;
+      }
+      if (a != r - 1 || b != q) {
+        a = r - 1;
+        b = q;
+        merge_runs(parent, a, b);
+      }
+    }
+  }
+  return r;
+}
+
+/* Number the segments by replacing the parent of every run by the number of
+   its segment.  Since the parent of a run has a lower index, it has already
+   been replaced by its segment number.  Returns the number of segments. */
+static long number_segments(long parent[], const long nruns)
+{
+  long r, q, nsegments = 0;
+
+  for (r = 0; r < nruns; ++r) {
+    q = parent[r];
+    parent[r] = (q == r ? nsegments++ : parent[q]);
+  }
+  return nsegments;
+}
+
+/* Add the run of pixels I0 to I1 - 1 to the number of pixels, the bounding
+   box and the moments of the segment S.  Runs are added by rows, so the
+   first run of a segment has the smallest ordinate and the last run the
+   largest one.  The Y-th row of pixels is the row Y - Y0 of IMG. */
+static void add_run(segment_t *s, run_moments_t *moments, const void *img,
+                    const long offset, const long stride, const long width,
+                    const long i0, const long i1, const long y0)
+{
+  double sum[6];
+  long x0, x1, y;
+
+  y = i0/width;
+  x0 = i0 - y*width;
+  x1 = i1 - 1 - y*width;
+  memset(sum, 0, sizeof(sum));
+  if (s->count == 0) {
+    s->xmin = x0;
+    s->xmax = x1;
+    s->ymin = y;
+    moments(img, offset, stride, x0, x1, y - y0, x0, y - y0, sum);
+    set_moments(s, x0, y, sum);
+  } else {
+    if (x0 < s->xmin) s->xmin = x0;
+    if (x1 > s->xmax) s->xmax = x1;
+    moments(img, offset, stride, x0, x1, y - y0, (long)s->xcen,
+            (long)s->ycen - y0, sum);
+    add_moments(s, sum);
+  }
+  s->ymax = y;
+  s->count += i1 - i0;
+}
+
+/* Store the pixels I0 to I1 - 1 of the run R into its segment of WS.  The
+   counts of the temporary segments are used to count the pixels already
+   stored.  The link of the I-th pixel is LINK[I - BASE]. */
+static void store_run(img_segmentation_t *ws, segment_t segment[],
+                      const long parent[], const long r, const long i0,
+                      const long i1, const long width, const link_t link[],
+                      const long base)
+{
+  segment_t *s = &ws->segment[parent[r]];
+  long k = segment[parent[r]].count;
+  long i, y = i0/width;
+
+  for (i = i0; i < i1; ++i) {
+    set_point(s, k++, i - y*width, y, link[i - base]);
+  }
+  segment[parent[r]].count = k;
+}
+
+/* Build the segments from the links of the pixels by merging the runs of
+   horizontally linked pixels that are vertically linked.  A run starts at
+   every pixel not linked to its left neighbor, so runs never span more than
+   one row and are indexed in raster order.  The runs are merged by a
+   union-find algorithm where the root of a set is always the first run of
+   the set; hence numbering the roots in increasing order yields the same
+   segments, in the same order, as the flood fill. */
+static img_segmentation_t *segment_runs(itemstack_t *stack,
+                                        img_context_t *ctx,
+                                        const link_t link[],
+                                        const void *img,
+                                        const long offset,
+                                        const long width,
+                                        const long height,
+                                        const long stride,
+                                        run_moments_t *moments)
+{
+  img_segmentation_t *ws;
+  segment_t *segment;
+  long *start, *parent;
+  long npixels, nruns, nsegments, first, r, i, y;
+  IMG_STATS_TIMER(tic)
+
+  /* Count the runs. */
+  IMG_STATS_START(tic);
+  npixels = width*height;
+  nruns = 0;
+  for (i = 0; i < npixels; ++i) {
+    if ((link[i] & IMG_LINK_WEST) == 0) {
+      ++nruns;
+    }
+  }
+  start = NEW_SCRATCH(long, nruns, SCRATCH_START);
+  if (start == NULL) {
+    return NULL;
+  }
+  parent = NEW_SCRATCH(long, nruns, SCRATCH_PARENT);
+  if (parent == NULL) {
+    return NULL;
+  }
+
+  /* Label the runs, merge the vertically linked ones and number the
+     segments. */
+  r = 0;
+  first = 0;
+  for (y = 0; y < height; ++y) {
+    r = label_runs(link + y*width, y, width, start, parent, r, &first);
+  }
+  nsegments = number_segments(parent, nruns);
+
+  /* Compute the number of pixels, the bounding box and the moments of the
+     segments. */
+  segment = NEW_SCRATCH_ZERO(segment_t, nsegments, SCRATCH_SEGMENT);
+  if (segment == NULL) {
+    return NULL;
+  }
+  for (r = 0; r < nruns; ++r) {
+    add_run(&segment[parent[r]], moments, img, offset, stride, width,
+            start[r], (r + 1 < nruns ? start[r + 1] : npixels), 0);
+  }
+
+  /* Create the image segmentation object and store the pixels of every
+     segment in raster order (the counts of the temporary segments are
+     reused to count the pixels already stored). */
+  ws = create(segment, nsegments, width, height);
+  if (ws == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < nsegments; ++i) {
+    segment[i].count = 0;
+  }
+  for (r = 0; r < nruns; ++r) {
+    store_run(ws, segment, parent, r, start[r],
+              (r + 1 < nruns ? start[r + 1] : npixels), width, link, 0);
+  }
+  IMG_STATS_STOP(IMG_STATS_RUNS, tic, nruns);
+  return ws;
+}
+
+/* Read the rows Y0 to Y1 - 1 of the image of the source SRC, with the rows
+   just below and above them if any, into BUF and build their links into
+   LINK.  On return, *LNK is the address of the links of the row Y0. */
+static int read_band(img_tile_source_t *src, const long y0, const long y1,
+                     const double threshold, void *buf, link_t link[],
+                     const link_t **lnk, run_moments_t **moments)
+{
+  const long width = img_tile_source_get_width(src);
+  const long height = img_tile_source_get_height(src);
+  pixels_moments_t *pixels_moments;
+  long yb = (y0 > 0 ? y0 - 1 : 0);
+  long ye = (y1 < height ? y1 + 1 : height);
+
+  if (img_tile_read(src, 0, yb, width, ye - yb, buf, width) != IMG_SUCCESS ||
+      build_links(buf, img_tile_source_get_type(src), 0, width, link,
+                  width, ye - yb, threshold, &pixels_moments,
+                  moments) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  *lnk = link + (y0 - yb)*width;
+  return IMG_SUCCESS;
+}
+
+/**
+ * @brief Segment an image by bands of rows.
+ *
+ * This function builds the same segmentation as
+ * img_segmentation_new_with_method() with method \c IMG_SEGMENTATION_RUNS
+ * for the whole image of the source \a src, but the image is read by bands
+ * of \a band_height rows (plus the rows just below and above them for the
+ * links).  The runs are labelled and merged with those of the previous
+ * bands as the bands are read, the segments crossing the borders of the
+ * bands are thus merged as for the whole image.  Apart from the result, the
+ * memory used is that of a band of pixels and of links plus 16 bytes per
+ * run and the temporary segments.  The image is read four times: to count
+ * the runs, to merge them, to integrate the moments and to store the
+ * pixels.
+ *
+ * @param src         The source of pixels.
+ * @param threshold   The threshold for linking neighbor pixels.
+ * @param band_height The number of rows per band.
+ *
+ * @return A new segmentation or \c NULL on error with \c errno set.
+ *
+ * @see img_segmentation_new_with_method(), img_tile_source_new().
+ */
+img_segmentation_t *img_tile_segmentation_new(img_tile_source_t *src,
+                                              double threshold,
+                                              long band_height)
+{
+  img_segmentation_t *ws;
+  itemstack_t *stack;
+  segment_t *segment;
+  run_moments_t *moments;
+  const link_t *lnk;
+  link_t *link;
+  void *buf;
+  long *start, *parent;
+  long width, height, npixels, nruns, nsegments, first, r, i, y, y0, y1;
+  int status;
+
+  if (src == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  width = img_tile_source_get_width(src);
+  height = img_tile_source_get_height(src);
+  if (band_height < 1 || width > WIDE_SIZE || height > WIDE_SIZE) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (band_height > height) {
+    band_height = height;
+  }
+
+  /* Setup memory managment. */
+  SETUP_STACK(NULL);
+  ws = NULL;
+  status = IMG_FAILURE;
+  npixels = width*height;
+  buf = PUSH_NEW_ARRAY(char, (band_height + 2)*width*
+                       img_get_pixel_size(img_tile_source_get_type(src)));
+  if (buf == NULL) {
+    goto done;
+  }
+  link = PUSH_NEW_ARRAY(link_t, (band_height + 2)*width);
+  if (link == NULL) {
+    goto done;
+  }
+
+  /* Count the runs. */
+  nruns = 0;
+  for (y0 = 0; y0 < height; y0 = y1) {
+    y1 = (y0 + band_height < height ? y0 + band_height : height);
+    if (read_band(src, y0, y1, threshold, buf, link, &lnk,
+                  &moments) != IMG_SUCCESS) {
+      goto done;
+    }
+    for (i = 0; i < (y1 - y0)*width; ++i) {
+      if ((lnk[i] & IMG_LINK_WEST) == 0) {
+        ++nruns;
+      }
+    }
+  }
+  start = PUSH_NEW_ARRAY(long, nruns);
+  if (start == NULL) {
+    goto done;
+  }
+  parent = PUSH_NEW_ARRAY(long, nruns);
+  if (parent == NULL) {
+    goto done;
+  }
+
+  /* Label the runs and merge the vertically linked ones exactly as
+     segment_runs() does, the runs of the previous row being kept from one
+     band to the next. */
+  r = 0;
+  first = 0;
+  for (y0 = 0; y0 < height; y0 = y1) {
+    y1 = (y0 + band_height < height ? y0 + band_height : height);
+    if (read_band(src, y0, y1, threshold, buf, link, &lnk,
+                  &moments) != IMG_SUCCESS) {
+      goto done;
+    }
+    for (y = y0; y < y1; ++y) {
+      r = label_runs(lnk + (y - y0)*width, y, width, start, parent, r,
+                     &first);
+    }
+  }
+  nsegments = number_segments(parent, nruns);
+
+  /* Compute the number of pixels, the bounding box and the moments of the
+     segments with the pixels of the rows of each band (the ordinates passed
+     to the moments function are relative to the band). */
+  segment = PUSH_NEW_ARRAY_ZERO(segment_t, nsegments);
+  if (segment == NULL) {
+    goto done;
+  }
+  r = 0;
+  for (y0 = 0; y0 < height; y0 = y1) {
+    y1 = (y0 + band_height < height ? y0 + band_height : height);
+    if (img_tile_read(src, 0, y0, width, y1 - y0, buf,
+                      width) != IMG_SUCCESS) {
+      goto done;
+    }
+    for (; r < nruns && start[r] < y1*width; ++r) {
+      add_run(&segment[parent[r]], moments, buf, 0, width, width, start[r],
+              (r + 1 < nruns ? start[r + 1] : npixels), y0);
+    }
+  }
 
-  /* Allocate a new image segmentation opaque object. */
-  ws = allocate(npixels, 0);
+  /* Create the image segmentation object and store the pixels of every
+     segment in raster order. */
+  ws = create(segment, nsegments, width, height);
   if (ws == NULL) {
     goto done;
   }
-  ws->width = width;
-  ws->height = height;
+  for (i = 0; i < nsegments; ++i) {
+    segment[i].count = 0;
+  }
+  r = 0;
+  for (y0 = 0; y0 < height; y0 = y1) {
+    y1 = (y0 + band_height < height ? y0 + band_height : height);
+    if (read_band(src, y0, y1, threshold, buf, link, &lnk,
+                  &moments) != IMG_SUCCESS) {
+      goto done;
+    }
+    for (; r < nruns && start[r] < y1*width; ++r) {
+      store_run(ws, segment, parent, r, start[r],
+                (r + 1 < nruns ? start[r + 1] : npixels), width, lnk,
+                y0*width);
+    }
+  }
+  status = IMG_SUCCESS;
+
+  /* Free all stacked memory blocks and return the result. */
+ done:
+  if (status != IMG_SUCCESS && ws != NULL) {
+    int code = errno;
+    img_segmentation_unlink(ws);
+    errno = code;
+    ws = NULL;
+  }
+  CLEAR_STACK();
+  return ws;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Segmentation of bitmaps. */
+
+/* Value of pixel X of the row ROW of a bitmap. */
+#define BITMAP_PIXEL(row, x) ((int)(((row)[(x) >> 6] >> ((x) & 63)) & 1))
+
+/* Index of the least significant bit set in W (which must not be zero). */
+static int lowest_bit(img_bitmap_word_t w)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll(w);
+#else
+  int k = 0;
+  while ((w & 1) == 0) {
+    w >>= 1;
+    ++k;
+  }
+  return k;
+#endif
+}
+
+/* Count the runs of pixels with the same value in the row ROW of a bitmap,
+   the changes of value are found 64 pixels at a time.  If START is not
+   NULL, the indices of the first pixels of the runs (the row being the Y-th
+   one) are stored into it.  Return the number of runs. */
+static long bitmap_runs(const img_bitmap_word_t row[], const long width,
+                        const long y, long start[])
+{
+  const long nwords = (width + 63)/64;
+  img_bitmap_word_t c, d;
+  long i, n;
+
+  if (start != NULL) {
+    start[0] = y*width;
+  }
+  n = 1;
+  c = row[0] & 1;
+  for (i = 0; i < nwords; ++i) {
+    /* Bit P of D is set if pixel 64*I + P differs from the previous one. */
+    d = row[i] ^ ((row[i] << 1) | c);
+    c = row[i] >> 63;
+    if (i == nwords - 1 && (width & 63) != 0) {
+      d &= ~(~(img_bitmap_word_t)0 << (width & 63));
+    }
+    if (start == NULL) {
+      for (; d != 0; d &= d - 1) {
+        ++n;
+      }
+    } else {
+      for (; d != 0; d &= d - 1) {
+        start[n++] = y*width + 64*i + lowest_bit(d);
+      }
+    }
+  }
+  return n;
+}
+
+/**
+ * @brief Segment a bitmap.
+ *
+ * This function builds the segmentation of a packed binary image (see
+ * img_copy() with \c IMG_TYPE_BIT).  A segment is a set of 4-connected
+ * pixels with the same value: the segments of the set pixels have a flux
+ * equal to their number of pixels, those of the cleared pixels have a null
+ * flux.  The runs of pixels with the same value are found 64 pixels at a
+ * time and merged by a union-find algorithm as with the method \c
+ * IMG_SEGMENTATION_RUNS of img_segmentation_new_with_method(); the
+ * segments are in the same order (by increasing index of their first pixel)
+ * and their pixels are stored in raster order.  Besides the result, the
+ * memory used is 16 bytes per run.
+ *
+ * @param bits    The address of the bitmap.
+ * @param width   The width of the image.
+ * @param height  The height of the image.
+ * @param pitch   The number of pixels between successive rows of \a bits,
+ *                a multiple of 64 at least equal to \a width.
+ *
+ * @return A new segmentation or \c NULL on error with \c errno set.
+ *
+ * @see img_copy(), img_bitmap_morph(), img_segmentation_new_with_method().
+ */
+img_segmentation_t *
+img_bitmap_segmentation_new(const img_bitmap_word_t *bits,
+                            long width, long height, long pitch)
+{
+  img_segmentation_t *ws;
+  itemstack_t *stack;
+  segment_t *segment;
+  const img_bitmap_word_t *row;
+  long *start, *parent;
+  long npixels, nruns, nsegments, first, prev, r, q, i, x, y;
+  double sum[6];
+  IMG_STATS_TIMER(tic)
+
+  if (bits == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (width < 1 || height < 1 || pitch < width || (pitch & 63) != 0 ||
+      width > WIDE_SIZE || height > WIDE_SIZE) {
+    errno = EINVAL;
+    return NULL;
+  }
+  IMG_STATS_START(tic);
+  pitch /= 64;
+  npixels = width*height;
+
+  /* Setup memory managment and find the runs. */
+  SETUP_STACK(NULL);
+  nruns = 0;
+  for (y = 0; y < height; ++y) {
+    nruns += bitmap_runs(bits + y*pitch, width, y, NULL);
+  }
+  start = PUSH_NEW_ARRAY(long, nruns);
+  if (start == NULL) {
+    goto error;
+  }
+  parent = PUSH_NEW_ARRAY(long, nruns);
+  if (parent == NULL) {
+    goto error;
+  }
+  r = 0;
+  for (y = 0; y < height; ++y) {
+    r += bitmap_runs(bits + y*pitch, width, y, start + r);
+  }
+
+  /* Merge the runs of the same value which overlap in successive rows, the
+     root of a set is its first run as in segment_runs().  Q is the run of
+     the previous row below the first pixel of the current run C. */
+#define RUN_STOP(R) ((R) + 1 < nruns ? start[(R) + 1] : npixels)
+  r = 0;
+  first = 0;
+  for (y = 0; y < height; ++y) {
+    long c;
+    prev = first;
+    first = r;
+    while (r < nruns && start[r] < (y + 1)*width) {
+      parent[r] = r;
+      ++r;
+    }
+    if (y == 0) {
+      continue;
+    }
+    row = bits + y*pitch;
+    q = prev;
+    for (c = first; c < r; ++c) {
+      long x0 = start[c] - y*width;
+      long x1 = RUN_STOP(c) - 1 - y*width;
+      int v = BITMAP_PIXEL(row, x0);
+      for (;;) {
+        long qstop = RUN_STOP(q) - (y - 1)*width;
+        if (BITMAP_PIXEL(row - pitch, start[q] - (y - 1)*width) == v) {
+          merge_runs(parent, c, q);
+        }
+        if (qstop > x1 + 1) {
+          break;
+        }
+        ++q;
+        if (qstop == x1 + 1) {
+          break;
+        }
+      }
+    }
+  }
 
-  /* This macro stores IDX-th pixel into current segment. */
-#define STORE(IDX)				\
-  point->link = link[IDX];			\
-  point->x = (IDX)%width;			\
-  point->y = (IDX)/width;			\
-  ++point;					\
-  link[IDX] |= OWNED;				\
-  region[++size] = (IDX)
+  nsegments = number_segments(parent, nruns);
 
-  /* This macro stores IDX-th pixel into current segment if current
-     pixel is linked to direction DIR. */
-#define CHECK(DIR, IDX)				\
-  if ((s & (DIR)) != 0) {			\
-    long _i = (IDX);				\
-    if ((link[_i] & OWNED) == 0) {		\
-      STORE(_i);                                \
-    }						\
+  /* Compute the number of pixels, the bounding box and the moments of the
+     segments.  The moments of the runs are those integrated by
+     RUN_MOMENTS() for pixel values equal to 0 or 1, for instance the sum
+     of DX*DX from DX = A to DX = B is T(B) - T(A - 1) with T(K) =
+     K*(K + 1)*(2*K + 1)/6. */
+  segment = PUSH_NEW_ARRAY_ZERO(segment_t, nsegments);
+  if (segment == NULL) {
+    goto error;
   }
+#define T(K) ((double)(K)*(double)((K) + 1)*(double)(2*(K) + 1)/6.0)
+  for (r = 0; r < nruns; ++r) {
+    segment_t *s = &segment[parent[r]];
+    long len, x0, x1, xo, yo;
+    i = start[r];
+    len = RUN_STOP(r) - i;
+    y = i/width;
+    x0 = i - y*width;
+    x1 = x0 + len - 1;
+    if (s->count == 0) {
+      s->xmin = x0;
+      s->xmax = x1;
+      s->ymin = y;
+      xo = x0;
+      yo = y;
+    } else {
+      if (x0 < s->xmin) s->xmin = x0;
+      if (x1 > s->xmax) s->xmax = x1;
+      xo = (long)s->xcen;
+      yo = (long)s->ycen;
+    }
+    memset(sum, 0, sizeof(sum));
+    if (BITMAP_PIXEL(bits + y*pitch, x0) != 0) {
+      double dy = y - yo;
+      double s0 = len;
+      double s1 = (double)(x0 + x1 - 2*xo)*len/2.0;
+      double s3 = T(x1 - xo) - T(x0 - xo - 1);
+      sum[0] = s0;
+      sum[1] = s1;
+      sum[2] = s0*dy;
+      sum[3] = s3;
+      sum[4] = s1*dy;
+      sum[5] = s0*dy*dy;
+    }
+    if (s->count == 0) {
+      set_moments(s, x0, y, sum);
+    } else {
+      add_moments(s, sum);
+    }
+    s->ymax = y;
+    s->count += len;
+  }
+#undef T
 
-  /* Build the segments. */
-#define OWNED  IMG_LINK_OWNED
-  point = ws->point;
-  nsegments = 0;
-  region = index;
-  for (i = 0; i < npixels; ++i) {
-    /* Check whether current pixel is not already owned by a segment. */
-    if ((link[i] & OWNED) == 0) {
-      long size = 0;
-      STORE(i);
-      for (j = 1; j <= size; ++j) {
-        long k = region[j];
-        int s = link[k];
-        CHECK(IMG_LINK_WEST,  k - 1);
-	CHECK(IMG_LINK_EAST,  k + 1);
-	CHECK(IMG_LINK_SOUTH, k - width);
-	CHECK(IMG_LINK_NORTH, k + width);
+  /* Create the image segmentation object and store the pixels of every
+     segment in raster order with their links. */
+  ws = create(segment, nsegments, width, height);
+  if (ws == NULL) {
+    goto error;
+  }
+  for (i = 0; i < nsegments; ++i) {
+    segment[i].count = 0;
+  }
+  for (r = 0; r < nruns; ++r) {
+    segment_t *s = &ws->segment[parent[r]];
+    long k = segment[parent[r]].count;
+    long x0, x1;
+    int v;
+    y = start[r]/width;
+    x0 = start[r] - y*width;
+    x1 = RUN_STOP(r) - 1 - y*width;
+    row = bits + y*pitch;
+    v = BITMAP_PIXEL(row, x0);
+    for (x = x0; x <= x1; ++x) {
+      int link = IMG_LINK_NONE;
+      if (x > x0) link |= IMG_LINK_WEST;
+      if (x < x1) link |= IMG_LINK_EAST;
+      if (y > 0 && BITMAP_PIXEL(row - pitch, x) == v) {
+        link |= IMG_LINK_SOUTH;
       }
-      region[0] = size; /* store the number of pixels in the region */
-      region += (size + 1); /* move to base of next region */
-      ++nsegments;
+      if (y < height - 1 && BITMAP_PIXEL(row + pitch, x) == v) {
+        link |= IMG_LINK_NORTH;
+      }
+      set_point(s, k++, x, y, link);
     }
+    segment[parent[r]].count = k;
   }
+#undef RUN_STOP
+  CLEAR_STACK();
+  IMG_STATS_STOP(IMG_STATS_SEGMENTATION, tic, nsegments);
+  return ws;
 
-#undef CHECK
-#undef STORE
-#undef OWNED
+ error:
+  CLEAR_STACK();
+  return NULL;
+}
 
-  /* Free no longer needed "link" array. */
-  DROP_ITEM(1);
+/* Job to segment a batch of images, one image per band. */
+typedef struct _segmentation_job segmentation_job_t;
+struct _segmentation_job {
+  const void *const *img;
+  img_segmentation_t **sgm;
+  long offset, width, height, stride;
+  double threshold;
+  int type;
+};
 
-  /* Create the image segmentation object. */
-  if (nsegments > 0) {
-    segment_t *segment;
-    segment = NEW_ARRAY_ZERO(segment_t, nsegments);
-    if (segment == NULL) {
-      img_segmentation_unlink(ws);
-      ws = NULL;
-      goto done;
-    }
-    ws->segment = segment;
-    ws->number = nsegments;
-    point = ws->point;
-    region = index;
-    for (i = 0; i < nsegments; ++i) {
-      int16_t x, xmin, xmax, y, ymin, ymax;
-      long count = region[0]; /* number of elements in the current region */
-      xmin = xmax = point[0].x;
-      ymin = ymax = point[0].y;
-      for (j = 1; j < count; ++j) {
-	x = point[j].x;
-	if (x < xmin) xmin = x;
-	if (x > xmax) xmax = x;
-	y = point[j].y;
-	if (y < ymin) ymin = y;
-	if (y > ymax) ymax = y;
+static int segmentation_task(void *data, long band, long nbands)
+{
+  segmentation_job_t *job = (segmentation_job_t *)data;
+  (void)nbands;
+  job->sgm[band] = img_segmentation_new(job->img[band], job->type,
+                                        job->offset, job->width,
+                                        job->height, job->stride,
+                                        job->threshold);
+  return (job->sgm[band] != NULL ? IMG_SUCCESS : IMG_FAILURE);
+}
+
+/**
+ * @brief Segment a batch of images.
+ *
+ * This function builds the segmentations of \a number images of same type
+ * and dimensions.  The images are processed in parallel by the threads (see
+ * img_set_num_threads()), the result is the same as calling
+ * img_segmentation_new() for every image.
+ *
+ * @param number      The number of images.
+ * @param img         The addresses of the images.
+ * @param type        The type identifier of the images.
+ * @param offset      The offset (in pixels) of the first pixel of the region
+ *                    of interest in every image.
+ * @param width       The width of the region of interest.
+ * @param height      The height of the region of interest.
+ * @param stride      The number of elements per row of the images.
+ * @param threshold   The threshold for linking neighbor pixels.
+ * @param sgm         The array to store the \a number new segmentations.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.  In case of
+ *         failure, the elements of \a sgm are all set to \c NULL.
+ *
+ * @see img_segmentation_new(), img_segmentation_unlink().
+ */
+int img_segmentation_new_batch(const long number,
+                               const void *const img[],
+                               const int type,
+                               const long offset,
+                               const long width,
+                               const long height,
+                               const long stride,
+                               const double threshold,
+                               img_segmentation_t *sgm[])
+{
+  segmentation_job_t job;
+  long i;
+  int code;
+
+  if ((img == NULL) || (sgm == NULL)) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (number < 0) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  for (i = 0; i < number; ++i) {
+    sgm[i] = NULL;
+  }
+  job.img = img;
+  job.sgm = sgm;
+  job.type = type;
+  job.offset = offset;
+  job.width = width;
+  job.height = height;
+  job.stride = stride;
+  job.threshold = threshold;
+  if (img_parallel(number, segmentation_task, &job) != IMG_SUCCESS) {
+    code = errno;
+    for (i = 0; i < number; ++i) {
+      if (sgm[i] != NULL) {
+        img_segmentation_unlink(sgm[i]);
+        sgm[i] = NULL;
       }
-      ws->segment[i].xcen = (xmin + xmax)*0.5;
-      ws->segment[i].ycen = (ymin + ymax)*0.5;
-      ws->segment[i].point = point;
-      ws->segment[i].count = count;
-      ws->segment[i].xmin = xmin;
-      ws->segment[i].xmax = xmax;
-      ws->segment[i].ymin = ymin;
-      ws->segment[i].ymax = ymax;
-      ws->segment[i].width = xmax - xmin + 1;
-      ws->segment[i].height = ymax - ymin + 1;
-      point += count;
-      region += count + 1;
     }
+    errno = code;
+    return IMG_FAILURE;
   }
-
-  /* Free all stacked memory blocks and return the result. */
- done:
-  CLEAR_STACK();
-  return ws;
+  return IMG_SUCCESS;
 }
 
 int img_segmentation_get_nrefs(img_segmentation_t *ws)
@@ -503,9 +1544,8 @@ img_segmentation_t *img_segmentation_select(const img_segmentation_t *src,
 					    const long list[],
 					    const long number)
 {
-  long i, j, nsegments, npoints;
+  long i, j, nsegments, nwide, ncompact;
   segment_t *segment;
-  point_t *point;
   img_segmentation_t *dst;
 
   /* Check arguments and indices of segments to select. */
@@ -517,7 +1557,8 @@ img_segmentation_t *img_segmentation_select(const img_segmentation_t *src,
     errno = EINVAL;
     return NULL;
   }
-  npoints = 0;
+  nwide = 0;
+  ncompact = 0;
   nsegments = src->number;
   segment = src->segment;
   for (i = 0; i < number; ++i) {
@@ -526,38 +1567,46 @@ img_segmentation_t *img_segmentation_select(const img_segmentation_t *src,
       errno = EINVAL;
       return NULL;
     }
-    npoints += segment[j].count;
+    if (IS_COMPACT(&segment[j])) {
+      ncompact += segment[j].count;
+    } else {
+      nwide += segment[j].count;
+    }
   }
 
   /* Build the copy. */
-  dst = allocate(npoints, number);
+  dst = allocate(nwide, ncompact, number);
   if (dst == NULL) {
     return NULL;
   }
   dst->width = src->width;
   dst->height = src->height;
-  point = dst->point;
   for (i = 0; i < number; ++i) {
-    j = list[i];
-    npoints = src->segment[j].count;
-    dst->segment[i] = src->segment[j];
-    dst->segment[i].point = memcpy(point, src->segment[j].point,
-				   npoints*sizeof(point_t));
-    point += npoints;
+    dst->segment[i] = segment[list[i]];
+  }
+  assign_points(dst);
+  for (i = 0; i < number; ++i) {
+    const segment_t *s = &segment[list[i]];
+    memcpy(dst->segment[i].point, s->point, s->count*
+           (IS_COMPACT(s) ? sizeof(point_t) : sizeof(wide_point_t)));
   }
   return dst;
 }
 
-static img_segmentation_t *allocate(long npoints, long nsegments)
+static img_segmentation_t *allocate(long nwide, long ncompact,
+                                    long nsegments)
 {
   img_segmentation_t *ws;
   size_t nbytes;
 
-  nbytes = OFFSET_OF(img_segmentation_t, point) + npoints*sizeof(point_t);
+  nbytes = (OFFSET_OF(img_segmentation_t, wide) +
+            nwide*sizeof(wide_point_t) + ncompact*sizeof(point_t));
   ws = (img_segmentation_t *)malloc(nbytes);
   if (ws == NULL) {
     return NULL;
   }
+  IMG_STATS_ALLOC(IMG_STATS_SEGMENTATION,
+                  nbytes + nsegments*sizeof(segment_t));
   ws->nrefs = 0;
   if (nsegments > 0) {
     ws->segment = NEW_ARRAY_ZERO(segment_t, nsegments);
@@ -572,6 +1621,84 @@ static img_segmentation_t *allocate(long npoints, long nsegments)
   }
   ws->width = 0;
   ws->height = 0;
+  ws->nwide = nwide;
+  return ws;
+}
+
+/* Make the segments of WS point to their storage, the wide points being
+   stored first.  The counts and bounding boxes of the segments must be
+   set. */
+static void assign_points(img_segmentation_t *ws)
+{
+  wide_point_t *wide = ws->wide;
+  point_t *compact = (point_t *)(ws->wide + ws->nwide);
+  long i;
+
+  for (i = 0; i < ws->number; ++i) {
+    segment_t *s = &ws->segment[i];
+    if (IS_COMPACT(s)) {
+      s->point = compact;
+      compact += s->count;
+    } else {
+      s->point = wide;
+      wide += s->count;
+    }
+  }
+}
+
+/* Create a new image segmentation with a copy of the NSEGMENTS segments
+   SEGMENT whose counts, bounding boxes and sums of moments are set (their
+   other parameters are computed).  The storage of the points is assigned
+   but the points are left uninitialized.  If the flux of a segment is zero,
+   its centroid is the center of its bounding box and its second moments
+   are zero. */
+static img_segmentation_t *create(segment_t segment[],
+                                  const long nsegments,
+                                  const long width, const long height)
+{
+  img_segmentation_t *ws;
+  long i, nwide, ncompact;
+
+  nwide = 0;
+  ncompact = 0;
+  for (i = 0; i < nsegments; ++i) {
+    segment_t *s = &segment[i];
+    if (s->flux != 0.0) {
+      double q = 1.0/s->flux;
+      double dx = s->xbar*q;
+      double dy = s->ybar*q;
+      s->xbar = s->xcen + dx;
+      s->ybar = s->ycen + dy;
+      s->mxx = s->mxx*q - dx*dx;
+      s->mxy = s->mxy*q - dx*dy;
+      s->myy = s->myy*q - dy*dy;
+    } else {
+      s->xbar = (s->xmin + s->xmax)*0.5;
+      s->ybar = (s->ymin + s->ymax)*0.5;
+      s->mxx = 0.0;
+      s->mxy = 0.0;
+      s->myy = 0.0;
+    }
+    s->xcen = (s->xmin + s->xmax)*0.5;
+    s->ycen = (s->ymin + s->ymax)*0.5;
+    s->width = s->xmax - s->xmin + 1;
+    s->height = s->ymax - s->ymin + 1;
+    if (IS_COMPACT(s)) {
+      ncompact += s->count;
+    } else {
+      nwide += s->count;
+    }
+  }
+  ws = allocate(nwide, ncompact, nsegments);
+  if (ws == NULL) {
+    return NULL;
+  }
+  ws->width = width;
+  ws->height = height;
+  if (nsegments > 0) {
+    memcpy(ws->segment, segment, nsegments*sizeof(segment_t));
+  }
+  assign_points(ws);
   return ws;
 }
 
@@ -626,10 +1753,10 @@ long img_segmentation_get_image_height(img_segmentation_t *sgm)
   return sgm->height;
 }
 
-#define GET_MEMBER(type, what)                                  \
+#define GET_MEMBER(type, what, whats)                           \
                                                                 \
-int img_segmentation_get_##what##s(img_segmentation_t *ws,      \
-                                   type what[], long number)    \
+int img_segmentation_get_##whats(img_segmentation_t *ws,        \
+                                 type what[], long number)      \
 {                                                               \
   long j;                                                       \
   segment_t *segment;                                           \
@@ -663,19 +1790,25 @@ type img_segmentation_get_##what(img_segmentation_t *ws,        \
   return ws->segment[j].what;                                   \
 }
 
-GET_MEMBER(double, xcen)
-GET_MEMBER(double, ycen)
-GET_MEMBER(long, count)
-GET_MEMBER(long, xmin)
-GET_MEMBER(long, xmax)
-GET_MEMBER(long, ymin)
-GET_MEMBER(long, ymax)
-GET_MEMBER(long, width)
-GET_MEMBER(long, height)
+GET_MEMBER(double, xcen, xcens)
+GET_MEMBER(double, ycen, ycens)
+GET_MEMBER(double, flux, fluxes)
+GET_MEMBER(double, xbar, xbars)
+GET_MEMBER(double, ybar, ybars)
+GET_MEMBER(double, mxx, mxxs)
+GET_MEMBER(double, mxy, mxys)
+GET_MEMBER(double, myy, myys)
+GET_MEMBER(long, count, counts)
+GET_MEMBER(long, xmin, xmins)
+GET_MEMBER(long, xmax, xmaxs)
+GET_MEMBER(long, ymin, ymins)
+GET_MEMBER(long, ymax, ymaxs)
+GET_MEMBER(long, width, widths)
+GET_MEMBER(long, height, heights)
 
 #undef GET_MEMBER
 
-#define GET_MEMBER(type, what)                          \
+#define GET_MEMBER(type, what, origin)                  \
 int img_segmentation_get_##what(img_segmentation_t *ws, \
                                 const long i,           \
                                 type what[],            \
@@ -683,7 +1816,6 @@ int img_segmentation_get_##what(img_segmentation_t *ws, \
 {                                                       \
   long j;                                               \
   segment_t *s;                                         \
-  point_t *p;                                           \
                                                         \
   if ((ws == NULL) || (what == NULL)) {                 \
     errno = EFAULT;                                     \
@@ -698,16 +1830,24 @@ int img_segmentation_get_##what(img_segmentation_t *ws, \
     errno = EINVAL;                                     \
     return IMG_FAILURE;                                 \
   }                                                     \
-  p = s->point;                                         \
-  for (j = 0; j < number; ++j) {                        \
-    what[j] = p[j].what;                                \
+  if (IS_COMPACT(s)) {                                   \
+    const point_t *p = (const point_t *)s->point;       \
+    for (j = 0; j < number; ++j) {                      \
+      what[j] = origin + p[j].what;                     \
+    }                                                   \
+  } else {                                              \
+    const wide_point_t *p;                              \
+    p = (const wide_point_t *)s->point;                 \
+    for (j = 0; j < number; ++j) {                      \
+      what[j] = origin + p[j].what;                     \
+    }                                                   \
   }                                                     \
   return IMG_SUCCESS;                                   \
 }
 
-GET_MEMBER(long, x)
-GET_MEMBER(long, y)
-GET_MEMBER(long, link)
+GET_MEMBER(long, x, s->xmin)
+GET_MEMBER(long, y, s->ymin)
+GET_MEMBER(long, link, 0)
 
 #undef GET_MEMBER
 
@@ -716,7 +1856,11 @@ GET_MEMBER(long, link)
 
 struct _img_chainpool {
   long nchains; /* number of chains in the pool */
+  long unfitted; /* number of chains not yet fitted */
+  double prec; /* precision for fitting the shears */
+  int lazy; /* the chains are fitted on demand */
   img_segmentation_t *segmentation; /* the image segmentation */
+  itempool_t *arena; /* memory for the chains */
   chain_t *chain[1]; /* actual size is sufficient for NCHAINS segments */
 };
 
@@ -734,16 +1878,12 @@ struct _img_chainpool {
  */
 void img_chainpool_destroy(img_chainpool_t *chn)
 {
-  long k;
-
   if (chn != NULL) {
     if (chn->segmentation != NULL) {
       img_segmentation_unlink(chn->segmentation);
     }
-    for (k = 0; k < chn->nchains; ++k) {
-      if (chn->chain[k] != NULL) {
-        free(chn->chain[k]);
-      }
+    if (chn->arena != NULL) {
+      itempool_destroy(chn->arena);
     }
     free(chn);
   }
@@ -817,7 +1957,11 @@ img_segmentation_t *img_chainpool_get_segmentation(img_chainpool_t *chn)
   return NULL;
 }
 
-#define GET_MEMBER(type, what)                          \
+static int fit_chains(img_chainpool_t *chn, long j, long n);
+
+/* The members which depend on the fit of a chain (FIT true) are computed on
+   demand if the pool was built by img_chainpool_new_lazy(). */
+#define GET_MEMBER(type, what, fit)                     \
                                                         \
 type img_chainpool_get_##what(img_chainpool_t *chn,     \
                               long j)                   \
@@ -830,6 +1974,9 @@ type img_chainpool_get_##what(img_chainpool_t *chn,     \
     errno = EINVAL;                                     \
     return 0;                                           \
   }                                                     \
+  if (fit && fit_chains(chn, j, 1) != IMG_SUCCESS) {    \
+    return 0;                                           \
+  }                                                     \
   return chn->chain[j]->what;                           \
 }                                                       \
                                                         \
@@ -847,6 +1994,9 @@ int img_chainpool_get_##what##s(img_chainpool_t *chn,   \
     errno = EINVAL;                                     \
     return IMG_FAILURE;                                 \
   }                                                     \
+  if (fit && fit_chains(chn, 0, n) != IMG_SUCCESS) {    \
+    return IMG_FAILURE;                                 \
+  }                                                     \
   chain = chn->chain;                                   \
   for (j = 0; j < n; ++j) {                             \
     what[j] = chain[j]->what;                           \
@@ -854,13 +2004,13 @@ int img_chainpool_get_##what##s(img_chainpool_t *chn,   \
   return IMG_SUCCESS;                                   \
 }
 
-GET_MEMBER(double, vertical_shear)
-GET_MEMBER(double, horizontal_shear)
-GET_MEMBER(double, xmin)
-GET_MEMBER(double, xmax)
-GET_MEMBER(double, ymin)
-GET_MEMBER(double, ymax)
-GET_MEMBER(long, length)
+GET_MEMBER(double, vertical_shear, TRUE)
+GET_MEMBER(double, horizontal_shear, TRUE)
+GET_MEMBER(double, xmin, TRUE)
+GET_MEMBER(double, xmax, TRUE)
+GET_MEMBER(double, ymin, TRUE)
+GET_MEMBER(double, ymax, TRUE)
+GET_MEMBER(long, length, FALSE)
 #undef GET_MEMBER
 
 /**
@@ -917,8 +2067,12 @@ static int short_line_accept(const short_line_t *line,
                              double slope,
                              double aatol,
                              double artol);
-static int fit_vertical_shear(chain_t *chain, double prec);
-static int fit_horizontal_shear(chain_t *chain, double prec);
+static int fit_vertical_shear(chain_t *chain, const chain_pixels_t *pix,
+                              double prec);
+static int fit_horizontal_shear(chain_t *chain, const chain_pixels_t *pix,
+                                double prec);
+static int fit_shears(chain_t *chain, const chain_pixels_t *pix,
+                      double prec);
 static int fit_line(double sw,
                     double swx,
                     double swy,
@@ -937,11 +2091,33 @@ static void sort_segments(segment_t *obj[], size_t n);
 #define HEAPSORT_GET_KEY(obj)   ((obj)->xcen)
 #include "heapsort.h"
 
+static void sort_indices(long obj[], size_t n);
+
+#define HEAPSORT_SCOPE          static
+#define HEAPSORT_FUNCTION       sort_indices
+#define HEAPSORT_OBJ_TYPE       long
+#include "heapsort.h"
+
+/* Get the index of the bucket of ordinate Y for NB buckets of height H
+   starting at Y0. */
+static long y_bucket(double y, double y0, double h, long nb)
+{
+  double t = floor((y - y0)/h);
+  return (t < 0.0 ? 0 : (t >= (double)(nb - 1) ? nb - 1 : (long)t));
+}
+
 static int chainlink_insert(chainlink_t **list,
                             itempool_t   *pool,
                             chainable_t  *left,
                             chainable_t  *right);
 
+static img_chainpool_t *new_chainpool(img_segmentation_t *sgm,
+                                      double satol, double srtol,
+                                      double drmin, double drmax,
+                                      double slope, double aatol,
+                                      double artol, double prec,
+                                      long lmin, long lmax, int lazy);
+
 /**
  * @brief Build chains of image segments.
  *
@@ -959,11 +2135,15 @@ static int chainlink_insert(chainlink_t **list,
  * @param lmin    The minimum length of the chains.
  * @param lmax    The maximum length of the chains.
  *
+ * The shears and the bounding boxes of the chains are fitted in parallel by
+ * the threads (see img_set_num_threads()), the chains whose fit fails are
+ * discarded.  The result does not depend on the number of threads.
+ *
  * @return The address of a new pool of chains of image segments; \c NULL in
  *         case of error.
  *
- * @see img_chainpool_destroy(), img_chainpool_get_segmentation(),
- *      img_chainpool_get_number().
+ * @see img_chainpool_new_lazy(), img_chainpool_destroy(),
+ *      img_chainpool_get_segmentation(), img_chainpool_get_number().
  */
 img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
                                    double satol,
@@ -977,16 +2157,71 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
                                    long lmin,
                                    long lmax)
 {
-  double sa, sq, sr, rmin, rmax;
-  long j, jleft, jright;
+  return new_chainpool(sgm, satol, srtol, drmin, drmax, slope,
+                       aatol, artol, prec, lmin, lmax, FALSE);
+}
+
+/**
+ * @brief Build chains of image segments without fitting them.
+ *
+ * This function is the same as img_chainpool_new() except that the shears
+ * and the bounding boxes of the chains are only fitted when they are first
+ * queried by the img_chainpool_get_*() accessors (of the chain for a single
+ * chain, of all the chains for the functions which return an array).  This
+ * saves the cost of the fits when only the segments of the chains are
+ * needed.  As the chains are not fitted when the pool is built, none of
+ * them is discarded: if the fit of a chain fails, its shears are zero and
+ * its bounding box is that of its segments.  The accessors of a lazy pool
+ * modify it and must therefore not be called concurrently on the same pool.
+ *
+ * @see img_chainpool_new().
+ */
+img_chainpool_t *img_chainpool_new_lazy(img_segmentation_t *sgm,
+                                        double satol,
+                                        double srtol,
+                                        double drmin,
+                                        double drmax,
+                                        double slope,
+                                        double aatol,
+                                        double artol,
+                                        double prec,
+                                        long lmin,
+                                        long lmax)
+{
+  return new_chainpool(sgm, satol, srtol, drmin, drmax, slope,
+                       aatol, artol, prec, lmin, lmax, TRUE);
+}
+
+static img_chainpool_t *new_chainpool(img_segmentation_t *sgm,
+                                      double satol,
+                                      double srtol,
+                                      double drmin,
+                                      double drmax,
+                                      double slope,
+                                      double aatol,
+                                      double artol,
+                                      double prec,
+                                      long lmin,
+                                      long lmax,
+                                      int lazy)
+{
+  double sa, sq, sr, rmin, rmax, ybase, bucket_height;
+  long j, jleft, nbuckets;
+  long *bucket, *bucket_index, *candidate;
   long count, length, level, nsegments, nchains;
   chainlink_t* top;
   segment_t** segment_list;
   img_chainpool_t* chainpool;
   chainlink_t* first;
   itempool_t* itempool;
-  size_t nbytes;
+  itemstack_t *stack;
+  size_t nbytes, arena_size;
   int pass;
+  IMG_STATS_TIMER(tic)
+  IMG_STATS_TIMER(toc)
+#ifdef IMG_USE_STATS
+  long nlinks;
+#endif
 
   /* Check/fix arguments. */
   if (sgm == NULL) {
@@ -1033,9 +2268,10 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
 
   /* Setup memory managment. */
   SETUP_STACK(NULL);
+  IMG_STATS_START(tic);
   first = NULL;
   chainpool = NULL;
-  itempool = itempool_new(sizeof(chainlink_t), 20);
+  itempool = itempool_new_arena(CHAINLINK_ARENA_SIZE*sizeof(chainlink_t));
   if ((itempool == NULL) ||
       (PUSH_ITEM((void *)itempool,
                  (destroy_t *)itempool_destroy) != ITEMSTACK_SUCCESS)) {
@@ -1044,19 +2280,85 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
   }
 
   /* Allocate an array of segment pointers and sort segments by increasing X
-     coordinate. */
+     coordinate.  The chaining members of the segments are reset as they may
+     have been left over by a previous pool built on the same segmentation
+     (its links are gone with it). */
   nsegments = sgm->number;
   segment_list = PUSH_NEW_ARRAY(segment_t *, nsegments);
   if (segment_list == NULL) {
     DEBUG_INFO("failure");
     goto failure;
   }
+  IMG_STATS_ALLOC(IMG_STATS_CHAINPOOL, nsegments*sizeof(segment_t *));
   for (j = 0; j < nsegments; ++j) {
-    segment_list[j] = &sgm->segment[j];
+    segment_t *seg = &sgm->segment[j];
+    seg->nparents = 0;
+    seg->first_link = NULL;
+    segment_list[j] = seg;
   }
+  IMG_STATS_START(toc);
   sort_segments(segment_list, nsegments);
+  IMG_STATS_STOP(IMG_STATS_SORT_SEGMENTS, toc, nsegments);
+
+  /* Index the segments by buckets of ordinates.  The segments of a bucket
+     are stored by increasing position in the sorted list, hence by
+     ascending abscissa.  The height of the buckets is the mean reach in
+     ordinate of the segments (the maximum distance allowed by the slope). */
+  if (nsegments > 0) {
+    double d, ybot, ytop, reach;
+    long b, nb;
+
+    ybot = ytop = segment_list[0]->ycen;
+    reach = 0.0;
+    for (j = 0; j < nsegments; ++j) {
+      segment_t *seg = segment_list[j];
+      double h0 = seg->height;
+      if (seg->ycen < ybot) ybot = seg->ycen;
+      if (seg->ycen > ytop) ytop = seg->ycen;
+      reach += slope*rmax*(h0 + (sr*h0 + sa)/sq);
+    }
+    bucket_height = reach/nsegments;
+    if (!(bucket_height >= 1.0)) {
+      bucket_height = 1.0;
+    }
+    d = floor((ytop - ybot)/bucket_height) + 1.0;
+    nb = (d < (double)nsegments ? (long)d : nsegments);
+    bucket = PUSH_NEW_ARRAY(long, nb + 1 + 2*nsegments);
+    if (bucket == NULL) {
+      DEBUG_INFO("failure");
+      goto failure;
+    }
+    IMG_STATS_ALLOC(IMG_STATS_CHAINPOOL, (nb + 1 + 2*nsegments)*sizeof(long));
+    bucket_index = bucket + nb + 1;
+    candidate = bucket_index + nsegments;
+    for (b = 0; b <= nb; ++b) {
+      bucket[b] = 0;
+    }
+    for (j = 0; j < nsegments; ++j) {
+      ++bucket[y_bucket(segment_list[j]->ycen, ybot, bucket_height, nb) + 1];
+    }
+    for (b = 0; b < nb; ++b) {
+      bucket[b + 1] += bucket[b];
+    }
+    for (j = 0; j < nsegments; ++j) {
+      b = y_bucket(segment_list[j]->ycen, ybot, bucket_height, nb);
+      bucket_index[bucket[b]++] = j;
+    }
+    for (b = nb; b > 0; --b) {
+      bucket[b] = bucket[b - 1];
+    }
+    bucket[0] = 0;
+    nbuckets = nb;
+    ybase = ybot;
+  } else {
+    bucket = bucket_index = candidate = NULL;
+    bucket_height = 1.0;
+    nbuckets = 0;
+    ybase = 0.0;
+  }
 
   /* Create the 1st level links between pairs of segments. */
+  IMG_STATS_START(toc);
   count = 0;
   for (jleft = 0; jleft < nsegments; ++jleft) {
     segment_t *left = segment_list[jleft];
@@ -1067,41 +2369,67 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
     double hmin = (sq*h0 - sa)/sr;
     double hmax = (sr*h0 + sa)/sq;
     double xmax = x0 + rmax*(h0 + hmax);
-
-    for (jright = jleft + 1; jright < nsegments; ++jright) {
-      /* Select all potential next segments.  To speed-up the search, the most
-         selective tests and which do involve the least computations are tried
-         first. */
-      segment_t *right = segment_list[jright];
-      double x1, y1, h1, w1, delta_x;
-
-      /* Check whether the next character is not too far. */
-      x1 = right->xcen;
-      if (x1 >= xmax) {
-        /* No other character is allowed beyond this limit since the segments
-           are ordered with ascending abscissa. */
-        break;
+    double dy = slope*(xmax - x0);
+    long b, b0, b1, k, k0, k1, kmid, ncandidates;
+
+    /* Select all potential next segments in the buckets which may contain
+       segments reachable from the LEFT one.  To speed-up the search, the
+       most selective tests and which do involve the least computations are
+       tried first. */
+    ncandidates = 0;
+    b0 = y_bucket(y0 - dy, ybase, bucket_height, nbuckets);
+    b1 = y_bucket(y0 + dy, ybase, bucket_height, nbuckets);
+    for (b = b0; b <= b1; ++b) {
+      /* Find the first segment after the LEFT one in the sorted list. */
+      k0 = bucket[b];
+      k1 = bucket[b + 1];
+      while (k0 < k1) {
+        kmid = k0 + (k1 - k0)/2;
+        if (bucket_index[kmid] <= jleft) {
+          k0 = kmid + 1;
+        } else {
+          k1 = kmid;
+        }
       }
+      for (k = k0; k < bucket[b + 1]; ++k) {
+        segment_t *right = segment_list[bucket_index[k]];
+        double x1, y1, h1, w1, delta_x;
+
+        /* Check whether the next character is not too far. */
+        x1 = right->xcen;
+        if (x1 >= xmax) {
+          /* No other character of the bucket is allowed beyond this limit
+             since the segments are ordered with ascending abscissa. */
+          break;
+        }
 
-      /* Check whether the height is in the (exclusive) range. */
-      h1 = right->height;
-      if (h1 <= hmin || h1 >= hmax) {
-        continue;
-      }
+        /* Check whether the height is in the (exclusive) range. */
+        h1 = right->height;
+        if (h1 <= hmin || h1 >= hmax) {
+          continue;
+        }
 
-      /* Check whether the slope is not too important. */
-      y1 = right->ycen;
-      if (fabs(y1 - y0) > slope*fabs(x1 - x0)) {
-        continue;
-      }
+        /* Check whether the slope is not too important. */
+        y1 = right->ycen;
+        if (fabs(y1 - y0) > slope*fabs(x1 - x0)) {
+          continue;
+        }
 
-      /* Check whether the abscissa of the next character is in the allowed
-         range. */
-      w1 = right->width;
-      delta_x = x1 - x0;
-      if (delta_x < 1.0 + rmin*(w0 + w1) || delta_x > rmax*(h0 + h1)) {
-        continue;
+        /* Check whether the abscissa of the next character is in the
+           allowed range. */
+        w1 = right->width;
+        delta_x = x1 - x0;
+        if (delta_x < 1.0 + rmin*(w0 + w1) || delta_x > rmax*(h0 + h1)) {
+          continue;
+        }
+        candidate[ncandidates++] = bucket_index[k];
       }
+    }
+
+    /* Consider the candidates in the order of the sorted list. */
+    sort_indices(candidate, ncandidates);
+    for (k = 0; k < ncandidates; ++k) {
+      segment_t *right = segment_list[candidate[k]];
 
       /* The potential RIGHT character must not be aligned with any of the
          existing successors of the LEFT character.  This is to avoid
@@ -1138,8 +2466,14 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
       ++count;
     }
   }
+  IMG_STATS_STOP(IMG_STATS_FIRST_LINKS, toc, count);
+  IMG_STATS_ALLOC(IMG_STATS_FIRST_LINKS, count*sizeof(chainlink_t));
 
   /* Try to build longer chains by appending segments to the longest ones. */
+  IMG_STATS_START(toc);
+#ifdef IMG_USE_STATS
+  nlinks = 0;
+#endif
   while (count > 0) {
     level = first->level;
     length = level + 1;
@@ -1186,11 +2520,18 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
         }
       }
     }
+#ifdef IMG_USE_STATS
+    nlinks += count;
+#endif
   }
+  IMG_STATS_STOP(IMG_STATS_EXTEND_CHAINS, toc, nlinks);
+  IMG_STATS_ALLOC(IMG_STATS_EXTEND_CHAINS, nlinks*sizeof(chainlink_t));
 
-  /* Save the longest chains (1st pass is to count the number of such chains,
-     2nd pass is to register them). */
+  /* Save the longest chains (1st pass is to count the number of such chains
+     and the memory they need, 2nd pass is to register them). */
+  IMG_STATS_START(toc);
   nchains = 0;
+  arena_size = 0;
   for (pass = 1; pass <= 2; ++pass) {
 
     if (pass == 2) {
@@ -1204,6 +2545,7 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
         DEBUG_INFO("not enough memory");
         goto failure;
       }
+      IMG_STATS_ALLOC(IMG_STATS_CHAINPOOL, nbytes + arena_size);
       memset(chainpool, 0, nbytes);
       if (PUSH_ITEM((void *)chainpool,
                     (destroy_t *)img_chainpool_destroy) != ITEMSTACK_SUCCESS) {
@@ -1211,6 +2553,16 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
         goto failure;
       }
       chainpool->segmentation = img_segmentation_link(sgm);
+      chainpool->prec = prec;
+      chainpool->lazy = lazy;
+
+      /* All the chains are stored in a single arena (its first block is
+         large enough for all of them). */
+      chainpool->arena = itempool_new_arena(arena_size);
+      if (chainpool->arena == NULL) {
+        DEBUG_INFO("not enough memory");
+        goto failure;
+      }
     }
 
     /* Loop over all the chains. */
@@ -1222,19 +2574,19 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
       if (top->nparents == 0) {
         if (pass == 1) {
           ++nchains;
+          arena_size += CHAIN_SIZE(length);
         } else {
           chainable_t *chainable;
           chain_t *chain;
           long k;
 
-          /* Allocate memory for the chain of segments. */
           nbytes = OFFSET_OF(chain_t, segment) + length*sizeof(void *);
-          chain = malloc(nbytes);
+          chain = itempool_alloc(chainpool->arena, nbytes);
           if (chain == NULL) {
             DEBUG_INFO("not enough memory");
             goto failure;
           }
-          chainpool->chain[chainpool->nchains++] = memset(chain, 0, nbytes);
+          memset(chain, 0, nbytes);
 
           /* Get the list of segments in the chain. */
           segment_list = chain->segment;
@@ -1248,27 +2600,31 @@ img_chainpool_t *img_chainpool_new(img_segmentation_t *sgm,
           segment_list[k++] = (segment_t *)chainable;
           ASSERT(k == length, goto failure);
           chain->length = length;
-
-          /* Iteratively estimate the slopes and the bounding box of the
-             chain. FIXME: use the mean slope of the chain to initialize the
-             fit */
-          chain->a[0] = 1.0;
-          chain->a[1] = 0.0;
-          chain->a[2] = 0.0;
-          chain->a[3] = 1.0;
-          chain->vertical_shear = 0.0;
-          chain->horizontal_shear = 0.0;
-          if (fit_vertical_shear(chain, prec) != SUCCESS ||
-              fit_horizontal_shear(chain, prec) != SUCCESS) {
-            /* Discard the chain. */
-            --chainpool->nchains;
-            free(chain);
-            continue;
-          }
+          chain->state = CHAIN_UNFITTED;
+          chainpool->chain[chainpool->nchains++] = chain;
         }
       }
     }
   }
+  chainpool->unfitted = chainpool->nchains;
+
+  /* Unless they are fitted on demand, fit all the chains and only keep
+     those whose fit succeeds (in the same order). */
+  if (! lazy) {
+    long i, n = 0;
+    if (fit_chains(chainpool, 0, chainpool->nchains) != IMG_SUCCESS) {
+      goto failure;
+    }
+    for (i = 0; i < chainpool->nchains; ++i) {
+      if (chainpool->chain[i]->state == CHAIN_FITTED) {
+        chainpool->chain[n++] = chainpool->chain[i];
+      }
+    }
+    chainpool->nchains = n;
+  }
+
+  IMG_STATS_STOP(IMG_STATS_SAVE_CHAINS, toc, nchains);
+  IMG_STATS_STOP(IMG_STATS_CHAINPOOL, tic, chainpool->nchains);
 
   /* Recover result from the top of the stack. */
   return POP_STACK();
@@ -1309,6 +2665,37 @@ static void *clear_and_pop(itemstack_t *stack)
   return item.data;
 }
 
+/**
+ * @brief Get a temporary array.
+ *
+ * @param stack   The address of the stack.
+ * @param ctx     The workspace context or \c NULL.
+ * @param slot    The index of the scratch buffer of the context.
+ * @param size    The size of the array in bytes.
+ * @param zero    Whether the array must be filled with zeros.
+ *
+ * @return The address of the scratch buffer \a slot of the context \a ctx
+ *         if it is not \c NULL, the address of a new array pushed on the
+ *         stack otherwise.  In case of error, \c NULL is returned and \c
+ *         errno is set.
+ */
+static void *scratch(itemstack_t *stack, img_context_t *ctx, long slot,
+                     size_t size, int zero)
+{
+  void *ptr;
+
+  if (ctx == NULL) {
+    IMG_STATS_ALLOC(IMG_STATS_SEGMENTATION, size);
+    return itemstack_push_dynamic(stack, size, zero);
+  }
+  IMG_CONTEXT_SET_PHASE(ctx, IMG_STATS_SEGMENTATION);
+  ptr = img_context_buffer(ctx, slot, size);
+  if (ptr != NULL && zero) {
+    memset(ptr, 0, size);
+  }
+  return ptr;
+}
+
 /**
  * @brief Create a new chain-link object.
  *
@@ -1334,7 +2721,7 @@ static int chainlink_insert(chainlink_t **list,
   ASSERT((left->level < 1) || (((chainlink_t *)left)->right_child == ((chainlink_t *)right)->left_child), return failure(EINVAL));
 
   /* Allocate a new chain-link item. */
-  link = (chainlink_t *)itempool_new_item(pool);
+  link = (chainlink_t *)itempool_alloc(pool, sizeof(chainlink_t));
   if (link == NULL) {
     return FAILURE;
   }
@@ -1483,6 +2870,184 @@ static int fit_line(double sw,
   }
 }
 
+/* Fit the vertical and then the horizontal shears of a chain whose pixels
+   are PIX, the chain is rejected if any of the fits fails. */
+static int fit_shears(chain_t *chain, const chain_pixels_t *pix,
+                      double prec)
+{
+  int status;
+  IMG_STATS_TIMER(tic)
+
+  chain->a[0] = 1.0;
+  chain->a[1] = 0.0;
+  chain->a[2] = 0.0;
+  chain->a[3] = 1.0;
+  chain->vertical_shear = 0.0;
+  chain->horizontal_shear = 0.0;
+  IMG_STATS_START(tic);
+  status = fit_vertical_shear(chain, pix, prec);
+  IMG_STATS_STOP(IMG_STATS_VERTICAL_SHEAR, tic, (status != SUCCESS));
+  if (status != SUCCESS) {
+    return status;
+  }
+  IMG_STATS_START(tic);
+  status = fit_horizontal_shear(chain, pix, prec);
+  IMG_STATS_STOP(IMG_STATS_HORIZONTAL_SHEAR, tic, (status != SUCCESS));
+  return status;
+}
+
+/* Gather the pixels of the segments of CHAIN into PIX (see get_bbox for
+   the pixels which are needed), the buffers of PIX are enlarged if needed.
+   Returns SUCCESS or FAILURE with errno set. */
+static int gather_pixels(chain_pixels_t *pix, const chain_t *chain)
+{
+  const link_t mask = (IMG_LINK_EAST  | IMG_LINK_WEST |
+                       IMG_LINK_NORTH | IMG_LINK_SOUTH);
+  long i, k, n, number, x0, y0;
+  double *x, *y;
+
+  n = 0;
+  for (k = 0; k < chain->length; ++k) {
+    n += chain->segment[k]->count;
+  }
+  if (pix->size < n) {
+    if (pix->x != NULL) free(pix->x);
+    if (pix->y != NULL) free(pix->y);
+    pix->size = 0;
+    pix->x = (double *)malloc(n*sizeof(double));
+    pix->y = (double *)malloc(n*sizeof(double));
+    if (pix->x == NULL || pix->y == NULL) {
+      errno = ENOMEM;
+      return FAILURE;
+    }
+    pix->size = n;
+  }
+  if (pix->length <= chain->length) {
+    if (pix->first != NULL) free(pix->first);
+    pix->length = 0;
+    pix->first = (long *)malloc((chain->length + 1)*sizeof(long));
+    if (pix->first == NULL) {
+      errno = ENOMEM;
+      return FAILURE;
+    }
+    pix->length = chain->length + 1;
+  }
+  x = pix->x;
+  y = pix->y;
+  n = 0;
+  for (k = 0; k < chain->length; ++k) {
+    const segment_t *s = chain->segment[k];
+    pix->first[k] = n;
+    number = s->count;
+    x0 = s->xmin;
+    y0 = s->ymin;
+#define GATHER(POINT)                                   \
+    do {                                                \
+      const POINT *point = (const POINT *)s->point;     \
+      for (i = 0; i < number; ++i) {                    \
+        if (i == 0 || (point[i].link & mask) != mask) { \
+          x[n] = x0 + point[i].x;                       \
+          y[n] = y0 + point[i].y;                       \
+          ++n;                                          \
+        }                                               \
+      }                                                 \
+    } while (0)
+    if (IS_COMPACT(s)) {
+      GATHER(point_t);
+    } else {
+      GATHER(wide_point_t);
+    }
+#undef GATHER
+  }
+  pix->first[chain->length] = n;
+  return SUCCESS;
+}
+
+/* Job to fit the chains CHAIN[0] to CHAIN[NUMBER - 1], split in bands of
+   chains.  If LAZY is true, the chains whose fit fails are kept with zero
+   shears and the bounding box of their segments. */
+typedef struct _chain_job chain_job_t;
+struct _chain_job {
+  chain_t **chain;
+  long number;
+  double prec;
+  int lazy;
+};
+
+static int chain_task(void *data, long band, long nbands)
+{
+  chain_job_t *job = (chain_job_t *)data;
+  chain_pixels_t pix;
+  long j, jmin, jmax;
+  int status = IMG_SUCCESS;
+
+  jmin = IMG_BAND_START(band, nbands, job->number);
+  jmax = IMG_BAND_START(band + 1, nbands, job->number);
+  memset(&pix, 0, sizeof(pix));
+  for (j = jmin; j < jmax; ++j) {
+    chain_t *chain = job->chain[j];
+    if (chain->state != CHAIN_UNFITTED) {
+      continue;
+    }
+    if (gather_pixels(&pix, chain) != SUCCESS) {
+      status = IMG_FAILURE;
+      break;
+    }
+    if (fit_shears(chain, &pix, job->prec) == SUCCESS) {
+      chain->state = CHAIN_FITTED;
+    } else if (job->lazy) {
+      bbox_t bbox;
+      long k;
+      chain->a[1] = chain->a[2] = 0.0;
+      chain->vertical_shear = chain->horizontal_shear = 0.0;
+      for (k = 0; k < chain->length; ++k) {
+        get_bbox(&bbox, &pix, k, chain->a);
+        if (k == 0 || bbox.xmin < chain->xmin) chain->xmin = bbox.xmin;
+        if (k == 0 || bbox.xmax > chain->xmax) chain->xmax = bbox.xmax;
+        if (k == 0 || bbox.ymin < chain->ymin) chain->ymin = bbox.ymin;
+        if (k == 0 || bbox.ymax > chain->ymax) chain->ymax = bbox.ymax;
+      }
+      chain->state = CHAIN_FITTED;
+    } else {
+      chain->state = CHAIN_REJECTED;
+    }
+  }
+  if (pix.x != NULL) free(pix.x);
+  if (pix.y != NULL) free(pix.y);
+  if (pix.first != NULL) free(pix.first);
+  return status;
+}
+
+/* Fit the chains J to J + N - 1 of the pool CHN which are not yet fitted,
+   in parallel by bands of chains.  Returns IMG_SUCCESS or IMG_FAILURE with
+   errno set. */
+static int fit_chains(img_chainpool_t *chn, long j, long n)
+{
+  chain_job_t job;
+  long i, count;
+
+  if (chn->unfitted <= 0) {
+    return IMG_SUCCESS;
+  }
+  job.chain = chn->chain + j;
+  job.number = n;
+  job.prec = chn->prec;
+  job.lazy = chn->lazy;
+  count = 0;
+  for (i = 0; i < n; ++i) {
+    count += (job.chain[i]->state == CHAIN_UNFITTED);
+  }
+  if (count <= 0) {
+    return IMG_SUCCESS;
+  }
+  if (img_parallel(img_get_num_bands(n, CHAIN_MIN_BAND),
+                   chain_task, &job) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  chn->unfitted -= count;
+  return IMG_SUCCESS;
+}
+
 /**
  * @brief Fit the vertical shear of a chain.
  *
@@ -1493,7 +3058,8 @@ static int fit_line(double sw,
  *
  * @return \c SUCCESS on success; \c FAILURE on failure.
  */
-static int fit_vertical_shear(chain_t *chain, double prec)
+static int fit_vertical_shear(chain_t *chain, const chain_pixels_t *pix,
+                              double prec)
 {
   const long maxiter = 10;
   bbox_t bbox;
@@ -1531,7 +3097,7 @@ static int fit_vertical_shear(chain_t *chain, double prec)
       }
     } else {
       for (k = 0; k < length; ++k) {
-        get_bbox(&bbox, segment_list[k], chain->a);
+        get_bbox(&bbox, pix, k, chain->a);
         if (k == 0) {
           xmin = bbox.xmin;
           xmax = bbox.xmax;
@@ -1588,17 +3154,16 @@ static int fit_vertical_shear(chain_t *chain, double prec)
  *
  * @return \c SUCCESS on success; \c FAILURE on failure.
  */
-static int fit_horizontal_shear(chain_t *chain, double prec)
+static int fit_horizontal_shear(chain_t *chain, const chain_pixels_t *pix,
+                                double prec)
 {
   double shear, best_shear, spacing, best_spacing;
   double width, height, step, bound, a[4];
   double xmin, xmax, ymin, ymax, prev_xmax;
   bbox_t bbox;
   long k, length, iter, maxiter;
-  segment_t **segment_list;
 
   length = chain->length;
-  segment_list = chain->segment;
   a[0] = chain->a[0];
   a[1] = chain->a[1];
   a[2] = chain->a[2];
@@ -1626,7 +3191,7 @@ static int fit_horizontal_shear(chain_t *chain, double prec)
     a[1] = -shear; /* to fix the shear */
     spacing = 0.0;
     for (k = 0; k < length; ++k) {
-      get_bbox(&bbox, segment_list[k], a);
+      get_bbox(&bbox, pix, k, a);
       if (k != 0) {
         spacing += (bbox.xmin - prev_xmax);
       }
@@ -1646,7 +3211,7 @@ static int fit_horizontal_shear(chain_t *chain, double prec)
   xmin = xmax = ymin = ymax = 0.0; /* avoid compiler warnings */
   xmin = xmax = ymin = ymax = 0.0; /* avoid compiler warnings */
   for (k = 0; k < length; ++k) {
-    get_bbox(&bbox, segment_list[k], a);
+    get_bbox(&bbox, pix, k, a);
     if (k == 0) {
       xmin = bbox.xmin;
       xmax = bbox.xmax;
@@ -1670,46 +3235,44 @@ static int fit_horizontal_shear(chain_t *chain, double prec)
  * @brief Get the bounding box of a segment after linear geometrical
  *        transform.  The segment must have at least one point.
  *
+ * Only the first pixel of the segment and the pixels on its boundary (those
+ * without all four neighbors in the segment) are considered, they are
+ * gathered by gather_pixels().
+ *
  * @param bbox   The address of the result.
- * @param s      The input segment.
+ * @param pix    The pixels of the segments of the chain.
+ * @param k      The index of the segment in the chain.
  * @param a      The coefficients of the linear transform.
  */
 static void get_bbox(bbox_t *bbox,
-		     const segment_t *s,
-		     const double a[])
+                     const chain_pixels_t *pix,
+                     long k,
+                     const double a[])
 {
-  double px, x, xmin, xmax;
-  double py, y, ymin, ymax;
+  const double *px = pix->x, *py = pix->y;
+  double x, xmin, xmax;
+  double y, ymin, ymax;
   double axx, axy, ayx, ayy;
-  const point_t *point;
-  long i, number;
-  const link_t mask = (IMG_LINK_EAST  | IMG_LINK_WEST |
-                       IMG_LINK_NORTH | IMG_LINK_SOUTH);
+  long i, imin, imax;
 
-  if ((s == NULL) || ((number = s->count) < 1)) {
+  imin = pix->first[k];
+  imax = pix->first[k + 1];
+  if (imin >= imax) {
     xmin = xmax = ymin = ymax = 0.0;
   } else {
     axx = a[0];
     axy = a[1];
     ayx = a[2];
     ayy = a[3];
-    point = s->point;
-    i = 0;
-    px = point[i].x;
-    py = point[i].y;
-    xmin = xmax = axx*px + axy*py;
-    ymin = ymax = ayx*px + ayy*py;
-    while (++i < number) {
-      if ((point[i].link & mask) != mask) {
-        px = point[i].x;
-        py = point[i].y;
-        x = axx*px + axy*py;
-        if (x < xmin) xmin = x;
-        if (x > xmax) xmax = x;
-        y = ayx*px + ayy*py;
-        if (y < ymin) ymin = y;
-      if (y > ymax) ymax = y;
-      }
+    xmin = xmax = axx*px[imin] + axy*py[imin];
+    ymin = ymax = ayx*px[imin] + ayy*py[imin];
+    for (i = imin + 1; i < imax; ++i) {
+      x = axx*px[i] + axy*py[i];
+      y = ayx*px[i] + ayy*py[i];
+      xmin = (x < xmin ? x : xmin);
+      xmax = (x > xmax ? x : xmax);
+      ymin = (y < ymin ? y : ymin);
+      ymax = (y > ymax ? y : ymax);
     }
   }
   bbox->xmin = xmin;
@@ -1885,7 +3448,12 @@ static int mem_realloc(void **ptr, size_t size)
       pix0 = img0[0];
       lnk2 = lnk0;
       lnk0 += lnk_pitch;
-      lnk0[0] = (link_t)IMG_LINK_NONE;
+      if (SIMILAR(pix0, img2[0], threshold)) {
+        lnk2[0] |= (link_t)IMG_LINK_NORTH;
+        lnk0[0] = (link_t)IMG_LINK_SOUTH;
+      } else {
+        lnk0[0] = (link_t)IMG_LINK_NONE;
+      }
       for (x = 1; x < width; ++x) {
         pix1 = pix0;     /* value of previous pixel */
 	pix0 = img0[x];  /* value of current pixel */
@@ -1929,7 +3497,12 @@ static int mem_realloc(void **ptr, size_t size)
       pix0 = img0[0];
       lnk2 = lnk0;
       lnk0 += lnk_pitch;
-      lnk0[0] = (link_t)IMG_LINK_NONE;
+      if (pix0 == img2[0]) {
+        lnk2[0] |= (link_t)IMG_LINK_NORTH;
+        lnk0[0] = (link_t)IMG_LINK_SOUTH;
+      } else {
+        lnk0[0] = (link_t)IMG_LINK_NONE;
+      }
       for (x = 1; x < width; ++x) {
         pix1 = pix0;     /* value of previous pixel */
 	pix0 = img0[x];  /* value of current pixel */
@@ -1952,6 +3525,66 @@ static int mem_realloc(void **ptr, size_t size)
   }
   return IMG_SUCCESS;
 }
+
+static void PIXELS_MOMENTS(TYPE)(const void *img, const long offset,
+                                 const long stride, const long width,
+                                 const long index[], const long count,
+                                 const long xo, const long yo, double sum[])
+{
+  const pixel_t *pix = (const pixel_t *)img + offset;
+  double v, dx, dy, s0, s1, s2, s3, s4, s5;
+  long j, k, x, y;
+
+  s0 = s1 = s2 = s3 = s4 = s5 = 0.0;
+  for (j = 0; j < count; ++j) {
+    k = index[j];
+    y = k/width;
+    x = k - y*width;
+    v = pix[y*stride + x];
+    dx = x - xo;
+    dy = y - yo;
+    s0 += v;
+    s1 += v*dx;
+    s2 += v*dy;
+    s3 += v*dx*dx;
+    s4 += v*dx*dy;
+    s5 += v*dy*dy;
+  }
+  sum[0] += s0;
+  sum[1] += s1;
+  sum[2] += s2;
+  sum[3] += s3;
+  sum[4] += s4;
+  sum[5] += s5;
+}
+
+static void RUN_MOMENTS(TYPE)(const void *img, const long offset,
+                              const long stride, const long x0,
+                              const long x1, const long y,
+                              const long xo, const long yo, double sum[])
+{
+  const pixel_t *pix = (const pixel_t *)img + offset + y*stride;
+  double v, dx, dy, s0, s1, s3;
+  long x;
+
+  /* The row is at constant DY, only the moments in DX are integrated. */
+  s0 = s1 = s3 = 0.0;
+  for (x = x0; x <= x1; ++x) {
+    v = pix[x];
+    dx = x - xo;
+    s0 += v;
+    s1 += v*dx;
+    s3 += v*dx*dx;
+  }
+  dy = y - yo;
+  sum[0] += s0;
+  sum[1] += s1;
+  sum[2] += s0*dy;
+  sum[3] += s3;
+  sum[4] += s1*dy;
+  sum[5] += s0*dy*dy;
+}
+
 #endif /* not COMPLEX and not COLOR */
 
 #undef ABS_DIFF
@@ -0,0 +1,170 @@
+/*
+ * img_stats.c --
+ *
+ * Counters of the instrumented phases of the image processing operations.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "img.h"
+#include "img_stats.h"
+
+static const char *names[IMG_STATS_PHASES] = {
+  "morph",
+  "detect_spot",
+  "segmentation",
+  "build_links",
+  "flood_fill",
+  "runs",
+  "chainpool",
+  "sort_segments",
+  "first_links",
+  "extend_chains",
+  "save_chains",
+  "vertical_shear",
+  "horizontal_shear"
+};
+
+#ifdef IMG_USE_STATS
+
+/*
+ * The counters are shared by all threads.  They are updated with atomic
+ * operations if the compiler provides them; otherwise concurrent updates may
+ * be lost (which only makes the statistics approximate).
+ */
+static struct {
+  long calls;
+  int64_t time; /* in nanoseconds */
+  long items;
+  long bytes;
+} counters[IMG_STATS_PHASES];
+
+#ifdef __GNUC__
+# define ADD(var, val) ((void)__sync_fetch_and_add(&(var), (val)))
+#else
+# define ADD(var, val) ((var) += (val))
+#endif
+
+int64_t img_stats_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec*1000000000 + (int64_t)ts.tv_nsec;
+#else
+  return (int64_t)((1e9/CLOCKS_PER_SEC)*(double)clock());
+#endif
+}
+
+void img_stats_add(int phase, int64_t ns, long items)
+{
+  ADD(counters[phase].calls, 1L);
+  ADD(counters[phase].time, ns);
+  if (items != 0) {
+    ADD(counters[phase].items, items);
+  }
+}
+
+void img_stats_alloc(int phase, size_t nbytes)
+{
+  ADD(counters[phase].bytes, (long)nbytes);
+}
+
+#endif /* IMG_USE_STATS */
+
+/**
+ * @brief Get the statistics of the instrumented phases.
+ *
+ * The library collects, for the main phases of the morpho-math operations,
+ * the detection of spots, the segmentation and the chaining of segments, the
+ * number of calls, the cumulated wall time, the number of items processed
+ * and the number of bytes allocated.  The time of a phase is summed over the
+ * threads which run it, the time of the phases split between the threads is
+ * measured by the calling thread.  The counters are cumulated since the
+ * start or the last call to img_reset_stats().
+ *
+ * The statistics are only available if the library has been compiled with
+ * the macro \c IMG_USE_STATS defined.
+ *
+ * @param stats   An array of \c IMG_STATS_PHASES elements to store the
+ *                statistics indexed by the phase (\c IMG_STATS_MORPH,
+ *                \c IMG_STATS_SEGMENTATION, etc.).
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set to \c EFAULT if
+ *         \a stats is \c NULL or to \c ENOSYS if the library has been
+ *         compiled without statistics.
+ *
+ * @see img_reset_stats(), img_get_stats_name().
+ */
+int img_get_stats(img_stats_t stats[])
+{
+#ifdef IMG_USE_STATS
+  int k;
+
+  if (stats == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  for (k = 0; k < IMG_STATS_PHASES; ++k) {
+    stats[k].calls = counters[k].calls;
+    stats[k].time = 1e-9*(double)counters[k].time;
+    stats[k].items = counters[k].items;
+    stats[k].bytes = counters[k].bytes;
+  }
+  return IMG_SUCCESS;
+#else
+  errno = (stats == NULL ? EFAULT : ENOSYS);
+  return IMG_FAILURE;
+#endif
+}
+
+/**
+ * @brief Reset the statistics of the instrumented phases.
+ *
+ * This function should not be called while some processing is in progress
+ * in another thread.
+ *
+ * @see img_get_stats().
+ */
+void img_reset_stats(void)
+{
+#ifdef IMG_USE_STATS
+  memset(counters, 0, sizeof(counters));
+#endif
+}
+
+/**
+ * @brief Get the name of an instrumented phase.
+ *
+ * @param phase   The index of the phase (\c IMG_STATS_MORPH, etc.).
+ *
+ * @return The name of the phase (e.g. "flood_fill") or \c NULL if \a phase
+ *         is invalid.
+ *
+ * @see img_get_stats().
+ */
+const char *img_get_stats_name(int phase)
+{
+  return (0 <= phase && phase < IMG_STATS_PHASES ? names[phase] : NULL);
+}
@@ -0,0 +1,78 @@
+/*
+ * img_stats.h --
+ *
+ * Private definitions for the instrumentation of the hot paths.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IMG_STATS_H
+#define _IMG_STATS_H 1
+
+#include <stddef.h>
+#include "img.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * The instrumentation is compiled only if the macro IMG_USE_STATS is
+ * defined, otherwise the following macros expand to nothing.  A phase is
+ * timed by:
+ *
+ *     IMG_STATS_TIMER(t)                  (declaration, no semicolon)
+ *     IMG_STATS_START(t);
+ *     ...
+ *     IMG_STATS_STOP(IMG_STATS_..., t, n);
+ *
+ * which adds one call, the elapsed time and N items to the counters of the
+ * phase.  IMG_STATS_ALLOC(IMG_STATS_..., n) adds N bytes allocated to the
+ * counters of a phase.  The counters are shared by all threads, they must
+ * only be updated once per call or per band of rows, not in inner loops.
+ */
+#ifdef IMG_USE_STATS
+
+#include <stdint.h>
+
+extern int64_t img_stats_clock(void);
+extern void img_stats_add(int phase, int64_t ns, long items);
+extern void img_stats_alloc(int phase, size_t nbytes);
+
+# define IMG_STATS_TIMER(t)           int64_t t;
+# define IMG_STATS_START(t)           (t) = img_stats_clock()
+# define IMG_STATS_STOP(phase, t, n)  \
+  img_stats_add(phase, img_stats_clock() - (t), n)
+# define IMG_STATS_ALLOC(phase, n)    img_stats_alloc(phase, n)
+
+#else /* not IMG_USE_STATS */
+
+# define IMG_STATS_TIMER(t)
+# define IMG_STATS_START(t)           ((void)0)
+# define IMG_STATS_STOP(phase, t, n)  ((void)0)
+# define IMG_STATS_ALLOC(phase, n)    ((void)0)
+
+#endif /* IMG_USE_STATS */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _IMG_STATS_H */
@@ -0,0 +1,405 @@
+/*
+ * img_thread.c --
+ *
+ * Implementation of a simple pool of threads to process images by bands of
+ * rows.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "img.h"
+#include "img_thread.h"
+
+#ifdef IMG_USE_PTHREADS
+# include <pthread.h>
+#endif
+
+/*
+ * The work is split in bands which are processed by the worker threads and
+ * by the calling thread.  The decomposition in bands is decided by the
+ * caller, the order in which the bands are processed is not specified, hence
+ * tasks must write their results in separate places (e.g. one partial sum
+ * per band) to be combined in a fixed order by the caller.  If the pool is
+ * already busy (nested or concurrent calls), the bands are simply processed
+ * by the calling thread.
+ */
+
+static long nthreads = 0; /* number of threads, 0 if not yet initialized */
+
+static void initialize(void);
+
+#ifdef IMG_USE_PTHREADS
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t *workers = NULL; /* worker threads */
+static long nworkers = 0;         /* number of running worker threads */
+static int busy = 0;              /* a job is in progress */
+static int quit = 0;              /* worker threads must exit */
+static unsigned long generation = 0; /* incremented for every new job */
+static unsigned long created = 0; /* generation when workers were created */
+
+/* Current job. */
+static img_task_t *job_task = NULL;
+static void *job_data = NULL;
+static long job_nbands = 0;  /* number of bands */
+static long job_next = 0;    /* next band to process */
+static long job_pending = 0; /* number of unfinished bands */
+static int job_status = IMG_SUCCESS;
+static int job_errno = 0;    /* value of errno for the first failure */
+
+/* Process the bands of the current job, must be called with the mutex
+   locked. */
+static void run_bands(void)
+{
+  while (job_next < job_nbands) {
+    long band = job_next++;
+    int status;
+    pthread_mutex_unlock(&mutex);
+    status = job_task(job_data, band, job_nbands);
+    if (status != IMG_SUCCESS) {
+      status = errno; /* errno is local to each thread */
+      pthread_mutex_lock(&mutex);
+      if (job_status == IMG_SUCCESS) {
+        job_status = IMG_FAILURE;
+        job_errno = status;
+      }
+    } else {
+      pthread_mutex_lock(&mutex);
+    }
+    if (--job_pending == 0) {
+      pthread_cond_signal(&done_cond);
+    }
+  }
+}
+
+static void *worker(void *arg)
+{
+  unsigned long seen;
+
+  pthread_mutex_lock(&mutex);
+  seen = created;
+  for (;;) {
+    while (generation == seen && ! quit) {
+      pthread_cond_wait(&start_cond, &mutex);
+    }
+    if (quit) {
+      break;
+    }
+    seen = generation;
+    run_bands();
+  }
+  pthread_mutex_unlock(&mutex);
+  return arg;
+}
+
+/* Stop all worker threads, must be called with the mutex unlocked and the
+   pool not busy. */
+static void stop_workers(void)
+{
+  long k, n;
+
+  pthread_mutex_lock(&mutex);
+  quit = 1;
+  n = nworkers;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&mutex);
+  for (k = 0; k < n; ++k) {
+    pthread_join(workers[k], NULL);
+  }
+  pthread_mutex_lock(&mutex);
+  quit = 0;
+  nworkers = 0;
+  if (workers != NULL) {
+    free((void *)workers);
+    workers = NULL;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+/* Start the worker threads (if not yet done), must be called with the mutex
+   locked.  On failure, less workers are available which is not an error. */
+static void start_workers(void)
+{
+  if (workers == NULL && nthreads > 1) {
+    workers = (pthread_t *)malloc((nthreads - 1)*sizeof(pthread_t));
+    if (workers != NULL) {
+      created = generation;
+      while (nworkers < nthreads - 1 &&
+             pthread_create(&workers[nworkers], NULL, worker, NULL) == 0) {
+        ++nworkers;
+      }
+    }
+  }
+}
+
+#endif /* IMG_USE_PTHREADS */
+
+static void initialize(void)
+{
+  if (nthreads < 1) {
+    const char *str = getenv("IMG_NUM_THREADS");
+    long n = 1;
+    if (str != NULL) {
+      char *end;
+      n = strtol(str, &end, 10);
+      if (end == str || *end != '\0' || n < 1) {
+        n = 1;
+      }
+    }
+#ifndef IMG_USE_PTHREADS
+    n = 1;
+#endif
+    nthreads = n;
+  }
+}
+
+/**
+ * @brief Set the number of threads.
+ *
+ * This function sets the number of threads used to process images.  The
+ * default number of threads is given by the environment variable
+ * \c IMG_NUM_THREADS, 1 if it is not set.  Whatever the number of threads,
+ * the results are exactly the same as with a single thread.
+ *
+ * @param n   The number of threads, must be at least 1.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set to \c EINVAL
+ *         if \a n is invalid, to \c EBUSY if some processing is in progress,
+ *         or to \c ENOSYS if \a n > 1 and the library has been compiled
+ *         without thread support.
+ *
+ * @see img_get_num_threads().
+ */
+int img_set_num_threads(long n)
+{
+  if (n < 1) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+#ifdef IMG_USE_PTHREADS
+  pthread_mutex_lock(&mutex);
+  if (busy) {
+    pthread_mutex_unlock(&mutex);
+    errno = EBUSY;
+    return IMG_FAILURE;
+  }
+  busy = 1; /* prevent other jobs while stopping the workers */
+  pthread_mutex_unlock(&mutex);
+  stop_workers();
+  pthread_mutex_lock(&mutex);
+  nthreads = n;
+  busy = 0;
+  pthread_mutex_unlock(&mutex);
+#else
+  if (n > 1) {
+    errno = ENOSYS;
+    return IMG_FAILURE;
+  }
+  nthreads = n;
+#endif
+  return IMG_SUCCESS;
+}
+
+/**
+ * @brief Get the number of threads.
+ *
+ * @return The number of threads used to process images.
+ *
+ * @see img_set_num_threads().
+ */
+long img_get_num_threads(void)
+{
+  long n;
+#ifdef IMG_USE_PTHREADS
+  pthread_mutex_lock(&mutex);
+  initialize();
+  n = nthreads;
+  pthread_mutex_unlock(&mutex);
+#else
+  initialize();
+  n = nthreads;
+#endif
+  return n;
+}
+
+/**
+ * @brief Get the number of bands for a parallel processing by rows.
+ *
+ * @param nrows      The number of rows to process.
+ * @param min_rows   The minimum number of rows per band.
+ *
+ * @return The number of bands, at least 1 and at most the number of
+ *         threads.
+ */
+long img_get_num_bands(long nrows, long min_rows)
+{
+  long n = img_get_num_threads();
+
+  if (min_rows < 1) {
+    min_rows = 1;
+  }
+  if (n > nrows/min_rows) {
+    n = nrows/min_rows;
+  }
+  return (n > 1 ? n : 1);
+}
+
+/**
+ * @brief Process bands in parallel.
+ *
+ * This function calls \a task for every band in the range 0 to \a nbands
+ * - 1.  The bands are processed by the pool of threads, or sequentially if
+ * there is a single thread or if the pool is already busy.
+ *
+ * @param nbands   The number of bands.
+ * @param task     The function to process a band.
+ * @param data     The data passed to \a task.
+ *
+ * @return \c IMG_SUCCESS if all bands have been successfully processed,
+ *         \c IMG_FAILURE otherwise with \c errno set by the first failed
+ *         task.
+ */
+int img_parallel(long nbands, img_task_t *task, void *data)
+{
+  long band;
+  int status = IMG_SUCCESS;
+#ifdef IMG_USE_PTHREADS
+  int code;
+#endif
+
+#ifdef IMG_USE_PTHREADS
+  if (nbands > 1) {
+    pthread_mutex_lock(&mutex);
+    initialize();
+    if (! busy && nthreads > 1) {
+      start_workers();
+    }
+    if (! busy && nworkers > 0) {
+      busy = 1;
+      job_task = task;
+      job_data = data;
+      job_nbands = nbands;
+      job_next = 0;
+      job_pending = nbands;
+      job_status = IMG_SUCCESS;
+      ++generation;
+      pthread_cond_broadcast(&start_cond);
+      run_bands();
+      while (job_pending > 0) {
+        pthread_cond_wait(&done_cond, &mutex);
+      }
+      status = job_status;
+      code = job_errno;
+      job_task = NULL;
+      job_data = NULL;
+      busy = 0;
+      pthread_mutex_unlock(&mutex);
+      if (status != IMG_SUCCESS) {
+        errno = code;
+      }
+      return status;
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+#endif
+  for (band = 0; band < nbands; ++band) {
+    if (task(data, band, nbands) != IMG_SUCCESS) {
+      return IMG_FAILURE;
+    }
+  }
+  return status;
+}
+
+/*
+ * Each thread has its own private stack of items to manage the temporary
+ * resources of the routines which are not thread safe otherwise.  The stack
+ * is kept until the thread exits so that the resources left by an
+ * interrupted call (for instance by Yorick) are released by the next call
+ * from the same thread.
+ */
+
+#ifdef IMG_USE_PTHREADS
+
+static pthread_once_t stack_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stack_key;
+static int stack_status = -1;
+
+static void destroy_stack(void *ptr)
+{
+  itemstack_destroy((itemstack_t *)ptr);
+}
+
+static void create_stack_key(void)
+{
+  stack_status = pthread_key_create(&stack_key, destroy_stack);
+}
+
+#else /* not IMG_USE_PTHREADS */
+
+static itemstack_t *private_stack = NULL;
+
+#endif /* IMG_USE_PTHREADS */
+
+/**
+ * @brief Get the private stack of the calling thread.
+ *
+ * @return The address of the private stack of items of the calling thread
+ *         (the stack is created if needed); \c NULL in case of error with
+ *         \c errno set.
+ */
+itemstack_t *img_get_private_stack(void)
+{
+  itemstack_t *stack;
+
+#ifdef IMG_USE_PTHREADS
+  if (pthread_once(&stack_once, create_stack_key) != 0 || stack_status != 0) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  stack = (itemstack_t *)pthread_getspecific(stack_key);
+  if (stack == NULL) {
+    stack = itemstack_new(0);
+    if (stack == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    if (pthread_setspecific(stack_key, (void *)stack) != 0) {
+      itemstack_destroy(stack);
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+#else /* not IMG_USE_PTHREADS */
+  if (private_stack == NULL) {
+    private_stack = itemstack_new(0);
+    if (private_stack == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+  stack = private_stack;
+#endif /* IMG_USE_PTHREADS */
+  return stack;
+}
@@ -0,0 +1,54 @@
+/*
+ * img_thread.h --
+ *
+ * Definitions for the parallel execution of image processing tasks.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IMG_THREAD_H
+#define _IMG_THREAD_H 1
+
+#include "itemstack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * A task processes band number BAND (in the range 0 to NBANDS - 1) of some
+ * work described by DATA.  It returns IMG_SUCCESS or IMG_FAILURE.
+ */
+typedef int img_task_t(void *data, long band, long nbands);
+
+/* Index of the first row of band BAND when NROWS rows are split into NBANDS
+   bands (the last row of the band is IMG_BAND_START(BAND + 1, ...) - 1). */
+#define IMG_BAND_START(band, nbands, nrows) (((band)*(nrows))/(nbands))
+
+/* Private functions. */
+extern long img_get_num_bands(long nrows, long min_rows);
+extern int  img_parallel(long nbands, img_task_t *task, void *data);
+extern itemstack_t *img_get_private_stack(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _IMG_THREAD_H */
@@ -0,0 +1,894 @@
+/*
+ * img_tile.c --
+ *
+ * Processing of images larger than the memory by tiles or bands of rows.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2009-2017 Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * This file is part of YImage.
+ *
+ * YImage is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * YImage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * YImage.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+#endif
+
+#include "img.h"
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+
+/*
+ * A source (resp. a sink) of pixels is either a callback which reads (resp.
+ * writes) rectangular regions or an array of pixels in memory.  In the latter
+ * case, BASE is the address of the first pixel and PITCH the number of
+ * pixels per row; if MAP is not NULL, the array is a mapping of MAP_SIZE
+ * bytes of a file which is unmapped when the source (resp. the sink) is
+ * destroyed.
+ */
+struct _img_tile_source {
+  img_tile_reader_t *read;
+  void *data;
+  const char *base;
+  void *map;
+  size_t map_size;
+  size_t size;
+  long width, height, pitch;
+  int type;
+};
+
+struct _img_tile_sink {
+  img_tile_writer_t *write;
+  void *data;
+  char *base;
+  void *map;
+  size_t map_size;
+  size_t size;
+  long width, height, pitch;
+  int type;
+};
+
+/* Check the type and the dimensions of a source or of a sink and get the
+   size of its pixels. */
+static size_t check_geometry(int type, long width, long height)
+{
+  size_t size = img_get_pixel_size(type);
+  if (size == 0 || width < 1 || height < 1) {
+    errno = EINVAL;
+    return 0;
+  }
+  return size;
+}
+
+/* Map NBYTES bytes after a header of HEADER bytes of a file.  If WRITABLE is
+   true, the file is created or extended if needed.  Return the address of
+   the mapping (of *MAP_SIZE bytes) or NULL on error with errno set. */
+static void *map_file(const char *path, long header, size_t nbytes,
+                      int writable, size_t *map_size)
+{
+#ifdef _WIN32
+  (void)path;
+  (void)header;
+  (void)nbytes;
+  (void)writable;
+  (void)map_size;
+  errno = ENOSYS;
+  return NULL;
+#else
+  struct stat st;
+  void *map;
+  size_t len;
+  int fd, code;
+
+  if (path == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (header < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  len = header + nbytes;
+  fd = (writable ? open(path, O_RDWR | O_CREAT, 0666) : open(path, O_RDONLY));
+  if (fd == -1) {
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0) {
+    goto failure;
+  }
+  if ((size_t)st.st_size < len) {
+    if (! writable) {
+      errno = EINVAL;
+      goto failure;
+    }
+    if (ftruncate(fd, (off_t)len) != 0) {
+      goto failure;
+    }
+  }
+  map = mmap(NULL, len, (writable ? PROT_READ | PROT_WRITE : PROT_READ),
+             MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    goto failure;
+  }
+  close(fd);
+  *map_size = len;
+  return map;
+
+ failure:
+  code = errno;
+  close(fd);
+  errno = code;
+  return NULL;
+#endif
+}
+
+static void unmap_file(void *map, size_t map_size)
+{
+#ifdef _WIN32
+  (void)map;
+  (void)map_size;
+#else
+  munmap(map, map_size);
+#endif
+}
+
+/* Check that the WIDTH by HEIGHT rectangle at (X,Y) is inside an image of
+   dimensions IMG_WIDTH by IMG_HEIGHT. */
+static int check_region(long img_width, long img_height, long x, long y,
+                        long width, long height, const void *buf, long pitch)
+{
+  if (buf == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (width < 1 || height < 1 || pitch < width || x < 0 || y < 0 ||
+      x + width > img_width || y + height > img_height) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  return IMG_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+/* SOURCES OF PIXELS */
+
+static img_tile_source_t *new_source(int type, long width, long height)
+{
+  img_tile_source_t *src;
+  size_t size;
+
+  size = check_geometry(type, width, height);
+  if (size == 0) {
+    return NULL;
+  }
+  src = (img_tile_source_t *)malloc(sizeof(img_tile_source_t));
+  if (src == NULL) {
+    return NULL;
+  }
+  src->read = NULL;
+  src->data = NULL;
+  src->base = NULL;
+  src->map = NULL;
+  src->map_size = 0;
+  src->size = size;
+  src->width = width;
+  src->height = height;
+  src->pitch = width;
+  src->type = type;
+  return src;
+}
+
+/**
+ * @brief Create a source of pixels given a callback.
+ *
+ * The callback \a read is called as `read(data, x, y, w, h, buf, pitch)` to
+ * store the \a w by \a h pixels of the rectangle starting at (\a x,\a y) in
+ * \a buf with \a pitch pixels per row.  It shall return \c IMG_SUCCESS or
+ * \c IMG_FAILURE with \c errno set.  The rectangles are always inside the
+ * image.
+ *
+ * @param type    The pixel type of the image.
+ * @param width   The width of the image.
+ * @param height  The height of the image.
+ * @param read    The callback to read the pixels.
+ * @param data    The client data for the callback.
+ *
+ * @return A new source or \c NULL on error with \c errno set.
+ *
+ * @see img_tile_source_destroy(), img_tile_read().
+ */
+img_tile_source_t *img_tile_source_new(int type, long width, long height,
+                                       img_tile_reader_t *read, void *data)
+{
+  img_tile_source_t *src;
+
+  if (read == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  src = new_source(type, width, height);
+  if (src != NULL) {
+    src->read = read;
+    src->data = data;
+  }
+  return src;
+}
+
+/**
+ * @brief Create a source of pixels from an array in memory.
+ *
+ * @param type    The pixel type of the image.
+ * @param width   The width of the image.
+ * @param height  The height of the image.
+ * @param img     The base address of the array.
+ * @param offset  The offset (in pixels) of the first pixel of the image.
+ * @param pitch   The number of pixels per row of the array.
+ *
+ * @return A new source or \c NULL on error with \c errno set.  The array
+ *         must remain valid until the source is destroyed.
+ */
+img_tile_source_t *img_tile_source_wrap(int type, long width, long height,
+                                        const void *img, long offset,
+                                        long pitch)
+{
+  img_tile_source_t *src;
+
+  if (img == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (pitch < width) {
+    errno = EINVAL;
+    return NULL;
+  }
+  src = new_source(type, width, height);
+  if (src != NULL) {
+    src->base = (const char *)img + offset*src->size;
+    src->pitch = pitch;
+  }
+  return src;
+}
+
+/**
+ * @brief Create a source of pixels from a raw file.
+ *
+ * The file is mapped in memory (read-only) so only the pages of the file
+ * which are read are loaded by the system.  The pixels are stored in native
+ * byte order and row by row after a header of \a header bytes.
+ *
+ * @param path    The name of the file.
+ * @param header  The number of bytes before the first pixel.
+ * @param type    The pixel type of the image.
+ * @param width   The width of the image.
+ * @param height  The height of the image.
+ *
+ * @return A new source or \c NULL on error with \c errno set (to \c EINVAL
+ *         if the file is too small, to \c ENOSYS if the memory mapping of
+ *         files is not supported).
+ */
+img_tile_source_t *img_tile_source_open(const char *path, long header,
+                                        int type, long width, long height)
+{
+  img_tile_source_t *src;
+  void *map;
+  size_t map_size;
+
+  src = new_source(type, width, height);
+  if (src == NULL) {
+    return NULL;
+  }
+  map = map_file(path, header, width*height*src->size, 0, &map_size);
+  if (map == NULL) {
+    int code = errno;
+    free(src);
+    errno = code;
+    return NULL;
+  }
+  src->map = map;
+  src->map_size = map_size;
+  src->base = (const char *)map + header;
+  return src;
+}
+
+/**
+ * @brief Destroy a source of pixels.
+ *
+ * @param src   The source (can be \c NULL).
+ */
+void img_tile_source_destroy(img_tile_source_t *src)
+{
+  if (src != NULL) {
+    if (src->map != NULL) {
+      unmap_file(src->map, src->map_size);
+    }
+    free(src);
+  }
+}
+
+int img_tile_source_get_type(const img_tile_source_t *src)
+{
+  return (src != NULL ? src->type : IMG_TYPE_NONE);
+}
+
+long img_tile_source_get_width(const img_tile_source_t *src)
+{
+  return (src != NULL ? src->width : 0);
+}
+
+long img_tile_source_get_height(const img_tile_source_t *src)
+{
+  return (src != NULL ? src->height : 0);
+}
+
+/**
+ * @brief Read a rectangular region from a source of pixels.
+ *
+ * @param src     The source.
+ * @param x       The abscissa of the first pixel of the region.
+ * @param y       The ordinate of the first pixel of the region.
+ * @param width   The width of the region.
+ * @param height  The height of the region.
+ * @param buf     The destination of the pixels.
+ * @param pitch   The number of pixels per row of \a buf.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set (to \c EINVAL
+ *         if the region is not inside the image).
+ */
+int img_tile_read(img_tile_source_t *src, long x, long y,
+                  long width, long height, void *buf, long pitch)
+{
+  const char *from;
+  char *to;
+  size_t nbytes;
+  long j;
+
+  if (src == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (check_region(src->width, src->height, x, y, width, height,
+                   buf, pitch) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  if (src->read != NULL) {
+    return src->read(src->data, x, y, width, height, buf, pitch);
+  }
+  from = src->base + (y*src->pitch + x)*src->size;
+  to = (char *)buf;
+  nbytes = width*src->size;
+  for (j = 0; j < height; ++j) {
+    memcpy(to, from, nbytes);
+    from += src->pitch*src->size;
+    to += pitch*src->size;
+  }
+  return IMG_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+/* SINKS OF PIXELS */
+
+static img_tile_sink_t *new_sink(int type, long width, long height)
+{
+  img_tile_sink_t *dst;
+  size_t size;
+
+  size = check_geometry(type, width, height);
+  if (size == 0) {
+    return NULL;
+  }
+  dst = (img_tile_sink_t *)malloc(sizeof(img_tile_sink_t));
+  if (dst == NULL) {
+    return NULL;
+  }
+  dst->write = NULL;
+  dst->data = NULL;
+  dst->base = NULL;
+  dst->map = NULL;
+  dst->map_size = 0;
+  dst->size = size;
+  dst->width = width;
+  dst->height = height;
+  dst->pitch = width;
+  dst->type = type;
+  return dst;
+}
+
+/**
+ * @brief Create a sink of pixels given a callback.
+ *
+ * The callback \a write is called as `write(data, x, y, w, h, buf, pitch)`
+ * to store the \a w by \a h pixels of \a buf (with \a pitch pixels per row)
+ * in the rectangle starting at (\a x,\a y).  It shall return \c IMG_SUCCESS
+ * or \c IMG_FAILURE with \c errno set.
+ *
+ * @see img_tile_source_new(), img_tile_sink_destroy(), img_tile_write().
+ */
+img_tile_sink_t *img_tile_sink_new(int type, long width, long height,
+                                   img_tile_writer_t *write, void *data)
+{
+  img_tile_sink_t *dst;
+
+  if (write == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  dst = new_sink(type, width, height);
+  if (dst != NULL) {
+    dst->write = write;
+    dst->data = data;
+  }
+  return dst;
+}
+
+/**
+ * @brief Create a sink of pixels from an array in memory.
+ *
+ * @see img_tile_source_wrap().
+ */
+img_tile_sink_t *img_tile_sink_wrap(int type, long width, long height,
+                                    void *img, long offset, long pitch)
+{
+  img_tile_sink_t *dst;
+
+  if (img == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (pitch < width) {
+    errno = EINVAL;
+    return NULL;
+  }
+  dst = new_sink(type, width, height);
+  if (dst != NULL) {
+    dst->base = (char *)img + offset*dst->size;
+    dst->pitch = pitch;
+  }
+  return dst;
+}
+
+/**
+ * @brief Create a sink of pixels to a raw file.
+ *
+ * The file is created if it does not exist and extended if it is too small
+ * to store the pixels after the header of \a header bytes (which is left
+ * unchanged).  The file is mapped in memory and the pixels are written in
+ * native byte order, row by row.
+ *
+ * @see img_tile_source_open().
+ */
+img_tile_sink_t *img_tile_sink_create(const char *path, long header,
+                                      int type, long width, long height)
+{
+  img_tile_sink_t *dst;
+  void *map;
+  size_t map_size;
+
+  dst = new_sink(type, width, height);
+  if (dst == NULL) {
+    return NULL;
+  }
+  map = map_file(path, header, width*height*dst->size, 1, &map_size);
+  if (map == NULL) {
+    int code = errno;
+    free(dst);
+    errno = code;
+    return NULL;
+  }
+  dst->map = map;
+  dst->map_size = map_size;
+  dst->base = (char *)map + header;
+  return dst;
+}
+
+/**
+ * @brief Destroy a sink of pixels.
+ *
+ * @param dst   The sink (can be \c NULL).  The mapping of a file is
+ *              released, the system writes the pixels to the file.
+ */
+void img_tile_sink_destroy(img_tile_sink_t *dst)
+{
+  if (dst != NULL) {
+    if (dst->map != NULL) {
+      unmap_file(dst->map, dst->map_size);
+    }
+    free(dst);
+  }
+}
+
+/**
+ * @brief Write a rectangular region into a sink of pixels.
+ *
+ * @see img_tile_read().
+ */
+int img_tile_write(img_tile_sink_t *dst, long x, long y,
+                   long width, long height, const void *buf, long pitch)
+{
+  const char *from;
+  char *to;
+  size_t nbytes;
+  long j;
+
+  if (dst == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (check_region(dst->width, dst->height, x, y, width, height,
+                   buf, pitch) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  if (dst->write != NULL) {
+    return dst->write(dst->data, x, y, width, height, buf, pitch);
+  }
+  from = (const char *)buf;
+  to = dst->base + (y*dst->pitch + x)*dst->size;
+  nbytes = width*dst->size;
+  for (j = 0; j < height; ++j) {
+    memcpy(to, from, nbytes);
+    from += pitch*dst->size;
+    to += dst->pitch*dst->size;
+  }
+  return IMG_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+/* TILED PROCESSING */
+
+/**
+ * @brief Apply a morpho-math operation by tiles.
+ *
+ * This function applies the morpho-math operation \a op to the image of
+ * the source \a src and stores the result in the sink \a dst.  The image is
+ * processed by tiles of \a tile_width by \a tile_height pixels read with a
+ * margin of \a r pixels for the erosion and the dilation, of 2*\a r pixels
+ * for the opening and the closing, so that the result is the same as for
+ * the whole image.
+ *
+ * @param op          The operation: \c IMG_MORPH_EROSION,
+ *                    \c IMG_MORPH_DILATION, \c IMG_MORPH_OPENING or
+ *                    \c IMG_MORPH_CLOSING.
+ * @param src         The source of pixels.
+ * @param r           The radius of the structuring element.
+ * @param tile_width  The width of the tiles.
+ * @param tile_height The height of the tiles.
+ * @param dst         The sink of the result, with the same pixel type and
+ *                    dimensions as \a src.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ */
+int img_tile_morph(int op, img_tile_source_t *src, long r,
+                   long tile_width, long tile_height, img_tile_sink_t *dst)
+{
+  const long width = (src != NULL ? src->width : 0);
+  const long height = (src != NULL ? src->height : 0);
+  char *in, *out;
+  long *ws;
+  long halo, bw, bh, x0, x1, y0, y1, bx0, bx1, by0, by1, pitch;
+  size_t size;
+  int status, code;
+
+  if (src == NULL || dst == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (dst->type != src->type || dst->width != width ||
+      dst->height != height || r < 0 || tile_width < 1 || tile_height < 1) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  switch (op) {
+  case IMG_MORPH_EROSION:
+  case IMG_MORPH_DILATION:
+    halo = r;
+    break;
+  case IMG_MORPH_OPENING:
+  case IMG_MORPH_CLOSING:
+    halo = 2*r;
+    break;
+  default:
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  size = src->size;
+  bw = MIN(tile_width + 2*halo, width);
+  bh = MIN(tile_height + 2*halo, height);
+  in = (char *)malloc(2*bw*bh*size + (2*r + 1)*sizeof(long));
+  if (in == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  out = in + bw*bh*size;
+  ws = (long *)(out + bw*bh*size);
+  status = IMG_SUCCESS;
+  for (y0 = 0; y0 < height && status == IMG_SUCCESS; y0 = y1) {
+    y1 = MIN(y0 + tile_height, height);
+    by0 = MAX(y0 - halo, 0);
+    by1 = MIN(y1 + halo, height);
+    for (x0 = 0; x0 < width; x0 = x1) {
+      x1 = MIN(x0 + tile_width, width);
+      bx0 = MAX(x0 - halo, 0);
+      bx1 = MIN(x1 + halo, width);
+      pitch = bx1 - bx0;
+      status = img_tile_read(src, bx0, by0, pitch, by1 - by0, in, pitch);
+      if (status != IMG_SUCCESS) {
+        break;
+      }
+      switch (op) {
+      case IMG_MORPH_EROSION:
+        status = img_morph_erosion(src->type, pitch, by1 - by0, in, pitch,
+                                   r, ws, out, pitch);
+        break;
+      case IMG_MORPH_DILATION:
+        status = img_morph_dilation(src->type, pitch, by1 - by0, in, pitch,
+                                    r, ws, out, pitch);
+        break;
+      case IMG_MORPH_OPENING:
+        status = img_morph_opening(src->type, pitch, by1 - by0, in, pitch,
+                                   r, out, pitch);
+        break;
+      default:
+        status = img_morph_closing(src->type, pitch, by1 - by0, in, pitch,
+                                   r, out, pitch);
+      }
+      if (status != IMG_SUCCESS) {
+        break;
+      }
+      status = img_tile_write(dst, x0, y0, x1 - x0, y1 - y0,
+                              out + ((y0 - by0)*pitch + (x0 - bx0))*size,
+                              pitch);
+      if (status != IMG_SUCCESS) {
+        break;
+      }
+    }
+  }
+  code = errno;
+  free(in);
+  errno = code;
+  return status;
+}
+
+/* Clamp the range of source indices [floor(T0) - M, floor(T1) + M] to a
+   non-empty range [*I0,*I1) of indices in [0,LENGTH). */
+static void clamp_window(double t0, double t1, long m, long length,
+                         long *i0, long *i1)
+{
+  double a = floor(t0) - m, b = floor(t1) + m + 1;
+  *i0 = (a <= 0.0 ? 0 : (a >= length - 1 ? length - 1 : (long)a));
+  *i1 = (b <= *i0 + 1 ? *i0 + 1 : (b >= length ? length : (long)b));
+}
+
+/**
+ * @brief Extract a rectangular region with coordinate transform by tiles.
+ *
+ * This function is the tiled counterpart of
+ * img_extract_rectangle_with_interp(): the destination image of the sink
+ * \a dst is computed by tiles of \a tile_width by \a tile_height pixels and,
+ * for each tile, only the part of the source image needed by the
+ * interpolation (the bounding box of the transformed tile enlarged by the
+ * footprint of the interpolation kernel) is read.  The result is the same
+ * as for the whole image up to the rounding errors of the transformed
+ * coordinates, except for a rotation with the cubic or Lanczos kernels:
+ * the rotation is computed by three shears whose sampling depends on the
+ * origin of the destination, so the tiles differ from the whole image at
+ * the level of the interpolation errors.
+ *
+ * @param src         The source of pixels.
+ * @param dst         The sink of the result, with the same pixel type as
+ *                    \a src.
+ * @param a           The coefficients of the coordinate transform (see
+ *                    img_extract_rectangle()).
+ * @param inverse     True if \a a gives the coefficients of the inverse
+ *                    coordinate transform.
+ * @param interp      The interpolation method.
+ * @param tile_width  The width of the tiles.
+ * @param tile_height The height of the tiles.
+ *
+ * @return \c IMG_SUCCESS or \c IMG_FAILURE with \c errno set.
+ */
+int img_tile_extract_rectangle(img_tile_source_t *src, img_tile_sink_t *dst,
+                               const double a[6], int inverse, int interp,
+                               long tile_width, long tile_height)
+{
+  double b[6], c[6], x[4], y[4], xmin, xmax, ymin, ymax;
+  char *buf, *out;
+  size_t size, len, cap;
+  long margin, xp0, xp1, yp0, yp1, wx0, wx1, wy0, wy1, k;
+  int status, code;
+
+  if (src == NULL || dst == NULL || a == NULL) {
+    errno = EFAULT;
+    return IMG_FAILURE;
+  }
+  if (dst->type != src->type || tile_width < 1 || tile_height < 1) {
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  switch (interp) {
+  case IMG_INTERP_LINEAR:
+    margin = 2;
+    break;
+  case IMG_INTERP_CUBIC:
+    margin = 8;
+    break;
+  case IMG_INTERP_LANCZOS3:
+    margin = 12;
+    break;
+  default:
+    errno = EINVAL;
+    return IMG_FAILURE;
+  }
+  if (inverse) {
+    memcpy(b, a, sizeof(b));
+  } else if (img_inverse_linear_transform(a, 6, b) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  size = src->size;
+  tile_width = MIN(tile_width, dst->width);
+  tile_height = MIN(tile_height, dst->height);
+  cap = tile_width*tile_height*size;
+  out = (char *)malloc(cap);
+  if (out == NULL) {
+    errno = ENOMEM;
+    return IMG_FAILURE;
+  }
+  buf = NULL;
+  cap = 0;
+  status = IMG_SUCCESS;
+  for (yp0 = 0; yp0 < dst->height && status == IMG_SUCCESS; yp0 = yp1) {
+    yp1 = MIN(yp0 + tile_height, dst->height);
+    for (xp0 = 0; xp0 < dst->width; xp0 = xp1) {
+      xp1 = MIN(xp0 + tile_width, dst->width);
+
+      /* Bounding box of the transformed corners of the tile. */
+      for (k = 0; k < 4; ++k) {
+        double xp = (k & 1 ? xp1 - 1 : xp0);
+        double yp = (k & 2 ? yp1 - 1 : yp0);
+        x[k] = b[0] + b[1]*xp + b[2]*yp;
+        y[k] = b[3] + b[4]*xp + b[5]*yp;
+      }
+      xmin = xmax = x[0];
+      ymin = ymax = y[0];
+      for (k = 1; k < 4; ++k) {
+        xmin = MIN(xmin, x[k]);
+        xmax = MAX(xmax, x[k]);
+        ymin = MIN(ymin, y[k]);
+        ymax = MAX(ymax, y[k]);
+      }
+      clamp_window(xmin, xmax, margin, src->width, &wx0, &wx1);
+      clamp_window(ymin, ymax, margin, src->height, &wy0, &wy1);
+      len = (wx1 - wx0)*(wy1 - wy0)*size;
+      if (len > cap) {
+        char *tmp = (char *)realloc(buf, len);
+        if (tmp == NULL) {
+          errno = ENOMEM;
+          status = IMG_FAILURE;
+          break;
+        }
+        buf = tmp;
+        cap = len;
+      }
+      status = img_tile_read(src, wx0, wy0, wx1 - wx0, wy1 - wy0,
+                             buf, wx1 - wx0);
+      if (status != IMG_SUCCESS) {
+        break;
+      }
+
+      /* Inverse transform relative to the tile and to the window. */
+      c[0] = b[0] + b[1]*xp0 + b[2]*yp0 - wx0;
+      c[1] = b[1];
+      c[2] = b[2];
+      c[3] = b[3] + b[4]*xp0 + b[5]*yp0 - wy0;
+      c[4] = b[4];
+      c[5] = b[5];
+      status = img_extract_rectangle_with_interp(buf, src->type, 0,
+                                                 wx1 - wx0, wy1 - wy0,
+                                                 wx1 - wx0,
+                                                 out, dst->type, 0,
+                                                 xp1 - xp0, yp1 - yp0,
+                                                 xp1 - xp0, c, 1, interp);
+      if (status != IMG_SUCCESS) {
+        break;
+      }
+      status = img_tile_write(dst, xp0, yp0, xp1 - xp0, yp1 - yp0,
+                              out, xp1 - xp0);
+      if (status != IMG_SUCCESS) {
+        break;
+      }
+    }
+  }
+  code = errno;
+  free(out);
+  if (buf != NULL) {
+    free(buf);
+  }
+  errno = code;
+  return status;
+}
+
+/**
+ * @brief Detect spots by bands of rows.
+ *
+ * This function reads the image of the source \a src by bands of
+ * \a band_height rows and gives them to a streaming spot detector (see
+ * img_spot_detector_new()) which keeps the rows needed by the filter from
+ * one band to the next, so that the spots are the same as for the whole
+ * image.
+ *
+ * @return A finished spot detector whose spots can be retrieved by
+ *         img_spot_detector_get_spots() and which must be destroyed by the
+ *         caller; \c NULL on error with \c errno set.
+ */
+img_spot_detector_t *img_tile_detect_spots(img_tile_source_t *src,
+                                           const double c0, const double c1,
+                                           const double c2, const double t0,
+                                           const double t1, const double t2,
+                                           long band_height)
+{
+  img_spot_detector_t *det;
+  void *buf;
+  long y0, y1;
+  int code;
+
+  if (src == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (band_height < 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  band_height = MIN(band_height, src->height);
+  det = img_spot_detector_new(src->type, src->width, c0, c1, c2, t0, t1, t2);
+  if (det == NULL) {
+    return NULL;
+  }
+  buf = malloc(band_height*src->width*src->size);
+  if (buf == NULL) {
+    img_spot_detector_destroy(det);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for (y0 = 0; y0 < src->height; y0 = y1) {
+    y1 = MIN(y0 + band_height, src->height);
+    if (img_tile_read(src, 0, y0, src->width, y1 - y0, buf,
+                      src->width) != IMG_SUCCESS ||
+        img_spot_detector_push(det, buf, src->width, y1 - y0) < 0) {
+      goto failure;
+    }
+  }
+  if (img_spot_detector_finish(det) < 0) {
+    goto failure;
+  }
+  free(buf);
+  return det;
+
+ failure:
+  code = errno;
+  free(buf);
+  img_spot_detector_destroy(det);
+  errno = code;
+  return NULL;
+}
@@ -112,6 +112,9 @@ extern void Y_img_morph_dilation(int argc);
 extern void Y_img_morph_lmin_lmax(int argc);
 extern void Y_img_morph_opening(int argc);
 extern void Y_img_morph_closing(int argc);
+extern void Y__img_morph_top_hat(int argc);
+extern void Y__img_morph_enhance(int argc);
+extern void Y__img_morph_trilevel(int argc);
 extern void Y_is_image(int argc);
 extern void Y_img_is_rgb(int argc);
 extern void Y_img_is_rgba(int argc);
@@ -125,7 +128,14 @@ extern void Y_img_get_width(int argc);
 extern void Y_img_get_height(int argc);
 extern void Y_img_get_type(int argc);
 extern void Y_img_estimate_noise(int argc);
+extern void Y_img_estimate_noise_map(int argc);
 extern void Y_img_cost_l2(int argc);
+extern void Y_img_cost_l2_map(int argc);
+extern void Y__img_cost_l2_batch(int argc);
+extern void Y_img_set_num_threads(int argc);
+extern void Y_img_get_num_threads(int argc);
+extern void Y_img_get_stats(int argc);
+extern void Y_img_reset_stats(int argc);
 
 typedef struct _image image_t;
 struct _image {
@@ -138,11 +148,104 @@ static void get_image(int iarg, image_t *img);
 static void new_image(image_t *img);
 
 static void push_string(const char *value);
+static int get_interp(int iarg);
 static void convert_image(int iarg, image_t *img, int new_img_type);
+static img_context_t *get_context(int iarg, const image_t *img, long r);
+static img_morph_cache_t *get_morph_cache(int iarg, const image_t *img,
+                                          long r, int what);
 static int get_binop_type(int left_type, int right_type);
 static void get_range_or_length(int iarg, long *start, long *stop, long *step,
                                 long *length);
 
+/*---------------------------------------------------------------------------*/
+/* REGIONS OF INTEREST AND OUTPUT ARRAYS */
+
+/* Restrict image IMG to the region of interest given by keyword ROI (at
+   stack position IARG, -1 if not specified) as [X0,X1,Y0,Y1] with Yorick
+   conventions for the bounds.  The address of the first pixel, the width
+   and the height of IMG are updated, the 0-based coordinates of the first
+   pixel of the region are stored in XY0 and the number of pixels per row
+   of the original image is returned. */
+static long get_roi(int iarg, image_t *img, long xy0[2])
+{
+  long *roi, ntot, pitch, x0, x1, y0, y1;
+
+  pitch = img->width;
+  if (iarg < 0 || yarg_nil(iarg)) {
+    xy0[0] = 0;
+    xy0[1] = 0;
+    return pitch;
+  }
+  roi = ygeta_l(iarg, &ntot, NULL);
+  if (ntot != 4) {
+    y_error("region of interest (ROI) must be [X0,X1,Y0,Y1]");
+  }
+  x0 = roi[0];
+  x1 = roi[1];
+  y0 = roi[2];
+  y1 = roi[3];
+  if (x0 < 1) x0 += img->width;
+  if (x1 < 1) x1 += img->width;
+  if (y0 < 1) y0 += img->height;
+  if (y1 < 1) y1 += img->height;
+  if ((x0 < 1) || (x0 > x1) || (x1 > img->width) ||
+      (y0 < 1) || (y0 > y1) || (y1 > img->height)) {
+    y_error("out of range region of interest (ROI)");
+  }
+  xy0[0] = x0 - 1;
+  xy0[1] = y0 - 1;
+  img->data = (char *)img->data + ((x0 - 1) + (y0 - 1)*pitch)*
+    img_get_pixel_size(img->type);
+  img->width = x1 - x0 + 1;
+  img->height = y1 - y0 + 1;
+  return pitch;
+}
+
+/* Get the output array given by keyword OUT (at stack position IARG) which
+   is overwritten by a WIDTH by HEIGHT result of pixel type TYPE.  If the
+   output array has the same size as the result, the result is stored in
+   the whole array; otherwise the result is stored in the rectangle whose
+   first pixel has 0-based coordinates XY0 and which must fit in the
+   output array.  The address of the first pixel of the result is returned
+   and the number of pixels per row of the output array is stored in
+   PITCH. */
+static void *get_output(int iarg, int type, long width, long height,
+                        const long xy0[2], long *pitch)
+{
+  image_t out;
+
+  if (yget_ref(iarg) < 0) {
+    y_error("output array (OUT) must be a variable");
+  }
+  get_image(iarg, &out);
+  if (out.type != type) {
+    y_error("output array (OUT) has not the same pixel type as the result");
+  }
+  *pitch = out.width;
+  if ((out.width == width) && (out.height == height)) {
+    return out.data;
+  }
+  if ((xy0[0] < 0) || (xy0[0] + width > out.width) ||
+      (xy0[1] < 0) || (xy0[1] + height > out.height)) {
+    y_error("result does not fit in output array (OUT)");
+  }
+  return ((char *)out.data +
+          (xy0[0] + xy0[1]*out.width)*img_get_pixel_size(type));
+}
+
+/* Check whether images A and B of pixel type TYPE overlap in memory. */
+static int overlap(const void *a, long a_width, long a_height, long a_pitch,
+                   const void *b, long b_width, long b_height, long b_pitch,
+                   int type)
+{
+  size_t elsize = img_get_pixel_size(type);
+  const char *a_end = (const char *)a + ((a_height - 1)*a_pitch +
+                                         a_width)*elsize;
+  const char *b_end = (const char *)b + ((b_height - 1)*b_pitch +
+                                         b_width)*elsize;
+  return ((const char *)a < b_end && (const char *)b < a_end);
+}
+
 /*---------------------------------------------------------------------------*/
 /* LINEAR TRANSFORM */
 
@@ -193,29 +296,39 @@ static void get_range_or_length(int iarg, long *start, long *stop, long *step,
 
 void Y_img_extract_rectangle(int argc)
 {
+  static char *knames[] = {"inverse", "interp", "roi", "out", NULL};
+  static long kglobs[NUMBEROF(knames)];
   double a[6];
   image_t img;
   void *src, *dst;
   long dst_x0, dst_x1, dst_xstep, dst_width,  src_width;
   long dst_y0, dst_y1, dst_ystep, dst_height, src_height;
-  int inverse, type;
+  long src_pitch, dst_pitch, xy0[2];
+  int kiargs[NUMBEROF(knames) - 1], pos[9], iarg, n, inverse, interp, type;
 
+  /* Get positional arguments (in order) and keywords. */
+  yarg_kw_init(knames, kglobs, kiargs);
+  n = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    iarg = yarg_kw(iarg, kglobs, kiargs);
+    if (iarg < 0) break;
+    if (n >= 9) y_error("too many arguments");
+    pos[n++] = iarg;
+  }
   inverse = 0;
-  if (argc == 9) {
-    a[0] = ygets_d(5);
-    a[1] = ygets_d(4);
-    a[2] = ygets_d(3);
-    a[3] = ygets_d(2);
-    a[4] = ygets_d(1);
-    a[5] = ygets_d(0);
-    yarg_drop(6);
-  } else if (argc == 4) {
+  if (n == 9) {
+    a[0] = ygets_d(pos[3]);
+    a[1] = ygets_d(pos[4]);
+    a[2] = ygets_d(pos[5]);
+    a[3] = ygets_d(pos[6]);
+    a[4] = ygets_d(pos[7]);
+    a[5] = ygets_d(pos[8]);
+  } else if (n == 4) {
     long ntot;
-    double *tmp = ygeta_d(0, &ntot, NULL);
+    double *tmp = ygeta_d(pos[3], &ntot, NULL);
     if (ntot != 6) y_error("coefficients must be a 6-element array");
     memcpy(a, tmp, 6*sizeof(double));
-    yarg_drop(1);
-  } else if (argc == 3) {
+  } else if (n == 3) {
     /* FIXME: avoid interpolation to speed up the code. */
     a[0] = 0.0;
     a[1] = 1.0;
@@ -227,17 +340,22 @@ void Y_img_extract_rectangle(int argc)
   } else {
     y_error("wrong number of arguments");
   }
-  get_image(2, &img);
+  if ((iarg = kiargs[0]) >= 0 && yarg_true(iarg)) {
+    inverse = 1;
+  }
+  interp = get_interp(kiargs[1]);
+  get_image(pos[0], &img);
   type = img.type;
   if ((type == IMG_TYPE_COMPLEX) ||
       (type == IMG_TYPE_RGB) || (type == IMG_TYPE_RGBA)) {
     y_error("operations not yet implemented for color or complex images");
   }
+  src_pitch = get_roi(kiargs[2], &img, xy0);
   src_width = img.width;
   src_height = img.height;
   src = img.data;
-  get_range_or_length(1, &dst_x0, &dst_x1, &dst_xstep, &dst_width);
-  get_range_or_length(0, &dst_y0, &dst_y1, &dst_ystep, &dst_height);
+  get_range_or_length(pos[1], &dst_x0, &dst_x1, &dst_xstep, &dst_width);
+  get_range_or_length(pos[2], &dst_y0, &dst_y1, &dst_ystep, &dst_height);
   if ((dst_xstep != 1) || (dst_ystep != 1)) {
     y_error("step != 1 not yet implemented");
   }
@@ -260,23 +378,168 @@ void Y_img_extract_rectangle(int argc)
 #undef src_x0
 #undef src_y0
 
-  /* Allocate the output image. */
+  /* Allocate the output image or get the output array. */
+  if (kiargs[3] >= 0 && ! yarg_nil(kiargs[3])) {
+    xy0[0] = dst_x0 - 1;
+    xy0[1] = dst_y0 - 1;
+    dst = get_output(kiargs[3], type, dst_width, dst_height, xy0,
+                     &dst_pitch);
+    if (overlap(src, src_width, src_height, src_pitch,
+                dst, dst_width, dst_height, dst_pitch, type)) {
+      y_error("output array (OUT) must not overlap the source image");
+    }
+    ypush_nil();
+  } else {
+    img.width = dst_width;
+    img.height = dst_height;
+    new_image(&img);
+    dst = img.data;
+    dst_pitch = dst_width;
+  }
+
+  /* Perform the operation. */
+  if (img_extract_rectangle_with_interp(src, type, 0, src_width, src_height,
+                                        src_pitch, dst, type, 0, dst_width,
+                                        dst_height, dst_pitch, a, 1,
+                                        interp) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("unexpected failure");
+  }
+}
+
+void Y_img_interpolate(int argc)
+{
+  static char *knames[] = {"interp", NULL};
+  static long kglobs[NUMBEROF(knames)];
+  image_t img;
+  const double *x, *y;
+  double *ws;
+  long i, nx, ny, xdims[Y_DIMSIZE], ydims[Y_DIMSIZE];
+  long src_width, src_height, dst_width, dst_height;
+  int kiargs[NUMBEROF(knames) - 1], pos[3], iarg, n, interp, separable, type;
+  void *src;
+
+  /* Get positional arguments (in order) and keywords. */
+  yarg_kw_init(knames, kglobs, kiargs);
+  n = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    iarg = yarg_kw(iarg, kglobs, kiargs);
+    if (iarg < 0) break;
+    if (n >= 3) y_error("too many arguments");
+    pos[n++] = iarg;
+  }
+  if (n != 3) {
+    y_error("wrong number of arguments");
+  }
+  interp = get_interp(kiargs[0]);
+  get_image(pos[0], &img);
+  type = img.type;
+  if ((type == IMG_TYPE_COMPLEX) ||
+      (type == IMG_TYPE_RGB) || (type == IMG_TYPE_RGBA)) {
+    y_error("operations not yet implemented for color or complex images");
+  }
+  src_width = img.width;
+  src_height = img.height;
+  src = img.data;
+  x = ygeta_d(pos[1], &nx, xdims);
+  y = ygeta_d(pos[2], &ny, ydims);
+
+  /* Separable coordinates are a WP vector (or a WPx1 array) and a HP vector
+     (or a 1xHP array), otherwise X and Y must be WPxHP arrays. */
+  if ((xdims[0] <= 1 || (xdims[0] == 2 && xdims[2] == 1)) &&
+      (ydims[0] <= 1 || (ydims[0] == 2 && ydims[1] == 1))) {
+    separable = 1;
+    dst_width = nx;
+    dst_height = ny;
+  } else if (xdims[0] == 2 && ydims[0] == 2 &&
+             xdims[1] == ydims[1] && xdims[2] == ydims[2]) {
+    separable = 0;
+    dst_width = xdims[1];
+    dst_height = xdims[2];
+  } else {
+    y_error("bad dimensions for the coordinates");
+    return;
+  }
+
+  /* Convert Yorick 1-based coordinates into 0-based ones. */
+  ws = (double *)ypush_scratch((nx + ny)*sizeof(double), NULL);
+  for (i = 0; i < nx; ++i) {
+    ws[i] = x[i] - 1.0;
+  }
+  for (i = 0; i < ny; ++i) {
+    ws[nx + i] = y[i] - 1.0;
+  }
+
+  /* Allocate the output image and perform the operation. */
   img.width = dst_width;
   img.height = dst_height;
   new_image(&img);
-  dst = img.data;
-
-  /* Perform the operation. */
-  if (img_extract_rectangle(src, type, 0, src_width, src_height, src_width,
-                            dst, type, 0, dst_width, dst_height, dst_width,
-                            a, 1) != IMG_SUCCESS) {
+  if (img_remap(src, type, 0, src_width, src_height, src_width,
+                img.data, type, 0, dst_width, dst_height, dst_width,
+                ws, ws + nx, separable, interp) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    if (errno == EINVAL) {
+      y_error("invalid coordinates");
+    }
     y_error("unexpected failure");
   }
 }
 
+/* Get the interpolation method given by keyword INTERP. */
+static int get_interp(int iarg)
+{
+  char *name;
+
+  if (iarg < 0 || yarg_nil(iarg)) {
+    return IMG_INTERP_LINEAR;
+  }
+  name = ygets_q(iarg);
+  if (name == NULL || strcmp(name, "linear") == 0) {
+    return IMG_INTERP_LINEAR;
+  } else if (strcmp(name, "cubic") == 0) {
+    return IMG_INTERP_CUBIC;
+  } else if (strcmp(name, "lanczos3") == 0) {
+    return IMG_INTERP_LANCZOS3;
+  }
+  y_error("bad interpolation method (INTERP)");
+  return -1;
+}
+
 /*---------------------------------------------------------------------------*/
 /* IMAGE NOISE */
 
+/* Get the noise estimation method given by a name or a value. */
+static int get_noise_method(int iarg)
+{
+  char *name;
+  long value;
+
+  if (iarg < 0 || yarg_nil(iarg)) {
+    return IMG_NOISE_RMS;
+  }
+  if (yarg_string(iarg)) {
+    name = ygets_q(iarg);
+    if (name == NULL || strcmp(name, "rms") == 0) {
+      return IMG_NOISE_RMS;
+    } else if (strcmp(name, "mad") == 0) {
+      return IMG_NOISE_MAD;
+    } else if (strcmp(name, "clipped") == 0) {
+      return IMG_NOISE_CLIPPED_RMS;
+    }
+  } else {
+    value = ygets_l(iarg);
+    if ((value >= IMG_NOISE_RMS) && (value <= IMG_NOISE_CLIPPED_RMS)) {
+      return (int)value;
+    }
+  }
+  y_error("bad noise estimation method");
+  return -1;
+}
+
 void Y_img_estimate_noise(int argc)
 {
   image_t img;
@@ -289,11 +552,7 @@ void Y_img_estimate_noise(int argc)
     y_error("wrong number of arguments");
   }
   get_image(argc - 1, &img);
-  if ((argc == 2) || (argc == 6)) {
-    method = ygets_i(0);
-  } else {
-    method = 0;
-  }
+  method = get_noise_method((argc == 2) || (argc == 6) ? 0 : -1);
   if ((argc == 5) || (argc == 6)) {
     x0 = ygets_l(argc - 2);
     x1 = ygets_l(argc - 3);
@@ -317,19 +576,123 @@ void Y_img_estimate_noise(int argc)
   }
   result = img_estimate_noise(img.type, img.data, x0 + img.width*y0,
                               x1 - x0, y1 - y0, img.width, method);
-  if (result < 0.0) y_error("bad pixel type");
+  if (result < 0.0) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
   ypush_double(result);
 }
 
+void Y_img_estimate_noise_map(int argc)
+{
+  image_t img;
+  double *map;
+  long tw, th, dims[3];
+  int method;
+
+  /* Get arguments. */
+  if ((argc != 3) && (argc != 4)) {
+    y_error("wrong number of arguments");
+  }
+  get_image(argc - 1, &img);
+  tw = ygets_l(argc - 2);
+  th = ygets_l(argc - 3);
+  method = get_noise_method(argc == 4 ? 0 : -1);
+  if ((tw < 2) || (th < 2)) {
+    y_error("tiles must be at least 2 by 2 pixels");
+  }
+
+  /* Compute the result. */
+  dims[0] = 2;
+  dims[1] = (img.width + tw - 1)/tw;
+  dims[2] = (img.height + th - 1)/th;
+  map = ypush_d(dims);
+  if (img_estimate_noise_map(img.type, img.data, 0, img.width, img.height,
+                             img.width, tw, th, method,
+                             map) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
 /*---------------------------------------------------------------------------*/
 /* SUB-IMAGE COMPARISON */
 
+/* Get the two sub-images A(AX0:AX1,AY0:AY1) and B(BX0:BX1,BY0:BY1) given by
+   the 10 arguments starting at IARG (A at IARG, BY1 at IARG - 9) and return
+   their common pixel type.  The bounds are stored in ABOX and BBOX as
+   0-based inclusive-exclusive coordinates: {X0, X1, Y0, Y1}. */
+static int get_sub_images(int iarg, image_t *a, long abox[4],
+                          image_t *b, long bbox[4])
+{
+  long ax0, ax1, ay0, ay1;
+  long bx0, bx1, by0, by1;
+  int type;
+
+  get_image(iarg, a);
+  ax0 = ygets_l(iarg - 1);
+  ax1 = ygets_l(iarg - 2);
+  ay0 = ygets_l(iarg - 3);
+  ay1 = ygets_l(iarg - 4);
+  get_image(iarg - 5, b);
+  bx0 = ygets_l(iarg - 6);
+  bx1 = ygets_l(iarg - 7);
+  by0 = ygets_l(iarg - 8);
+  by1 = ygets_l(iarg - 9);
+
+  /* Check arguments. */
+  type = get_binop_type(a->type, b->type);
+  if (type == IMG_TYPE_NONE) {
+    y_error("incompatible image types");
+  }
+  if ((type == IMG_TYPE_RGB) || (type == IMG_TYPE_RGBA) ||
+      (type == IMG_TYPE_SCOMPLEX) || (type == IMG_TYPE_DCOMPLEX)) {
+    y_error("operation not yet implemented for complex or color images");
+  }
+  if (ax0 < 1) ax0 += a->width;
+  if (ax1 < 1) ax1 += a->width;
+  if (ay0 < 1) ay0 += a->height;
+  if (ay1 < 1) ay1 += a->height;
+  if (bx0 < 1) bx0 += b->width;
+  if (bx1 < 1) bx1 += b->width;
+  if (by0 < 1) by0 += b->height;
+  if (by1 < 1) by1 += b->height;
+  if ((ax0 < 1) || (ax0 > ax1) || (ax1 > a->width) ||
+      (ay0 < 1) || (ay0 > ay1) || (ay1 > a->height) ||
+      (bx0 < 1) || (bx0 > bx1) || (bx1 > b->width) ||
+      (by0 < 1) || (by0 > by1) || (by1 > b->height)) {
+    y_error("out of range sub-image bound(s)");
+  }
+
+  if (a->type != type) {
+    convert_image(iarg, a, type);
+  }
+  if (b->type != type) {
+    convert_image(iarg - 5, b, type);
+  }
+
+  /* Convert Yorick inclusive and 1-based bounds into bounding box
+     inclusive-exclusive and 0-based coordinates. */
+  abox[0] = ax0 - 1;
+  abox[1] = ax1;
+  abox[2] = ay0 - 1;
+  abox[3] = ay1;
+  bbox[0] = bx0 - 1;
+  bbox[1] = bx1;
+  bbox[2] = by0 - 1;
+  bbox[3] = by1;
+  return type;
+}
+
 void Y_img_cost_l2(int argc)
 {
   double scl, bg, res;
   image_t a, b;
-  long ax0, ax1, ay0, ay1;
-  long bx0, bx1, by0, by1;
+  long abox[4], bbox[4];
   long dx, dy;
   int type;
 
@@ -341,19 +704,104 @@ void Y_img_cost_l2(int argc)
   bg  = ygets_d(1);
   dx  = ygets_l(2);
   dy  = ygets_l(3);
-  by1 = ygets_l(4);
-  by0 = ygets_l(5);
-  bx1 = ygets_l(6);
-  bx0 = ygets_l(7);
-  get_image(8, &b);
-  ay1 = ygets_l(9);
-  ay0 = ygets_l(10);
-  ax1 = ygets_l(11);
-  ax0 = ygets_l(12);
-  get_image(13, &a);
+  if (scl < 0.0) {
+    y_error("scale factor must be non-negative");
+  }
+  type = get_sub_images(13, &a, abox, &b, bbox);
+
+  /* Compute the result. */
+  res = img_cost_l2(type,
+                    a.data, abox[0] + a.width*abox[2], abox[1] - abox[0],
+                    abox[3] - abox[2], a.width,
+                    b.data, bbox[0] + b.width*bbox[2], bbox[1] - bbox[0],
+                    bbox[3] - bbox[2], b.width,
+                    dx, dy, bg, scl);
+  if (res < 0.0) {
+    y_error("bad pixel type");
+  }
+  ypush_double(res);
+}
+
+void Y_img_cost_l2_map(int argc)
+{
+  double scl, bg, *cost;
+  image_t a, b;
+  long abox[4], bbox[4], dims[3];
+  long dx_min, dx_max, dy_min, dy_max;
+  int type;
+
+  /* Get arguments. */
+  if (argc != 16) {
+    y_error("wrong number of arguments");
+  }
+  scl = ygets_d(0);
+  bg  = ygets_d(1);
+  dy_max = ygets_l(2);
+  dy_min = ygets_l(3);
+  dx_max = ygets_l(4);
+  dx_min = ygets_l(5);
+  if (scl < 0.0) {
+    y_error("scale factor must be non-negative");
+  }
+  if (dx_min > dx_max || dy_min > dy_max) {
+    y_error("bad range of shifts");
+  }
+  type = get_sub_images(15, &a, abox, &b, bbox);
+
+  /* Compute the result. */
+  dims[0] = 2;
+  dims[1] = dx_max - dx_min + 1;
+  dims[2] = dy_max - dy_min + 1;
+  cost = ypush_d(dims);
+  if (img_cost_l2_map(type,
+                      a.data, abox[0] + a.width*abox[2], abox[1] - abox[0],
+                      abox[3] - abox[2], a.width,
+                      b.data, bbox[0] + b.width*bbox[2], bbox[1] - bbox[0],
+                      bbox[3] - bbox[2], b.width,
+                      dx_min, dx_max, dy_min, dy_max, bg, scl,
+                      cost) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
+void Y__img_cost_l2_batch(int argc)
+{
+  const long *off, *wid, *hgt, *dx, *dy;
+  const double *bg, *scl;
+  double *cost;
+  image_t a, buf;
+  long ax0, ax1, ay0, ay1, *stride;
+  long n, n0, n1, n2, n3, n4, n5;
+  long k, ntot, dims[2];
+  int type;
+
+  /* Get arguments. */
+  if (argc != 13) {
+    y_error("wrong number of arguments");
+  }
+  get_image(12, &a);
+  ax0 = ygets_l(11);
+  ax1 = ygets_l(10);
+  ay0 = ygets_l(9);
+  ay1 = ygets_l(8);
+  get_image(7, &buf);
+  off = ygeta_l(6, &n, NULL);
+  wid = ygeta_l(5, &n5, NULL);
+  hgt = ygeta_l(4, &n4, NULL);
+  dx  = ygeta_l(3, &n3, NULL);
+  dy  = ygeta_l(2, &n2, NULL);
+  bg  = ygeta_d(1, &n1, NULL);
+  scl = ygeta_d(0, &n0, NULL);
+  if ((n5 != n) || (n4 != n) || (n3 != n) || (n2 != n) || (n1 != n) ||
+      (n0 != n)) {
+    y_error("all parameters of the references must have the same length");
+  }
 
   /* Check arguments. */
-  type = get_binop_type(a.type, b.type);
+  type = get_binop_type(a.type, buf.type);
   if (type == IMG_TYPE_NONE) {
     y_error("incompatible image types");
   }
@@ -361,49 +809,50 @@ void Y_img_cost_l2(int argc)
       (type == IMG_TYPE_SCOMPLEX) || (type == IMG_TYPE_DCOMPLEX)) {
     y_error("operation not yet implemented for complex or color images");
   }
-  if (scl < 0.0) {
-    y_error("scale factor must be non-negative");
-  }
   if (ax0 < 1) ax0 += a.width;
   if (ax1 < 1) ax1 += a.width;
   if (ay0 < 1) ay0 += a.height;
   if (ay1 < 1) ay1 += a.height;
-  if (bx0 < 1) bx0 += b.width;
-  if (bx1 < 1) bx1 += b.width;
-  if (by0 < 1) by0 += b.height;
-  if (by1 < 1) by1 += b.height;
-  fprintf(stderr, "a(%ld:%ld, %ld:%ld) - b(%ld:%ld, %ld:%ld)\n",
-          ax0, ax1, ay0, ay1,
-          bx0, bx1, by0, by1);
   if ((ax0 < 1) || (ax0 > ax1) || (ax1 > a.width) ||
-      (ay0 < 1) || (ay0 > ay1) || (ay1 > a.height) ||
-      (bx0 < 1) || (bx0 > bx1) || (bx1 > b.width) ||
-      (by0 < 1) || (by0 > by1) || (by1 > b.height)) {
+      (ay0 < 1) || (ay0 > ay1) || (ay1 > a.height)) {
     y_error("out of range sub-image bound(s)");
   }
-
+  ntot = buf.width*buf.height;
+  for (k = 0; k < n; ++k) {
+    if ((wid[k] < 1) || (hgt[k] < 1) || (off[k] < 0) ||
+        (off[k] > ntot - wid[k]*hgt[k])) {
+      y_error("out of range reference");
+    }
+    if (scl[k] < 0.0) {
+      y_error("scale factor must be non-negative");
+    }
+  }
   if (a.type != type) {
-    convert_image(13, &a, type);
+    convert_image(12, &a, type);
   }
-  if (b.type != type) {
-    convert_image(8, &b, type);
+  if (buf.type != type) {
+    convert_image(7, &buf, type);
   }
 
-  /* Convert Yorick inclusive and 1-based bounds into bounding box
-     inclusive-exclusive and 0-based coordinates.  Then compute the result. */
-  --ax0;
-  --ay0;
-  --bx0;
-  --by0;
-
-  res = img_cost_l2(type,
-                    a.data, ax0 + a.width*ay0, ax1 - ax0, ay1 - ay0, a.width,
-                    b.data, bx0 + b.width*by0, bx1 - bx0, by1 - by0, b.width,
-                    dx, dy, bg, scl);
-  if (res < 0.0) {
+  /* Compute the result.  The references are contiguous so their strides
+     are their widths. */
+  stride = (long *)ypush_scratch(n*sizeof(long), NULL);
+  for (k = 0; k < n; ++k) {
+    stride[k] = wid[k];
+  }
+  dims[0] = 1;
+  dims[1] = n;
+  cost = ypush_d(dims);
+  if (img_cost_l2_batch(type,
+                        a.data, (ax0 - 1) + a.width*(ay0 - 1), ax1 - ax0 + 1,
+                        ay1 - ay0 + 1, a.width,
+                        n, buf.data, off, wid, hgt, stride,
+                        dx, dy, bg, scl, cost) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
     y_error("bad pixel type");
   }
-  ypush_double(res);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -415,57 +864,168 @@ void Y_img_cost_l2(int argc)
 #define OPENING   3
 #define CLOSING   4
 
+/* Apply the morpho-math operation OP to the image IMG converted into a
+   bitmap, BITS has room for two bitmaps with rows of PITCH pixels.  The
+   result is converted back into DST with values 0 and 1. */
+static int morph_binary(int op, const image_t *img, const void *src,
+                        long src_pitch, long r, img_bitmap_word_t *bits,
+                        long pitch, void *dst, long dst_pitch)
+{
+  img_bitmap_word_t *tmp = bits + (pitch/64)*img->height;
+
+  if (img_copy(img->width, img->height, src, img->type, 0, src_pitch,
+               bits, IMG_TYPE_BIT, 0, pitch) != IMG_SUCCESS ||
+      img_bitmap_morph(op, img->width, img->height, bits, pitch, r,
+                       tmp, pitch) != IMG_SUCCESS) {
+    return IMG_FAILURE;
+  }
+  return img_copy(img->width, img->height, tmp, IMG_TYPE_BIT, 0, pitch,
+                  dst, img->type, 0, dst_pitch);
+}
+
 static void img_morph_operation(int argc, int what)
 {
-  long r, lmin_ref, lmax_ref;
+  static char *knames[] = {"roi", "out", "ctx", "binary", "cache", NULL};
+  static long kglobs[NUMBEROF(knames)];
+  long r, lmin_ref, lmax_ref, src_pitch, dst_pitch, out_pitch, xy0[2];
   image_t img;
-  void *src;
-  long *ws;
-  int contrast = (what == CONTRAST);
-
-  if ((contrast ? 4 : 2) != argc) {
+  img_context_t *ctx;
+  img_morph_cache_t *cache;
+  void *src, *dst, *out;
+  long *ws, bit_pitch;
+  img_bitmap_word_t *bits;
+  int kiargs[NUMBEROF(knames) - 1], pos[4], iarg, n, op, status;
+  int contrast = (what == CONTRAST), binary;
+
+  /* Get positional arguments (in order) and keywords. */
+  yarg_kw_init(knames, kglobs, kiargs);
+  n = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    iarg = yarg_kw(iarg, kglobs, kiargs);
+    if (iarg < 0) break;
+    if (n >= 4) y_error("too many arguments");
+    pos[n++] = iarg;
+  }
+  if ((contrast ? 4 : 2) != n) {
     y_error("wrong number of arguments");
   }
   if (contrast) {
-    lmax_ref = yget_ref(0);
-    lmin_ref = yget_ref(1);
+    lmin_ref = yget_ref(pos[2]);
+    lmax_ref = yget_ref(pos[3]);
     if (lmax_ref < 0 || lmin_ref < 0) {
       y_error("LMIN and LMAX must be simple variables");
     }
-    yarg_drop(2); /* left only IMG and R on top of the stack */
+    if (kiargs[1] >= 0 && ! yarg_nil(kiargs[1])) {
+      y_error("keyword OUT is not supported by img_morph_lmin_lmax");
+    }
   } else {
     lmin_ref = lmax_ref = -1;
   }
-  r = ygets_l(0);
-  yarg_drop(1);
-  get_image(0, &img);
-  if (r <= 0) {
-    if (r < 0) {
-      y_error("radius of structuring element must be non-negative");
+  binary = (kiargs[3] >= 0 && yarg_true(kiargs[3]));
+  if (binary && contrast) {
+    y_error("keyword BINARY is not supported by img_morph_lmin_lmax");
+  }
+  if (binary && kiargs[2] >= 0 && ! yarg_nil(kiargs[2])) {
+    y_error("keywords BINARY and CTX are exclusive");
+  }
+  if (kiargs[4] >= 0 && ! yarg_nil(kiargs[4])) {
+    if (what == OPENING || what == CLOSING) {
+      y_error("keyword CACHE is not supported by this operation");
     }
+    if (binary || (kiargs[2] >= 0 && ! yarg_nil(kiargs[2]))) {
+      y_error("keyword CACHE is exclusive with BINARY and CTX");
+    }
+    if (kiargs[0] >= 0 && ! yarg_nil(kiargs[0])) {
+      y_error("keywords CACHE and ROI are exclusive");
+    }
+  }
+  r = ygets_l(pos[1]);
+  get_image(pos[0], &img);
+  if (r < 0) {
+    y_error("radius of structuring element must be non-negative");
+  }
+  src_pitch = get_roi(kiargs[0], &img, xy0);
+  src = img.data;
+  if (kiargs[1] >= 0 && ! yarg_nil(kiargs[1])) {
+    out = get_output(kiargs[1], img.type, img.width, img.height, xy0,
+                     &out_pitch);
+  } else {
+    out = NULL;
+    out_pitch = 0;
+  }
+  if (r == 0 && out == NULL && ! binary &&
+      (kiargs[0] < 0 || yarg_nil(kiargs[0]))) {
+    /* Nothing to do. */
+    yarg_drop(pos[0]);
     if (contrast) {
       yput_global(lmax_ref, 0);
       yput_global(lmin_ref, 0);
+      ypush_nil();
     }
     return;
   }
-  ypush_check(3);
-  ws = ypush_scratch((2*r + 1)*sizeof(long), NULL);
-  src = img.data;
-  if (what == EROSION) {
+  ctx = get_context(kiargs[2], &img, r);
+  cache = get_morph_cache(kiargs[4], &img, r,
+                          (what == EROSION ? IMG_MORPH_CACHE_MIN :
+                           what == DILATION ? IMG_MORPH_CACHE_MAX :
+                           IMG_MORPH_CACHE_BOTH));
+  ypush_check(4);
+  if (ctx == NULL && cache == NULL) {
+    ws = ypush_scratch((2*r + 1)*sizeof(long), NULL);
+  } else {
+    ws = NULL;
+  }
+  if (binary) {
+    bit_pitch = IMG_BITMAP_PITCH(img.width);
+    bits = ypush_scratch(2*(bit_pitch/64)*img.height*
+                         sizeof(img_bitmap_word_t), NULL);
+  } else {
+    bit_pitch = 0;
+    bits = NULL;
+  }
+
+  /* Erosion and dilation cannot be performed in-place: if the output array
+     overlaps the source, the result is computed into a temporary image and
+     then copied.  This is not needed for the bitmaps as the source is first
+     converted. */
+  if (out != NULL && (binary ||
+                      ! ((what == EROSION || what == DILATION) &&
+                         overlap(src, img.width, img.height, src_pitch,
+                                 out, img.width, img.height, out_pitch,
+                                 img.type)))) {
+    dst = out;
+    dst_pitch = out_pitch;
+  } else if (! contrast) {
     new_image(&img);
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, img.data, img.width,
-                            NULL, 0) != IMG_SUCCESS) {
-      goto error;
-    }
+    dst = img.data;
+    dst_pitch = img.width;
+  } else {
+    dst = NULL;
+    dst_pitch = 0;
+  }
+  status = IMG_FAILURE;
+  op = (what == EROSION ? IMG_MORPH_EROSION :
+        what == DILATION ? IMG_MORPH_DILATION :
+        what == OPENING ? IMG_MORPH_OPENING :
+        IMG_MORPH_CLOSING);
+  if (binary) {
+    status = morph_binary(op, &img, src, src_pitch, r, bits, bit_pitch,
+                          dst, dst_pitch);
+  } else if (ctx != NULL && what != CONTRAST) {
+    status = img_context_morph(ctx, op, src, src_pitch, dst, dst_pitch);
+  } else if (cache != NULL && what == EROSION) {
+    status = img_morph_cache_lmin_lmax(cache, r, dst, dst_pitch, NULL, 0);
+  } else if (cache != NULL && what == DILATION) {
+    status = img_morph_cache_lmin_lmax(cache, r, NULL, 0, dst, dst_pitch);
+  } else if (what == EROSION) {
+    status = img_morph_lmin_lmax(img.type, img.width, img.height,
+                                 src, src_pitch, r, ws,
+                                 dst, dst_pitch,
+                                 NULL, 0);
   } else if (what == DILATION) {
-    new_image(&img);
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, NULL, 0,
-                            img.data, img.width) != IMG_SUCCESS) {
-      goto error;
-    }
+    status = img_morph_lmin_lmax(img.type, img.width, img.height,
+                                 src, src_pitch, r, ws, NULL, 0,
+                                 dst, dst_pitch);
   } else if (what == CONTRAST) {
     void *lmin_ptr, *lmax_ptr;
     new_image(&img);
@@ -474,52 +1034,48 @@ static void img_morph_operation(int argc, int what)
     new_image(&img);
     lmax_ptr = img.data;
     yput_global(lmax_ref, 0);
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, lmin_ptr, img.width,
-                            lmax_ptr, img.width) != IMG_SUCCESS) {
-      goto error;
+    if (ctx != NULL) {
+      status = img_context_morph_lmin_lmax(ctx, src, src_pitch,
+                                           lmin_ptr, img.width,
+                                           lmax_ptr, img.width);
+    } else if (cache != NULL) {
+      status = img_morph_cache_lmin_lmax(cache, r, lmin_ptr, img.width,
+                                         lmax_ptr, img.width);
+    } else {
+      status = img_morph_lmin_lmax(img.type, img.width, img.height,
+                                   src, src_pitch, r, ws,
+                                   lmin_ptr, img.width,
+                                   lmax_ptr, img.width);
     }
-    yarg_drop(4); /* clear the stack */
     ypush_nil();
   } else if (what == OPENING) {
     /* Perform an erosion followed by a dilation. */
-    new_image(&img);
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, img.data,
-                            img.width, NULL, 0) != IMG_SUCCESS) {
-      goto error;
-    }
-    yarg_swap(0, 2); /* exchange input image with temporary result */
-    yarg_drop(1); /* get rid of no longer needed input image */
-    src = img.data; /* temporary result is the source of next operation */
-    new_image(&img); /* allocate image for next operation */
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, NULL, 0,
-                            img.data, img.width) != IMG_SUCCESS) {
-      goto error;
-    }
+    status = img_morph_opening(img.type, img.width, img.height,
+                               src, src_pitch, r, dst,
+                               dst_pitch);
   } else if (what == CLOSING) {
     /* Perform a dilation followed by an erosion. */
-    new_image(&img);
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, NULL, 0,
-                            img.data, img.width) != IMG_SUCCESS) {
-      goto error;
-    }
-    yarg_swap(0, 2); /* exchange input image with temporary result */
-    yarg_drop(1); /* get rid of no longer needed input image */
-    src = img.data; /* temporary result is the source of next operation */
-    new_image(&img); /* allocate image for next operation */
-    if (img_morph_lmin_lmax(img.type, img.width, img.height,
-                            src, img.width, r, ws, img.data,
-                            img.width, NULL, 0) != IMG_SUCCESS) {
+    status = img_morph_closing(img.type, img.width, img.height,
+                               src, src_pitch, r, dst,
+                               dst_pitch);
+  }
+  if (status != IMG_SUCCESS) {
+    goto error;
+  }
+  if (out != NULL) {
+    if (dst != out &&
+        img_copy(img.width, img.height, dst, img.type, 0, dst_pitch,
+                 out, img.type, 0, out_pitch) != IMG_SUCCESS) {
       goto error;
     }
+    ypush_nil();
   }
   return;
 
  error:
-  /* At this point, this is the only possible error. */
+  if (errno == ENOMEM) {
+    y_error("insufficient memory");
+  }
   y_error("bad pixel type");
 }
 
@@ -548,43 +1104,378 @@ extern void Y_img_morph_closing(int argc)
   img_morph_operation(argc, CLOSING);
 }
 
+extern void Y__img_morph_top_hat(int argc)
+{
+  long r, s;
+  image_t img;
+  void *src;
+  int black;
+
+  if (argc != 4) {
+    y_error("wrong number of arguments");
+  }
+  black = yarg_true(0);
+  s = (yarg_nil(1) ? 0 : ygets_l(1));
+  r = ygets_l(2);
+  if ((r < 0) || (s < 0)) {
+    y_error("radius of structuring element must be non-negative");
+  }
+  get_image(3, &img);
+  src = img.data;
+  new_image(&img);
+  if (img_morph_top_hat(img.type, img.width, img.height, src, img.width,
+                        r, s, black, img.data, img.width) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
+extern void Y__img_morph_enhance(int argc)
+{
+  long r, niter;
+  double s;
+  image_t img;
+  void *src;
+
+  if (argc != 4) {
+    y_error("wrong number of arguments");
+  }
+  niter = ygets_l(0);
+  s = ygets_d(1);
+  r = ygets_l(2);
+  if (r < 0) {
+    y_error("radius of structuring element must be non-negative");
+  }
+  if (niter < 0) {
+    y_error("number of iterations must be non-negative");
+  }
+  get_image(3, &img);
+  src = img.data;
+  new_image(&img);
+  if (img_morph_enhance(img.type, img.width, img.height, src, img.width,
+                        r, s, niter, img.data, img.width) != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
+extern void Y__img_morph_trilevel(int argc)
+{
+  double atol, rtol, black, white;
+  long r;
+  image_t img;
+  img_morph_cache_t *cache;
+  void *src;
+  int type, status;
+
+  if (argc != 7) {
+    y_error("wrong number of arguments");
+  }
+  white = ygets_d(1);
+  black = ygets_d(2);
+  rtol = ygets_d(3);
+  atol = ygets_d(4);
+  r = ygets_l(5);
+  if (r < 0) {
+    y_error("radius of structuring element must be non-negative");
+  }
+  get_image(6, &img);
+  cache = get_morph_cache(0, &img, r, IMG_MORPH_CACHE_BOTH);
+  src = img.data;
+  type = img.type;
+  img.type = IMG_TYPE_BYTE;
+  new_image(&img);
+  if (cache != NULL) {
+    status = img_morph_cache_trilevel(cache, r, atol, rtol, black, white,
+                                      (unsigned char *)img.data, img.width);
+  } else {
+    status = img_morph_trilevel(type, img.width, img.height, src, img.width,
+                                r, atol, rtol, black, white,
+                                (unsigned char *)img.data, img.width);
+  }
+  if (status != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
 /*---------------------------------------------------------------------------*/
 /* DETECTION */
 
 extern void Y_img_detect_spot(int argc)
 {
+  static char *knames[] = {"ctx", NULL};
+  static long kglobs[NUMBEROF(knames)];
   image_t img;
+  img_context_t *ctx;
   const void* src;
   int* dst;
   double* ws;
-  double c0, c1, c2, t0, t1, t2;
+  double c[6];
   long count;
-  int type, iarg;
+  int kiargs[NUMBEROF(knames) - 1], pos[7], type, iarg, n, status;
 
-  if (argc != 7) y_error("wrong number of arguments");
-  iarg = argc - 1;
-  get_image(iarg, &img);
+  yarg_kw_init(knames, kglobs, kiargs);
+  n = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    iarg = yarg_kw(iarg, kglobs, kiargs);
+    if (iarg < 0) break;
+    if (n >= 7) y_error("too many arguments");
+    pos[n++] = iarg;
+  }
+  if (n != 7) y_error("wrong number of arguments");
+  get_image(pos[0], &img);
   type = img.type;
   if (type < IMG_TYPE_INT8 || type > IMG_TYPE_DOUBLE) {
     y_error("bad image type");
   }
   src = img.data;
-  --iarg; c0 = ygets_d(iarg);
-  --iarg; c1 = ygets_d(iarg);
-  --iarg; c2 = ygets_d(iarg);
-  --iarg; t0 = ygets_d(iarg);
-  --iarg; t1 = ygets_d(iarg);
-  --iarg; t2 = ygets_d(iarg);
-  ws = (double*)ypush_scratch(3*img.width*sizeof(double), NULL);
+  for (n = 0; n < 6; ++n) {
+    c[n] = ygets_d(pos[n + 1]);
+  }
+  ctx = get_context(kiargs[0], &img, -1);
+  ws = (ctx == NULL ?
+        (double*)ypush_scratch(3*img.width*sizeof(double), NULL) : NULL);
   img.type = IMG_TYPE_INT;
   new_image(&img);
   dst = (int*)img.data;
-  if (img_detect_spot(src, type, img.width, img.height, c0, c1, c2,
-                      t0, t1, t2, dst, &count, ws) != IMG_SUCCESS) {
+  if (ctx != NULL) {
+    status = img_context_detect_spot(ctx, src, c[0], c[1], c[2],
+                                     c[3], c[4], c[5], dst, &count);
+  } else {
+    status = img_detect_spot(src, type, img.width, img.height,
+                             c[0], c[1], c[2], c[3], c[4], c[5],
+                             dst, &count, ws);
+  }
+  if (status != IMG_SUCCESS) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
     y_error("operation failed (bug?)");
   }
 }
 
+/*---------------------------------------------------------------------------*/
+/* MULTI-THREADING */
+
+extern void Y_img_set_num_threads(int argc)
+{
+  if (argc != 1) y_error("wrong number of arguments");
+  if (img_set_num_threads(ygets_l(0)) != IMG_SUCCESS) {
+    if (errno == ENOSYS) {
+      y_error("compiled without support for threads");
+    }
+    if (errno == EBUSY) {
+      y_error("threads are busy");
+    }
+    y_error("number of threads must be at least 1");
+  }
+  ypush_nil();
+}
+
+extern void Y_img_get_num_threads(int argc)
+{
+  if (argc != 1 || ! yarg_nil(0)) y_error("wrong number of arguments");
+  ypush_long(img_get_num_threads());
+}
+
+/*---------------------------------------------------------------------------*/
+/* STATISTICS */
+
+extern void Y_img_get_stats(int argc)
+{
+  img_stats_t stats[IMG_STATS_PHASES];
+  long dims[3];
+  int k;
+
+  if (argc != 1) y_error("wrong number of arguments");
+  if (yarg_true(0)) {
+    char **names;
+    dims[0] = 1;
+    dims[1] = IMG_STATS_PHASES;
+    names = ypush_q(dims);
+    for (k = 0; k < IMG_STATS_PHASES; ++k) {
+      names[k] = p_strcpy((char *)img_get_stats_name(k));
+    }
+  } else if (img_get_stats(stats) == IMG_SUCCESS) {
+    double *arr;
+    dims[0] = 2;
+    dims[1] = 4;
+    dims[2] = IMG_STATS_PHASES;
+    arr = ypush_d(dims);
+    for (k = 0; k < IMG_STATS_PHASES; ++k) {
+      arr[4*k]     = (double)stats[k].calls;
+      arr[4*k + 1] = stats[k].time;
+      arr[4*k + 2] = (double)stats[k].items;
+      arr[4*k + 3] = (double)stats[k].bytes;
+    }
+  } else {
+    ypush_nil();
+  }
+}
+
+extern void Y_img_reset_stats(int argc)
+{
+  if (argc != 1 || ! yarg_nil(0)) y_error("wrong number of arguments");
+  img_reset_stats();
+  ypush_nil();
+}
+
+/*---------------------------------------------------------------------------*/
+/* WORKSPACE CONTEXTS */
+
+static void yfree_img_context(void *); /* do not call directly */
+static y_userobj_t ytype_img_context = {
+  "img_context", yfree_img_context,
+  NULL, NULL, NULL, NULL
+};
+
+static void yfree_img_context(void *ptr)
+{
+  if ((ptr != NULL) && (*(void **)ptr != NULL)) {
+    img_context_destroy(*(img_context_t **)ptr);
+  }
+}
+
+/* Get the context given by keyword argument IARG (NULL if unset) and check
+   that it is suitable for image IMG and radius R (if R >= 0). */
+static img_context_t *get_context(int iarg, const image_t *img, long r)
+{
+  img_context_t *ctx;
+
+  if (iarg < 0 || yarg_nil(iarg)) {
+    return NULL;
+  }
+  ctx = YGET_OBJPTR(img_context, iarg);
+  if (ctx == NULL) {
+    y_error("expecting an img_context object");
+  }
+  if (img_context_get_type(ctx) != img->type ||
+      img_context_get_width(ctx) != img->width ||
+      img_context_get_height(ctx) != img->height) {
+    y_error("image does not match the workspace context");
+  }
+  if (r >= 0 && img_context_get_radius(ctx) != r) {
+    y_error("radius does not match the workspace context");
+  }
+  return ctx;
+}
+
+void Y_img_context_new(int argc)
+{
+  image_t img;
+  img_context_t **ptr;
+  long r;
+
+  if (argc < 1 || argc > 2) y_error("wrong number of arguments");
+  r = (argc >= 2 && ! yarg_nil(argc - 2) ? ygets_l(argc - 2) : 0);
+  if (r < 0) {
+    y_error("radius of structuring element must be non-negative");
+  }
+  get_image(argc - 1, &img);
+  ptr = (img_context_t **)ypush_obj(&ytype_img_context, sizeof(void *));
+  *ptr = img_context_new(img.type, img.width, img.height, r);
+  if (*ptr == NULL) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* MORPHOLOGY CACHES */
+
+static void yfree_img_morph_cache(void *); /* do not call directly */
+static y_userobj_t ytype_img_morph_cache = {
+  "img_morph_cache", yfree_img_morph_cache,
+  NULL, NULL, NULL, NULL
+};
+
+static void yfree_img_morph_cache(void *ptr)
+{
+  if ((ptr != NULL) && (*(void **)ptr != NULL)) {
+    img_morph_cache_destroy(*(img_morph_cache_t **)ptr);
+  }
+}
+
+/* Get the morphology cache given by argument IARG (NULL if unset) and check
+   that it is suitable for image IMG, radius R and the extrema WHAT. */
+static img_morph_cache_t *get_morph_cache(int iarg, const image_t *img,
+                                          long r, int what)
+{
+  img_morph_cache_t *cache;
+
+  if (iarg < 0 || yarg_nil(iarg)) {
+    return NULL;
+  }
+  cache = YGET_OBJPTR(img_morph_cache, iarg);
+  if (cache == NULL) {
+    y_error("expecting an img_morph_cache object");
+  }
+  if (img_morph_cache_get_type(cache) != img->type ||
+      img_morph_cache_get_width(cache) != img->width ||
+      img_morph_cache_get_height(cache) != img->height) {
+    y_error("image does not match the morphology cache");
+  }
+  if (r > img_morph_cache_get_radius(cache)) {
+    y_error("radius is larger than that of the morphology cache");
+  }
+  if ((img_morph_cache_get_what(cache) & what) != what) {
+    y_error("the morphology cache does not have the needed extrema");
+  }
+  return cache;
+}
+
+void Y_img_morph_cache_new(int argc)
+{
+  static char *knames[] = {"what", NULL};
+  static long kglobs[NUMBEROF(knames)];
+  image_t img;
+  img_morph_cache_t **ptr;
+  long rmax;
+  int kiargs[NUMBEROF(knames) - 1], pos[2], iarg, n, what;
+
+  yarg_kw_init(knames, kglobs, kiargs);
+  n = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    iarg = yarg_kw(iarg, kglobs, kiargs);
+    if (iarg < 0) break;
+    if (n >= 2) y_error("too many arguments");
+    pos[n++] = iarg;
+  }
+  if (n != 2) y_error("wrong number of arguments");
+  if (kiargs[0] >= 0 && ! yarg_nil(kiargs[0])) {
+    what = ygets_i(kiargs[0]);
+    if (what < IMG_MORPH_CACHE_MIN || what > IMG_MORPH_CACHE_BOTH) {
+      y_error("bad value for keyword WHAT");
+    }
+  } else {
+    what = IMG_MORPH_CACHE_BOTH;
+  }
+  rmax = ygets_l(pos[1]);
+  if (rmax < 0) {
+    y_error("radius of structuring element must be non-negative");
+  }
+  get_image(pos[0], &img);
+  ptr = (img_morph_cache_t **)ypush_obj(&ytype_img_morph_cache,
+                                        sizeof(void *));
+  *ptr = img_morph_cache_new(img.type, img.width, img.height, img.data,
+                             img.width, rmax, what);
+  if (*ptr == NULL) {
+    if (errno == ENOMEM) {
+      y_error("insufficient memory");
+    }
+    y_error("bad pixel type");
+  }
+}
+
 /*---------------------------------------------------------------------------*/
 /* IMAGE MANAGEMENT */
 
@@ -803,18 +1694,58 @@ static void ypush_img_segmentation(img_segmentation_t *sgm)
 
 void Y_img_segmentation_new(int argc)
 {
+  static char *knames[] = {"runs", "ctx", "binary", NULL};
+  static long kglobs[NUMBEROF(knames)];
+  int kiargs[NUMBEROF(knames) - 1], iarg, n, method;
   image_t img;
   double threshold;
+  img_context_t *ctx;
   img_segmentation_t *sgm;
 
   /* Get arguments. */
-  if (argc != 2) {
+  threshold = 0.0;
+  yarg_kw_init(knames, kglobs, kiargs);
+  n = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    iarg = yarg_kw(iarg, kglobs, kiargs);
+    if (iarg < 0) break;
+    if (n == 0) {
+      get_image(iarg, &img);
+    } else if (n == 1) {
+      threshold = ygets_d(iarg);
+    }
+    ++n;
+  }
+  if (n != 2) {
     y_error("wrong number of arguments");
   }
-  get_image(1, &img);
-  threshold = ygets_d(0);
-  sgm = img_segmentation_new(img.data, img.type, 0, img.width, img.height,
-                             img.width, threshold);
+  if ((iarg = kiargs[0]) >= 0 && yarg_true(iarg)) {
+    method = IMG_SEGMENTATION_RUNS;
+  } else {
+    method = IMG_SEGMENTATION_FLOOD_FILL;
+  }
+  if ((iarg = kiargs[2]) >= 0 && yarg_true(iarg)) {
+    /* Segment the bitmap of the non-zero pixels. */
+    long pitch = IMG_BITMAP_PITCH(img.width);
+    img_bitmap_word_t *bits;
+    if (kiargs[1] >= 0 && ! yarg_nil(kiargs[1])) {
+      y_error("keywords BINARY and CTX are exclusive");
+    }
+    bits = ypush_scratch((pitch/64)*img.height*sizeof(img_bitmap_word_t),
+                         NULL);
+    if (img_copy(img.width, img.height, img.data, img.type, 0, img.width,
+                 bits, IMG_TYPE_BIT, 0, pitch) != IMG_SUCCESS) {
+      y_error("bad pixel type");
+    }
+    sgm = img_bitmap_segmentation_new(bits, img.width, img.height, pitch);
+  } else if ((ctx = get_context(kiargs[1], &img, -1)) != NULL) {
+    sgm = img_context_segmentation_new(ctx, img.data, 0, img.width,
+                                       threshold, method);
+  } else {
+    sgm = img_segmentation_new_with_method(img.data, img.type, 0, img.width,
+                                           img.height, img.width, threshold,
+                                           method);
+  }
   if (sgm == NULL) {
     int code = errno;
     if (code == ENOMEM) {
@@ -852,7 +1783,7 @@ void Y_img_segmentation_get_nrefs(int argc)
   ypush_long(img_segmentation_get_nrefs(yget_img_segmentation(0)));
 }
 
-#define BUILTIN(what, pushs, pusha)                                     \
+#define BUILTIN(what, whats, pushs, pusha)                              \
   void Y_img_segmentation_get_##what(int argc)                          \
   {                                                                     \
     img_segmentation_t *ws;                                             \
@@ -872,21 +1803,27 @@ void Y_img_segmentation_get_nrefs(int argc)
       long dims[2];                                                     \
       dims[0] = 1;                                                      \
       dims[1] = number;                                                 \
-      if (img_segmentation_get_##what##s(ws, pusha(dims), number)       \
+      if (img_segmentation_get_##whats(ws, pusha(dims), number)         \
           != IMG_SUCCESS) y_error("bug in img_segmentation_get_" #what "()"); \
     } else {                                                            \
       ypush_nil();                                                      \
     }                                                                   \
   }
-BUILTIN(count, ypush_long, ypush_l)
-BUILTIN(xmin, ypush_long, ypush_l)
-BUILTIN(xmax, ypush_long, ypush_l)
-BUILTIN(ymin, ypush_long, ypush_l)
-BUILTIN(ymax, ypush_long, ypush_l)
-BUILTIN(width, ypush_long, ypush_l)
-BUILTIN(height, ypush_long, ypush_l)
-BUILTIN(xcen, ypush_double, ypush_d)
-BUILTIN(ycen, ypush_double, ypush_d)
+BUILTIN(count, counts, ypush_long, ypush_l)
+BUILTIN(xmin, xmins, ypush_long, ypush_l)
+BUILTIN(xmax, xmaxs, ypush_long, ypush_l)
+BUILTIN(ymin, ymins, ypush_long, ypush_l)
+BUILTIN(ymax, ymaxs, ypush_long, ypush_l)
+BUILTIN(width, widths, ypush_long, ypush_l)
+BUILTIN(height, heights, ypush_long, ypush_l)
+BUILTIN(xcen, xcens, ypush_double, ypush_d)
+BUILTIN(ycen, ycens, ypush_double, ypush_d)
+BUILTIN(flux, fluxes, ypush_double, ypush_d)
+BUILTIN(xbar, xbars, ypush_double, ypush_d)
+BUILTIN(ybar, ybars, ypush_double, ypush_d)
+BUILTIN(mxx, mxxs, ypush_double, ypush_d)
+BUILTIN(mxy, mxys, ypush_double, ypush_d)
+BUILTIN(myy, myys, ypush_double, ypush_d)
 #undef BUILTIN
 
 #define BUILTIN(what, push)                                             \
@@ -990,13 +1927,13 @@ void Y_img_chainpool_new(int argc)
 {
   static char *knames[] = {"satol", "srtol", "drmin", "drmax",
                            "slope", "aatol", "artol", "prec",
-                           "lmin", "lmax", NULL};
+                           "lmin", "lmax", "lazy", NULL};
   static long kglobs[NUMBEROF(knames)];
   img_segmentation_t *sgm;
   img_chainpool_t *chn;
   double satol, srtol, drmin, drmax, slope, aatol, artol, prec;
   long lmin, lmax;
-  int kiargs[NUMBEROF(knames) - 1], iarg, n;
+  int kiargs[NUMBEROF(knames) - 1], iarg, n, lazy;
 
   /* Parse arguments and keywords. */
   sgm = NULL;
@@ -1041,9 +1978,15 @@ void Y_img_chainpool_new(int argc)
   GET_KEYWORD(9, lmax, 10, ygets_l, lmax >= lmin,
               "bad maximum number of characters per chain (LMAX)");
 #undef GET_KEYWORD
+  lazy = (kiargs[10] >= 0 && yarg_true(kiargs[10]));
   errno = 0;
-  chn = img_chainpool_new(sgm, satol, srtol, drmin, drmax, slope,
-                          aatol, artol, prec, lmin, lmax);
+  if (lazy) {
+    chn = img_chainpool_new_lazy(sgm, satol, srtol, drmin, drmax, slope,
+                                 aatol, artol, prec, lmin, lmax);
+  } else {
+    chn = img_chainpool_new(sgm, satol, srtol, drmin, drmax, slope,
+                            aatol, artol, prec, lmin, lmax);
+  }
   if (chn == NULL) {
     if (errno == ENOMEM) {
       y_error("not enough memory");
@@ -1130,7 +2073,10 @@ void Y_img_chainpool_get_##what(int argc)                             \
     long dims[2];                                                     \
     dims[0] = 1;                                                      \
     dims[1] = nchains;                                                \
-    img_chainpool_get_##what##s(chn, pusha(dims), nchains);           \
+    if (img_chainpool_get_##what##s(chn, pusha(dims), nchains)        \
+        != IMG_SUCCESS) {                                             \
+      y_error("insufficient memory");                                 \
+    }                                                                 \
   }                                                                   \
 }
 BUILTIN(vertical_shear, ypush_double, ypush_d)
@@ -1255,6 +2201,9 @@ extern void Y__img_init(int argc)
   img_type_to_yor_type[IMG_TYPE_RGB] = Y_CHAR;
   img_type_to_yor_type[IMG_TYPE_RGBA] = Y_CHAR;
 
+  /* Select the fast pixel converters. */
+  img_copy_init();
+
 #if 0 /* DEBUG */
 #define PRT(expr) fprintf(stderr, "%20s = %3d\n", #expr, expr)
   PRT(CPT_INT8);
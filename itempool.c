@@ -3,7 +3,8 @@
  *
  * Implementation of pools of items to allocate lots of small items by chunk
  * of larger blocks of memory.  All the items managed by a given pool have the
- * same size.
+ * same size.  Arenas are pools of items of any size which can only be
+ * released all together.
  *
  *-----------------------------------------------------------------------------
  *
@@ -36,11 +37,17 @@
 
 static const size_t ALIGN = MAX(sizeof(double), sizeof(void *));
 
+/* Maximum size (in bytes) of the blocks of memory of an arena. */
+#define ARENA_MAX_CHUNK ((size_t)1 << 24)
+
 struct _itempool {
   size_t number; /* number of items per block of memory */
-  size_t size;   /* size of an item */
+  size_t size;   /* size of an item, 0 for an arena */
   void *block;   /* last fragment of memory allocated */
   void *item;    /* first unused item, NULL if none */
+  char *top;     /* first free byte of the last block of an arena */
+  size_t avail;  /* number of free bytes at TOP */
+  size_t chunk;  /* size of the next block of an arena */
 };
 
 static void insert_fragment(itempool_t *pool, void *block,
@@ -78,11 +85,106 @@ itempool_t *itempool_new(size_t size, size_t number)
     pool->size = size;
     pool->block = NULL;
     pool->item = NULL;
+    pool->top = NULL;
+    pool->avail = 0;
+    pool->chunk = 0;
     insert_fragment(pool, (void *)pool, offset, block_size, stride);
   }
   return pool;
 }
 
+/**
+ * @brief Create a new arena.
+ *
+ * An arena is an item-pool for items of any size which are allocated by
+ * itempool_alloc() from large blocks of memory and which are all released
+ * at once by itempool_destroy().  The blocks of memory grow geometrically,
+ * hence a large number of items only costs a few calls to \c malloc().
+ *
+ * @param size     The size (in bytes) of the first block of memory.
+ *
+ * @return The address of the new arena; \c NULL in case of error (invalid
+ *         argument(s) or insufficient memory and \c errno set accordingly).
+ */
+itempool_t *itempool_new_arena(size_t size)
+{
+  size_t offset;
+  itempool_t *pool;
+
+  if (size < 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  /* As for an item-pool, the first block is allocated with the arena. */
+  size = ROUND_UP(size, ALIGN);
+  offset = ROUND_UP(sizeof(itempool_t), ALIGN);
+  pool = (itempool_t *)malloc(offset + size);
+  if (pool != NULL) {
+    pool->number = 0;
+    pool->size = 0;
+    pool->block = NULL;
+    pool->item = NULL;
+    pool->top = (char *)ADDRESS(pool, offset);
+    pool->avail = size;
+    pool->chunk = 2*size;
+    if (pool->chunk > ARENA_MAX_CHUNK) {
+      pool->chunk = MAX(size, ARENA_MAX_CHUNK);
+    }
+  }
+  return pool;
+}
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * This function returns the address of \a size bytes of memory (suitably
+ * aligned for any kind of data) taken from an arena.  A new block of memory
+ * is allocated for the arena if there is not enough memory left in the
+ * current one.  The memory cannot be released separately, it is released
+ * when the arena is destroyed.
+ *
+ * @param pool   The address of the arena.
+ * @param size   The number of bytes to allocate.
+ *
+ * @return The address of the memory; \c NULL in case of error (invalid
+ *         argument(s) or insufficient memory and \c errno set accordingly).
+ */
+void *itempool_alloc(itempool_t *pool, size_t size)
+{
+  void *ptr;
+
+  if (pool == NULL) {
+    errno = EFAULT;
+    return NULL;
+  }
+  if (pool->size != 0 || size < 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  size = ROUND_UP(size, ALIGN);
+  if (size > pool->avail) {
+    /* Allocate a new block of memory, at least twice as large as the
+       previous one (up to a limit) and large enough for the item. */
+    size_t chunk = MAX(pool->chunk, size);
+    void *block = malloc(ALIGN + chunk);
+    if (block == NULL) {
+      return NULL;
+    }
+    *(void **)block = pool->block;
+    pool->block = block;
+    pool->top = (char *)ADDRESS(block, ALIGN);
+    pool->avail = chunk;
+    if (pool->chunk < ARENA_MAX_CHUNK) {
+      pool->chunk *= 2;
+    }
+  }
+  ptr = (void *)pool->top;
+  pool->top += size;
+  pool->avail -= size;
+  return ptr;
+}
+
 /**
  * @brief Insert a fragment of memory in the item pool.
  *
@@ -148,7 +250,7 @@ void itempool_destroy(itempool_t *pool)
  *
  * @param pool   The address of the item-pool.
  *
- * @return The item size; 0 in case of error.
+ * @return The item size; 0 in case of error or for an arena.
  */
 size_t itempool_get_size(const itempool_t *pool)
 {
@@ -206,6 +308,11 @@ void *itempool_new_item(itempool_t *pool)
     errno = EFAULT;
     return NULL;
   }
+  if (pool->size == 0) {
+    /* Use itempool_alloc() for an arena. */
+    errno = EINVAL;
+    return NULL;
+  }
   if (pool->item == NULL) {
     /* Allocate a new fragment of memory. */
     size_t number, stride, offset, size;
@@ -240,7 +347,7 @@ void *itempool_new_item(itempool_t *pool)
  */
 void itempool_free_item(itempool_t *pool, void *item)
 {
-  if ((item != NULL) && (pool != NULL)) {
+  if ((item != NULL) && (pool != NULL) && (pool->size != 0)) {
     *(void **)item = pool->item;
     pool->item = item;
   }
@@ -1,7 +1,7 @@
 /*
  * itempool.h --
  *
- * Definitions for pools of small items of same size.
+ * Definitions for pools of small items of same size and for arenas.
  *
  *-----------------------------------------------------------------------------
  *
@@ -43,6 +43,8 @@ extern size_t      itempool_get_number(const itempool_t *pool);
 extern void        itempool_set_number(itempool_t *pool, size_t number);
 extern void       *itempool_new_item(itempool_t *pool);
 extern void        itempool_free_item(itempool_t *pool, void *item);
+extern itempool_t *itempool_new_arena(size_t size);
+extern void       *itempool_alloc(itempool_t *pool, size_t size);
 
 #ifdef __cplusplus
 }
@@ -26,6 +26,7 @@
 #ifndef _ITEMSTACK_H
 #define _ITEMSTACK_H 1
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #define ITEMSTACK_FAILURE (-1)
@@ -28,6 +28,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <yapi.h>
 
 #define IGNORE   -1
@@ -36,27 +37,53 @@
 #define _JOIN(a, b)   a##b
 #define JOIN(a, b)    _JOIN(a, b)
 
+/* The pixels are sorted by increasing levels with a stable radix sort of
+   unsigned integer keys of the same size as the pixels and which preserve
+   the order of the levels: the sign bit of signed integers is flipped; for
+   floating-point values, all bits of negative values are flipped and only
+   the sign bit of positive values. */
+#define SIGN_BIT(KEY) ((KEY)1 << (8*sizeof(KEY) - 1))
+#define INTEGER_KEY(KEY, val)  ((KEY)(val) ^ SIGN_BIT(KEY))
+#define FLOAT_KEY(KEY, val, key)                        \
+  do {                                                  \
+    memcpy(&(key), &(val), sizeof(KEY));                \
+    (key) ^= (((key) & SIGN_BIT(KEY)) != 0 ?            \
+              ~(KEY)0 : SIGN_BIT(KEY));                 \
+  } while (0)
+
 #define TYPE unsigned char
+#define KEY  unsigned char
+#define ENCODE(val, key)  key = (val)
 #define SFX  c
 #include __FILE__
 
 #define TYPE short
+#define KEY  unsigned short
+#define ENCODE(val, key)  key = INTEGER_KEY(KEY, val)
 #define SFX  s
 #include __FILE__
 
 #define TYPE int
+#define KEY  unsigned int
+#define ENCODE(val, key)  key = INTEGER_KEY(KEY, val)
 #define SFX  i
 #include __FILE__
 
 #define TYPE long
+#define KEY  unsigned long
+#define ENCODE(val, key)  key = INTEGER_KEY(KEY, val)
 #define SFX  l
 #include __FILE__
 
 #define TYPE float
+#define KEY  uint32_t
+#define ENCODE(val, key)  FLOAT_KEY(KEY, val, key)
 #define SFX  f
 #include __FILE__
 
 #define TYPE double
+#define KEY  uint64_t
+#define ENCODE(val, key)  FLOAT_KEY(KEY, val, key)
 #define SFX  d
 #include __FILE__
 
@@ -66,7 +93,9 @@ void Y_img_watershed(int argc)
   long srcDims[Y_DIMSIZE];
   void* src;
   void* dst;
+  void* key;
   long* idx;
+  long* stk;
   long i, rank, srcNumber, dstNumber;
   int srcType, dstType;
 
@@ -99,99 +128,102 @@ void Y_img_watershed(int argc)
     yarg_drop(1);
     dst = tmp;
   }
+  /* Workspaces: sorted indices, temporary indices (also used as the stack
+     of the flooding) and keys (same size as the source). */
   idx = ypush_l(srcDims);
+  stk = ypush_l(srcDims);
+  i = (srcType == Y_CHAR ? sizeof(char) :
+       srcType == Y_SHORT ? sizeof(short) :
+       srcType == Y_INT ? sizeof(int) :
+       srcType == Y_LONG ? sizeof(long) :
+       srcType == Y_FLOAT ? sizeof(float) : sizeof(double));
+  key = ypush_scratch(srcNumber*i, NULL);
 
   if (srcType == Y_CHAR) {
-    watershed_c(dst, src, srcDims[1], srcDims[2], idx);
+    watershed_c(dst, src, srcDims[1], srcDims[2], idx, stk, key);
   } else if (srcType == Y_SHORT) {
-    watershed_s(dst, src, srcDims[1], srcDims[2], idx);
+    watershed_s(dst, src, srcDims[1], srcDims[2], idx, stk, key);
   } else if (srcType == Y_INT) {
-    watershed_i(dst, src, srcDims[1], srcDims[2], idx);
+    watershed_i(dst, src, srcDims[1], srcDims[2], idx, stk, key);
   } else if (srcType == Y_LONG) {
-    watershed_l(dst, src, srcDims[1], srcDims[2], idx);
+    watershed_l(dst, src, srcDims[1], srcDims[2], idx, stk, key);
   } else if (srcType == Y_FLOAT) {
-    watershed_f(dst, src, srcDims[1], srcDims[2], idx);
+    watershed_f(dst, src, srcDims[1], srcDims[2], idx, stk, key);
   } else if (srcType == Y_DOUBLE) {
-    watershed_d(dst, src, srcDims[1], srcDims[2], idx);
+    watershed_d(dst, src, srcDims[1], srcDims[2], idx, stk, key);
   } else {
     y_error("expecting a 2D real array");
     return;
   }
 
   /* Left the result on top of the stack. */
-  yarg_drop(2);
+  yarg_drop(4);
 }
 
 #else /* _WATERSHED_C defined */
 
-#define HEAPSORT   JOIN(heapsort_,SFX)
-#define PROPAGATE  JOIN(propagate_,SFX)
+#define RADIXSORT  JOIN(radixsort_,SFX)
 #define WATERSHED  JOIN(watershed_,SFX)
 
-/* HEAPSORT - indirect sorting of an array, with C-indexing (starting at 0) */
+/* RADIXSORT - stable indirect sorting of an array (with C-indexing starting
+   at 0) by a least significant digit radix sort of its keys.  Indices of
+   elements with the same value are in increasing order.  The passes for the
+   digits which are the same for all keys are skipped, so 1 pass at most is
+   needed for 8-bit data and 2 passes for 16-bit data. */
 static void
-HEAPSORT(long index[], const TYPE a[], const long n)
+RADIXSORT(long index[], const TYPE a[], const long n, long tmp[], KEY key[])
 {
-  long i, j, k, l, isave;
-  TYPE asave;
+  long count[256];
+  long i, j, d, *src, *dst, *swp;
+  KEY all_or, all_and;
+  unsigned int shift;
 
+  all_or = 0;
+  all_and = ~(KEY)0;
   for (i = 0; i < n; ++i) {
+    ENCODE(a[i], key[i]);
+    all_or |= key[i];
+    all_and &= key[i];
     index[i] = i;
   }
-  if (n < 2) {
-    return;
-  }
-  k = n/2;
-  l = n - 1;
-  for (;;) {
-    if (k > 0) {
-      isave = index[--k];
-    } else {
-      isave = index[l];
-      index[l] = index[0];
-      if (--l == 0) {
-        index[0] = isave;
-        return;
-      }
+  src = index;
+  dst = tmp;
+  for (shift = 0; shift < 8*sizeof(KEY); shift += 8) {
+    if ((((all_or ^ all_and) >> shift) & 0xff) == 0) {
+      /* All keys have the same digit. */
+      continue;
+    }
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; ++i) {
+      ++count[(key[i] >> shift) & 0xff];
+    }
+    for (d = 0, j = 0; d < 256; ++d) {
+      long c = count[d];
+      count[d] = j;
+      j += c;
     }
-    asave = a[isave];
-    i = k;
-    while ((j = 2*i + 1) <= l) {
-      if (j < l && a[index[j]] < a[index[j + 1]]) ++j;
-      if (a[index[j]] <= asave) break;
-      index[i] = index[j];
-      i = j;
+    for (j = 0; j < n; ++j) {
+      i = src[j];
+      dst[count[(key[i] >> shift) & 0xff]++] = i;
     }
-    index[i] = isave;
+    swp = src;
+    src = dst;
+    dst = swp;
   }
-}
-
-static void
-PROPAGATE(long lab[], const TYPE arr[], TYPE lvl,
-          long i, long i1, long i2, long k, long n1, long n2)
-{
-  lab[i] = k;
-#define CHECK(test, off, i1, i2)                        \
-  if (test) {                                           \
-    long j = off;                                       \
-    if (lab[j] == UNKNOWN && arr[j] <= lvl) {           \
-      PROPAGATE(lab, arr, lvl, j, i1, i2, k, n1, n2);   \
-    }                                                   \
+  if (src != index) {
+    memcpy(index, src, n*sizeof(long));
   }
-  CHECK( i2 > 0    , i-n1 , i1   , i2-1 );
-  CHECK( i1 > 0    , i-1  , i1-1 , i2   );
-  CHECK( i1 < n1-1 , i+1  , i1+1 , i2   );
-  CHECK( i2 < n2-1 , i+n1 , i1   , i2+1 );
-#undef CHECK
 }
 
 static void
-WATERSHED(long lab[], const TYPE arr[], long n1, long n2, long idx[])
+WATERSHED(long lab[], const TYPE arr[], long n1, long n2, long idx[],
+          long stack[], KEY key[])
 {
-  long i1, i2, i, j, k, kp, n;
+  long i1, i2, i, j, k, kp, n, top;
+  TYPE lvl;
 
   n = n1*n2;
-  HEAPSORT(idx, arr, n);
+  RADIXSORT(idx, arr, n, stack, key);
   for (j = 0; j < n; ++j) {
     i = idx[j];
     if (lab[i] != UNKNOWN) {
@@ -215,19 +247,40 @@ WATERSHED(long lab[], const TYPE arr[], long n1, long n2, long idx[])
     UPDATE( i2 < n2-1 , i+n1 );
 #undef UPDATE
     if (k > UNKNOWN) {
-#if 0
+      /* Flood the unlabelled pixels connected to the current one and not
+         above its level, with an explicit stack of pixels: every pixel is
+         labelled when pushed so the stack has at most N elements. */
+      lvl = arr[i];
       lab[i] = k;
-#else
-      PROPAGATE(lab, arr, arr[i], i, i1, i2, k, n1, n2);
-#endif
+      stack[0] = i;
+      top = 1;
+      while (top > 0) {
+        long p = stack[--top];
+        long p2 = p/n1;
+        long p1 = p - p2*n1;
+#define CHECK(test, off)                                \
+        if (test) {                                     \
+          long q = off;                                 \
+          if (lab[q] == UNKNOWN && arr[q] <= lvl) {     \
+            lab[q] = k;                                 \
+            stack[top++] = q;                           \
+          }                                             \
+        }
+        CHECK( p2 > 0    , p-n1 );
+        CHECK( p1 > 0    , p-1  );
+        CHECK( p1 < n1-1 , p+1  );
+        CHECK( p2 < n2-1 , p+n1 );
+#undef CHECK
+      }
     }
   }
 }
 
 #undef TYPE
+#undef KEY
+#undef ENCODE
 #undef WATERSHED
-#undef PROPAGATE
-#undef HEAPSORT
+#undef RADIXSORT
 #undef SFX
 
 #endif /* _WATERSHED_C */